@@ -10,9 +10,19 @@
 #include <termios.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <time.h>
 
 #include "../common/protocol.h"
+#include "../common/latency.h"
+#include "../server/game.h"
+#include "../server/view.h"
+#include "screen.h"
+
+#define CLIENT_DISPLAY_INTERVAL_MS 16
+#define CLIENT_SCOREBOARD_MAX_ROWS 10
+#define CLIENT_LOBBY_CONNECT_TRIES 25
+#define CLIENT_PING_INTERVAL_MS    1000
 
 static int connect_to_server(const char *server_ip, uint16_t server_port) {
     int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -29,14 +39,103 @@ static int connect_to_server(const char *server_ip, uint16_t server_port) {
         return -1;
     }
 
+    socket_tuning_t tuning;
+    socket_tuning_defaults(&tuning);
+    (void)socket_apply_buffers(socket_fd, &tuning);
+
     if (connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         close(socket_fd);
         return -1;
     }
 
+    (void)socket_apply_tuning(socket_fd, &tuning);
     return socket_fd;
 }
 
+// A server we forked ourselves also listens on its default local socket; TCP stays the fallback.
+static int connect_to_local_server(const char *server_ip, uint16_t server_port) {
+    char name[LOCAL_SOCKET_NAME_MAX];
+    local_socket_default_name(name, sizeof(name), server_port);
+
+    int socket_fd = local_socket_connect(name);
+    if (socket_fd >= 0) {
+        socket_tuning_t tuning;
+        socket_tuning_defaults(&tuning);
+        (void)socket_apply_buffers(socket_fd, &tuning);
+        return socket_fd;
+    }
+    return connect_to_server(server_ip, server_port);
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
+}
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)(ts.tv_nsec / 1000ULL);
+}
+
+// Key press to the frame that shows it, and server tick to screen once a pong has given the
+// clock offset. The stamps are 32-bit microsecond clocks, so differences wrap modulo 2^32.
+typedef struct {
+    latency_hist_t input_to_screen;
+    latency_hist_t tick_to_screen;
+    uint32_t next_seq;
+    uint32_t shown_seq;
+    uint64_t last_ping_ms;
+    uint32_t rtt_us;
+    uint32_t best_rtt_us;
+    uint32_t clock_offset_us;
+    int has_offset;
+} client_latency_t;
+
+static void client_latency_send_ping(int server_socket_fd, client_latency_t *latency) {
+    ping_message_t ping;
+    ping.client_us_net = htonl((uint32_t)monotonic_us());
+    ping.server_us_net = 0;
+    (void)send_message(server_socket_fd, MSG_PING, &ping, (uint32_t)sizeof(ping));
+    latency->last_ping_ms = monotonic_ms();
+}
+
+// The offset comes from the fastest round trip seen, where the halves are most likely even.
+static void client_latency_on_pong(client_latency_t *latency, const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len != sizeof(ping_message_t)) return;
+    const ping_message_t *pong = (const ping_message_t*)payload;
+    uint32_t sent_us = ntohl(pong->client_us_net);
+    uint32_t rtt_us = (uint32_t)monotonic_us() - sent_us;
+    latency->rtt_us = rtt_us;
+    if (!latency->has_offset || rtt_us <= latency->best_rtt_us) {
+        latency->best_rtt_us = rtt_us;
+        latency->clock_offset_us = ntohl(pong->server_us_net) - (sent_us + rtt_us / 2);
+        latency->has_offset = 1;
+    }
+}
+
+static void client_latency_on_display(client_latency_t *latency, const state_message_t *state) {
+    uint32_t now_us = (uint32_t)monotonic_us();
+    uint32_t seq = ntohl(state->input_seq_net);
+    if (seq != 0 && seq != latency->shown_seq) {
+        latency_hist_add(&latency->input_to_screen, now_us - ntohl(state->input_sent_us_net));
+        latency->shown_seq = seq;
+    }
+    if (latency->has_offset && state->tick_us_net != 0) {
+        int32_t since_tick = (int32_t)(now_us - (ntohl(state->tick_us_net) - latency->clock_offset_us));
+        latency_hist_add(&latency->tick_to_screen, since_tick > 0 ? (uint32_t)since_tick : 0);
+    }
+}
+
+static void print_latency_summary(const client_latency_t *latency) {
+    const latency_hist_t *h = &latency->input_to_screen;
+    if (h->total == 0) return;
+    printf("client: input latency p50=%.1f ms p90=%.1f ms p99=%.1f ms over %u inputs, rtt %.1f ms\n",
+           latency_hist_percentile(h, 500) / 1000.0, latency_hist_percentile(h, 900) / 1000.0,
+           latency_hist_percentile(h, 990) / 1000.0, h->total, latency->rtt_us / 1000.0);
+}
+
 static void sleep_ms(int ms) {
     if (ms <= 0) return;
     struct timespec t;
@@ -45,27 +144,28 @@ static void sleep_ms(int ms) {
     nanosleep(&t, NULL);
 }
 
-static int recv_next_message(int server_socket_fd, uint16_t *out_type, void *payload_buf, size_t payload_buf_cap, uint16_t *out_payload_len) {
+static int recv_next_message(int server_socket_fd, uint16_t *out_type, void *payload_buf, size_t payload_buf_cap, uint32_t *out_payload_len) {
     message_header_t header_net;
     if (recv_message_header(server_socket_fd, &header_net) < 0) return -1;
 
     uint16_t message_type = ntohs(header_net.message_type_net);
-    uint16_t payload_len  = ntohs(header_net.payload_len_net);
+    uint32_t payload_len  = ntohl(header_net.payload_len_net);
+    if (payload_len > MSG_MAX_PAYLOAD_LEN) return -1;
 
     if (payload_len > payload_buf_cap) {
         size_t to_read = payload_buf_cap;
         if (to_read > 0) {
             if (recv_all_bytes(server_socket_fd, payload_buf, to_read) < 0) return -1;
         }
-        uint16_t rem = (uint16_t)(payload_len - to_read);
+        uint32_t rem = (uint32_t)(payload_len - to_read);
         char dump[256];
         while (rem > 0) {
-            uint16_t c = rem > (uint16_t)sizeof(dump) ? (uint16_t)sizeof(dump) : rem;
+            uint32_t c = rem > (uint32_t)sizeof(dump) ? (uint32_t)sizeof(dump) : rem;
             if (recv_all_bytes(server_socket_fd, dump, c) < 0) return -1;
-            rem = (uint16_t)(rem - c);
+            rem -= c;
         }
         *out_type = message_type;
-        *out_payload_len = (uint16_t)to_read;
+        *out_payload_len = (uint32_t)to_read;
         return 0;
     }
 
@@ -87,34 +187,298 @@ static void trim_player_name_inplace(char *name) {
     if (n >= STATE_NAME_MAX) name[STATE_NAME_MAX - 1] = '\0';
 }
 
-static char player_label_char(int idx) {
-    if (idx >= 0 && idx < 26) return (char)('A' + idx);
-    idx -= 26;
-    if (idx >= 0 && idx < 10) return (char)('0' + idx);
-    return '?';
+static char player_glyph(uint16_t owner, int is_head) {
+    int idx = owner % 36;
+    if (idx < 26) return (char)((is_head ? 'A' : 'a') + idx);
+    return (char)('0' + idx - 26);
 }
 
-static void render_scoreboard(const state_message_t *state) {
-    printf("players:\n");
-    for (int i = 0; i < STATE_MAX_PLAYERS; i++) {
-        const state_player_info_t *p = &state->players[i];
-        if (!p->has_joined) continue;
+static char cell_glyph(uint16_t cell) {
+    if (cell & STATE_CELL_HEAD) return player_glyph(cell & STATE_CELL_OWNER_MASK, 1);
+    if (cell & STATE_CELL_BODY) return player_glyph(cell & STATE_CELL_OWNER_MASK, 0);
+    switch (cell) {
+        case STATE_CELL_OBSTACLE: return '#';
+        case STATE_CELL_FOOD:     return '*';
+        case STATE_CELL_DEAD:     return 'x';
+        default:                  return ' ';
+    }
+}
+
+typedef struct {
+    uint32_t player_id;
+    uint8_t flags;
+    uint16_t score;
+    char name[STATE_NAME_MAX];
+} client_roster_entry_t;
 
-        unsigned score = (unsigned)ntohs(p->score_net);
-        const char *alive = p->is_alive ? "alive" : "dead";
-        const char *paused = p->is_paused ? "paused" : "run";
-        printf("  %c name=%s score=%u %s %s\n", player_label_char(i), (const char*)p->name, score, alive, paused);
+typedef struct {
+    uint16_t count;
+    uint16_t position[STATE_MAX_PLAYERS];
+    client_roster_entry_t entries[STATE_MAX_PLAYERS];
+} client_roster_t;
+
+static void client_roster_clear(client_roster_t *roster) {
+    for (uint16_t i = 0; i < roster->count; i++) {
+        roster->position[GAME_PLAYER_INDEX(roster->entries[i].player_id)] = 0;
     }
+    roster->count = 0;
 }
 
-static void print_horizontal_border(uint8_t width) {
-    putchar('+');
-    for (uint8_t i = 0; i < width; i++) putchar('-');
-    putchar('+');
-    putchar('\n');
+static client_roster_entry_t *client_roster_add(client_roster_t *roster, uint32_t player_id) {
+    uint16_t idx = GAME_PLAYER_INDEX(player_id);
+    if (idx >= STATE_MAX_PLAYERS || roster->count >= STATE_MAX_PLAYERS) return NULL;
+
+    client_roster_entry_t *e = &roster->entries[roster->count++];
+    memset(e, 0, sizeof(*e));
+    e->player_id = player_id;
+    roster->position[idx] = roster->count;
+    return e;
 }
 
-static void render_state(const state_message_t *state) {
+static client_roster_entry_t *client_roster_find(client_roster_t *roster, uint32_t player_id) {
+    uint16_t idx = GAME_PLAYER_INDEX(player_id);
+    if (idx >= STATE_MAX_PLAYERS || roster->position[idx] == 0) return NULL;
+    client_roster_entry_t *e = &roster->entries[roster->position[idx] - 1];
+    return e->player_id == player_id ? e : NULL;
+}
+
+static void client_roster_set_status(client_roster_entry_t *e, const state_player_status_t *status) {
+    e->flags = status->flags;
+    e->score = ntohs(status->score_net);
+}
+
+static void client_roster_load(client_roster_t *roster, const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len < sizeof(roster_message_t)) return;
+    const roster_message_t *msg = (const roster_message_t*)payload;
+    uint16_t count = ntohs(msg->player_count_net);
+    if (payload_len != sizeof(roster_message_t) + (size_t)count * sizeof(roster_entry_t)) return;
+
+    client_roster_clear(roster);
+    for (uint16_t i = 0; i < count; i++) {
+        const roster_entry_t *src = &msg->players[i];
+        client_roster_entry_t *e = client_roster_add(roster, ntohl(src->status.player_id_net));
+        if (!e) continue;
+        client_roster_set_status(e, &src->status);
+        memcpy(e->name, src->name, STATE_NAME_MAX - 1);
+    }
+}
+
+static void client_roster_apply_statuses(client_roster_t *roster, const state_message_t *state) {
+    const state_player_status_t *statuses = state_message_statuses(state);
+    uint16_t count = ntohs(state->status_count_net);
+    for (uint16_t i = 0; i < count; i++) {
+        client_roster_entry_t *e = client_roster_find(roster, ntohl(statuses[i].player_id_net));
+        if (e) client_roster_set_status(e, &statuses[i]);
+    }
+}
+
+static void client_roster_from_game(client_roster_t *roster, const game_state_t *g) {
+    client_roster_clear(roster);
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+        client_roster_entry_t *e = client_roster_add(roster, pl->player_id);
+        if (!e) continue;
+        e->flags = (uint8_t)((pl->is_active ? STATE_PLAYER_USED : 0) |
+                             (pl->has_joined ? STATE_PLAYER_JOINED : 0) |
+                             (pl->is_alive ? STATE_PLAYER_ALIVE : 0) |
+                             (pl->is_paused ? STATE_PLAYER_PAUSED : 0));
+        e->score = pl->score;
+        memcpy(e->name, pl->player_name, STATE_NAME_MAX - 1);
+    }
+}
+
+static int count_joined_players(const client_roster_t *roster) {
+    int count = 0;
+    for (uint16_t i = 0; i < roster->count; i++) {
+        if (roster->entries[i].flags & STATE_PLAYER_JOINED) count++;
+    }
+    return count;
+}
+
+static int scoreboard_rows(const client_roster_t *roster) {
+    int joined = count_joined_players(roster);
+    if (joined > CLIENT_SCOREBOARD_MAX_ROWS) return CLIENT_SCOREBOARD_MAX_ROWS + 1;
+    return joined;
+}
+
+static int render_scoreboard(screen_t *screen, int row, const state_message_t *state, const client_roster_t *roster) {
+    int world_paused = (state->flags & STATE_FLAG_WORLD_PAUSED) ? 1 : 0;
+    int shown = 0;
+    int hidden = 0;
+
+    screen_put_text(screen, row++, 0, "players:");
+    for (uint16_t i = 0; i < roster->count; i++) {
+        const client_roster_entry_t *p = &roster->entries[i];
+        if (!(p->flags & STATE_PLAYER_JOINED)) continue;
+        if (shown == CLIENT_SCOREBOARD_MAX_ROWS) {
+            hidden++;
+            continue;
+        }
+
+        const char *alive = (p->flags & STATE_PLAYER_ALIVE) ? "alive" : "dead";
+        const char *paused = (world_paused || (p->flags & STATE_PLAYER_PAUSED)) ? "paused" : "run";
+        char label = player_glyph(GAME_PLAYER_INDEX(p->player_id), 1);
+        screen_printf(screen, row++, 0, "  %c name=%s score=%u %s %s", label, p->name, (unsigned)p->score, alive, paused);
+        shown++;
+    }
+    if (hidden > 0) screen_printf(screen, row++, 0, "  ... and %d more", hidden);
+    return row;
+}
+
+static void draw_horizontal_border(screen_t *screen, int row, int width) {
+    screen_put_char(screen, row, 0, '+');
+    for (int i = 0; i < width; i++) screen_put_char(screen, row, 1 + i, '-');
+    screen_put_char(screen, row, 1 + width, '+');
+}
+
+static void terminal_size(int *out_cols, int *out_rows) {
+    struct winsize ws;
+    *out_cols = 0;
+    *out_rows = 0;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+        *out_cols = (int)ws.ws_col;
+        *out_rows = (int)ws.ws_row;
+    }
+}
+
+static int state_message_is_valid(const state_message_t *state, uint32_t payload_len) {
+    if (payload_len < sizeof(state_message_t)) return 0;
+    size_t body = state_message_cells_offset(ntohs(state->status_count_net));
+    body += (size_t)state->minimap_width * state->minimap_height;
+    if (!(state->flags & STATE_FLAG_CELLS_UNCHANGED)) {
+        body += (size_t)ntohs(state->view_width_net) * ntohs(state->view_height_net) * sizeof(uint16_t);
+    }
+    return payload_len == sizeof(state_message_t) + body;
+}
+
+static const uint8_t *state_message_cells(const state_message_t *state) {
+    return state->data + state_message_cells_offset(ntohs(state->status_count_net));
+}
+
+static const uint8_t *state_message_minimap(const state_message_t *state) {
+    const uint8_t *minimap = state_message_cells(state);
+    if (!(state->flags & STATE_FLAG_CELLS_UNCHANGED)) {
+        minimap += (size_t)ntohs(state->view_width_net) * ntohs(state->view_height_net) * sizeof(uint16_t);
+    }
+    return minimap;
+}
+
+typedef struct {
+    uint8_t *cells;
+    size_t cells_cap;
+    int has_cells;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+
+    uint16_t requested_width;
+    uint16_t requested_height;
+} client_view_t;
+
+static void client_view_init(client_view_t *view) {
+    memset(view, 0, sizeof(*view));
+    view->requested_width = VIEW_DEFAULT_WIDTH;
+    view->requested_height = VIEW_DEFAULT_HEIGHT;
+}
+
+static void client_view_free(client_view_t *view) {
+    free(view->cells);
+    memset(view, 0, sizeof(*view));
+}
+
+static void client_view_store(client_view_t *view, const state_message_t *state) {
+    if (state->flags & STATE_FLAG_CELLS_UNCHANGED) return;
+
+    uint16_t width = ntohs(state->view_width_net);
+    uint16_t height = ntohs(state->view_height_net);
+    size_t bytes = (size_t)width * height * sizeof(uint16_t);
+    if (bytes > view->cells_cap) {
+        uint8_t *grown = (uint8_t*)realloc(view->cells, bytes);
+        if (!grown) {
+            view->has_cells = 0;
+            return;
+        }
+        view->cells = grown;
+        view->cells_cap = bytes;
+    }
+
+    memcpy(view->cells, state_message_cells(state), bytes);
+    view->x = ntohs(state->view_x_net);
+    view->y = ntohs(state->view_y_net);
+    view->width = width;
+    view->height = height;
+    view->has_cells = 1;
+}
+
+static const uint8_t *client_view_cells(const client_view_t *view, const state_message_t *state) {
+    if (!view->has_cells) return NULL;
+    if (view->x != ntohs(state->view_x_net) || view->y != ntohs(state->view_y_net)) return NULL;
+    if (view->width != ntohs(state->view_width_net) || view->height != ntohs(state->view_height_net)) return NULL;
+    return view->cells;
+}
+
+static void client_view_update_request(int server_socket_fd, client_view_t *view, const state_message_t *state,
+                                       const client_roster_t *roster) {
+    int term_cols, term_rows;
+    terminal_size(&term_cols, &term_rows);
+    if (term_cols <= 0 || term_rows <= 0) return;
+
+    int border = (state->world_type == 0) ? 1 : 0;
+    int header_rows = 1 + 1 + scoreboard_rows(roster) + 1;
+
+    int width = term_cols - 2 * border - (VIEW_MINIMAP_MAX_WIDTH + 2);
+    int height = term_rows - header_rows - 2 * border - 1;
+    if (width < VIEW_MIN_SIZE) width = VIEW_MIN_SIZE;
+    if (height < VIEW_MIN_SIZE) height = VIEW_MIN_SIZE;
+    if (width > VIEW_MAX_WIDTH) width = VIEW_MAX_WIDTH;
+    if (height > VIEW_MAX_HEIGHT) height = VIEW_MAX_HEIGHT;
+
+    if (width == view->requested_width && height == view->requested_height) return;
+
+    viewport_message_t viewport;
+    viewport.width_net = htons((uint16_t)width);
+    viewport.height_net = htons((uint16_t)height);
+    if (send_message(server_socket_fd, MSG_VIEWPORT, &viewport, (uint32_t)sizeof(viewport)) < 0) return;
+
+    view->requested_width = (uint16_t)width;
+    view->requested_height = (uint16_t)height;
+}
+
+static void render_minimap(screen_t *screen, int row, int col, int max_rows, const state_message_t *state, const uint8_t *minimap) {
+    int map_width = (int)ntohs(state->width_net);
+    int map_height = (int)ntohs(state->height_net);
+    int view_x = (int)ntohs(state->view_x_net);
+    int view_y = (int)ntohs(state->view_y_net);
+    int view_x1 = view_x + (int)ntohs(state->view_width_net);
+    int view_y1 = view_y + (int)ntohs(state->view_height_net);
+
+    for (int my = 0; my < state->minimap_height && my < max_rows; my++) {
+        int cell_y0 = my * map_height / state->minimap_height;
+        int cell_y1 = (my + 1) * map_height / state->minimap_height;
+        for (int mx = 0; mx < state->minimap_width; mx++) {
+            int cell_x0 = mx * map_width / state->minimap_width;
+            int cell_x1 = (mx + 1) * map_width / state->minimap_width;
+
+            char ch = (char)minimap[(size_t)my * state->minimap_width + mx];
+            int in_view = cell_x0 < view_x1 && cell_x1 > view_x && cell_y0 < view_y1 && cell_y1 > view_y;
+            if (in_view && ch == '.') ch = '+';
+            screen_put_char(screen, row + my, col + mx, ch);
+        }
+    }
+}
+
+static void render_latency(screen_t *screen, int row, const client_latency_t *latency) {
+    const latency_hist_t *h = &latency->input_to_screen;
+    if (h->total == 0 && !latency->has_offset) return;
+    screen_printf(screen, row, 0, "latency p50=%.1fms p90=%.1fms p99=%.1fms (%u) | tick->screen p50=%.1fms | rtt=%.1fms",
+                  latency_hist_percentile(h, 500) / 1000.0, latency_hist_percentile(h, 900) / 1000.0,
+                  latency_hist_percentile(h, 990) / 1000.0, h->total,
+                  latency_hist_percentile(&latency->tick_to_screen, 500) / 1000.0, latency->rtt_us / 1000.0);
+}
+
+static void render_state(screen_t *screen, const state_message_t *state, const uint8_t *view_cells, const client_roster_t *roster,
+                         const client_latency_t *latency) {
     uint32_t tick = ntohl(state->tick_counter_net);
     uint32_t elapsed_ms = ntohl(state->elapsed_ms_net);
     uint32_t remaining_ms = ntohl(state->remaining_ms_net);
@@ -122,37 +486,60 @@ static void render_state(const state_message_t *state) {
     unsigned elapsed_s = elapsed_ms / 1000U;
     unsigned rem_s = remaining_ms / 1000U;
 
-    printf("\033[H\033[J");
+    int view_width = (int)ntohs(state->view_width_net);
+    int view_height = (int)ntohs(state->view_height_net);
+
+    int show_border = (state->world_type == 0) ? 1 : 0;
+    int border = show_border ? 1 : 0;
+    int header_rows = 1 + 1 + scoreboard_rows(roster) + 1;
+
+    const uint8_t *minimap = state_message_minimap(state);
+    int minimap_col = 2 * border + view_width + 2;
+
+    int cols = 2 * border + view_width;
+    if (state->minimap_width > 0) cols = minimap_col + state->minimap_width;
+    if (cols < 96) cols = 96;
+    int map_rows = 2 * border + view_height;
+    int rows = header_rows + map_rows;
+
+    if (screen_begin_frame(screen, cols, rows) < 0) return;
+
     if (state->game_mode == GAME_MODE_TIMED) {
-        printf("tick=%u | time=%us | remaining=%us | WASD move | p pause | q leave | r respawn\n",
-               (unsigned)tick, elapsed_s, rem_s);
+        screen_printf(screen, 0, 0, "tick=%u | time=%us | remaining=%us | WASD move | p pause | q leave | r respawn",
+                      (unsigned)tick, elapsed_s, rem_s);
     } else {
-        printf("tick=%u | time=%us | STANDARD | WASD move | p pause | q leave | r respawn\n",
-               (unsigned)tick, elapsed_s);
+        screen_printf(screen, 0, 0, "tick=%u | time=%us | STANDARD | WASD move | p pause | q leave | r respawn",
+                      (unsigned)tick, elapsed_s);
     }
 
-    render_scoreboard(state);
-    printf("\n");
-
-    uint8_t width = state->width;
-    uint8_t height = state->height;
+    int row = render_scoreboard(screen, 1, state, roster);
+    if (latency) render_latency(screen, row, latency);
+    row++;
 
-    int show_border = (state->world_type == 0) ? 1 : 0;
+    if (state->minimap_width > 0) render_minimap(screen, row, minimap_col, map_rows, state, minimap);
 
-    if (show_border) print_horizontal_border(width);
+    if (show_border) draw_horizontal_border(screen, row++, view_width);
 
-    for (uint8_t y = 0; y < height; y++) {
-        if (show_border) putchar('|');
-        for (uint8_t x = 0; x < width; x++) {
-            putchar((char)state->cells[(size_t)y * width + x]);
+    for (int y = 0; y < view_height; y++) {
+        if (show_border) {
+            screen_put_char(screen, row, 0, '|');
+            screen_put_char(screen, row, 1 + view_width, '|');
+        }
+        if (view_cells) {
+            const uint8_t *cells = view_cells + (size_t)y * view_width * sizeof(uint16_t);
+            for (int x = 0; x < view_width; x++) {
+                uint16_t cell_net;
+                memcpy(&cell_net, cells + (size_t)x * sizeof(cell_net), sizeof(cell_net));
+                screen_put_char(screen, row, border + x, cell_glyph(ntohs(cell_net)));
+            }
         }
-        if (show_border) putchar('|');
-        putchar('\n');
+        row++;
     }
 
-    if (show_border) print_horizontal_border(width);
+    if (show_border) draw_horizontal_border(screen, row, view_width);
 
     fflush(stdout);
+    screen_flush(screen, STDOUT_FILENO);
 }
 
 static void render_game_over(const game_over_message_t *msg) {
@@ -164,7 +551,8 @@ static void render_game_over(const game_over_message_t *msg) {
     printf("total game time: %us\n\n", elapsed_s);
 
     printf("results:\n");
-    for (uint8_t i = 0; i < msg->player_count && i < STATE_MAX_PLAYERS; i++) {
+    uint16_t player_count = ntohs(msg->player_count_net);
+    for (uint16_t i = 0; i < player_count; i++) {
         const game_over_player_entry_t *e = &msg->players[i];
         if (!e->has_joined) continue;
         unsigned score = (unsigned)ntohs(e->score_net);
@@ -177,10 +565,135 @@ static void render_game_over(const game_over_message_t *msg) {
     fflush(stdout);
 }
 
-static int send_input_direction(int server_socket_fd, direction_t direction) {
-    input_message_t input_msg;
-    input_msg.direction = (uint8_t)direction;
-    return send_message(server_socket_fd, MSG_INPUT, &input_msg, (uint16_t)sizeof(input_msg));
+typedef struct {
+    game_state_t game_state;
+    view_cache_t view_cache;
+    game_pos_t view_center;
+    uint8_t minimap[VIEW_MINIMAP_MAX_WIDTH * VIEW_MINIMAP_MAX_HEIGHT];
+    state_message_t *render_message;
+    size_t render_message_cap;
+    uint64_t now_ms;
+    int is_active;
+    int awaiting_keyframe;
+    int needs_render;
+} lockstep_sim_t;
+
+static void lockstep_request_keyframe(int server_socket_fd, lockstep_sim_t *sim) {
+    if (sim->awaiting_keyframe) return;
+    (void)send_message(server_socket_fd, MSG_KEYFRAME_REQUEST, NULL, 0);
+    sim->awaiting_keyframe = 1;
+}
+
+static game_player_id_t find_joined_player_by_name(const game_state_t *g, const char *player_name) {
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+        if (pl->has_joined && strncmp(pl->player_name, player_name, GAME_MAX_NAME_LEN) == 0) return pl->player_id;
+    }
+    return GAME_PLAYER_NONE;
+}
+
+static void lockstep_render(int server_socket_fd, screen_t *screen, lockstep_sim_t *sim, client_view_t *view,
+                            client_roster_t *roster, const char *player_name) {
+    game_state_t *g = &sim->game_state;
+    if (view_cache_update(&sim->view_cache, g) != 0) return;
+
+    game_player_id_t follow_id = find_joined_player_by_name(g, player_name);
+    view_rect_t rect = view_rect_follow(g, follow_id, view->requested_width, view->requested_height, &sim->view_center);
+
+    uint8_t minimap_width = 0, minimap_height = 0;
+    if (rect.width != g->map_width || rect.height != g->map_height) {
+        view_minimap_size(g, &minimap_width, &minimap_height);
+        view_build_minimap(&sim->view_cache, g, sim->minimap, minimap_width, minimap_height);
+    }
+
+    size_t needed = view_state_size(g, &rect, UINT32_MAX, 1, minimap_width, minimap_height);
+    if (needed > sim->render_message_cap) {
+        state_message_t *grown = (state_message_t*)realloc(sim->render_message, needed);
+        if (!grown) return;
+        sim->render_message = grown;
+        sim->render_message_cap = needed;
+    }
+
+    if (view_build_state(&sim->view_cache, g, sim->now_ms, &rect, UINT32_MAX, 1, sim->minimap, minimap_width, minimap_height,
+                         sim->render_message, sim->render_message_cap) == 0) return;
+
+    client_roster_from_game(roster, g);
+    client_view_update_request(server_socket_fd, view, sim->render_message, roster);
+    render_state(screen, sim->render_message, state_message_cells(sim->render_message), roster, NULL);
+}
+
+static void lockstep_free(lockstep_sim_t *sim) {
+    game_free(&sim->game_state);
+    view_cache_free(&sim->view_cache);
+    free(sim->render_message);
+    free(sim);
+}
+
+static void lockstep_apply_keyframe(lockstep_sim_t *sim, const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len < sizeof(lockstep_keyframe_header_t)) return;
+
+    lockstep_keyframe_header_t header;
+    memcpy(&header, payload, sizeof(header));
+    uint64_t now_ms = ((uint64_t)ntohl(header.now_ms_high_net) << 32) | (uint64_t)ntohl(header.now_ms_low_net);
+
+    if (game_snapshot_decode(&sim->game_state, now_ms, payload + sizeof(header), payload_len - sizeof(header)) != 0) {
+        sim->is_active = 0;
+        return;
+    }
+
+    sim->now_ms = now_ms;
+    sim->is_active = 1;
+    sim->awaiting_keyframe = 0;
+    sim->needs_render = 1;
+}
+
+static void lockstep_apply_tick(int server_socket_fd, lockstep_sim_t *sim, const uint8_t *payload, uint32_t payload_len) {
+    if (!sim->is_active || sim->awaiting_keyframe) return;
+    if (payload_len < sizeof(lockstep_tick_header_t)) return;
+
+    lockstep_tick_header_t header;
+    memcpy(&header, payload, sizeof(header));
+
+    game_state_t *g = &sim->game_state;
+    uint32_t tick = ntohl(header.tick_counter_net);
+    if (tick != g->tick_counter + 1) {
+        lockstep_request_keyframe(server_socket_fd, sim);
+        return;
+    }
+
+    uint16_t event_count = ntohs(header.event_count_net);
+    const uint8_t *cursor = payload + sizeof(header);
+    size_t remaining = payload_len - sizeof(header);
+
+    for (uint16_t i = 0; i < event_count; i++) {
+        game_event_t ev;
+        size_t used = game_event_decode(&ev, g->start_time_ms, cursor, remaining);
+        if (used == 0) {
+            lockstep_request_keyframe(server_socket_fd, sim);
+            return;
+        }
+        (void)game_apply_event(g, &ev);
+        cursor += used;
+        remaining -= used;
+    }
+
+    uint64_t now_ms = g->start_time_ms + ntohl(header.now_offset_ms_net);
+    game_tick(g, now_ms);
+    sim->now_ms = now_ms;
+    sim->needs_render = 1;
+
+    if (header.has_state_hash && game_state_hash(g, now_ms) != ntohl(header.state_hash_net)) {
+        lockstep_request_keyframe(server_socket_fd, sim);
+    }
+}
+
+// The batch keeps a pointer to the message, so it lives in the caller's array until the flush.
+static int queue_input_direction(msg_batch_t *batch, input_message_t *msg, client_latency_t *latency, direction_t direction) {
+    memset(msg, 0, sizeof(*msg));
+    msg->direction = (uint8_t)direction;
+    msg->seq_net = htonl(++latency->next_seq);
+    msg->sent_us_net = htonl((uint32_t)monotonic_us());
+    return msg_batch_add(batch, MSG_INPUT, msg, (uint32_t)sizeof(*msg));
 }
 
 static void enable_raw_mode(struct termios *out_old) {
@@ -227,7 +740,7 @@ static void prompt_string(const char *label, const char *default_value, char *ou
     }
 }
 
-static int start_server_process_empty(uint16_t port, game_mode_t mode, uint32_t timed_seconds, int world_type, uint8_t map_width, uint8_t map_height) {
+static int start_server_process_empty(uint16_t port, game_mode_t mode, uint32_t timed_seconds, int world_type, uint16_t map_width, uint16_t map_height) {
     pid_t pid = fork();
     if (pid < 0) return -1;
 
@@ -299,39 +812,260 @@ static int request_server_shutdown(const char *server_ip, uint16_t server_port)
     return 0;
 }
 
+// The server accepts map changes only over its local socket, so this works on the server's host.
+static int request_server_map_change(const char *server_ip, uint16_t server_port, const char *map_path) {
+    int fd = connect_to_local_server(server_ip, server_port);
+    if (fd < 0) {
+        fprintf(stderr, "client: connect failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (send_message(fd, MSG_MAP_RELOAD, map_path, (uint32_t)strlen(map_path)) < 0) {
+        fprintf(stderr, "client: send map reload failed\n");
+        close(fd);
+        return -1;
+    }
+
+    uint16_t msg_type = 0;
+    uint32_t payload_len = 0;
+    char reply[128];
+    while (recv_next_message(fd, &msg_type, reply, sizeof(reply) - 1, &payload_len) == 0) {
+        if (msg_type != MSG_TEXT && msg_type != MSG_ERROR) continue;
+        reply[payload_len] = '\0';
+        printf("client: server: %s\n", reply);
+        break;
+    }
+    close(fd);
+    return 0;
+}
+
+static void lobby_print_rooms(const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len < sizeof(lobby_rooms_message_t)) return;
+    const lobby_rooms_message_t *msg = (const lobby_rooms_message_t*)payload;
+    uint16_t count = ntohs(msg->room_count_net);
+    if (payload_len != sizeof(*msg) + (size_t)count * sizeof(lobby_room_entry_t)) return;
+
+    printf("\n%-21s %-5s %-8s %-20s %-9s %s\n", "server", "room", "rezim", "svet", "hraci", "tick");
+    for (uint16_t i = 0; i < count; i++) {
+        const lobby_room_entry_t *entry = &msg->rooms[i];
+        const room_report_message_t *r = &entry->report;
+        char host[INET_ADDRSTRLEN];
+        char endpoint[32];
+        char world[48];
+        char players[16];
+        struct in_addr addr;
+        addr.s_addr = entry->host_ipv4_net;
+        inet_ntop(AF_INET, &addr, host, sizeof(host));
+        snprintf(endpoint, sizeof(endpoint), "%s:%u", host, (unsigned)ntohs(r->port_net));
+        snprintf(world, sizeof(world), "%.32s %ux%u", (const char*)r->world_name,
+                 (unsigned)ntohs(r->width_net), (unsigned)ntohs(r->height_net));
+        snprintf(players, sizeof(players), "%u/%u", (unsigned)ntohs(r->player_count_net), (unsigned)ntohs(r->player_capacity_net));
+        printf("%-21s %-5u %-8s %-20s %-9s %u/%u us\n", endpoint, (unsigned)ntohs(r->room_net),
+               r->game_mode == GAME_MODE_TIMED ? "casovy" : "standard", world, players,
+               (unsigned)ntohl(r->tick_cost_us_net), (unsigned)ntohl(r->tick_budget_us_net));
+    }
+    if (count == 0) printf("(ziadne miestnosti)\n");
+}
+
+// Lists the lobby's rooms, then asks it to place us; a loopback host means the lobby's own machine.
+static int lobby_find_room(const char *lobby_ip, uint16_t lobby_port, game_mode_t mode, uint8_t world_type,
+                           char *out_ip, size_t out_ip_cap, uint16_t *out_port, uint16_t *out_room) {
+    int fd = connect_to_server(lobby_ip, lobby_port);
+    if (fd < 0) {
+        fprintf(stderr, "client: lobby connect failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    lobby_match_message_t match;
+    memset(&match, 0, sizeof(match));
+    match.game_mode = (uint8_t)mode;
+    match.world_type = world_type;
+    if (send_message(fd, MSG_LOBBY_LIST, NULL, 0) < 0 ||
+        send_message(fd, MSG_LOBBY_MATCH, &match, (uint32_t)sizeof(match)) < 0) {
+        fprintf(stderr, "client: lobby request failed\n");
+        close(fd);
+        return -1;
+    }
+
+    static uint8_t reply[sizeof(lobby_rooms_message_t) + 1024 * sizeof(lobby_room_entry_t)];
+    uint16_t msg_type = 0;
+    uint32_t payload_len = 0;
+    int rc = -1;
+    while (recv_next_message(fd, &msg_type, reply, sizeof(reply) - 1, &payload_len) == 0) {
+        if (msg_type == MSG_LOBBY_ROOMS) {
+            lobby_print_rooms(reply, payload_len);
+        } else if (msg_type == MSG_ERROR) {
+            reply[payload_len] = '\0';
+            printf("client: lobby: %s\n", (const char*)reply);
+            break;
+        } else if (msg_type == MSG_LOBBY_PLACE && payload_len == sizeof(lobby_place_message_t)) {
+            lobby_place_message_t place;
+            memcpy(&place, reply, sizeof(place));
+            struct in_addr addr;
+            addr.s_addr = place.host_ipv4_net;
+            if ((ntohl(place.host_ipv4_net) >> 24) == 127) {
+                snprintf(out_ip, out_ip_cap, "%s", lobby_ip);
+            } else {
+                inet_ntop(AF_INET, &addr, out_ip, (socklen_t)out_ip_cap);
+            }
+            *out_port = ntohs(place.port_net);
+            *out_room = ntohs(place.room_net);
+            rc = 0;
+            break;
+        }
+    }
+    close(fd);
+    return rc;
+}
+
+// A room the lobby just spawned may need a moment before it listens.
+static int wait_for_server(const char *server_ip, uint16_t server_port) {
+    for (int attempt = 0; attempt < CLIENT_LOBBY_CONNECT_TRIES; attempt++) {
+        int fd = connect_to_server(server_ip, server_port);
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        sleep_ms(200);
+    }
+    return -1;
+}
+
+// Like map changes, the server takes migrate requests only over its local socket.
+static int request_server_migration(const char *server_ip, uint16_t server_port, uint16_t target_port, uint16_t target_room) {
+    int fd = connect_to_local_server(server_ip, server_port);
+    if (fd < 0) {
+        fprintf(stderr, "client: connect failed: %s\n", strerror(errno));
+        return -1;
+    }
+    room_target_message_t target;
+    target.port_net = htons(target_port);
+    target.room_net = htons(target_room);
+    if (send_message(fd, MSG_MIGRATE, &target, (uint32_t)sizeof(target)) < 0) {
+        fprintf(stderr, "client: send migrate failed\n");
+        close(fd);
+        return -1;
+    }
+
+    uint16_t msg_type = 0;
+    uint32_t payload_len = 0;
+    char reply[192];
+    while (recv_next_message(fd, &msg_type, reply, sizeof(reply) - 1, &payload_len) == 0) {
+        if (msg_type != MSG_TEXT && msg_type != MSG_ERROR) continue;
+        reply[payload_len] = '\0';
+        printf("client: server: %s\n", reply);
+        break;
+    }
+    close(fd);
+    return 0;
+}
+
+static int request_server_metrics(const char *server_ip, uint16_t server_port) {
+    int fd = connect_to_server(server_ip, server_port);
+    if (fd < 0) {
+        fprintf(stderr, "client: connect failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (send_message(fd, MSG_METRICS, NULL, 0) < 0) {
+        fprintf(stderr, "client: send metrics request failed\n");
+        close(fd);
+        return -1;
+    }
+
+    uint16_t msg_type = 0;
+    uint32_t payload_len = 0;
+    char reply[2048];
+    while (recv_next_message(fd, &msg_type, reply, sizeof(reply) - 1, &payload_len) == 0) {
+        if (msg_type != MSG_TEXT && msg_type != MSG_ERROR) continue;
+        reply[payload_len] = '\0';
+        printf("client: server: %s\n", reply);
+        break;
+    }
+    close(fd);
+    return 0;
+}
+
 typedef struct {
     int has_paused_session;
     char server_ip[64];
     uint16_t server_port;
+    uint16_t room;
+    int local_server;
     char player_name[64];
 } paused_session_t;
 
-static int run_game_session(const char *server_ip, uint16_t server_port, const char *player_name_raw, paused_session_t *paused_session) {
-    char player_name[64];
-    strncpy(player_name, player_name_raw, sizeof(player_name) - 1);
-    player_name[sizeof(player_name) - 1] = '\0';
-    trim_player_name_inplace(player_name);
-
-    int server_socket_fd = connect_to_server(server_ip, server_port);
+static int session_connect(const char *server_ip, uint16_t server_port, uint16_t room, int local_server, int spectate,
+                           const char *player_name) {
+    int server_socket_fd = local_server ? connect_to_local_server(server_ip, server_port)
+                                        : connect_to_server(server_ip, server_port);
     if (server_socket_fd < 0) {
         fprintf(stderr, "client: connect failed: %s\n", strerror(errno));
         return -1;
     }
 
-    if (send_message(server_socket_fd, MSG_JOIN, player_name, (uint16_t)strlen(player_name)) < 0) {
+    uint8_t join_payload[PLAYER_NAME_MAX + 1 + sizeof(uint16_t)];
+    size_t join_len = join_payload_build(join_payload, sizeof(join_payload), player_name, room);
+    int join_rc = spectate ? send_message(server_socket_fd, MSG_SPECTATE, NULL, 0)
+                           : send_message(server_socket_fd, MSG_JOIN, join_payload, (uint32_t)join_len);
+    if (join_rc < 0) {
         fprintf(stderr, "client: send JOIN failed\n");
         close(server_socket_fd);
         return -1;
     }
+    return server_socket_fd;
+}
+
+static int run_game_session(const char *server_ip, uint16_t server_port, uint16_t room, int local_server, int spectate,
+                            const char *player_name_raw, paused_session_t *paused_session) {
+    char player_name[64];
+    strncpy(player_name, player_name_raw, sizeof(player_name) - 1);
+    player_name[sizeof(player_name) - 1] = '\0';
+    trim_player_name_inplace(player_name);
+
+    int server_socket_fd = session_connect(server_ip, server_port, room, local_server, spectate, player_name);
+    if (server_socket_fd < 0) return -1;
+    uint16_t session_port = server_port;
+    uint16_t session_room = room;
 
     struct termios old_term;
     enable_raw_mode(&old_term);
 
+    screen_t screen;
+    screen_init(&screen);
+
     int is_running = 1;
     int did_pause = 0;
-    int got_game_over = 0;
-    game_over_message_t game_over;
-    memset(&game_over, 0, sizeof(game_over));
+    game_over_message_t *game_over = NULL;
+
+    msg_reader_t reader;
+    msg_reader_init(&reader);
+
+    uint64_t last_render_ms = 0;
+    int render_pending = 0;
+
+    // The newest STATE not drawn yet, copied out of the reader before its buffer moves on.
+    uint8_t *held_state = NULL;
+    size_t held_state_cap = 0;
+    int has_held_state = 0;
+
+    client_view_t view;
+    client_view_init(&view);
+
+    client_latency_t latency;
+    memset(&latency, 0, sizeof(latency));
+
+    lockstep_sim_t *sim = (lockstep_sim_t*)calloc(1, sizeof(*sim));
+    client_roster_t *roster = (client_roster_t*)calloc(1, sizeof(*roster));
+    if (!sim || !roster) {
+        free(sim);
+        free(roster);
+        screen_free(&screen);
+        restore_terminal(&old_term);
+        close(server_socket_fd);
+        return -1;
+    }
+    view_cache_init(&sim->view_cache);
+    sim->view_center.x = UINT16_MAX;
+    sim->view_center.y = UINT16_MAX;
 
     while (is_running) {
         fd_set read_fds;
@@ -341,79 +1075,193 @@ static int run_game_session(const char *server_ip, uint16_t server_port, const c
 
         int max_fd = server_socket_fd > STDIN_FILENO ? server_socket_fd : STDIN_FILENO;
 
-        int rc = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        struct timeval render_timeout;
+        struct timeval *timeout = NULL;
+        if (render_pending) {
+            uint64_t since_render = monotonic_ms() - last_render_ms;
+            uint64_t wait_ms = since_render >= CLIENT_DISPLAY_INTERVAL_MS ? 0 : CLIENT_DISPLAY_INTERVAL_MS - since_render;
+            render_timeout.tv_sec = 0;
+            render_timeout.tv_usec = (suseconds_t)(wait_ms * 1000ULL);
+            timeout = &render_timeout;
+        }
+
+        int rc = select(max_fd + 1, &read_fds, NULL, NULL, timeout);
         if (rc < 0) {
             if (errno == EINTR) continue;
             break;
         }
 
         if (FD_ISSET(STDIN_FILENO, &read_fds)) {
-            char ch;
-            ssize_t n = read(STDIN_FILENO, &ch, 1);
-            if (n == 1) {
+            char keys[64];
+            ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+            input_message_t inputs[sizeof(keys)];
+            size_t input_count = 0;
+            msg_batch_t batch;
+            msg_batch_init(&batch, server_socket_fd);
+            for (ssize_t k = 0; k < n && is_running; k++) {
+                char ch = keys[k];
                 if (ch == 'q' || ch == 'Q') {
-                    (void)send_message(server_socket_fd, MSG_LEAVE, NULL, 0);
+                    (void)msg_batch_add(&batch, MSG_LEAVE, NULL, 0);
                     is_running = 0;
+                } else if (spectate) {
+                    continue;
                 } else if (ch == 'p' || ch == 'P') {
-                    (void)send_message(server_socket_fd, MSG_PAUSE, NULL, 0);
+                    (void)msg_batch_add(&batch, MSG_PAUSE, NULL, 0);
                     did_pause = 1;
                     is_running = 0;
                 } else if (ch == 'r' || ch == 'R') {
-                    (void)send_message(server_socket_fd, MSG_RESPAWN, NULL, 0);
+                    (void)msg_batch_add(&batch, MSG_RESPAWN, NULL, 0);
                 } else if (ch == 'w' || ch == 'W') {
-                    send_input_direction(server_socket_fd, DIR_UP);
+                    (void)queue_input_direction(&batch, &inputs[input_count++], &latency, DIR_UP);
                 } else if (ch == 'd' || ch == 'D') {
-                    send_input_direction(server_socket_fd, DIR_RIGHT);
+                    (void)queue_input_direction(&batch, &inputs[input_count++], &latency, DIR_RIGHT);
                 } else if (ch == 's' || ch == 'S') {
-                    send_input_direction(server_socket_fd, DIR_DOWN);
+                    (void)queue_input_direction(&batch, &inputs[input_count++], &latency, DIR_DOWN);
                 } else if (ch == 'a' || ch == 'A') {
-                    send_input_direction(server_socket_fd, DIR_LEFT);
+                    (void)queue_input_direction(&batch, &inputs[input_count++], &latency, DIR_LEFT);
                 }
             }
+            (void)msg_batch_flush(&batch);
+            if (!is_running) break;
         }
 
         if (FD_ISSET(server_socket_fd, &read_fds)) {
-            uint16_t msg_type = 0;
-            uint16_t payload_len = 0;
+            if (msg_reader_fill(&reader, server_socket_fd) < 0) break;
+        }
 
-            uint8_t payload_buf[sizeof(state_message_t) > sizeof(game_over_message_t) ? sizeof(state_message_t) : sizeof(game_over_message_t)];
+        const state_message_t *latest_state = has_held_state ? (const state_message_t*)held_state : NULL;
+        uint32_t latest_state_len = 0;
+        int redirected = 0;
 
-            if (recv_next_message(server_socket_fd, &msg_type, payload_buf, sizeof(payload_buf), &payload_len) < 0) {
-                break;
-            }
+        uint16_t msg_type = 0;
+        const uint8_t *payload = NULL;
+        uint32_t payload_len = 0;
 
+        int next_rc;
+        while ((next_rc = msg_reader_next(&reader, &msg_type, &payload, &payload_len)) > 0) {
             if (msg_type == MSG_STATE) {
-                if (payload_len == sizeof(state_message_t)) {
-                    state_message_t state;
-                    memcpy(&state, payload_buf, sizeof(state));
-                    render_state(&state);
+                if (state_message_is_valid((const state_message_t*)payload, payload_len)) {
+                    latest_state = (const state_message_t*)payload;
+                    latest_state_len = payload_len;
+                    client_view_store(&view, latest_state);
+                    client_roster_apply_statuses(roster, latest_state);
+                }
+            } else if (msg_type == MSG_ROSTER) {
+                client_roster_load(roster, payload, payload_len);
+            } else if (msg_type == MSG_PONG) {
+                client_latency_on_pong(&latency, payload, payload_len);
+            } else if (msg_type == MSG_REDIRECT) {
+                if (payload_len == sizeof(room_target_message_t)) {
+                    const room_target_message_t *target = (const room_target_message_t*)payload;
+                    session_port = ntohs(target->port_net);
+                    session_room = ntohs(target->room_net);
+                    redirected = 1;
                 }
+            } else if (msg_type == MSG_LOCKSTEP_KEYFRAME) {
+                lockstep_apply_keyframe(sim, payload, payload_len);
+            } else if (msg_type == MSG_LOCKSTEP_TICK) {
+                lockstep_apply_tick(server_socket_fd, sim, payload, payload_len);
             } else if (msg_type == MSG_GAME_OVER) {
-                if (payload_len == sizeof(game_over_message_t)) {
-                    memcpy(&game_over, payload_buf, sizeof(game_over));
-                    got_game_over = 1;
-                    is_running = 0;
+                if (payload_len >= sizeof(game_over_message_t) && !game_over) {
+                    const game_over_message_t *msg = (const game_over_message_t*)payload;
+                    size_t expected = sizeof(game_over_message_t) +
+                                      (size_t)ntohs(msg->player_count_net) * sizeof(game_over_player_entry_t);
+                    game_over = expected == payload_len ? (game_over_message_t*)malloc(payload_len) : NULL;
+                    if (game_over) {
+                        memcpy(game_over, payload, payload_len);
+                        is_running = 0;
+                    }
                 }
             }
         }
+        if (next_rc < 0) break;
+
+        // The match moved to another process on the same host; rejoining by name resumes it there.
+        if (redirected) {
+            close(server_socket_fd);
+            msg_reader_free(&reader);
+            msg_reader_init(&reader);
+            has_held_state = 0;
+            server_socket_fd = session_connect(server_ip, session_port, session_room, local_server, spectate, player_name);
+            if (server_socket_fd < 0) break;
+            continue;
+        }
+
+        if (!latest_state && sim->needs_render && is_running) {
+            uint64_t now = monotonic_ms();
+            if (now - last_render_ms >= CLIENT_DISPLAY_INTERVAL_MS) {
+                lockstep_render(server_socket_fd, &screen, sim, &view, roster, player_name);
+                last_render_ms = now;
+                sim->needs_render = 0;
+            }
+        }
+
+        render_pending = sim->needs_render && is_running;
+        if (latest_state && is_running) {
+            uint64_t now = monotonic_ms();
+            if (now - last_render_ms >= CLIENT_DISPLAY_INTERVAL_MS) {
+                client_view_update_request(server_socket_fd, &view, latest_state, roster);
+                render_state(&screen, latest_state, client_view_cells(&view, latest_state), roster, &latency);
+                client_latency_on_display(&latency, latest_state);
+                last_render_ms = now;
+                has_held_state = 0;
+            } else {
+                if (latest_state_len > 0) {
+                    if (latest_state_len > held_state_cap) {
+                        uint8_t *grown = (uint8_t*)realloc(held_state, latest_state_len);
+                        if (grown) {
+                            held_state = grown;
+                            held_state_cap = latest_state_len;
+                        }
+                    }
+                    has_held_state = latest_state_len <= held_state_cap;
+                    if (has_held_state) memcpy(held_state, latest_state, latest_state_len);
+                }
+                if (has_held_state) render_pending = 1;
+            }
+        }
+
+        if (!spectate && is_running && monotonic_ms() - latency.last_ping_ms >= CLIENT_PING_INTERVAL_MS) {
+            client_latency_send_ping(server_socket_fd, &latency);
+        }
+
+        if (reader.eof) break;
     }
 
+    msg_reader_free(&reader);
+    free(held_state);
+    lockstep_free(sim);
+    free(roster);
+    client_view_free(&view);
+    screen_release(&screen, STDOUT_FILENO);
+    screen_free(&screen);
+
     restore_terminal(&old_term);
-    close(server_socket_fd);
+    if (server_socket_fd >= 0) close(server_socket_fd);
 
-    if (got_game_over) {
-        render_game_over(&game_over);
+    if (game_over) {
+        render_game_over(game_over);
+        print_latency_summary(&latency);
+        free(game_over);
         char line[8];
         read_line(line, sizeof(line));
         paused_session->has_paused_session = 0;
         return 0;
     }
 
+    if (spectate) {
+        printf("\nclient: spectating ended\n");
+        return 0;
+    }
+
+    print_latency_summary(&latency);
     if (did_pause) {
         paused_session->has_paused_session = 1;
         strncpy(paused_session->server_ip, server_ip, sizeof(paused_session->server_ip) - 1);
         paused_session->server_ip[sizeof(paused_session->server_ip) - 1] = '\0';
-        paused_session->server_port = server_port;
+        paused_session->server_port = session_port;
+        paused_session->room = session_room;
+        paused_session->local_server = local_server;
         strncpy(paused_session->player_name, player_name, sizeof(paused_session->player_name) - 1);
         paused_session->player_name[sizeof(paused_session->player_name) - 1] = '\0';
         printf("\nclient: paused -> back to menu\n");
@@ -433,6 +1281,11 @@ static void print_menu(const paused_session_t *paused) {
     else printf("3) Pokracovat v hre (resume) [nie je dostupne]\n");
     printf("4) Koniec\n");
     printf("5) Ukoncit server (shutdown)\n");
+    printf("6) Zmenit mapu servera\n");
+    printf("7) Sledovat hru (spectate)\n");
+    printf("8) Najst hru cez lobby\n");
+    printf("9) Presunut hru na iny server (migrate)\n");
+    printf("10) Zobrazit metriky servera\n");
     printf("Vyber: ");
     fflush(stdout);
 }
@@ -488,19 +1341,19 @@ int main(void) {
                 }
 
                 sleep_ms(200);
-                (void)run_game_session(server_ip, port, player_name, &paused);
+                (void)run_game_session(server_ip, port, JOIN_ROOM_ANY, 1, 0, player_name, &paused);
 
             } else {
-                int width_i = prompt_int("Sirka mapy (5-80)", 40);
-                int height_i = prompt_int("Vyska mapy (5-40)", 20);
+                int width_i = prompt_int("Sirka mapy (5-4096)", 40);
+                int height_i = prompt_int("Vyska mapy (5-4096)", 20);
 
                 if (width_i < 5) width_i = 5;
                 if (height_i < 5) height_i = 5;
-                if (width_i > STATE_MAX_WIDTH) width_i = STATE_MAX_WIDTH;
-                if (height_i > STATE_MAX_HEIGHT) height_i = STATE_MAX_HEIGHT;
+                if (width_i > GAME_MAX_WIDTH) width_i = GAME_MAX_WIDTH;
+                if (height_i > GAME_MAX_HEIGHT) height_i = GAME_MAX_HEIGHT;
 
-                uint8_t map_width = (uint8_t)width_i;
-                uint8_t map_height = (uint8_t)height_i;
+                uint16_t map_width = (uint16_t)width_i;
+                uint16_t map_height = (uint16_t)height_i;
 
                 printf("Spustam server (EMPTY) na porte %u...\n", (unsigned)port);
                 if (start_server_process_empty(port, mode, timed_seconds, world_type, map_width, map_height) < 0) {
@@ -509,7 +1362,7 @@ int main(void) {
                 }
 
                 sleep_ms(200);
-                (void)run_game_session(server_ip, port, player_name, &paused);
+                (void)run_game_session(server_ip, port, JOIN_ROOM_ANY, 1, 0, player_name, &paused);
             }
 
         } else if (choice == 2) {
@@ -528,14 +1381,14 @@ int main(void) {
             }
             uint16_t port = (uint16_t)port_i;
 
-            (void)run_game_session(server_ip, port, player_name, &paused);
+            (void)run_game_session(server_ip, port, JOIN_ROOM_ANY, 0, 0, player_name, &paused);
 
         } else if (choice == 3) {
             if (!paused.has_paused_session) {
                 printf("Nie je co pokracovat (nebola pauza).\n");
                 continue;
             }
-            (void)run_game_session(paused.server_ip, paused.server_port, paused.player_name, &paused);
+            (void)run_game_session(paused.server_ip, paused.server_port, paused.room, paused.local_server, 0, paused.player_name, &paused);
 
         } else if (choice == 4) {
             break;
@@ -553,6 +1406,96 @@ int main(void) {
 
             (void)request_server_shutdown(server_ip, port);
 
+        } else if (choice == 6) {
+            char server_ip[64];
+            char map_path[256];
+            prompt_string("IP servera", "127.0.0.1", server_ip, sizeof(server_ip));
+
+            int port_i = prompt_int("Port", 23456);
+            if (port_i <= 0 || port_i > 65535) {
+                printf("Zly port.\n");
+                continue;
+            }
+            uint16_t port = (uint16_t)port_i;
+
+            printf("Cesta k mape (prazdne = dalsia v rotacii): ");
+            fflush(stdout);
+            read_line(map_path, sizeof(map_path));
+
+            (void)request_server_map_change(server_ip, port, map_path);
+
+        } else if (choice == 7) {
+            char server_ip[64];
+            prompt_string("IP servera", "127.0.0.1", server_ip, sizeof(server_ip));
+
+            int port_i = prompt_int("Port", 23456);
+            if (port_i <= 0 || port_i > 65535) {
+                printf("Zly port.\n");
+                continue;
+            }
+            uint16_t port = (uint16_t)port_i;
+
+            (void)run_game_session(server_ip, port, JOIN_ROOM_ANY, 0, 1, "", &paused);
+
+        } else if (choice == 8) {
+            char player_name[64];
+            char lobby_ip[64];
+
+            prompt_string("Meno hraca", "player1", player_name, sizeof(player_name));
+            trim_player_name_inplace(player_name);
+
+            prompt_string("IP lobby", "127.0.0.1", lobby_ip, sizeof(lobby_ip));
+
+            int port_i = prompt_int("Port lobby", LOBBY_DEFAULT_PORT);
+            if (port_i <= 0 || port_i > 65535) {
+                printf("Zly port.\n");
+                continue;
+            }
+
+            int mode_i = prompt_int("Rezim (0=standard 10s, 1=casovy)", 0);
+            game_mode_t mode = (mode_i == 1) ? GAME_MODE_TIMED : GAME_MODE_STANDARD;
+
+            int world_i = prompt_int("Svet (0=empty wrap, 1=prekazky zo suboru, -1=lubovolny)", -1);
+            uint8_t world_type = world_i == 0 ? 0 : world_i == 1 ? 1 : LOBBY_WORLD_ANY;
+
+            char server_ip[64];
+            uint16_t port = 0;
+            uint16_t room = 0;
+            if (lobby_find_room(lobby_ip, (uint16_t)port_i, mode, world_type, server_ip, sizeof(server_ip), &port, &room) != 0) continue;
+
+            printf("Lobby: miestnost %u na %s:%u\n", (unsigned)room, server_ip, (unsigned)port);
+            if (wait_for_server(server_ip, port) != 0) {
+                printf("Server nie je dostupny.\n");
+                continue;
+            }
+            (void)run_game_session(server_ip, port, room, 0, 0, player_name, &paused);
+
+        } else if (choice == 9) {
+            char server_ip[64];
+            prompt_string("IP servera", "127.0.0.1", server_ip, sizeof(server_ip));
+
+            int port_i = prompt_int("Port", 23456);
+            int target_i = prompt_int("Cielovy port (server na tom istom stroji)", 23457);
+            if (port_i <= 0 || port_i > 65535 || target_i <= 0 || target_i > 65535) {
+                printf("Zly port.\n");
+                continue;
+            }
+            int room_i = prompt_int("Cielova miestnost (-1 = bez miestnosti)", -1);
+            uint16_t target_room = (room_i < 0 || room_i >= (int)JOIN_ROOM_ANY) ? (uint16_t)JOIN_ROOM_ANY : (uint16_t)room_i;
+
+            (void)request_server_migration(server_ip, (uint16_t)port_i, (uint16_t)target_i, target_room);
+
+        } else if (choice == 10) {
+            char server_ip[64];
+            prompt_string("IP servera", "127.0.0.1", server_ip, sizeof(server_ip));
+
+            int port_i = prompt_int("Port", 23456);
+            if (port_i <= 0 || port_i > 65535) {
+                printf("Zly port.\n");
+                continue;
+            }
+            (void)request_server_metrics(server_ip, (uint16_t)port_i);
+
         } else {
             printf("Zly vyber.\n");
         }
@@ -0,0 +1,172 @@
+#include "screen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+void screen_init(screen_t *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+void screen_free(screen_t *s) {
+    free(s->front);
+    free(s->back);
+    free(s->out);
+    memset(s, 0, sizeof(*s));
+}
+
+static int out_reserve(screen_t *s, size_t extra) {
+    if (s->out_len + extra <= s->out_cap) return 0;
+
+    size_t cap = s->out_cap ? s->out_cap : 4096;
+    while (cap < s->out_len + extra) cap *= 2;
+
+    char *grown = (char*)realloc(s->out, cap);
+    if (!grown) return -1;
+    s->out = grown;
+    s->out_cap = cap;
+    return 0;
+}
+
+static void out_append(screen_t *s, const char *data, size_t len) {
+    if (out_reserve(s, len) < 0) return;
+    memcpy(s->out + s->out_len, data, len);
+    s->out_len += len;
+}
+
+static void out_move_cursor(screen_t *s, int row, int col) {
+    char seq[32];
+    int n = snprintf(seq, sizeof(seq), "\033[%d;%dH", row + 1, col + 1);
+    if (n > 0) out_append(s, seq, (size_t)n);
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += (size_t)n;
+    }
+    return 0;
+}
+
+int screen_begin_frame(screen_t *s, int cols, int rows) {
+    if (cols < 1) cols = 1;
+    if (rows < 1) rows = 1;
+
+    if (cols != s->cols || rows != s->rows) {
+        size_t cells = (size_t)cols * (size_t)rows;
+        char *front = (char*)malloc(cells);
+        char *back = (char*)malloc(cells);
+        if (!front || !back) {
+            free(front);
+            free(back);
+            return -1;
+        }
+
+        memset(front, 0, cells);
+        if (!s->front || cols < s->cols || rows < s->rows) {
+            s->needs_clear = 1;
+        } else {
+            for (int r = 0; r < s->rows; r++) {
+                memcpy(front + (size_t)r * cols, s->front + (size_t)r * s->cols, (size_t)s->cols);
+            }
+        }
+
+        free(s->front);
+        free(s->back);
+        s->front = front;
+        s->back = back;
+        s->cols = cols;
+        s->rows = rows;
+    }
+
+    memset(s->back, ' ', (size_t)s->cols * (size_t)s->rows);
+    return 0;
+}
+
+void screen_put_char(screen_t *s, int row, int col, char c) {
+    if (!s->back) return;
+    if (row < 0 || row >= s->rows || col < 0 || col >= s->cols) return;
+    s->back[(size_t)row * s->cols + col] = c;
+}
+
+void screen_put_text(screen_t *s, int row, int col, const char *text) {
+    if (!s->back || !text) return;
+    if (row < 0 || row >= s->rows) return;
+    for (int i = 0; text[i] != '\0' && text[i] != '\n'; i++) {
+        if (col + i >= s->cols) break;
+        if (col + i >= 0) s->back[(size_t)row * s->cols + col + i] = text[i];
+    }
+}
+
+void screen_printf(screen_t *s, int row, int col, const char *fmt, ...) {
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    screen_put_text(s, row, col, line);
+}
+
+int screen_flush(screen_t *s, int fd) {
+    if (!s->back) return 0;
+
+    size_t cells = (size_t)s->cols * (size_t)s->rows;
+    s->out_len = 0;
+
+    if (s->needs_clear) {
+        static const char clear_seq[] = "\033[?25l\033[H\033[2J";
+        out_append(s, clear_seq, sizeof(clear_seq) - 1);
+        memset(s->front, ' ', cells);
+        s->needs_clear = 0;
+    }
+
+    for (int r = 0; r < s->rows; r++) {
+        const char *b = s->back + (size_t)r * s->cols;
+        const char *f = s->front + (size_t)r * s->cols;
+
+        int c = 0;
+        while (c < s->cols) {
+            if (b[c] == f[c]) {
+                c++;
+                continue;
+            }
+
+            int start = c;
+            int end = c + 1;
+            for (int scan = c + 1; scan < s->cols; scan++) {
+                if (b[scan] != f[scan]) end = scan + 1;
+                else if (scan - end >= SCREEN_RUN_MERGE_GAP) break;
+            }
+
+            out_move_cursor(s, r, start);
+            out_append(s, b + start, (size_t)(end - start));
+            c = end;
+        }
+    }
+
+    memcpy(s->front, s->back, cells);
+
+    if (s->out_len == 0) return 0;
+    out_move_cursor(s, s->rows, 0);
+    return write_all(fd, s->out, s->out_len);
+}
+
+void screen_invalidate(screen_t *s) {
+    s->needs_clear = 1;
+}
+
+int screen_release(screen_t *s, int fd) {
+    s->out_len = 0;
+    if (s->front) out_move_cursor(s, s->rows, 0);
+    static const char show_cursor[] = "\033[?25h";
+    out_append(s, show_cursor, sizeof(show_cursor) - 1);
+    return write_all(fd, s->out, s->out_len);
+}
@@ -0,0 +1,35 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stddef.h>
+
+#define SCREEN_RUN_MERGE_GAP 6
+
+typedef struct {
+    int cols;
+    int rows;
+
+    char *front;
+    char *back;
+    int front_valid;
+    int needs_clear;
+
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+} screen_t;
+
+void screen_init(screen_t *screen);
+void screen_free(screen_t *screen);
+
+int  screen_begin_frame(screen_t *screen, int cols, int rows);
+void screen_put_char(screen_t *screen, int row, int col, char c);
+void screen_put_text(screen_t *screen, int row, int col, const char *text);
+void screen_printf(screen_t *screen, int row, int col, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+int  screen_flush(screen_t *screen, int fd);
+void screen_invalidate(screen_t *screen);
+int  screen_release(screen_t *screen, int fd);
+
+#endif
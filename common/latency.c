@@ -0,0 +1,39 @@
+#include "latency.h"
+
+#include <string.h>
+
+static unsigned bucket_of(uint32_t us) {
+    if (us < LATENCY_LINEAR_BUCKETS) return us;
+    unsigned msb = 31u - (unsigned)__builtin_clz(us);
+    unsigned index = LATENCY_LINEAR_BUCKETS + (msb - 4u) * 4u + ((us >> (msb - 2u)) & 3u);
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+static uint32_t bucket_upper(unsigned index) {
+    if (index < LATENCY_LINEAR_BUCKETS) return index;
+    unsigned msb = 4u + (index - LATENCY_LINEAR_BUCKETS) / 4u;
+    unsigned sub = (index - LATENCY_LINEAR_BUCKETS) % 4u;
+    return (1u << msb) + ((sub + 1u) << (msb - 2u)) - 1u;
+}
+
+void latency_hist_reset(latency_hist_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void latency_hist_add(latency_hist_t *h, uint32_t us) {
+    h->counts[bucket_of(us)]++;
+    h->total++;
+    if (us > h->max_us) h->max_us = us;
+}
+
+uint32_t latency_hist_percentile(const latency_hist_t *h, unsigned permille) {
+    if (h->total == 0) return 0;
+    uint64_t rank = ((uint64_t)h->total * permille + 999u) / 1000u;
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) return bucket_upper(i) < h->max_us ? bucket_upper(i) : h->max_us;
+    }
+    return h->max_us;
+}
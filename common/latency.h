@@ -0,0 +1,24 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Microsecond histogram: 16 exact buckets, then four per power of two, so a reported
+// percentile is the upper edge of a bucket at most a quarter wider than its lower edge.
+// Samples past about 16 s land in the last bucket.
+#define LATENCY_LINEAR_BUCKETS 16
+#define LATENCY_BUCKETS        96
+
+typedef struct {
+    uint32_t counts[LATENCY_BUCKETS];
+    uint32_t total;
+    uint32_t max_us;
+} latency_hist_t;
+
+void     latency_hist_reset(latency_hist_t *hist);
+void     latency_hist_add(latency_hist_t *hist, uint32_t sample_us);
+
+// permille: 500 for the median, 990 for p99. Returns 0 for an empty histogram.
+uint32_t latency_hist_percentile(const latency_hist_t *hist, unsigned permille);
+
+#endif
@@ -2,8 +2,19 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef TCP_USER_TIMEOUT
+#define TCP_USER_TIMEOUT 18
+#endif
 
 int send_all_bytes(int socket_fd, const void *buffer, size_t byte_count) {
     const unsigned char *byte_ptr = (const unsigned char*)buffer;
@@ -22,6 +33,74 @@ int send_all_bytes(int socket_fd, const void *buffer, size_t byte_count) {
     return 0;
 }
 
+// Packet sockets refuse records larger than their send buffer; such frames go out
+// as a run of smaller records, which msg_reader_fill stitches back together.
+static int send_iov_chunked(int socket_fd, const struct iovec *iov, size_t iov_count) {
+    for (size_t i = 0; i < iov_count; i++) {
+        const uint8_t *byte_ptr = (const uint8_t*)iov[i].iov_base;
+        size_t remaining = iov[i].iov_len;
+        while (remaining > 0) {
+            size_t chunk = remaining < LOCAL_SOCKET_CHUNK ? remaining : LOCAL_SOCKET_CHUNK;
+            ssize_t sent_now = send(socket_fd, byte_ptr, chunk, MSG_NOSIGNAL);
+            if (sent_now < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (sent_now == 0) return -1;
+            byte_ptr += sent_now;
+            remaining -= (size_t)sent_now;
+        }
+    }
+    return 0;
+}
+
+int send_all_iov(int socket_fd, struct iovec *iov, size_t iov_count) {
+    while (iov_count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        ssize_t sent_now = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+        if (sent_now < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EMSGSIZE) return send_iov_chunked(socket_fd, iov, iov_count);
+            return -1;
+        }
+        if (sent_now == 0) return -1;
+
+        size_t sent = (size_t)sent_now;
+        while (iov_count > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+
+    return 0;
+}
+
+// Non-blocking: returns 1 once everything is out, 0 if the socket is full (resume from *io_offset), -1 on error.
+int send_pending_bytes(int socket_fd, const uint8_t *data, size_t len, size_t *io_offset) {
+    while (*io_offset < len) {
+        size_t remaining = len - *io_offset;
+        size_t chunk = remaining < LOCAL_SOCKET_CHUNK ? remaining : LOCAL_SOCKET_CHUNK;
+        ssize_t sent_now = send(socket_fd, data + *io_offset, chunk, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent_now < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (sent_now == 0) return -1;
+        *io_offset += (size_t)sent_now;
+    }
+    return 1;
+}
+
 int recv_all_bytes(int socket_fd, void *buffer, size_t byte_count) {
     unsigned char *byte_ptr = (unsigned char*)buffer;
     size_t recv_total = 0;
@@ -39,23 +118,395 @@ int recv_all_bytes(int socket_fd, void *buffer, size_t byte_count) {
     return 0;
 }
 
-int send_message(int socket_fd, uint16_t message_type_host, const void *payload, uint16_t payload_len_host) {
-    message_header_t header_net;
-    header_net.message_type_net = htons(message_type_host);
-    header_net.payload_len_net = htons(payload_len_host);
+int send_message(int socket_fd, uint16_t message_type_host, const void *payload, uint32_t payload_len_host) {
+    msg_batch_t batch;
+    msg_batch_init(&batch, socket_fd);
+    if (msg_batch_add(&batch, message_type_host, payload, payload_len_host) < 0) return -1;
+    return msg_batch_flush(&batch);
+}
+
+void msg_batch_init(msg_batch_t *batch, int socket_fd) {
+    batch->socket_fd = socket_fd;
+    batch->frame_count = 0;
+    batch->iov_count = 0;
+}
+
+int msg_batch_add(msg_batch_t *batch, uint16_t message_type_host, const void *payload, uint32_t payload_len_host) {
+    if (batch->frame_count == MSG_BATCH_MAX_FRAMES && msg_batch_flush(batch) < 0) return -1;
+
+    message_header_t *header_net = &batch->headers[batch->frame_count++];
+    header_net->message_type_net = htons(message_type_host);
+    header_net->payload_len_net = htonl(payload != NULL ? payload_len_host : 0);
 
-    if (send_all_bytes(socket_fd, &header_net, sizeof(header_net)) < 0) return -1;
+    batch->iov[batch->iov_count].iov_base = header_net;
+    batch->iov[batch->iov_count].iov_len = sizeof(*header_net);
+    batch->iov_count++;
 
     if (payload_len_host > 0 && payload != NULL) {
-        if (send_all_bytes(socket_fd, payload, payload_len_host) < 0) return -1;
+        batch->iov[batch->iov_count].iov_base = (void*)payload;
+        batch->iov[batch->iov_count].iov_len = payload_len_host;
+        batch->iov_count++;
     }
-
     return 0;
 }
 
+int msg_batch_flush(msg_batch_t *batch) {
+    int rc = 0;
+    if (batch->iov_count > 0) rc = send_all_iov(batch->socket_fd, batch->iov, batch->iov_count);
+    batch->frame_count = 0;
+    batch->iov_count = 0;
+    return rc;
+}
+
+void socket_tuning_defaults(socket_tuning_t *tuning) {
+    tuning->no_delay = 1;
+    tuning->send_buffer_bytes = SOCKET_DEFAULT_SNDBUF;
+    tuning->recv_buffer_bytes = SOCKET_DEFAULT_RCVBUF;
+    tuning->user_timeout_ms = SOCKET_DEFAULT_USER_TIMEOUT_MS;
+}
+
+int socket_apply_buffers(int socket_fd, const socket_tuning_t *tuning) {
+    int rc = 0;
+    if (tuning->send_buffer_bytes > 0 &&
+        setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &tuning->send_buffer_bytes, sizeof(tuning->send_buffer_bytes)) < 0) rc = -1;
+    if (tuning->recv_buffer_bytes > 0 &&
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &tuning->recv_buffer_bytes, sizeof(tuning->recv_buffer_bytes)) < 0) rc = -1;
+    return rc;
+}
+
+int socket_apply_tuning(int socket_fd, const socket_tuning_t *tuning) {
+    int rc = socket_apply_buffers(socket_fd, tuning);
+
+    int no_delay = tuning->no_delay ? 1 : 0;
+    if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) < 0) rc = -1;
+
+    if (tuning->user_timeout_ms > 0) {
+        unsigned timeout = tuning->user_timeout_ms;
+        if (setsockopt(socket_fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) < 0) rc = -1;
+    }
+    return rc;
+}
+
 int recv_message_header(int socket_fd, message_header_t *out_header_net) {
     if (!out_header_net) return -1;
     if (recv_all_bytes(socket_fd, out_header_net, sizeof(*out_header_net)) < 0) return -1;
     return 0;
 }
 
+
+void msg_reader_init(msg_reader_t *reader) {
+    memset(reader, 0, sizeof(*reader));
+}
+
+void msg_reader_free(msg_reader_t *reader) {
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
+
+static void msg_reader_compact(msg_reader_t *reader) {
+    if (reader->start == 0) return;
+    size_t remaining = reader->len - reader->start;
+    if (remaining > 0) memmove(reader->buf, reader->buf + reader->start, remaining);
+    reader->len = remaining;
+    reader->checked = reader->checked > reader->start ? reader->checked - reader->start : 0;
+    reader->start = 0;
+}
+
+static int msg_reader_reserve(msg_reader_t *reader, size_t free_bytes) {
+    if (reader->cap - reader->len >= free_bytes) return 0;
+
+    size_t cap = reader->cap ? reader->cap : 16384;
+    while (cap - reader->len < free_bytes) cap *= 2;
+    uint8_t *grown = (uint8_t*)realloc(reader->buf, cap);
+    if (!grown) return -1;
+    reader->buf = grown;
+    reader->cap = cap;
+    return 0;
+}
+
+static uint32_t msg_reader_limit(const msg_reader_t *reader, uint16_t message_type) {
+    if (reader->max_payload == 0) return MSG_MAX_PAYLOAD_LEN;
+    if (reader->bulk_type != 0 && message_type == reader->bulk_type) return MSG_MAX_PAYLOAD_LEN;
+    return reader->max_payload;
+}
+
+// Walks the headers buffered since the last call, so an oversized frame is refused as soon as
+// its header arrives rather than after its payload has been buffered.
+static int msg_reader_check(msg_reader_t *reader) {
+    size_t offset = reader->checked > reader->start ? reader->checked : reader->start;
+    while (offset <= reader->len && reader->len - offset >= sizeof(message_header_t)) {
+        message_header_t header_net;
+        memcpy(&header_net, reader->buf + offset, sizeof(header_net));
+        uint32_t payload_len = ntohl(header_net.payload_len_net);
+        if (payload_len > msg_reader_limit(reader, ntohs(header_net.message_type_net))) return -1;
+        offset += sizeof(header_net) + payload_len;
+    }
+    reader->checked = offset;
+    return 0;
+}
+
+int msg_reader_fill(msg_reader_t *reader, int socket_fd) {
+    msg_reader_compact(reader);
+
+    if (reader->socket_type == 0) {
+        socklen_t type_len = sizeof(reader->socket_type);
+        if (getsockopt(socket_fd, SOL_SOCKET, SO_TYPE, &reader->socket_type, &type_len) < 0) reader->socket_type = SOCK_STREAM;
+    }
+
+    size_t filled = 0;
+    while (filled < MSG_READER_MAX_FILL) {
+        size_t want = 1;
+        if (reader->socket_type == SOCK_SEQPACKET) {
+            ssize_t record_len = recv(socket_fd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+            if (record_len < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
+            }
+            if (record_len > 0) want = (size_t)record_len;
+        }
+        if (msg_reader_reserve(reader, want) != 0) return -1;
+
+        ssize_t recv_now = recv(socket_fd, reader->buf + reader->len, reader->cap - reader->len, MSG_DONTWAIT);
+        if (recv_now > 0) {
+            reader->len += (size_t)recv_now;
+            filled += (size_t)recv_now;
+            if (msg_reader_check(reader) != 0) return -1;
+            continue;
+        }
+        if (recv_now == 0) {
+            reader->eof = 1;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Appends bytes a completion-based transport already received on the reader's behalf.
+int msg_reader_push(msg_reader_t *reader, const uint8_t *data, size_t len) {
+    msg_reader_compact(reader);
+    if (msg_reader_reserve(reader, len) != 0) return -1;
+    memcpy(reader->buf + reader->len, data, len);
+    reader->len += len;
+    return msg_reader_check(reader);
+}
+
+int msg_reader_next(msg_reader_t *reader, uint16_t *out_type, const uint8_t **out_payload, uint32_t *out_payload_len) {
+    size_t available = reader->len - reader->start;
+    if (available < sizeof(message_header_t)) return 0;
+
+    message_header_t header_net;
+    memcpy(&header_net, reader->buf + reader->start, sizeof(header_net));
+    uint32_t payload_len = ntohl(header_net.payload_len_net);
+    if (payload_len > msg_reader_limit(reader, ntohs(header_net.message_type_net))) return -1;
+    if (available < sizeof(header_net) + payload_len) return 0;
+
+    reader->last_frame_offset = reader->start;
+    *out_type = ntohs(header_net.message_type_net);
+    *out_payload = reader->buf + reader->start + sizeof(header_net);
+    *out_payload_len = payload_len;
+
+    reader->start += sizeof(header_net) + payload_len;
+    return 1;
+}
+
+void msg_reader_rewind(msg_reader_t *reader, size_t frame_offset) {
+    if (frame_offset <= reader->len) reader->start = frame_offset;
+}
+
+void local_socket_default_name(char *out, size_t cap, uint16_t port) {
+    snprintf(out, cap, "@snake-%u", (unsigned)port);
+}
+
+static socklen_t local_socket_address(const char *name, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(addr->sun_path)) return 0;
+    memcpy(addr->sun_path, name, len);
+    // A leading '@' selects the Linux abstract namespace: no file to clean up.
+    if (name[0] == '@') addr->sun_path[0] = '\0';
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + (name[0] == '@' ? 0 : 1));
+}
+
+int local_socket_listen(const char *name) {
+    struct sockaddr_un addr;
+    socklen_t addr_len = local_socket_address(name, &addr);
+    if (addr_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (listen_fd < 0) return -1;
+
+    if (name[0] != '@') unlink(name);
+    if (bind(listen_fd, (struct sockaddr*)&addr, addr_len) < 0 || listen(listen_fd, 16) < 0) {
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+int local_socket_connect(const char *name) {
+    return local_socket_connect_flags(name, 0);
+}
+
+int local_socket_connect_flags(const char *name, int socket_flags) {
+    struct sockaddr_un addr;
+    socklen_t addr_len = local_socket_address(name, &addr);
+    if (addr_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | socket_flags, 0);
+    if (socket_fd < 0) return -1;
+    if (connect(socket_fd, (struct sockaddr*)&addr, addr_len) < 0) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+size_t join_payload_build(uint8_t *out, size_t cap, const char *name, uint16_t room) {
+    size_t name_len = strlen(name);
+    size_t len = name_len + (room != JOIN_ROOM_ANY ? 1 + sizeof(uint16_t) : 0);
+    if (len > cap) return 0;
+
+    memcpy(out, name, name_len);
+    if (room != JOIN_ROOM_ANY) {
+        uint16_t room_net = htons(room);
+        out[name_len] = '\0';
+        memcpy(out + name_len + 1, &room_net, sizeof(room_net));
+    }
+    return len;
+}
+
+int join_payload_parse(const uint8_t *payload, uint32_t payload_len, uint32_t *out_name_len, uint16_t *out_room) {
+    const uint8_t *nul = (const uint8_t*)memchr(payload, '\0', payload_len);
+    *out_name_len = nul ? (uint32_t)(nul - payload) : payload_len;
+    *out_room = JOIN_ROOM_ANY;
+    if (!nul) return 0;
+
+    if (payload_len != *out_name_len + 1 + sizeof(uint16_t)) return -1;
+    uint16_t room_net;
+    memcpy(&room_net, nul + 1, sizeof(room_net));
+    *out_room = ntohs(room_net);
+    return 0;
+}
+
+void handoff_socket_name(char *out, size_t cap, uint16_t port, uint16_t room) {
+    snprintf(out, cap, "@snake-%u-room-%u", (unsigned)port, (unsigned)room);
+}
+
+int handoff_socket_bind(const char *name) {
+    struct sockaddr_un addr;
+    socklen_t addr_len = local_socket_address(name, &addr);
+    if (addr_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int handoff_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (handoff_fd < 0) return -1;
+
+    if (name[0] != '@') unlink(name);
+    if (bind(handoff_fd, (struct sockaddr*)&addr, addr_len) < 0) {
+        close(handoff_fd);
+        return -1;
+    }
+    return handoff_fd;
+}
+
+int handoff_send(int handoff_fd, const char *peer_name, int socket_fd, const uint8_t *data, size_t len) {
+    struct sockaddr_un addr;
+    socklen_t addr_len = local_socket_address(peer_name, &addr);
+    if (addr_len == 0 || len > HANDOFF_MAX_BYTES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    // A leading marker keeps the datagram non-empty when no bytes were read yet.
+    uint8_t marker = 'H';
+    struct iovec iov[2];
+    iov[0].iov_base = &marker;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = addr_len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &socket_fd, sizeof(int));
+
+    for (;;) {
+        ssize_t sent = sendmsg(handoff_fd, &msg, MSG_NOSIGNAL);
+        if (sent >= 0) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+    }
+}
+
+// Returns 1 with a socket, 0 when nothing is queued, -1 on error.
+int handoff_recv(int handoff_fd, int *out_socket_fd, uint8_t *buf, size_t cap, size_t *out_len) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    uint8_t marker = 0;
+    struct iovec iov[2];
+    iov[0].iov_base = &marker;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = cap;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    ssize_t got;
+    do {
+        got = recvmsg(handoff_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    int socket_fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) memcpy(&socket_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (socket_fd < 0 || marker != 'H' || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (socket_fd >= 0) close(socket_fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    *out_socket_fd = socket_fd;
+    *out_len = (size_t)got - 1;
+    return 1;
+}
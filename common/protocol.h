@@ -4,12 +4,18 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 typedef struct {
     uint16_t message_type_net;
-    uint16_t payload_len_net;
+    uint32_t payload_len_net;
 } __attribute__((packed)) message_header_t;
 
+#define MSG_MAX_PAYLOAD_LEN (64u * 1024u * 1024u)
+
+// Cap for frames from untrusted peers; every request they may send fits well inside it.
+#define MSG_INBOUND_PAYLOAD_LEN (4u * 1024u)
+
 enum {
     MSG_JOIN      = 1,
     MSG_WELCOME   = 2,
@@ -24,7 +30,35 @@ enum {
     MSG_LEAVE     = 14,
     MSG_RESPAWN   = 15,
 
-    MSG_GAME_OVER = 16
+    MSG_GAME_OVER = 16,
+
+    MSG_MAP_RELOAD = 17,
+
+    MSG_LOCKSTEP_KEYFRAME = 18,
+    MSG_LOCKSTEP_TICK     = 19,
+    MSG_KEYFRAME_REQUEST  = 20,
+
+    MSG_VIEWPORT  = 21,
+    MSG_ROSTER    = 22,
+
+    MSG_SPECTATE  = 23,
+
+    MSG_ROOM_REPORT = 24,
+    MSG_LOBBY_LIST  = 25,
+    MSG_LOBBY_ROOMS = 26,
+    MSG_LOBBY_MATCH = 27,
+    MSG_LOBBY_PLACE = 28,
+
+    MSG_MIGRATE       = 29,
+    MSG_MIGRATE_STATE = 30,
+    MSG_REDIRECT      = 31,
+
+    MSG_METRICS       = 32,
+
+    MSG_PING          = 33,
+    MSG_PONG          = 34,
+
+    MSG_MIGRATE_COMMIT = 35
 };
 
 typedef enum {
@@ -34,15 +68,33 @@ typedef enum {
     DIR_LEFT = 3
 } direction_t;
 
+// seq counts up per connection and sent_us is the sender's monotonic clock in microseconds,
+// truncated to 32 bits; MSG_STATE echoes both. A bare one-byte direction is still accepted.
 typedef struct {
     uint8_t direction;
+    uint8_t reserved0;
+    uint16_t reserved1;
+    uint32_t seq_net;
+    uint32_t sent_us_net;
 } __attribute__((packed)) input_message_t;
 
-#define STATE_MAX_WIDTH   80
-#define STATE_MAX_HEIGHT  40
-#define STATE_MAX_CELLS   (STATE_MAX_WIDTH * STATE_MAX_HEIGHT)
+#define INPUT_LEGACY_LEN 1
+
+// MSG_PING carries the client clock; MSG_PONG returns it with the server clock at reply time.
+typedef struct {
+    uint32_t client_us_net;
+    uint32_t server_us_net;
+} __attribute__((packed)) ping_message_t;
+
+typedef struct {
+    uint16_t width_net;
+    uint16_t height_net;
+} __attribute__((packed)) viewport_message_t;
+
+#define STATE_MAX_WIDTH   4096
+#define STATE_MAX_HEIGHT  4096
 
-#define STATE_MAX_PLAYERS 64
+#define STATE_MAX_PLAYERS 4096
 #define STATE_NAME_MAX    32
 #define PLAYER_NAME_MAX   STATE_NAME_MAX
 
@@ -51,31 +103,83 @@ typedef enum {
     GAME_MODE_TIMED    = 1
 } game_mode_t;
 
-typedef struct {
-    uint8_t is_used;
-    uint8_t has_joined;
-    uint8_t is_alive;
-    uint8_t is_paused;
+#define STATE_PLAYER_USED   0x01
+#define STATE_PLAYER_JOINED 0x02
+#define STATE_PLAYER_ALIVE  0x04
+#define STATE_PLAYER_PAUSED 0x08
 
+typedef struct {
+    uint32_t player_id_net;
+    uint8_t flags;
+    uint8_t reserved0;
     uint16_t score_net;
+} __attribute__((packed)) state_player_status_t;
+
+typedef struct {
+    state_player_status_t status;
     uint8_t name[STATE_NAME_MAX];
-} __attribute__((packed)) state_player_info_t;
+} __attribute__((packed)) roster_entry_t;
+
+typedef struct {
+    uint16_t player_count_net;
+    uint16_t reserved0;
+    roster_entry_t players[];
+} __attribute__((packed)) roster_message_t;
 
 typedef struct {
     uint32_t tick_counter_net;
 
-    uint8_t width;
-    uint8_t height;
+    uint16_t width_net;
+    uint16_t height_net;
     uint8_t game_mode;
     uint8_t world_type;
+    uint16_t reserved0;
 
     uint32_t elapsed_ms_net;
     uint32_t remaining_ms_net;
 
-    state_player_info_t players[STATE_MAX_PLAYERS];
-    uint8_t cells[STATE_MAX_CELLS];
+    uint16_t view_x_net;
+    uint16_t view_y_net;
+    uint16_t view_width_net;
+    uint16_t view_height_net;
+    uint8_t minimap_width;
+    uint8_t minimap_height;
+    uint8_t flags;
+    uint8_t reserved1;
+
+    uint16_t status_count_net;
+    uint16_t reserved2;
+
+    // Latency stamps, all 32-bit microsecond clocks: the newest input of the receiving player
+    // that this tick applied, the client time of the oldest input it acknowledges, and the
+    // server time the tick started and this frame was built.
+    uint32_t input_seq_net;
+    uint32_t input_sent_us_net;
+    uint32_t tick_us_net;
+    uint32_t frame_us_net;
+
+    uint8_t data[];
 } __attribute__((packed)) state_message_t;
 
+#define STATE_FLAG_CELLS_UNCHANGED 0x01
+#define STATE_FLAG_WORLD_PAUSED    0x02
+
+#define STATE_CELL_EMPTY      0x0000
+#define STATE_CELL_OBSTACLE   0x0001
+#define STATE_CELL_FOOD       0x0002
+#define STATE_CELL_DEAD       0x0003
+#define STATE_CELL_BODY       0x4000
+#define STATE_CELL_HEAD       0x8000
+#define STATE_CELL_OWNER_MASK 0x3FFF
+
+static inline state_player_status_t *state_message_statuses(const state_message_t *msg) {
+    return (state_player_status_t*)msg->data;
+}
+
+static inline size_t state_message_cells_offset(uint16_t status_count) {
+    return (size_t)status_count * sizeof(state_player_status_t);
+}
+
 typedef struct {
     uint8_t has_joined;
     uint8_t reserved0;
@@ -86,19 +190,160 @@ typedef struct {
 
 typedef struct {
     uint32_t elapsed_ms_net;
-    uint8_t player_count;
-    uint8_t reserved1;
-    uint16_t reserved2;
-    game_over_player_entry_t players[STATE_MAX_PLAYERS];
+    uint16_t player_count_net;
+    uint16_t reserved1;
+    game_over_player_entry_t players[];
 } __attribute__((packed)) game_over_message_t;
 
+typedef struct {
+    uint32_t now_ms_high_net;
+    uint32_t now_ms_low_net;
+} __attribute__((packed)) lockstep_keyframe_header_t;
+
+typedef struct {
+    uint32_t tick_counter_net;
+    uint32_t now_offset_ms_net;
+    uint16_t event_count_net;
+    uint8_t has_state_hash;
+    uint8_t reserved0;
+    uint32_t state_hash_net;
+} __attribute__((packed)) lockstep_tick_header_t;
+
+#define LOBBY_DEFAULT_PORT   23400
+#define ROOM_WORLD_NAME_MAX  32
+#define LOBBY_WORLD_ANY      0xFF
+
+// Sent by a room host to the lobby about once a second; tick cost is the mean work per tick.
+typedef struct {
+    uint16_t port_net;
+    uint16_t room_net;
+    uint8_t game_mode;
+    uint8_t world_type;
+    uint16_t width_net;
+    uint16_t height_net;
+    uint16_t player_count_net;
+    uint16_t player_capacity_net;
+    uint16_t reserved0;
+    uint32_t tick_cost_us_net;
+    uint32_t tick_budget_us_net;
+    uint8_t world_name[ROOM_WORLD_NAME_MAX];
+} __attribute__((packed)) room_report_message_t;
+
+typedef struct {
+    uint32_t host_ipv4_net;
+    room_report_message_t report;
+} __attribute__((packed)) lobby_room_entry_t;
+
+typedef struct {
+    uint16_t room_count_net;
+    uint16_t reserved0;
+    lobby_room_entry_t rooms[];
+} __attribute__((packed)) lobby_rooms_message_t;
+
+typedef struct {
+    uint8_t game_mode;
+    uint8_t world_type;
+    uint16_t reserved0;
+} __attribute__((packed)) lobby_match_message_t;
+
+typedef struct {
+    uint32_t host_ipv4_net;
+    uint16_t port_net;
+    uint16_t room_net;
+} __attribute__((packed)) lobby_place_message_t;
+
+// MSG_MIGRATE asks a server to hand its match to another server process on the same host;
+// MSG_REDIRECT then tells each client where to rejoin by name. The target only stages a
+// MSG_MIGRATE_STATE image and starts the match on the source's MSG_MIGRATE_COMMIT.
+typedef struct {
+    uint16_t port_net;
+    uint16_t room_net;
+} __attribute__((packed)) room_target_message_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    size_t start;
+    size_t last_frame_offset;
+    size_t checked;             // headers before this offset are already within the cap
+    int eof;
+    int socket_type;
+    uint32_t max_payload;       // 0 means MSG_MAX_PAYLOAD_LEN
+    uint16_t bulk_type;         // one message type exempt from max_payload, 0 for none
+} msg_reader_t;
+
+#define MSG_READER_MAX_FILL (1024 * 1024)
+
+void msg_reader_init(msg_reader_t *reader);
+void msg_reader_free(msg_reader_t *reader);
+int  msg_reader_fill(msg_reader_t *reader, int socket_fd);
+int  msg_reader_push(msg_reader_t *reader, const uint8_t *data, size_t len);
+int  msg_reader_next(msg_reader_t *reader, uint16_t *out_type, const uint8_t **out_payload, uint32_t *out_payload_len);
+void msg_reader_rewind(msg_reader_t *reader, size_t frame_offset);
+
+#define MSG_BATCH_MAX_FRAMES 32
+
+// Frames queued in a batch reference the caller's payload buffers until flushed.
+typedef struct {
+    int socket_fd;
+    size_t frame_count;
+    message_header_t headers[MSG_BATCH_MAX_FRAMES];
+    struct iovec iov[2 * MSG_BATCH_MAX_FRAMES];
+    size_t iov_count;
+} msg_batch_t;
+
+void msg_batch_init(msg_batch_t *batch, int socket_fd);
+int  msg_batch_add(msg_batch_t *batch, uint16_t message_type_host, const void *payload, uint32_t payload_len_host);
+int  msg_batch_flush(msg_batch_t *batch);
+
+#define SOCKET_DEFAULT_SNDBUF          (256 * 1024)
+#define SOCKET_DEFAULT_RCVBUF          (256 * 1024)
+#define SOCKET_DEFAULT_USER_TIMEOUT_MS 10000
+
+typedef struct {
+    int no_delay;
+    int send_buffer_bytes;
+    int recv_buffer_bytes;
+    unsigned user_timeout_ms;
+} socket_tuning_t;
+
+void socket_tuning_defaults(socket_tuning_t *tuning);
+int  socket_apply_buffers(int socket_fd, const socket_tuning_t *tuning);
+int  socket_apply_tuning(int socket_fd, const socket_tuning_t *tuning);
+
+#define LOCAL_SOCKET_NAME_MAX 108
+#define LOCAL_SOCKET_CHUNK    (64 * 1024)
+
+void local_socket_default_name(char *out, size_t cap, uint16_t port);
+int  local_socket_listen(const char *name);
+int  local_socket_connect(const char *name);
+int  local_socket_connect_flags(const char *name, int socket_flags);   // e.g. SOCK_NONBLOCK
+
+// MSG_JOIN payload: the player name, optionally followed by a NUL and a u16 room (network order).
+#define JOIN_ROOM_ANY 0xFFFFu
+
+size_t join_payload_build(uint8_t *out, size_t cap, const char *name, uint16_t room);
+int    join_payload_parse(const uint8_t *payload, uint32_t payload_len, uint32_t *out_name_len, uint16_t *out_room);
+
+// Passes an accepted connection to another server process on this host: one datagram carries
+// the socket (SCM_RIGHTS) plus the bytes already read from it, so no input is lost.
+#define HANDOFF_MAX_BYTES (60 * 1024)
+
+void handoff_socket_name(char *out, size_t cap, uint16_t port, uint16_t room);
+int  handoff_socket_bind(const char *name);
+int  handoff_send(int handoff_fd, const char *peer_name, int socket_fd, const uint8_t *data, size_t len);
+int  handoff_recv(int handoff_fd, int *out_socket_fd, uint8_t *buf, size_t cap, size_t *out_len);
+
 int send_all_bytes(int socket_fd, const void *buffer, size_t byte_count);
+int send_all_iov(int socket_fd, struct iovec *iov, size_t iov_count);
+int send_pending_bytes(int socket_fd, const uint8_t *data, size_t len, size_t *io_offset);
 int recv_all_bytes(int socket_fd, void *buffer, size_t byte_count);
 
-int send_message(int socket_fd, uint16_t message_type_host, const void *payload, uint16_t payload_len_host);
+int send_message(int socket_fd, uint16_t message_type_host, const void *payload, uint32_t payload_len_host);
 int recv_message_header(int socket_fd, message_header_t *out_header_net);
 
-static inline int send_msg(int socket_fd, uint16_t message_type_host, const void *payload, uint16_t payload_len_host) {
+static inline int send_msg(int socket_fd, uint16_t message_type_host, const void *payload, uint32_t payload_len_host) {
     return send_message(socket_fd, message_type_host, payload, payload_len_host);
 }
 
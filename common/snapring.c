@@ -0,0 +1,180 @@
+#include "snapring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPRING_SLOTS_OFFSET 64u
+
+static void ring_shm_name(char *out, size_t cap, const char *name) {
+    if (name[0] == '/') snprintf(out, cap, "%s", name);
+    else snprintf(out, cap, "/%s", name);
+}
+
+static snapring_slot_t *slot_at(const snapring_header_t *h, uint64_t seq) {
+    uint8_t *base = (uint8_t*)h + SNAPRING_SLOTS_OFFSET;
+    return (snapring_slot_t*)(base + (size_t)(seq % h->slot_count) * h->slot_stride);
+}
+
+int snapring_create(snapring_t *ring, const char *name, uint32_t slot_count, uint32_t slot_bytes) {
+    memset(ring, 0, sizeof(*ring));
+    if (!name || !name[0] || slot_count == 0 || slot_count > SNAPRING_MAX_SLOTS ||
+        slot_bytes == 0 || slot_bytes > SNAPRING_MAX_SLOT_BYTES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring_shm_name(ring->name, sizeof(ring->name), name);
+
+    uint32_t stride = (uint32_t)((sizeof(snapring_slot_t) + slot_bytes + 63u) & ~(size_t)63u);
+    size_t map_len = SNAPRING_SLOTS_OFFSET + (size_t)slot_count * stride;
+
+    int fd = shm_open(ring->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)map_len) != 0) {
+        int saved = errno;
+        close(fd);
+        shm_unlink(ring->name);
+        errno = saved;
+        return -1;
+    }
+
+    void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(ring->name);
+        return -1;
+    }
+
+    snapring_header_t *h = (snapring_header_t*)map;
+    h->version = SNAPRING_VERSION;
+    h->slot_count = slot_count;
+    h->slot_bytes = slot_bytes;
+    h->slot_stride = stride;
+    atomic_store_explicit(&h->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->dropped, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    h->magic = SNAPRING_MAGIC;
+
+    ring->header = h;
+    ring->map_len = map_len;
+    ring->is_writer = 1;
+    return 0;
+}
+
+int snapring_open(snapring_t *ring, const char *name) {
+    memset(ring, 0, sizeof(*ring));
+    if (!name || !name[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring_shm_name(ring->name, sizeof(ring->name), name);
+
+    int fd = shm_open(ring->name, O_RDONLY, 0);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if ((size_t)st.st_size < SNAPRING_SLOTS_OFFSET) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const snapring_header_t *h = (const snapring_header_t*)map;
+    size_t need = SNAPRING_SLOTS_OFFSET + (size_t)h->slot_count * h->slot_stride;
+    if (h->magic != SNAPRING_MAGIC || h->version != SNAPRING_VERSION || h->slot_count == 0 ||
+        h->slot_stride < sizeof(snapring_slot_t) + h->slot_bytes || need > (size_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    ring->header = (snapring_header_t*)map;
+    ring->map_len = (size_t)st.st_size;
+    return 0;
+}
+
+void snapring_close(snapring_t *ring) {
+    if (!ring->header) return;
+    munmap(ring->header, ring->map_len);
+    if (ring->is_writer) shm_unlink(ring->name);
+    memset(ring, 0, sizeof(*ring));
+}
+
+uint8_t *snapring_begin(snapring_t *ring, size_t *out_cap) {
+    snapring_header_t *h = ring->header;
+    uint64_t seq = atomic_load_explicit(&h->head, memory_order_relaxed);
+    snapring_slot_t *slot = slot_at(h, seq);
+
+    atomic_store_explicit(&slot->seq, 2 * seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    *out_cap = h->slot_bytes;
+    return slot->data;
+}
+
+void snapring_commit(snapring_t *ring, uint32_t tick, uint64_t time_ms, size_t len) {
+    snapring_header_t *h = ring->header;
+    uint64_t seq = atomic_load_explicit(&h->head, memory_order_relaxed);
+    snapring_slot_t *slot = slot_at(h, seq);
+
+    slot->tick = tick;
+    slot->len = (uint32_t)len;
+    slot->time_ms = time_ms;
+    atomic_store_explicit(&slot->seq, 2 * seq + 2, memory_order_release);
+    atomic_store_explicit(&h->head, seq + 1, memory_order_release);
+}
+
+// The slot stays marked as in-progress; the next begin() reuses it.
+void snapring_abandon(snapring_t *ring) {
+    atomic_fetch_add_explicit(&ring->header->dropped, 1, memory_order_relaxed);
+}
+
+uint64_t snapring_head(const snapring_t *ring) {
+    return atomic_load_explicit(&ring->header->head, memory_order_acquire);
+}
+
+int snapring_read(snapring_t *ring, uint64_t seq, uint8_t *buf, size_t cap, snapring_frame_t *out_frame) {
+    const snapring_header_t *h = ring->header;
+    snapring_slot_t *slot = slot_at(h, seq);
+    uint64_t complete = 2 * seq + 2;
+
+    uint64_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (before < complete) return SNAPRING_AGAIN;
+    if (before > complete) return SNAPRING_LOST;
+
+    uint32_t tick = slot->tick;
+    uint32_t len = slot->len;
+    uint64_t time_ms = slot->time_ms;
+    int fits = len <= h->slot_bytes && len <= cap;
+    if (fits) memcpy(buf, slot->data, len);
+
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if (after != before) {
+        ring->torn_reads++;
+        return SNAPRING_LOST;
+    }
+
+    out_frame->seq = seq;
+    out_frame->tick = tick;
+    out_frame->len = len;
+    out_frame->time_ms = time_ms;
+    return fits ? SNAPRING_OK : SNAPRING_TOO_SMALL;
+}
@@ -0,0 +1,71 @@
+#ifndef SNAPRING_H
+#define SNAPRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SNAPRING_MAGIC         0x534E5247u
+#define SNAPRING_VERSION       1
+#define SNAPRING_NAME_MAX      64
+#define SNAPRING_DEFAULT_SLOTS 8
+#define SNAPRING_DEFAULT_SLOT_BYTES (1024u * 1024u)
+#define SNAPRING_MAX_SLOTS     1024
+#define SNAPRING_MAX_SLOT_BYTES (64u * 1024u * 1024u)
+
+typedef enum {
+    SNAPRING_OK        = 0,
+    SNAPRING_AGAIN     = 1,   // requested snapshot not published yet
+    SNAPRING_LOST      = 2,   // writer lapped the reader; skip ahead
+    SNAPRING_TOO_SMALL = 3
+} snapring_result_t;
+
+// Shared layout: one header followed by slot_count slots of slot_stride bytes.
+// Snapshot n lives in slot n % slot_count; its seq is 2n+1 while the writer
+// fills it and 2n+2 once complete, so readers detect torn copies without locks.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    uint32_t slot_stride;
+    uint32_t reserved0;
+    _Atomic uint64_t head;
+    _Atomic uint64_t dropped;
+} snapring_header_t;
+
+typedef struct {
+    _Atomic uint64_t seq;
+    uint32_t tick;
+    uint32_t len;
+    uint64_t time_ms;
+    uint8_t data[];
+} snapring_slot_t;
+
+typedef struct {
+    snapring_header_t *header;
+    size_t map_len;
+    int is_writer;
+    char name[SNAPRING_NAME_MAX];
+    uint64_t torn_reads;
+} snapring_t;
+
+typedef struct {
+    uint64_t seq;
+    uint32_t tick;
+    uint32_t len;
+    uint64_t time_ms;
+} snapring_frame_t;
+
+int      snapring_create(snapring_t *ring, const char *name, uint32_t slot_count, uint32_t slot_bytes);
+int      snapring_open(snapring_t *ring, const char *name);
+void     snapring_close(snapring_t *ring);
+
+uint8_t *snapring_begin(snapring_t *ring, size_t *out_cap);
+void     snapring_commit(snapring_t *ring, uint32_t tick, uint64_t time_ms, size_t len);
+void     snapring_abandon(snapring_t *ring);
+
+uint64_t snapring_head(const snapring_t *ring);
+int      snapring_read(snapring_t *ring, uint64_t seq, uint8_t *buf, size_t cap, snapring_frame_t *out_frame);
+
+#endif
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../common/protocol.h"
+#include "../server/game.h"
+
+#define LOBBY_MAX_CONNECTIONS   1024
+#define LOBBY_MAX_ROOMS         1024
+#define LOBBY_POLL_MS           250
+#define LOBBY_ROOM_TIMEOUT_MS   3000
+#define LOBBY_SPAWN_GRACE_MS    5000
+#define LOBBY_LOAD_LIMIT        900    // permille; fuller rooms take no new players
+#define LOBBY_SPAWN_CAPACITY    32
+#define LOBBY_SPAWN_WIDTH       40
+#define LOBBY_SPAWN_HEIGHT      20
+#define LOBBY_SPAWN_TIMED_S     60
+
+typedef struct {
+    int fd;
+    uint32_t host_ipv4_net;
+    msg_reader_t reader;
+} lobby_conn_t;
+
+// A room is known from its host's reports; a spawned room is listed before its first report so
+// that a burst of joins lands in it instead of spawning one server per player.
+typedef struct {
+    int is_used;
+    int conn_fd;
+    uint32_t host_ipv4_net;
+    room_report_message_t report;
+    uint16_t placed;            // players sent here since the last report
+    uint64_t last_report_ms;
+} lobby_room_t;
+
+typedef struct {
+    int listen_fd;
+    lobby_conn_t conns[LOBBY_MAX_CONNECTIONS];
+    int conn_count;
+    lobby_room_t rooms[LOBBY_MAX_ROOMS];
+
+    uint16_t lobby_port;
+    uint16_t spawn_port_first;
+    uint16_t spawn_port_last;
+    const char *spawn_map;
+    const char *server_bin;
+} lobby_t;
+
+static volatile sig_atomic_t lobby_stop_requested = 0;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
+}
+
+static void lobby_on_signal(int sig) {
+    (void)sig;
+    lobby_stop_requested = 1;
+}
+
+static const char *long_option_value(const char *arg, const char *name) {
+    size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0) return NULL;
+    if (arg[name_len] != '=') return NULL;
+    return arg + name_len + 1;
+}
+
+static int create_listen_socket(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int yes = 1;
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Load in permille: the larger of how full the room is and how much of its tick budget it uses.
+static uint32_t room_load(const lobby_room_t *room) {
+    uint32_t capacity = ntohs(room->report.player_capacity_net);
+    uint32_t players = (uint32_t)ntohs(room->report.player_count_net) + room->placed;
+    uint32_t budget = ntohl(room->report.tick_budget_us_net);
+    uint32_t cost = ntohl(room->report.tick_cost_us_net);
+
+    uint32_t fill = capacity > 0 ? players * 1000u / capacity : 1000u;
+    uint32_t cpu = budget > 0 ? (uint32_t)((uint64_t)cost * 1000u / budget) : 0;
+    return fill > cpu ? fill : cpu;
+}
+
+static lobby_room_t *lobby_find_room(lobby_t *lobby, uint32_t host_ipv4_net, uint16_t port, uint16_t room_index) {
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        lobby_room_t *room = &lobby->rooms[i];
+        if (!room->is_used || room->host_ipv4_net != host_ipv4_net) continue;
+        if (ntohs(room->report.port_net) == port && ntohs(room->report.room_net) == room_index) return room;
+    }
+    return NULL;
+}
+
+static lobby_room_t *lobby_alloc_room(lobby_t *lobby) {
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        if (!lobby->rooms[i].is_used) {
+            memset(&lobby->rooms[i], 0, sizeof(lobby->rooms[i]));
+            lobby->rooms[i].is_used = 1;
+            lobby->rooms[i].conn_fd = -1;
+            return &lobby->rooms[i];
+        }
+    }
+    return NULL;
+}
+
+static void lobby_handle_report(lobby_t *lobby, lobby_conn_t *conn, const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len != sizeof(room_report_message_t)) return;
+    room_report_message_t report;
+    memcpy(&report, payload, sizeof(report));
+    report.world_name[ROOM_WORLD_NAME_MAX - 1] = '\0';
+
+    lobby_room_t *room = lobby_find_room(lobby, conn->host_ipv4_net, ntohs(report.port_net), ntohs(report.room_net));
+    if (!room) {
+        room = lobby_alloc_room(lobby);
+        if (!room) return;
+        room->host_ipv4_net = conn->host_ipv4_net;
+        fprintf(stderr, "lobby: room %u on port %u registered\n", (unsigned)ntohs(report.room_net), (unsigned)ntohs(report.port_net));
+    }
+    room->conn_fd = conn->fd;
+    room->report = report;
+    room->placed = 0;
+    room->last_report_ms = monotonic_ms();
+}
+
+static void lobby_send_rooms(lobby_t *lobby, lobby_conn_t *conn) {
+    static uint8_t buf[sizeof(lobby_rooms_message_t) + LOBBY_MAX_ROOMS * sizeof(lobby_room_entry_t)];
+    lobby_rooms_message_t *msg = (lobby_rooms_message_t*)buf;
+    uint16_t count = 0;
+
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        const lobby_room_t *room = &lobby->rooms[i];
+        if (!room->is_used || room->last_report_ms == 0) continue;
+        lobby_room_entry_t *entry = &msg->rooms[count++];
+        entry->host_ipv4_net = room->host_ipv4_net;
+        entry->report = room->report;
+        entry->report.player_count_net = htons((uint16_t)(ntohs(room->report.player_count_net) + room->placed));
+    }
+    msg->room_count_net = htons(count);
+    msg->reserved0 = 0;
+    (void)send_message(conn->fd, MSG_LOBBY_ROOMS, buf, (uint32_t)(sizeof(*msg) + count * sizeof(lobby_room_entry_t)));
+}
+
+static int lobby_port_in_use(const lobby_t *lobby, uint16_t port) {
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        if (lobby->rooms[i].is_used && ntohs(lobby->rooms[i].report.port_net) == port) return 1;
+    }
+    return 0;
+}
+
+static lobby_room_t *lobby_spawn_room(lobby_t *lobby, uint8_t game_mode, uint8_t world_type) {
+    if (lobby->spawn_port_first == 0) return NULL;
+    if (world_type == WORLD_FILE && !lobby->spawn_map) return NULL;
+
+    uint16_t port = 0;
+    for (uint32_t p = lobby->spawn_port_first; p <= lobby->spawn_port_last; p++) {
+        if (!lobby_port_in_use(lobby, (uint16_t)p)) {
+            port = (uint16_t)p;
+            break;
+        }
+    }
+    if (port == 0) return NULL;
+
+    lobby_room_t *room = lobby_alloc_room(lobby);
+    if (!room) return NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        room->is_used = 0;
+        return NULL;
+    }
+    if (pid == 0) {
+        (void)setsid();
+        signal(SIGHUP, SIG_IGN);
+
+        char port_str[16];
+        char mode_str[16];
+        char timed_str[16];
+        char world_str[16];
+        char width_str[16];
+        char height_str[16];
+        char lobby_str[64];
+
+        snprintf(port_str, sizeof(port_str), "%u", (unsigned)port);
+        snprintf(mode_str, sizeof(mode_str), "%u", (unsigned)game_mode);
+        snprintf(timed_str, sizeof(timed_str), "%u", (unsigned)LOBBY_SPAWN_TIMED_S);
+        snprintf(world_str, sizeof(world_str), "%u", (unsigned)world_type);
+        snprintf(width_str, sizeof(width_str), "%u", (unsigned)LOBBY_SPAWN_WIDTH);
+        snprintf(height_str, sizeof(height_str), "%u", (unsigned)LOBBY_SPAWN_HEIGHT);
+        snprintf(lobby_str, sizeof(lobby_str), "--lobby=127.0.0.1:%u", (unsigned)lobby->lobby_port);
+
+        if (world_type == WORLD_FILE) {
+            execl(lobby->server_bin, "server_bin", port_str, mode_str, timed_str, world_str, lobby->spawn_map, lobby_str, (char*)NULL);
+        } else {
+            execl(lobby->server_bin, "server_bin", port_str, mode_str, timed_str, world_str, width_str, height_str, lobby_str, (char*)NULL);
+        }
+        perror("lobby: exec server_bin failed");
+        _exit(127);
+    }
+
+    // Until the server reports, assume an empty room of the default size.
+    room->host_ipv4_net = htonl(INADDR_LOOPBACK);
+    room->last_report_ms = monotonic_ms() + LOBBY_SPAWN_GRACE_MS - LOBBY_ROOM_TIMEOUT_MS;
+    room->report.port_net = htons(port);
+    room->report.room_net = 0;
+    room->report.game_mode = game_mode;
+    room->report.world_type = world_type;
+    room->report.player_capacity_net = htons(LOBBY_SPAWN_CAPACITY);
+    snprintf((char*)room->report.world_name, sizeof(room->report.world_name), "%s",
+             world_type == WORLD_FILE ? lobby->spawn_map : "empty");
+    fprintf(stderr, "lobby: spawned server %d on port %u\n", (int)pid, (unsigned)port);
+    return room;
+}
+
+static void lobby_handle_match(lobby_t *lobby, lobby_conn_t *conn, const uint8_t *payload, uint32_t payload_len) {
+    if (payload_len != sizeof(lobby_match_message_t)) {
+        const char *err = "bad match request";
+        (void)send_message(conn->fd, MSG_ERROR, err, (uint32_t)strlen(err));
+        return;
+    }
+    lobby_match_message_t match;
+    memcpy(&match, payload, sizeof(match));
+
+    lobby_room_t *best = NULL;
+    uint32_t best_load = LOBBY_LOAD_LIMIT;
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        lobby_room_t *room = &lobby->rooms[i];
+        if (!room->is_used || room->report.game_mode != match.game_mode) continue;
+        if (match.world_type != LOBBY_WORLD_ANY && room->report.world_type != match.world_type) continue;
+        uint32_t load = room_load(room);
+        if (load < best_load) {
+            best = room;
+            best_load = load;
+        }
+    }
+
+    if (!best) {
+        uint8_t world_type = match.world_type == LOBBY_WORLD_ANY ? 0 : match.world_type;
+        best = lobby_spawn_room(lobby, match.game_mode, world_type);
+    }
+    if (!best) {
+        const char *err = "no room available";
+        (void)send_message(conn->fd, MSG_ERROR, err, (uint32_t)strlen(err));
+        return;
+    }
+
+    best->placed++;
+    lobby_place_message_t place;
+    place.host_ipv4_net = best->host_ipv4_net;
+    place.port_net = best->report.port_net;
+    place.room_net = best->report.room_net;
+    (void)send_message(conn->fd, MSG_LOBBY_PLACE, &place, (uint32_t)sizeof(place));
+}
+
+static void lobby_close_conn(lobby_t *lobby, int index) {
+    lobby_conn_t *conn = &lobby->conns[index];
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        lobby_room_t *room = &lobby->rooms[i];
+        if (room->is_used && room->conn_fd == conn->fd) {
+            fprintf(stderr, "lobby: room %u on port %u left\n", (unsigned)ntohs(room->report.room_net), (unsigned)ntohs(room->report.port_net));
+            room->is_used = 0;
+        }
+    }
+    close(conn->fd);
+    msg_reader_free(&conn->reader);
+    lobby->conns[index] = lobby->conns[--lobby->conn_count];
+}
+
+static void lobby_accept(lobby_t *lobby) {
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    int fd = accept4(lobby->listen_fd, (struct sockaddr*)&peer, &peer_len, SOCK_CLOEXEC);
+    if (fd < 0) return;
+    if (lobby->conn_count >= LOBBY_MAX_CONNECTIONS) {
+        close(fd);
+        return;
+    }
+    lobby_conn_t *conn = &lobby->conns[lobby->conn_count++];
+    conn->fd = fd;
+    conn->host_ipv4_net = peer.sin_addr.s_addr;
+    msg_reader_init(&conn->reader);
+    conn->reader.max_payload = MSG_INBOUND_PAYLOAD_LEN;
+}
+
+// Returns -1 when the connection should be closed.
+static int lobby_read(lobby_t *lobby, lobby_conn_t *conn) {
+    if (msg_reader_fill(&conn->reader, conn->fd) < 0) return -1;
+
+    uint16_t msg_type = 0;
+    const uint8_t *payload = NULL;
+    uint32_t payload_len = 0;
+    int rc;
+    while ((rc = msg_reader_next(&conn->reader, &msg_type, &payload, &payload_len)) > 0) {
+        if (msg_type == MSG_ROOM_REPORT) {
+            lobby_handle_report(lobby, conn, payload, payload_len);
+        } else if (msg_type == MSG_LOBBY_LIST) {
+            lobby_send_rooms(lobby, conn);
+        } else if (msg_type == MSG_LOBBY_MATCH) {
+            lobby_handle_match(lobby, conn, payload, payload_len);
+        }
+    }
+    if (rc < 0 || conn->reader.eof) return -1;
+    return 0;
+}
+
+static void lobby_expire_rooms(lobby_t *lobby, uint64_t now_ms) {
+    for (int i = 0; i < LOBBY_MAX_ROOMS; i++) {
+        lobby_room_t *room = &lobby->rooms[i];
+        if (!room->is_used || now_ms < room->last_report_ms + LOBBY_ROOM_TIMEOUT_MS) continue;
+        fprintf(stderr, "lobby: room %u on port %u stopped reporting\n", (unsigned)ntohs(room->report.room_net), (unsigned)ntohs(room->report.port_net));
+        room->is_used = 0;
+    }
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+    }
+}
+
+int main(int argc, char **argv) {
+    static lobby_t lobby;
+    lobby.lobby_port = LOBBY_DEFAULT_PORT;
+    lobby.server_bin = "./server_bin";
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = NULL;
+        if (strncmp(argv[i], "--", 2) != 0) {
+            lobby.lobby_port = (uint16_t)atoi(argv[i]);
+        } else if ((value = long_option_value(argv[i], "--spawn-ports")) != NULL) {
+            unsigned first = 0;
+            unsigned last = 0;
+            if (sscanf(value, "%u-%u", &first, &last) != 2 || first == 0 || last < first || last > 65535) {
+                fprintf(stderr, "lobby: bad port range: %s\n", value);
+                return 1;
+            }
+            lobby.spawn_port_first = (uint16_t)first;
+            lobby.spawn_port_last = (uint16_t)last;
+        } else if ((value = long_option_value(argv[i], "--spawn-map")) != NULL) {
+            lobby.spawn_map = value;
+        } else if ((value = long_option_value(argv[i], "--server-bin")) != NULL) {
+            lobby.server_bin = value;
+        } else {
+            fprintf(stderr, "lobby: unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, lobby_on_signal);
+    signal(SIGTERM, lobby_on_signal);
+
+    lobby.listen_fd = create_listen_socket(lobby.lobby_port);
+    if (lobby.listen_fd < 0) {
+        fprintf(stderr, "lobby: listen failed: %s\n", strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "lobby: listening on port %u\n", (unsigned)lobby.lobby_port);
+
+    static struct pollfd fds[LOBBY_MAX_CONNECTIONS + 1];
+    while (!lobby_stop_requested) {
+        fds[0].fd = lobby.listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < lobby.conn_count; i++) {
+            fds[i + 1].fd = lobby.conns[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        int polled = lobby.conn_count;
+        int rc = poll(fds, (nfds_t)polled + 1, LOBBY_POLL_MS);
+        if (rc < 0 && errno != EINTR) break;
+
+        if (rc > 0) {
+            for (int i = polled - 1; i >= 0; i--) {
+                if (fds[i + 1].revents == 0) continue;
+                if (lobby_read(&lobby, &lobby.conns[i]) < 0) lobby_close_conn(&lobby, i);
+            }
+            if (fds[0].revents & POLLIN) lobby_accept(&lobby);
+        }
+
+        lobby_expire_rooms(&lobby, monotonic_ms());
+    }
+
+    for (int i = lobby.conn_count - 1; i >= 0; i--) lobby_close_conn(&lobby, i);
+    close(lobby.listen_fd);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../common/snapring.h"
+#include "../server/game.h"
+
+#define OBSERVER_IDLE_SLEEP_MS 2
+#define OBSERVER_TOP_PLAYERS   3
+
+static game_state_t observed_state;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000L * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+static const char *long_option_value(const char *arg, const char *name) {
+    size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0) return NULL;
+    if (arg[name_len] != '=') return NULL;
+    return arg + name_len + 1;
+}
+
+static void print_summary(const game_state_t *g, const snapring_frame_t *frame, uint64_t now_ms,
+                          uint64_t lost, uint64_t torn) {
+    const game_player_t *top[OBSERVER_TOP_PLAYERS];
+    int top_count = 0;
+    uint32_t joined = 0;
+    uint32_t alive = 0;
+
+    for (uint32_t n = 0; n < g->player_count; n++) {
+        const game_player_t *pl = game_player_at(g, n);
+        if (!pl->has_joined) continue;
+        joined++;
+        if (pl->is_alive) alive++;
+
+        int pos = top_count < OBSERVER_TOP_PLAYERS ? top_count++ : OBSERVER_TOP_PLAYERS;
+        while (pos > 0 && top[pos - 1]->score < pl->score) {
+            if (pos < OBSERVER_TOP_PLAYERS) top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < OBSERVER_TOP_PLAYERS) top[pos] = pl;
+    }
+
+    printf("tick=%u age=%llums players=%u alive=%u food=%u bytes=%u lost=%llu torn=%llu top:",
+           frame->tick, (unsigned long long)(now_ms - frame->time_ms), joined, alive,
+           (unsigned)g->food_count, frame->len, (unsigned long long)lost, (unsigned long long)torn);
+    for (int i = 0; i < top_count; i++) printf(" %s(%u)", top[i]->player_name, (unsigned)top[i]->score);
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *ring_name = NULL;
+    long every = 1;
+    long count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = NULL;
+        if (strncmp(argv[i], "--", 2) != 0) {
+            ring_name = argv[i];
+        } else if ((value = long_option_value(argv[i], "--every")) != NULL) {
+            every = atol(value);
+        } else if ((value = long_option_value(argv[i], "--count")) != NULL) {
+            count = atol(value);
+        } else {
+            fprintf(stderr, "observer: unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!ring_name) {
+        fprintf(stderr, "usage: %s RING_NAME [--every=N] [--count=N]\n", argv[0]);
+        return 1;
+    }
+    if (every < 1) every = 1;
+
+    snapring_t ring;
+    if (snapring_open(&ring, ring_name) != 0) {
+        fprintf(stderr, "observer: cannot open ring %s: %s\n", ring_name, strerror(errno));
+        return 1;
+    }
+
+    size_t buf_cap = ring.header->slot_bytes;
+    uint8_t *buf = (uint8_t*)malloc(buf_cap);
+    if (!buf) {
+        fprintf(stderr, "observer: out of memory\n");
+        snapring_close(&ring);
+        return 1;
+    }
+
+    uint64_t head = snapring_head(&ring);
+    uint64_t next = head > 0 ? head - 1 : 0;
+    uint64_t lost = 0;
+    long shown = 0;
+
+    while (count == 0 || shown < count) {
+        snapring_frame_t frame;
+        int rc = snapring_read(&ring, next, buf, buf_cap, &frame);
+
+        if (rc == SNAPRING_AGAIN) {
+            sleep_ms(OBSERVER_IDLE_SLEEP_MS);
+            continue;
+        }
+        if (rc == SNAPRING_LOST) {
+            head = snapring_head(&ring);
+            uint64_t resume = head > 0 ? head - 1 : 0;
+            if (resume > next) lost += resume - next;
+            next = resume > next ? resume : next + 1;
+            continue;
+        }
+        if (rc != SNAPRING_OK) {
+            fprintf(stderr, "observer: snapshot of %u bytes exceeds slot size\n", frame.len);
+            break;
+        }
+
+        next++;
+        if ((long)(frame.seq % (uint64_t)every) != 0) continue;
+
+        uint64_t now = monotonic_ms();
+        if (game_snapshot_decode(&observed_state, now, buf, frame.len) != 0) {
+            fprintf(stderr, "observer: bad snapshot at tick %u\n", frame.tick);
+            continue;
+        }
+        print_summary(&observed_state, &frame, now, lost, ring.torn_reads);
+        shown++;
+    }
+
+    game_free(&observed_state);
+    free(buf);
+    snapring_close(&ring);
+    return 0;
+}
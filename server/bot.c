@@ -0,0 +1,230 @@
+#include "bot.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BOT_BLOCKING_FLAGS (GAME_CELL_OBSTACLE | GAME_CELL_BODY_MASK)
+
+void bot_manager_init(bot_manager_t *bots, uint32_t cell_budget) {
+    memset(bots, 0, sizeof(*bots));
+    bots->cell_budget = cell_budget > 0 ? cell_budget : BOT_DEFAULT_CELL_BUDGET;
+}
+
+static void field_free(bot_flow_field_t *f) {
+    for (int w = 0; w < 2; w++) {
+        free(f->distance[w]);
+        free(f->stamp[w]);
+        f->distance[w] = NULL;
+        f->stamp[w] = NULL;
+    }
+    free(f->queue);
+    f->queue = NULL;
+}
+
+void bot_manager_free(bot_manager_t *bots) {
+    if (!bots) return;
+    field_free(&bots->field);
+}
+
+int bot_add(bot_manager_t *bots, game_state_t *g, uint64_t now_ms) {
+    if (!bots || !g) return -1;
+    if (bots->bot_count >= BOT_MAX_COUNT) return -1;
+
+    // Skips numbers whose name a player already took, so the scoreboard never shows two bot3s.
+    char bot_name[GAME_MAX_NAME_LEN];
+    int number = bots->bot_count + 1;
+    do {
+        snprintf(bot_name, sizeof(bot_name), "bot%d", number++);
+    } while (game_find_player_by_name(g, bot_name) != GAME_PLAYER_NONE);
+
+    game_player_id_t player_id = game_activate_new_player(g, now_ms);
+    if (player_id == GAME_PLAYER_NONE) return -1;
+    if (game_emit_event(g, GAME_EVENT_JOIN, player_id, 0, bot_name, now_ms) != 0) {
+        game_emit_event(g, GAME_EVENT_DEACTIVATE, player_id, 0, NULL, now_ms);
+        return -1;
+    }
+
+    return bot_adopt(bots, player_id);
+}
+
+// Drives an existing player as a bot, e.g. one a restored match had as a bot.
+int bot_adopt(bot_manager_t *bots, game_player_id_t player_id) {
+    if (bots->bot_count >= BOT_MAX_COUNT || player_id == GAME_PLAYER_NONE) return -1;
+    bots->bot_ids[bots->bot_count] = player_id;
+    bots->respawn_at_ms[bots->bot_count] = 0;
+    bots->bot_count++;
+    bots->bot_at_index[GAME_PLAYER_INDEX(player_id)] = player_id;
+    return 0;
+}
+
+void bot_forget_all(bot_manager_t *bots) {
+    for (int i = 0; i < bots->bot_count; i++) bots->bot_at_index[GAME_PLAYER_INDEX(bots->bot_ids[i])] = GAME_PLAYER_NONE;
+    bots->bot_count = 0;
+}
+
+int bot_is_bot(const bot_manager_t *bots, game_player_id_t player_id) {
+    return player_id != GAME_PLAYER_NONE && bots->bot_at_index[GAME_PLAYER_INDEX(player_id)] == player_id;
+}
+
+static int field_reset_if_resized(bot_flow_field_t *f, const game_state_t *g) {
+    if (f->queue && f->width == g->map_width && f->height == g->map_height) return 0;
+
+    field_free(f);
+    f->width = 0;
+    f->height = 0;
+    f->has_ready_field = 0;
+    f->build_in_progress = 0;
+
+    // Zeroed stamps never match an epoch, which starts at 1, so no build has to clear the field.
+    size_t cells = (size_t)g->map_width * (size_t)g->map_height;
+    for (int w = 0; w < 2; w++) {
+        f->distance[w] = (uint16_t*)malloc(cells * sizeof(uint16_t));
+        f->stamp[w] = (uint32_t*)calloc(cells, sizeof(uint32_t));
+        f->epoch[w] = 0;
+    }
+    f->queue = (uint32_t*)malloc(cells * sizeof(uint32_t));
+    if (!f->distance[0] || !f->distance[1] || !f->stamp[0] || !f->stamp[1] || !f->queue) {
+        field_free(f);
+        return -1;
+    }
+
+    f->width = g->map_width;
+    f->height = g->map_height;
+    return 0;
+}
+
+static uint16_t field_distance(const bot_flow_field_t *f, int which, size_t idx) {
+    return f->stamp[which][idx] == f->epoch[which] ? f->distance[which][idx] : BOT_FIELD_UNREACHED;
+}
+
+static void field_set_distance(bot_flow_field_t *f, int which, size_t idx, uint16_t distance) {
+    f->stamp[which][idx] = f->epoch[which];
+    f->distance[which][idx] = distance;
+}
+
+// Moving to a new epoch forgets the previous build in O(1); only when the counter wraps, once
+// in four billion builds, are the stamps cleared for real.
+static uint32_t field_start_build(bot_flow_field_t *f, const game_state_t *g) {
+    int which = 1 - f->ready_index;
+    if (++f->epoch[which] == 0) {
+        memset(f->stamp[which], 0, (size_t)g->map_width * (size_t)g->map_height * sizeof(uint32_t));
+        f->epoch[which] = 1;
+    }
+
+    f->queue_head = 0;
+    f->queue_tail = 0;
+    uint32_t seeded = 0;
+    for (uint16_t i = 0; i < g->food_count; i++) {
+        game_pos_t p = g->food_positions[i];
+        size_t idx = (size_t)p.y * g->map_width + p.x;
+        seeded++;
+        if (field_distance(f, which, idx) == 0) continue;
+        field_set_distance(f, which, idx, 0);
+        f->queue[f->queue_tail++] = (uint32_t)idx;
+    }
+
+    f->build_in_progress = 1;
+    return seeded;
+}
+
+static void field_continue_build(bot_flow_field_t *f, const game_state_t *g, uint32_t budget) {
+    int which = 1 - f->ready_index;
+    uint32_t expanded = 0;
+
+    while (f->queue_head < f->queue_tail && expanded < budget) {
+        uint32_t idx = f->queue[f->queue_head++];
+        expanded++;
+
+        game_pos_t p;
+        p.x = (uint16_t)(idx % g->map_width);
+        p.y = (uint16_t)(idx / g->map_width);
+        uint16_t distance = f->distance[which][idx];
+        uint16_t next_distance = distance < BOT_FIELD_UNREACHED - 1 ? (uint16_t)(distance + 1) : (uint16_t)(BOT_FIELD_UNREACHED - 1);
+
+        for (int d = 0; d < 4; d++) {
+            game_pos_t n;
+            if (game_next_position(g, p, (direction_t)d, &n) != 0) continue;
+
+            size_t nidx = (size_t)n.y * g->map_width + n.x;
+            if (g->cell_flags[nidx] & BOT_BLOCKING_FLAGS) continue;
+            if (f->stamp[which][nidx] == f->epoch[which]) continue;
+
+            field_set_distance(f, which, nidx, next_distance);
+            f->queue[f->queue_tail++] = (uint32_t)nidx;
+        }
+    }
+
+    if (f->queue_head >= f->queue_tail) {
+        f->ready_index = 1 - f->ready_index;
+        f->has_ready_field = 1;
+        f->build_in_progress = 0;
+    }
+}
+
+static void steer_bot(const bot_flow_field_t *f, game_state_t *g, game_player_t *pl, uint64_t now_ms) {
+    if (!pl->has_joined || !pl->is_alive || pl->is_paused) return;
+    if (pl->snake_len == 0) return;
+
+    game_pos_t head = game_snake_head(g, pl);
+
+    direction_t best_dir = pl->current_direction;
+    uint32_t best_score = UINT32_MAX;
+
+    for (int k = 0; k < 4; k++) {
+        direction_t dir = (direction_t)((pl->current_direction + k) % 4);
+        if (k == 2) continue;
+
+        game_pos_t n;
+        if (game_next_position(g, head, dir, &n) != 0) continue;
+
+        size_t nidx = (size_t)n.y * g->map_width + n.x;
+        if (g->cell_flags[nidx] & BOT_BLOCKING_FLAGS) continue;
+
+        uint32_t score = f->has_ready_field ? field_distance(f, f->ready_index, nidx) : BOT_FIELD_UNREACHED;
+        if (score < best_score) {
+            best_score = score;
+            best_dir = dir;
+        }
+    }
+
+    if (best_dir == pl->requested_direction) return;
+    game_emit_event(g, GAME_EVENT_INPUT, pl->player_id, (uint8_t)best_dir, NULL, now_ms);
+}
+
+void bot_update(bot_manager_t *bots, game_state_t *g, uint64_t now_ms) {
+    if (!bots || !g || bots->bot_count == 0) return;
+
+    bot_flow_field_t *f = &bots->field;
+    if (field_reset_if_resized(f, g) != 0) return;
+
+    // The field is rebuilt from scratch rather than patched on each food change. The budget is
+    // a hard cap on the tick's share, seeding included, so a large board rebuilds over more
+    // ticks while bots steer by the last finished field.
+    uint32_t budget = bots->cell_budget;
+    if (!f->build_in_progress) {
+        uint32_t seeded = field_start_build(f, g);
+        budget = seeded < budget ? budget - seeded : 0;
+    }
+    if (budget > 0) field_continue_build(f, g, budget);
+
+    uint32_t spawned = 0;
+    for (int i = 0; i < bots->bot_count; i++) {
+        game_player_id_t player_id = bots->bot_ids[i];
+        game_player_t *pl = game_player_lookup(g, player_id);
+        if (!pl || !pl->has_joined) continue;
+
+        if (!pl->is_alive) {
+            if (bots->respawn_at_ms[i] == 0) {
+                bots->respawn_at_ms[i] = now_ms + BOT_RESPAWN_DELAY_MS;
+            } else if (now_ms >= bots->respawn_at_ms[i] && (bots->spawn_limit == 0 || spawned < bots->spawn_limit)) {
+                spawned++;
+                if (game_emit_event(g, GAME_EVENT_RESPAWN_QUIET, player_id, 0, NULL, now_ms) == 0) bots->respawn_at_ms[i] = 0;
+                else bots->respawn_at_ms[i] = now_ms + BOT_RESPAWN_DELAY_MS;
+            }
+            continue;
+        }
+
+        steer_bot(f, g, pl, now_ms);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdint.h>
+#include "game.h"
+
+#define BOT_MAX_COUNT          GAME_MAX_PLAYERS
+#define BOT_DEFAULT_CELL_BUDGET 4096
+#define BOT_RESPAWN_DELAY_MS   2000
+#define BOT_FIELD_UNREACHED    0xFFFF
+
+typedef struct {
+    uint16_t *distance[2];
+    uint32_t *stamp[2];     // a distance counts only while its stamp matches the buffer's epoch
+    uint32_t epoch[2];
+    int ready_index;
+    int has_ready_field;
+
+    uint32_t *queue;
+    size_t queue_head;
+    size_t queue_tail;
+    int build_in_progress;
+
+    uint16_t width;
+    uint16_t height;
+} bot_flow_field_t;
+
+typedef struct {
+    int bot_count;
+    game_player_id_t bot_ids[BOT_MAX_COUNT];
+    uint64_t respawn_at_ms[BOT_MAX_COUNT];
+
+    uint32_t cell_budget;   // field cells seeded or expanded per update; large boards rebuild over more ticks
+    uint32_t spawn_limit;   // respawns per update, 0 = unlimited; the rest wait for the next one
+    bot_flow_field_t field;
+    game_player_id_t bot_at_index[GAME_MAX_PLAYERS];   // by player pool index, GAME_PLAYER_NONE if not a bot
+} bot_manager_t;
+
+void bot_manager_init(bot_manager_t *bots, uint32_t cell_budget);
+void bot_manager_free(bot_manager_t *bots);
+
+int  bot_add(bot_manager_t *bots, game_state_t *game_state, uint64_t now_ms);
+int  bot_adopt(bot_manager_t *bots, game_player_id_t player_id);
+void bot_forget_all(bot_manager_t *bots);
+int  bot_is_bot(const bot_manager_t *bots, game_player_id_t player_id);
+
+void bot_update(bot_manager_t *bots, game_state_t *game_state, uint64_t now_ms);
+
+#endif
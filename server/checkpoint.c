@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#define CHECKPOINT_HEADER_WORDS 6
+#define CHECKPOINT_HEADER_LEN   (CHECKPOINT_HEADER_WORDS * sizeof(uint32_t))
+#define CHECKPOINT_MAX_LEN      (256u * 1024u * 1024u)
+
+static uint32_t checkpoint_hash(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    uint32_t v_net = htonl(v);
+    memcpy(out, &v_net, sizeof(v_net));
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    uint32_t v_net;
+    memcpy(&v_net, in, sizeof(v_net));
+    return ntohl(v_net);
+}
+
+void checkpoint_image_free(checkpoint_image_t *image) {
+    free(image->buf);
+    memset(image, 0, sizeof(*image));
+}
+
+static int image_reserve(checkpoint_image_t *image, size_t needed) {
+    if (needed > CHECKPOINT_MAX_LEN) return -1;
+    if (needed <= image->cap) return 0;
+    size_t cap = image->cap ? image->cap : 64 * 1024;
+    while (cap < needed) cap *= 2;
+    uint8_t *buf = (uint8_t*)realloc(image->buf, cap);
+    if (!buf) return -1;
+    image->buf = buf;
+    image->cap = cap;
+    return 0;
+}
+
+int checkpoint_capture(checkpoint_image_t *image, const game_state_t *g, const bot_manager_t *bots, uint64_t now_ms) {
+    size_t snapshot_len = game_snapshot_size(g, now_ms);
+    size_t bots_len = (size_t)bots->bot_count * sizeof(uint32_t);
+    if (image_reserve(image, CHECKPOINT_HEADER_LEN + bots_len + snapshot_len) != 0) return -1;
+
+    uint8_t *body = image->buf + CHECKPOINT_HEADER_LEN;
+    for (int i = 0; i < bots->bot_count; i++) put_u32(body + (size_t)i * sizeof(uint32_t), bots->bot_ids[i]);
+    if (game_snapshot_encode(g, now_ms, body + bots_len, snapshot_len, &snapshot_len) != 0) return -1;
+
+    size_t body_len = bots_len + snapshot_len;
+    put_u32(image->buf + 0, CHECKPOINT_MAGIC);
+    put_u32(image->buf + 4, CHECKPOINT_VERSION);
+    put_u32(image->buf + 8, (uint32_t)body_len);
+    put_u32(image->buf + 12, checkpoint_hash(body, body_len));
+    put_u32(image->buf + 16, g->tick_counter);
+    put_u32(image->buf + 20, (uint32_t)bots->bot_count);
+    image->len = CHECKPOINT_HEADER_LEN + body_len;
+    image->tick = g->tick_counter;
+    return 0;
+}
+
+// Written beside the target and renamed over it, so a crash mid-write keeps the previous image.
+int checkpoint_save(const checkpoint_image_t *image, const char *path) {
+    char tmp_path[512];
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    size_t written = 0;
+    while (written < image->len) {
+        ssize_t n = write(fd, image->buf + written, image->len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int saved = errno;
+            close(fd);
+            unlink(tmp_path);
+            errno = saved;
+            return -1;
+        }
+        written += (size_t)n;
+    }
+
+    if (fdatasync(fd) != 0 || close(fd) != 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    if (rename(tmp_path, path) != 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_load(checkpoint_image_t *image, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if ((size_t)st.st_size < CHECKPOINT_HEADER_LEN || image_reserve(image, (size_t)st.st_size) != 0) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < (size_t)st.st_size) {
+        ssize_t n = read(fd, image->buf + got, (size_t)st.st_size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+
+    if (got != (size_t)st.st_size) {
+        errno = EPROTO;
+        return -1;
+    }
+    image->len = got;
+    return checkpoint_verify(image);
+}
+
+int checkpoint_verify(checkpoint_image_t *image) {
+    if (image->len < CHECKPOINT_HEADER_LEN ||
+        get_u32(image->buf + 0) != CHECKPOINT_MAGIC ||
+        get_u32(image->buf + 4) != CHECKPOINT_VERSION ||
+        (size_t)get_u32(image->buf + 8) != image->len - CHECKPOINT_HEADER_LEN ||
+        get_u32(image->buf + 12) != checkpoint_hash(image->buf + CHECKPOINT_HEADER_LEN, image->len - CHECKPOINT_HEADER_LEN)) {
+        errno = EPROTO;
+        return -1;
+    }
+    image->tick = get_u32(image->buf + 16);
+    return 0;
+}
+
+int checkpoint_restore(const checkpoint_image_t *image, game_state_t *g, bot_manager_t *bots, uint64_t now_ms) {
+    if (image->len < CHECKPOINT_HEADER_LEN) return -1;
+    uint32_t bot_count = get_u32(image->buf + 20);
+    size_t body_len = image->len - CHECKPOINT_HEADER_LEN;
+    if (bot_count > BOT_MAX_COUNT || (size_t)bot_count * sizeof(uint32_t) > body_len) return -1;
+
+    const uint8_t *bot_ids = image->buf + CHECKPOINT_HEADER_LEN;
+    size_t bots_len = (size_t)bot_count * sizeof(uint32_t);
+
+    // Decoded aside so a damaged image leaves the fresh match untouched.
+    game_state_t *restored = (game_state_t*)calloc(1, sizeof(*restored));
+    if (!restored) return -1;
+    restored->event_sink = g->event_sink;
+    restored->event_sink_ctx = g->event_sink_ctx;
+    if (game_snapshot_decode(restored, now_ms, bot_ids + bots_len, body_len - bots_len) != 0) {
+        game_free(restored);
+        free(restored);
+        return -1;
+    }
+    game_free(g);
+    *g = *restored;
+    free(restored);
+
+    bot_forget_all(bots);
+    for (uint32_t i = 0; i < bot_count; i++) {
+        game_player_id_t id = get_u32(bot_ids + (size_t)i * sizeof(uint32_t));
+        if (game_player_lookup(g, id)) (void)bot_adopt(bots, id);
+    }
+
+    // No connection survived the restart: players who had joined wait paused for their owner,
+    // the rest are dropped.
+    uint32_t n = g->player_count;
+    while (n > 0) {
+        game_player_t *pl = game_player_at(g, --n);
+        if (bot_is_bot(bots, pl->player_id)) continue;
+
+        if (pl->has_joined) {
+            game_mark_client_inactive_keep_or_clear(g, pl->player_id, 1);
+            pl->is_paused = 1;
+        } else {
+            game_mark_client_inactive_keep_or_clear(g, pl->player_id, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "game.h"
+#include "bot.h"
+
+#define CHECKPOINT_MAGIC       0x534E4B43u   // "SNKC"
+#define CHECKPOINT_VERSION     1
+#define CHECKPOINT_DEFAULT_MS  1000
+
+// A serialized match: a small header, the bot player ids, then a game snapshot whose
+// timers are stored as offsets from the capture time.
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    uint32_t tick;
+} checkpoint_image_t;
+
+void checkpoint_image_free(checkpoint_image_t *image);
+
+// Capture runs under the state lock; save and load only touch the image and the file.
+int  checkpoint_capture(checkpoint_image_t *image, const game_state_t *game_state, const bot_manager_t *bots, uint64_t now_ms);
+int  checkpoint_save(const checkpoint_image_t *image, const char *path);
+int  checkpoint_load(checkpoint_image_t *image, const char *path);
+int  checkpoint_verify(checkpoint_image_t *image);
+
+// Rebuilds the match; human players come back paused so they can rejoin by name.
+int  checkpoint_restore(const checkpoint_image_t *image, game_state_t *game_state, bot_manager_t *bots, uint64_t now_ms);
+
+#endif
@@ -3,6 +3,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <arpa/inet.h>
+
+#define GAME_SNAPSHOT_VERSION 4
+#define GAME_PLAYER_POOL_INITIAL 64
+#define GAME_SEGMENT_POOL_INITIAL 256
+
+static uint32_t game_rand(game_state_t *g) {
+    uint32_t x = g->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g->rng_state = x;
+    return x;
+}
 
 static int is_opposite_direction(direction_t a, direction_t b) {
     return (a == DIR_UP && b == DIR_DOWN) ||
@@ -37,51 +51,346 @@ static game_pos_t wrap_position(const game_state_t *g, int x, int y) {
     if (ny < 0) ny += h;
 
     game_pos_t p;
-    p.x = (uint8_t)nx;
-    p.y = (uint8_t)ny;
+    p.x = (uint16_t)nx;
+    p.y = (uint16_t)ny;
     return p;
 }
 
-static int cell_is_obstacle(const game_state_t *g, uint8_t x, uint8_t y) {
-    if (x >= g->map_width || y >= g->map_height) return 1;
-    return g->obstacle_map[(size_t)y * g->map_width + x] ? 1 : 0;
+static size_t cell_index(const game_state_t *g, game_pos_t p) {
+    return (size_t)p.y * g->map_width + p.x;
 }
 
-static int is_food_at(const game_state_t *g, game_pos_t p, int *out_food_index) {
-    for (uint8_t i = 0; i < g->food_count; i++) {
-        if (g->food_positions[i].x == p.x && g->food_positions[i].y == p.y) {
-            if (out_food_index) *out_food_index = (int)i;
-            return 1;
-        }
+int game_region_cols(const game_state_t *g) {
+    return (g->map_width + GAME_REGION_SIZE - 1) >> GAME_REGION_SHIFT;
+}
+
+int game_region_rows(const game_state_t *g) {
+    return (g->map_height + GAME_REGION_SIZE - 1) >> GAME_REGION_SHIFT;
+}
+
+static void mark_cell_changed(game_state_t *g, game_pos_t p) {
+    size_t region = (size_t)(p.y >> GAME_REGION_SHIFT) * (size_t)game_region_cols(g) + (p.x >> GAME_REGION_SHIFT);
+    g->region_serial[region] = ++g->change_serial;
+}
+
+static void mark_all_changed(game_state_t *g) {
+    size_t regions = (size_t)game_region_cols(g) * (size_t)game_region_rows(g);
+    g->change_serial++;
+    for (size_t r = 0; r < regions; r++) g->region_serial[r] = g->change_serial;
+}
+
+// Snake bodies live in fixed-size chunks from a shared pool, linked head to
+// tail. Chunks are addressed by index because growing the pool moves it.
+static int grow_segment_pool(game_segment_pool_t *pool) {
+    uint32_t old_capacity = pool->capacity;
+    uint32_t capacity = old_capacity ? old_capacity * 2 : GAME_SEGMENT_POOL_INITIAL;
+    if (capacity <= old_capacity) return -1;
+
+    game_segment_chunk_t *chunks = (game_segment_chunk_t*)realloc(pool->chunks, (size_t)capacity * sizeof(game_segment_chunk_t));
+    if (!chunks) return -1;
+    pool->chunks = chunks;
+
+    for (uint32_t i = capacity; i > old_capacity; i--) {
+        chunks[i - 1].next = pool->free_head;
+        pool->free_head = i - 1;
     }
+    pool->capacity = capacity;
     return 0;
 }
 
-static void remove_food_at(game_state_t *g, int food_index) {
-    if (food_index < 0 || food_index >= (int)g->food_count) return;
-    uint8_t last = (uint8_t)(g->food_count - 1);
-    g->food_positions[food_index] = g->food_positions[last];
-    g->food_count = last;
+static uint32_t segment_chunk_alloc(game_segment_pool_t *pool) {
+    if (pool->used == pool->capacity && grow_segment_pool(pool) != 0) return GAME_SEGMENT_NONE;
+
+    uint32_t chunk = pool->free_head;
+    pool->free_head = pool->chunks[chunk].next;
+    pool->chunks[chunk].prev = GAME_SEGMENT_NONE;
+    pool->chunks[chunk].next = GAME_SEGMENT_NONE;
+    pool->used++;
+    return chunk;
 }
 
-static int is_occupied_except_tail(const game_state_t *g, int player_slot, game_pos_t p, int will_grow) {
-    for (int s = 0; s < GAME_MAX_PLAYERS; s++) {
-        const game_player_t *pl = &g->players[s];
-        if (!pl->has_joined) continue;
-        if (!pl->is_alive) continue;
+static void segment_chunk_free(game_segment_pool_t *pool, uint32_t chunk) {
+    pool->chunks[chunk].next = pool->free_head;
+    pool->free_head = chunk;
+    pool->used--;
+}
+
+static int snake_push_front(game_state_t *g, game_player_t *pl, game_pos_t p) {
+    game_segment_pool_t *pool = &g->segments;
+    if (pl->snake_len == 0 || pl->snake_head_offset == 0) {
+        uint32_t chunk = segment_chunk_alloc(pool);
+        if (chunk == GAME_SEGMENT_NONE) return -1;
+        if (pl->snake_len == 0) {
+            pl->snake_tail_chunk = chunk;
+            pl->snake_tail_offset = GAME_SEGMENT_CHUNK_LEN - 1;
+        } else {
+            pool->chunks[chunk].next = pl->snake_head_chunk;
+            pool->chunks[pl->snake_head_chunk].prev = chunk;
+        }
+        pl->snake_head_chunk = chunk;
+        pl->snake_head_offset = GAME_SEGMENT_CHUNK_LEN - 1;
+    } else {
+        pl->snake_head_offset--;
+    }
+    pool->chunks[pl->snake_head_chunk].cells[pl->snake_head_offset] = p;
+    pl->snake_len++;
+    return 0;
+}
 
-        for (uint16_t i = 0; i < pl->snake_len; i++) {
-            if (s == player_slot && !will_grow && i == (uint16_t)(pl->snake_len - 1)) continue;
-            if (pl->snake_body[i].x == p.x && pl->snake_body[i].y == p.y) return 1;
+static int snake_push_back(game_state_t *g, game_player_t *pl, game_pos_t p) {
+    game_segment_pool_t *pool = &g->segments;
+    if (pl->snake_len == 0 || pl->snake_tail_offset == GAME_SEGMENT_CHUNK_LEN - 1) {
+        uint32_t chunk = segment_chunk_alloc(pool);
+        if (chunk == GAME_SEGMENT_NONE) return -1;
+        if (pl->snake_len == 0) {
+            pl->snake_head_chunk = chunk;
+            pl->snake_head_offset = 0;
+        } else {
+            pool->chunks[chunk].prev = pl->snake_tail_chunk;
+            pool->chunks[pl->snake_tail_chunk].next = chunk;
         }
+        pl->snake_tail_chunk = chunk;
+        pl->snake_tail_offset = 0;
+    } else {
+        pl->snake_tail_offset++;
+    }
+    pool->chunks[pl->snake_tail_chunk].cells[pl->snake_tail_offset] = p;
+    pl->snake_len++;
+    return 0;
+}
+
+static void snake_pop_back(game_state_t *g, game_player_t *pl) {
+    game_segment_pool_t *pool = &g->segments;
+    if (pl->snake_len == 0) return;
+
+    pl->snake_len--;
+    if (pl->snake_len == 0) {
+        segment_chunk_free(pool, pl->snake_tail_chunk);
+    } else if (pl->snake_tail_offset == 0) {
+        uint32_t chunk = pl->snake_tail_chunk;
+        pl->snake_tail_chunk = pool->chunks[chunk].prev;
+        pl->snake_tail_offset = GAME_SEGMENT_CHUNK_LEN - 1;
+        pool->chunks[pl->snake_tail_chunk].next = GAME_SEGMENT_NONE;
+        segment_chunk_free(pool, chunk);
+    } else {
+        pl->snake_tail_offset--;
+    }
+}
+
+static void snake_clear(game_state_t *g, game_player_t *pl) {
+    if (pl->snake_len == 0) return;
+    uint32_t chunk = pl->snake_head_chunk;
+    for (;;) {
+        uint32_t next = g->segments.chunks[chunk].next;
+        segment_chunk_free(&g->segments, chunk);
+        if (chunk == pl->snake_tail_chunk) break;
+        chunk = next;
+    }
+    pl->snake_len = 0;
+}
+
+static game_pos_t snake_tail(const game_state_t *g, const game_player_t *pl) {
+    return g->segments.chunks[pl->snake_tail_chunk].cells[pl->snake_tail_offset];
+}
+
+game_pos_t game_snake_head(const game_state_t *g, const game_player_t *pl) {
+    return g->segments.chunks[pl->snake_head_chunk].cells[pl->snake_head_offset];
+}
+
+void game_snake_iter_begin(const game_state_t *g, const game_player_t *pl, game_snake_iter_t *it) {
+    (void)g;
+    it->chunk = pl->snake_head_chunk;
+    it->offset = pl->snake_head_offset;
+    it->remaining = pl->snake_len;
+}
+
+int game_snake_iter_next(const game_state_t *g, game_snake_iter_t *it, game_pos_t *out_pos) {
+    if (it->remaining == 0) return 0;
+
+    const game_segment_chunk_t *chunk = &g->segments.chunks[it->chunk];
+    *out_pos = chunk->cells[it->offset];
+    it->remaining--;
+    if (++it->offset == GAME_SEGMENT_CHUNK_LEN) {
+        it->offset = 0;
+        it->chunk = chunk->next;
     }
+    return 1;
+}
+
+static void mark_snake_changed(game_state_t *g, const game_player_t *pl) {
+    game_snake_iter_t it;
+    game_pos_t p;
+    game_snake_iter_begin(g, pl, &it);
+    while (game_snake_iter_next(g, &it, &p)) mark_cell_changed(g, p);
+}
+
+static int grow_player_pool(game_state_t *g, uint32_t min_capacity) {
+    if (min_capacity <= g->player_capacity) return 0;
+    if (min_capacity > GAME_MAX_PLAYERS) return -1;
+
+    uint32_t old_capacity = g->player_capacity;
+    uint32_t capacity = old_capacity ? old_capacity : GAME_PLAYER_POOL_INITIAL;
+    while (capacity < min_capacity) capacity *= 2;
+    if (capacity > GAME_MAX_PLAYERS) capacity = GAME_MAX_PLAYERS;
+
+    game_player_t *players = (game_player_t*)realloc(g->players, capacity * sizeof(game_player_t));
+    if (!players) return -1;
+    g->players = players;
+
+    uint16_t *free_players = (uint16_t*)realloc(g->free_players, capacity * sizeof(uint16_t));
+    if (!free_players) return -1;
+    g->free_players = free_players;
+
+    uint16_t *player_list = (uint16_t*)realloc(g->player_list, capacity * sizeof(uint16_t));
+    if (!player_list) return -1;
+    g->player_list = player_list;
+
+    memset(g->players + old_capacity, 0, (capacity - old_capacity) * sizeof(game_player_t));
+    for (uint32_t i = capacity; i > old_capacity; i--) {
+        g->free_players[g->free_player_count++] = (uint16_t)(i - 1);
+    }
+    g->player_capacity = capacity;
     return 0;
 }
 
+game_player_t *game_player_lookup(const game_state_t *g, game_player_id_t player_id) {
+    if (!g || player_id == GAME_PLAYER_NONE) return NULL;
+    uint16_t idx = GAME_PLAYER_INDEX(player_id);
+    if (idx >= g->player_capacity) return NULL;
+    game_player_t *pl = &g->players[idx];
+    return pl->player_id == player_id ? pl : NULL;
+}
+
+game_player_t *game_player_at(const game_state_t *g, uint32_t list_position) {
+    return &g->players[g->player_list[list_position]];
+}
+
+game_player_id_t game_next_player_id(const game_state_t *g) {
+    uint16_t idx;
+    uint16_t generation;
+    if (g->free_player_count > 0) {
+        idx = g->free_players[g->free_player_count - 1];
+        generation = g->players[idx].generation;
+    } else if (g->player_capacity < GAME_MAX_PLAYERS) {
+        idx = (uint16_t)g->player_capacity;
+        generation = 0;
+    } else {
+        return GAME_PLAYER_NONE;
+    }
+
+    generation++;
+    if (generation == 0) generation = 1;
+    return GAME_PLAYER_MAKE_ID(generation, idx);
+}
+
+static game_player_t *claim_player(game_state_t *g, game_player_id_t player_id) {
+    uint16_t idx = GAME_PLAYER_INDEX(player_id);
+    if (player_id == GAME_PLAYER_NONE || GAME_PLAYER_GENERATION(player_id) == 0) return NULL;
+    if (idx >= GAME_MAX_PLAYERS) return NULL;
+    if (grow_player_pool(g, (uint32_t)idx + 1) != 0) return NULL;
+
+    game_player_t *pl = &g->players[idx];
+    if (pl->player_id != GAME_PLAYER_NONE) return NULL;
+
+    for (uint32_t i = g->free_player_count; i > 0; i--) {
+        if (g->free_players[i - 1] != idx) continue;
+        g->free_players[i - 1] = g->free_players[--g->free_player_count];
+        break;
+    }
+
+    memset(pl, 0, sizeof(*pl));
+    pl->player_id = player_id;
+    pl->generation = GAME_PLAYER_GENERATION(player_id);
+    pl->current_direction = DIR_RIGHT;
+    pl->requested_direction = DIR_RIGHT;
+    pl->list_index = g->player_count;
+    g->player_list[g->player_count++] = idx;
+    g->roster_serial++;
+    return pl;
+}
+
+static void release_player(game_state_t *g, game_player_t *pl) {
+    uint16_t idx = GAME_PLAYER_INDEX(pl->player_id);
+    uint16_t generation = pl->generation;
+
+    uint16_t last = g->player_list[--g->player_count];
+    g->player_list[pl->list_index] = last;
+    g->players[last].list_index = pl->list_index;
+
+    snake_clear(g, pl);
+    memset(pl, 0, sizeof(*pl));
+    pl->generation = generation;
+    g->free_players[g->free_player_count++] = idx;
+    g->roster_serial++;
+}
+
+static int cell_is_obstacle(const game_state_t *g, uint16_t x, uint16_t y) {
+    if (x >= g->map_width || y >= g->map_height) return 1;
+    return (g->cell_flags[(size_t)y * g->map_width + x] & GAME_CELL_OBSTACLE) ? 1 : 0;
+}
+
+static void occupy_snake(game_state_t *g, const game_player_t *pl) {
+    game_snake_iter_t it;
+    game_pos_t p;
+    game_snake_iter_begin(g, pl, &it);
+    while (game_snake_iter_next(g, &it, &p)) {
+        g->cell_flags[cell_index(g, p)]++;
+        mark_cell_changed(g, p);
+    }
+}
+
+static void release_cell(game_state_t *g, game_pos_t p) {
+    uint8_t *cell = &g->cell_flags[cell_index(g, p)];
+    if (*cell & GAME_CELL_BODY_MASK) (*cell)--;
+    mark_cell_changed(g, p);
+}
+
+static void release_snake(game_state_t *g, const game_player_t *pl) {
+    game_snake_iter_t it;
+    game_pos_t p;
+    game_snake_iter_begin(g, pl, &it);
+    while (game_snake_iter_next(g, &it, &p)) release_cell(g, p);
+}
+
+static int is_food_at(const game_state_t *g, game_pos_t p) {
+    if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return 0;
+    return (g->cell_flags[cell_index(g, p)] & GAME_CELL_FOOD) ? 1 : 0;
+}
+
+static void add_food(game_state_t *g, game_pos_t p) {
+    g->food_positions[g->food_count++] = p;
+    g->cell_flags[cell_index(g, p)] |= GAME_CELL_FOOD;
+    mark_cell_changed(g, p);
+}
+
+static void remove_food_at(game_state_t *g, game_pos_t p) {
+    for (uint16_t i = 0; i < g->food_count; i++) {
+        if (g->food_positions[i].x != p.x || g->food_positions[i].y != p.y) continue;
+        g->food_positions[i] = g->food_positions[g->food_count - 1];
+        g->food_count--;
+        break;
+    }
+    g->cell_flags[cell_index(g, p)] &= (uint8_t)~GAME_CELL_FOOD;
+    mark_cell_changed(g, p);
+}
+
+static int is_occupied_except_tail(const game_state_t *g, const game_player_t *mover, game_pos_t p, int will_grow) {
+    if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return 0;
+
+    int bodies = g->cell_flags[cell_index(g, p)] & GAME_CELL_BODY_MASK;
+    if (bodies == 0) return 0;
+
+    if (mover && !will_grow && mover->snake_len > 0) {
+        game_pos_t tail = snake_tail(g, mover);
+        if (tail.x == p.x && tail.y == p.y) bodies--;
+    }
+    return bodies > 0;
+}
+
 static int count_alive_snakes(const game_state_t *g) {
     int count = 0;
-    for (int s = 0; s < GAME_MAX_PLAYERS; s++) {
-        const game_player_t *pl = &g->players[s];
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
         if (pl->has_joined && pl->is_alive) count++;
     }
     return count;
@@ -91,19 +400,19 @@ static int cell_is_free_for_spawn(const game_state_t *g, game_pos_t p) {
     if (g->world_type == WORLD_FILE) {
         if (cell_is_obstacle(g, p.x, p.y)) return 0;
     }
-    if (is_occupied_except_tail(g, -1, p, 1)) return 0;
-    if (is_food_at(g, p, NULL)) return 0;
+    if (is_occupied_except_tail(g, NULL, p, 1)) return 0;
+    if (is_food_at(g, p)) return 0;
     return 1;
 }
 
-static int find_free_cell(const game_state_t *g, game_pos_t *out_pos) {
+static int find_free_cell(game_state_t *g, game_pos_t *out_pos) {
     int w = (int)g->map_width;
     int h = (int)g->map_height;
 
     for (int attempts = 0; attempts < 40000; attempts++) {
         game_pos_t p;
-        p.x = (uint8_t)(rand() % w);
-        p.y = (uint8_t)(rand() % h);
+        p.x = (uint16_t)(game_rand(g) % (uint32_t)w);
+        p.y = (uint16_t)(game_rand(g) % (uint32_t)h);
         if (!cell_is_free_for_spawn(g, p)) continue;
         *out_pos = p;
         return 0;
@@ -116,23 +425,25 @@ static void ensure_food_count(game_state_t *g) {
     if (alive < 0) alive = 0;
     if (alive > GAME_MAX_PLAYERS) alive = GAME_MAX_PLAYERS;
 
-    while (g->food_count < (uint8_t)alive) {
+    while (g->food_count < (uint16_t)alive) {
         game_pos_t p;
         if (find_free_cell(g, &p) != 0) break;
-        g->food_positions[g->food_count++] = p;
+        add_food(g, p);
     }
 
-    while (g->food_count > (uint8_t)alive) {
+    while (g->food_count > (uint16_t)alive) {
         g->food_count--;
+        g->cell_flags[cell_index(g, g->food_positions[g->food_count])] &= (uint8_t)~GAME_CELL_FOOD;
+        mark_cell_changed(g, g->food_positions[g->food_count]);
     }
 }
 
-static void strip_line_endings(char *line) {
-    size_t len = strlen(line);
+static size_t strip_line_endings(char *line, size_t len) {
     while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
         line[len - 1] = '\0';
         len--;
     }
+    return len;
 }
 
 static int map_char_is_obstacle(char c) {
@@ -140,63 +451,99 @@ static int map_char_is_obstacle(char c) {
     return 1;
 }
 
-int game_load_map_from_file(game_state_t *g, const char *path) {
-    if (!g || !path || path[0] == '\0') return -1;
-    if (g->map_width == 0 || g->map_height == 0) return -1;
-    if (g->map_width > STATE_MAX_WIDTH || g->map_height > STATE_MAX_HEIGHT) return -1;
+int game_map_load(game_map_t *map, const char *path) {
+    if (!map || !path || path[0] == '\0') return -1;
 
     FILE *f = fopen(path, "r");
     if (!f) return -1;
 
-    memset(g->obstacle_map, 0, sizeof(g->obstacle_map));
-
-    char line[1024];
-    for (uint8_t y = 0; y < g->map_height; y++) {
-        if (!fgets(line, sizeof(line), f)) {
-            fclose(f);
-            return -1;
+    memset(map, 0, sizeof(*map));
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    size_t width = 0;
+    size_t height = 0;
+    size_t grid_cap = 0;
+    size_t free_cells = 0;
+    int rc = 0;
+
+    while ((line_len = getline(&line, &line_cap, f)) >= 0) {
+        size_t len = strip_line_endings(line, (size_t)line_len);
+        if (len == 0) continue;
+
+        if (width == 0) width = len;
+        if (len != width || width > GAME_MAX_WIDTH || height >= GAME_MAX_HEIGHT) {
+            rc = -1;
+            break;
         }
 
-        strip_line_endings(line);
-
-        size_t len = strlen(line);
-        if (len < g->map_width) {
-            fclose(f);
-            return -1;
+        if ((height + 1) * width > grid_cap) {
+            size_t cap = grid_cap ? grid_cap * 2 : width * 64;
+            uint8_t *grown = (uint8_t*)realloc(map->cell_flags, cap);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            map->cell_flags = grown;
+            grid_cap = cap;
         }
 
-        for (uint8_t x = 0; x < g->map_width; x++) {
-            char c = line[x];
-            g->obstacle_map[(size_t)y * g->map_width + x] = map_char_is_obstacle(c) ? 1 : 0;
+        uint8_t *row = map->cell_flags + height * width;
+        for (size_t x = 0; x < width; x++) {
+            int is_obstacle = map_char_is_obstacle(line[x]);
+            row[x] = is_obstacle ? GAME_CELL_OBSTACLE : 0;
+            if (!is_obstacle) free_cells++;
         }
+        height++;
     }
 
+    free(line);
     fclose(f);
+
+    if (rc == 0 && (width < 5 || height < 5)) rc = -1;
+    if (rc == 0 && free_cells < 3) rc = -1;
+    if (rc != 0) {
+        game_map_free(map);
+        return -1;
+    }
+
+    map->map_width = (uint16_t)width;
+    map->map_height = (uint16_t)height;
     return 0;
 }
 
-void game_init(game_state_t *g,
-               uint8_t map_width,
-               uint8_t map_height,
-               game_mode_t mode,
-               uint32_t timed_duration_ms,
-               world_type_t world_type) {
+void game_map_free(game_map_t *map) {
+    if (!map) return;
+    free(map->cell_flags);
+    memset(map, 0, sizeof(*map));
+}
+
+int game_init(game_state_t *g,
+              uint16_t map_width,
+              uint16_t map_height,
+              game_mode_t mode,
+              uint32_t timed_duration_ms,
+              world_type_t world_type) {
     memset(g, 0, sizeof(*g));
 
     if (map_width < 5) map_width = 5;
     if (map_height < 5) map_height = 5;
-    if (map_width > STATE_MAX_WIDTH) map_width = STATE_MAX_WIDTH;
-    if (map_height > STATE_MAX_HEIGHT) map_height = STATE_MAX_HEIGHT;
+    if (map_width > GAME_MAX_WIDTH) map_width = GAME_MAX_WIDTH;
+    if (map_height > GAME_MAX_HEIGHT) map_height = GAME_MAX_HEIGHT;
 
     g->map_width = map_width;
     g->map_height = map_height;
 
     g->world_type = world_type;
-    memset(g->obstacle_map, 0, sizeof(g->obstacle_map));
+    g->cell_flags = (uint8_t*)calloc((size_t)map_width * map_height, 1);
+    if (!g->cell_flags) return -1;
+    mark_all_changed(g);
 
     g->food_count = 0;
 
     g->game_mode = mode;
+    g->max_snake_len = GAME_DEFAULT_SNAKE_LEN;
     g->start_time_ms = 0;
     g->timed_end_ms = 0;
     g->last_no_snakes_ms = 0;
@@ -206,63 +553,75 @@ void game_init(game_state_t *g,
     g->global_pause_active = 0;
     g->global_pause_owner_name[0] = '\0';
 
-    for (int i = 0; i < GAME_MAX_PLAYERS; i++) {
-        game_player_t *pl = &g->players[i];
-        pl->is_active = 0;
-        pl->has_joined = 0;
-        pl->is_alive = 0;
-        pl->is_paused = 0;
-        pl->score = 0;
-        pl->snake_len = 0;
-        pl->current_direction = DIR_RIGHT;
-        pl->requested_direction = DIR_RIGHT;
-        pl->player_name[0] = '\0';
-        pl->freeze_until_ms = 0;
-        pl->snake_alive_start_ms = 0;
-        pl->snake_time_ms = 0;
-    }
-
     unsigned seed = (unsigned)timed_duration_ms;
     seed ^= (unsigned)(uintptr_t)g;
     seed ^= (unsigned)map_width << 8;
     seed ^= (unsigned)map_height << 16;
-    srand(seed);
+    g->rng_state = seed != 0 ? (uint32_t)seed : 0x9E3779B9u;
+    return 0;
 }
 
-void game_mark_client_active(game_state_t *g, int player_slot) {
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return;
-    g->players[player_slot].is_active = 1;
+void game_free(game_state_t *g) {
+    if (!g) return;
+    free(g->cell_flags);
+    free(g->players);
+    free(g->free_players);
+    free(g->player_list);
+    free(g->segments.chunks);
+    memset(&g->segments, 0, sizeof(g->segments));
+    g->cell_flags = NULL;
+    g->players = NULL;
+    g->free_players = NULL;
+    g->player_list = NULL;
+    g->player_capacity = 0;
+    g->free_player_count = 0;
+    g->player_count = 0;
 }
 
-void game_mark_client_inactive_keep_or_clear(game_state_t *g, int player_slot, int keep_player_state) {
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return;
+int game_mark_client_active(game_state_t *g, game_player_id_t player_id) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl) pl = claim_player(g, player_id);
+    if (!pl) return -1;
+    pl->is_active = 1;
+    return 0;
+}
 
-    game_player_t *pl = &g->players[player_slot];
+game_player_id_t game_activate_new_player(game_state_t *g, uint64_t now_ms) {
+    game_player_id_t player_id = game_next_player_id(g);
+    if (player_id == GAME_PLAYER_NONE) return GAME_PLAYER_NONE;
+    if (game_emit_event(g, GAME_EVENT_ACTIVATE, player_id, 0, NULL, now_ms) != 0) return GAME_PLAYER_NONE;
+    return player_id;
+}
+
+void game_mark_client_inactive_keep_or_clear(game_state_t *g, game_player_id_t player_id, int keep_player_state) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl) return;
     pl->is_active = 0;
 
     if (keep_player_state) return;
 
-    pl->has_joined = 0;
-    pl->is_alive = 0;
-    pl->is_paused = 0;
-    pl->snake_len = 0;
-    pl->score = 0;
-    pl->player_name[0] = '\0';
-    pl->current_direction = DIR_RIGHT;
-    pl->requested_direction = DIR_RIGHT;
-    pl->freeze_until_ms = 0;
-    pl->snake_alive_start_ms = 0;
-    pl->snake_time_ms = 0;
+    if (pl->has_joined && pl->is_alive) release_snake(g, pl);
+    else mark_snake_changed(g, pl);
+    release_player(g, pl);
 }
 
-int game_find_paused_player_by_name(const game_state_t *g, const char *player_name) {
-    for (int i = 0; i < GAME_MAX_PLAYERS; i++) {
-        const game_player_t *pl = &g->players[i];
+game_player_id_t game_find_paused_player_by_name(const game_state_t *g, const char *player_name) {
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
         if (!pl->has_joined) continue;
         if (!pl->is_paused) continue;
-        if (strncmp(pl->player_name, player_name, GAME_MAX_NAME_LEN) == 0) return i;
+        if (strncmp(pl->player_name, player_name, GAME_MAX_NAME_LEN) == 0) return pl->player_id;
     }
-    return -1;
+    return GAME_PLAYER_NONE;
+}
+
+game_player_id_t game_find_player_by_name(const game_state_t *g, const char *player_name) {
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+        if (!pl->has_joined) continue;
+        if (strncmp(pl->player_name, player_name, GAME_MAX_NAME_LEN) == 0) return pl->player_id;
+    }
+    return GAME_PLAYER_NONE;
 }
 
 static game_pos_t step_in_world(const game_state_t *g, game_pos_t from, direction_t dir) {
@@ -276,16 +635,16 @@ static game_pos_t step_in_world(const game_state_t *g, game_pos_t from, directio
     }
 
     game_pos_t p;
-    p.x = (uint8_t)nx;
-    p.y = (uint8_t)ny;
+    p.x = (uint16_t)nx;
+    p.y = (uint16_t)ny;
     return p;
 }
 
 static int cell_is_safe_for_spawn_path(const game_state_t *g, game_pos_t p) {
     if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return 0;
     if (g->world_type == WORLD_FILE && cell_is_obstacle(g, p.x, p.y)) return 0;
-    if (is_occupied_except_tail(g, -1, p, 1)) return 0;
-    if (is_food_at(g, p, NULL)) return 0;
+    if (is_occupied_except_tail(g, NULL, p, 1)) return 0;
+    if (is_food_at(g, p)) return 0;
     return 1;
 }
 
@@ -301,14 +660,14 @@ static int spawn_is_safe(const game_state_t *g, game_pos_t head, direction_t sta
     return 1;
 }
 
-static int pick_safe_spawn(const game_state_t *g, game_pos_t *out_head, direction_t *out_dir) {
+static int pick_safe_spawn(game_state_t *g, game_pos_t *out_head, direction_t *out_dir) {
     static const direction_t dirs[4] = { DIR_UP, DIR_RIGHT, DIR_DOWN, DIR_LEFT };
 
     for (int attempts = 0; attempts < 80000; attempts++) {
         game_pos_t head;
         if (find_free_cell(g, &head) != 0) return -1;
 
-        int d0 = rand() % 4;
+        int d0 = (int)(game_rand(g) % 4);
         for (int k = 0; k < 4; k++) {
             direction_t dir = dirs[(d0 + k) % 4];
             if (spawn_is_safe(g, head, dir)) {
@@ -321,6 +680,22 @@ static int pick_safe_spawn(const game_state_t *g, game_pos_t *out_head, directio
     return -1;
 }
 
+static int place_spawn_snake(game_state_t *g, game_player_t *pl, game_pos_t head, direction_t start_dir) {
+    direction_t back_dir = (direction_t)((start_dir + 2) % 4);
+    game_pos_t seg1 = step_in_world(g, head, back_dir);
+    game_pos_t seg2 = step_in_world(g, seg1, back_dir);
+
+    snake_clear(g, pl);
+    if (snake_push_front(g, pl, seg2) != 0 ||
+        snake_push_front(g, pl, seg1) != 0 ||
+        snake_push_front(g, pl, head) != 0) {
+        snake_clear(g, pl);
+        return -1;
+    }
+    occupy_snake(g, pl);
+    return 0;
+}
+
 static void start_snake_life(game_player_t *pl, uint64_t now_ms) {
     pl->snake_alive_start_ms = now_ms;
 }
@@ -332,23 +707,25 @@ static void end_snake_life(game_player_t *pl, uint64_t now_ms) {
     pl->snake_alive_start_ms = 0;
 }
 
-int game_join_new_player(game_state_t *g, int player_slot, const char *player_name, uint64_t now_ms) {
+int game_join_new_player(game_state_t *g, game_player_id_t player_id, const char *player_name, uint64_t now_ms) {
     if (!g || !player_name) return -1;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return -1;
 
-    if (g->start_time_ms == 0) g->start_time_ms = now_ms;
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl || !pl->is_active) return -1;
 
-    game_player_t *pl = &g->players[player_slot];
-    if (!pl->is_active) return -1;
+    if (g->start_time_ms == 0) g->start_time_ms = now_ms;
 
+    if (pl->has_joined && pl->is_alive) release_snake(g, pl);
+    else mark_snake_changed(g, pl);
     strncpy(pl->player_name, player_name, GAME_MAX_NAME_LEN - 1);
     pl->player_name[GAME_MAX_NAME_LEN - 1] = '\0';
+    g->roster_serial++;
 
     pl->has_joined = 1;
     pl->is_alive = 1;
     pl->is_paused = 0;
     pl->score = 0;
-    pl->snake_len = 0;
+    snake_clear(g, pl);
     pl->freeze_until_ms = 0;
     pl->snake_time_ms = 0;
 
@@ -359,15 +736,7 @@ int game_join_new_player(game_state_t *g, int player_slot, const char *player_na
     pl->current_direction = start_dir;
     pl->requested_direction = start_dir;
 
-    pl->snake_len = 3;
-
-    direction_t back_dir = (direction_t)((start_dir + 2) % 4);
-    game_pos_t seg1 = step_in_world(g, head, back_dir);
-    game_pos_t seg2 = step_in_world(g, seg1, back_dir);
-
-    pl->snake_body[0] = head;
-    pl->snake_body[1] = seg1;
-    pl->snake_body[2] = seg2;
+    if (place_spawn_snake(g, pl, head, start_dir) != 0) return -1;
 
     start_snake_life(pl, now_ms);
 
@@ -377,23 +746,26 @@ int game_join_new_player(game_state_t *g, int player_slot, const char *player_na
     return 0;
 }
 
-int game_resume_player(game_state_t *g, int player_slot, uint64_t now_ms) {
-    (void)now_ms;
-    if (!g) return -1;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return -1;
-    game_player_t *pl = &g->players[player_slot];
-    if (!pl->has_joined) return -1;
+int game_resume_player(game_state_t *g, game_player_id_t player_id, uint64_t now_ms) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl || !pl->has_joined) return -1;
 
     pl->is_paused = 0;
+
+    if (g->global_pause_active &&
+        strncmp(g->global_pause_owner_name, pl->player_name, GAME_MAX_NAME_LEN) == 0) {
+        g->global_pause_active = 0;
+        g->global_pause_owner_name[0] = '\0';
+    }
+    g->global_freeze_until_ms = now_ms + 3000ULL;
+
     ensure_food_count(g);
     return 0;
 }
 
-int game_respawn_player(game_state_t *g, int player_slot, uint64_t now_ms) {
-    if (!g) return -1;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return -1;
-
-    game_player_t *pl = &g->players[player_slot];
+static int respawn_player(game_state_t *g, game_player_id_t player_id, uint64_t now_ms, int freeze_world) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl) return -1;
     if (!pl->has_joined) return -1;
     if (!pl->is_active) return -1;
     if (pl->is_alive) return -1;
@@ -403,33 +775,77 @@ int game_respawn_player(game_state_t *g, int player_slot, uint64_t now_ms) {
     direction_t start_dir;
     if (pick_safe_spawn(g, &head, &start_dir) != 0) return -1;
 
+    mark_snake_changed(g, pl);
+    if (place_spawn_snake(g, pl, head, start_dir) != 0) return -1;
+
     pl->is_alive = 1;
     pl->freeze_until_ms = now_ms + 1000ULL;
     pl->current_direction = start_dir;
     pl->requested_direction = start_dir;
 
-    pl->snake_len = 3;
-    direction_t back_dir = (direction_t)((start_dir + 2) % 4);
-    game_pos_t seg1 = step_in_world(g, head, back_dir);
-    game_pos_t seg2 = step_in_world(g, seg1, back_dir);
-
-    pl->snake_body[0] = head;
-    pl->snake_body[1] = seg1;
-    pl->snake_body[2] = seg2;
-
     start_snake_life(pl, now_ms);
 
-    g->global_freeze_until_ms = now_ms + 3000ULL;
+    if (freeze_world) g->global_freeze_until_ms = now_ms + 3000ULL;
 
     ensure_food_count(g);
     return 0;
 }
 
-void game_handle_input(game_state_t *g, int player_slot, direction_t direction) {
-    if (!g) return;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return;
+int game_respawn_player(game_state_t *g, game_player_id_t player_id, uint64_t now_ms) {
+    return respawn_player(g, player_id, now_ms, 1);
+}
 
-    game_player_t *pl = &g->players[player_slot];
+int game_respawn_player_without_freeze(game_state_t *g, game_player_id_t player_id, uint64_t now_ms) {
+    return respawn_player(g, player_id, now_ms, 0);
+}
+
+void game_apply_map(game_state_t *g, game_map_t *map, uint64_t now_ms) {
+    if (!g || !map || !map->cell_flags) return;
+
+    uint8_t *old_cells = g->cell_flags;
+    uint16_t old_width = g->map_width;
+    uint16_t old_height = g->map_height;
+
+    g->map_width = map->map_width;
+    g->map_height = map->map_height;
+    g->world_type = WORLD_FILE;
+    g->cell_flags = map->cell_flags;
+
+    map->cell_flags = old_cells;
+    map->map_width = old_width;
+    map->map_height = old_height;
+    mark_all_changed(g);
+
+    g->food_count = 0;
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        snake_clear(g, game_player_at(g, i));
+    }
+
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        game_player_t *pl = game_player_at(g, i);
+        if (!pl->has_joined || !pl->is_alive) continue;
+
+        game_pos_t head;
+        direction_t start_dir;
+        if (pick_safe_spawn(g, &head, &start_dir) != 0 ||
+            place_spawn_snake(g, pl, head, start_dir) != 0) {
+            pl->is_alive = 0;
+            end_snake_life(pl, now_ms);
+            continue;
+        }
+
+        pl->current_direction = start_dir;
+        pl->requested_direction = start_dir;
+    }
+
+    g->global_freeze_until_ms = now_ms + 3000ULL;
+
+    ensure_food_count(g);
+}
+
+void game_handle_input(game_state_t *g, game_player_id_t player_id, direction_t direction) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl) return;
     if (!pl->has_joined || !pl->is_alive) return;
     if (pl->is_paused) return;
 
@@ -437,11 +853,23 @@ void game_handle_input(game_state_t *g, int player_slot, direction_t direction)
     pl->requested_direction = direction;
 }
 
-void game_handle_pause(game_state_t *g, int player_slot) {
-    if (!g) return;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return;
-    game_player_t *pl = &g->players[player_slot];
-    if (!pl->has_joined) return;
+int game_next_position(const game_state_t *g, game_pos_t from, direction_t direction, game_pos_t *out_pos) {
+    if (!g || !out_pos) return -1;
+    game_pos_t p = step_in_world(g, from, direction);
+    if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return -1;
+    *out_pos = p;
+    return 0;
+}
+
+int game_cell_is_obstacle(const game_state_t *g, game_pos_t pos) {
+    if (!g) return 1;
+    if (g->world_type != WORLD_FILE) return is_inside_bounds(g, (int)pos.x, (int)pos.y) ? 0 : 1;
+    return cell_is_obstacle(g, pos.x, pos.y);
+}
+
+void game_handle_pause(game_state_t *g, game_player_id_t player_id) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl || !pl->has_joined) return;
 
     g->global_pause_active = 1;
     strncpy(g->global_pause_owner_name, pl->player_name, GAME_MAX_NAME_LEN - 1);
@@ -449,11 +877,10 @@ void game_handle_pause(game_state_t *g, int player_slot) {
     pl->is_paused = 1;
 }
 
-void game_handle_leave(game_state_t *g, int player_slot, uint64_t now_ms) {
-    if (!g) return;
-    if (player_slot < 0 || player_slot >= GAME_MAX_PLAYERS) return;
+void game_handle_leave(game_state_t *g, game_player_id_t player_id, uint64_t now_ms) {
+    game_player_t *pl = game_player_lookup(g, player_id);
+    if (!pl) return;
 
-    game_player_t *pl = &g->players[player_slot];
     if (pl->has_joined && pl->is_alive) {
         end_snake_life(pl, now_ms);
     }
@@ -463,7 +890,7 @@ void game_handle_leave(game_state_t *g, int player_slot, uint64_t now_ms) {
         g->global_pause_owner_name[0] = '\0';
     }
 
-    game_mark_client_inactive_keep_or_clear(g, player_slot, 0);
+    game_mark_client_inactive_keep_or_clear(g, player_id, 0);
     ensure_food_count(g);
 }
 
@@ -495,8 +922,8 @@ void game_tick(game_state_t *g, uint64_t now_ms) {
 
     g->tick_counter++;
 
-    for (int s = 0; s < GAME_MAX_PLAYERS; s++) {
-        game_player_t *pl = &g->players[s];
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        game_player_t *pl = game_player_at(g, i);
         if (!pl->has_joined || !pl->is_alive) continue;
         if (pl->is_paused) continue;
         pl->current_direction = pl->requested_direction;
@@ -507,58 +934,54 @@ void game_tick(game_state_t *g, uint64_t now_ms) {
     if (g->global_freeze_until_ms != 0 && now_ms < g->global_freeze_until_ms) global_frozen = 1;
 
     if (!global_frozen) {
-        for (int s = 0; s < GAME_MAX_PLAYERS; s++) {
-            game_player_t *pl = &g->players[s];
+        for (uint32_t i = 0; i < g->player_count; i++) {
+            game_player_t *pl = game_player_at(g, i);
             if (!pl->has_joined || !pl->is_alive) continue;
             if (pl->is_paused) continue;
             if (pl->freeze_until_ms != 0 && now_ms < pl->freeze_until_ms) continue;
 
-            game_pos_t head = pl->snake_body[0];
+            game_pos_t head = game_snake_head(g, pl);
             game_pos_t new_head = step_in_world(g, head, pl->current_direction);
 
             if (g->world_type == WORLD_FILE) {
-                if (!is_inside_bounds(g, (int)new_head.x, (int)new_head.y)) {
-                    pl->is_alive = 0;
-                    end_snake_life(pl, now_ms);
-                    continue;
-                }
-                if (cell_is_obstacle(g, new_head.x, new_head.y)) {
+                if (!is_inside_bounds(g, (int)new_head.x, (int)new_head.y) ||
+                    cell_is_obstacle(g, new_head.x, new_head.y)) {
+                    release_snake(g, pl);
                     pl->is_alive = 0;
                     end_snake_life(pl, now_ms);
                     continue;
                 }
             }
 
-            int food_index = -1;
-            int will_grow = is_food_at(g, new_head, &food_index);
+            int will_grow = is_food_at(g, new_head);
+            // At the length cap eating still pops the tail, so the tail
+            // cell is vacated this tick and must not count as a collision.
+            int keeps_tail = will_grow && pl->snake_len < g->max_snake_len;
 
-            if (is_occupied_except_tail(g, s, new_head, will_grow)) {
+            if (is_occupied_except_tail(g, pl, new_head, keeps_tail)) {
+                release_snake(g, pl);
                 pl->is_alive = 0;
                 end_snake_life(pl, now_ms);
                 continue;
             }
 
             if (will_grow) {
-                remove_food_at(g, food_index);
+                remove_food_at(g, new_head);
                 pl->score = (uint16_t)(pl->score + 1);
-                if (pl->snake_len < GAME_MAX_SNAKE_LEN) {
-                    for (uint16_t i = pl->snake_len; i > 0; i--) {
-                        pl->snake_body[i] = pl->snake_body[i - 1];
-                    }
-                    pl->snake_body[0] = new_head;
-                    pl->snake_len++;
-                } else {
-                    for (uint16_t i = pl->snake_len - 1; i > 0; i--) {
-                        pl->snake_body[i] = pl->snake_body[i - 1];
-                    }
-                    pl->snake_body[0] = new_head;
-                }
-            } else {
-                for (uint16_t i = pl->snake_len - 1; i > 0; i--) {
-                    pl->snake_body[i] = pl->snake_body[i - 1];
-                }
-                pl->snake_body[0] = new_head;
             }
+            if (!keeps_tail) {
+                release_cell(g, snake_tail(g, pl));
+                snake_pop_back(g, pl);
+            }
+            if (snake_push_front(g, pl, new_head) != 0) {
+                release_snake(g, pl);
+                pl->is_alive = 0;
+                end_snake_life(pl, now_ms);
+                continue;
+            }
+            g->cell_flags[cell_index(g, new_head)]++;
+            mark_cell_changed(g, new_head);
+            mark_cell_changed(g, head);
         }
     }
 
@@ -566,87 +989,516 @@ void game_tick(game_state_t *g, uint64_t now_ms) {
     update_game_termination(g, now_ms);
 }
 
-static char head_char(int idx) {
-    if (idx >= 0 && idx < 26) return (char)('A' + idx);
-    idx -= 26;
-    if (idx >= 0 && idx < 10) return (char)('0' + idx);
-    return '@';
+uint32_t game_get_elapsed_ms(const game_state_t *g, uint64_t now_ms) {
+    if (!g) return 0;
+    if (g->start_time_ms == 0) return 0;
+    uint64_t diff = now_ms - g->start_time_ms;
+    if (diff > 0xFFFFFFFFULL) diff = 0xFFFFFFFFULL;
+    return (uint32_t)diff;
+}
+
+uint32_t game_get_remaining_ms(const game_state_t *g, uint64_t now_ms) {
+    if (!g) return 0;
+    if (g->game_mode != GAME_MODE_TIMED) return 0;
+    if (g->timed_end_ms == 0) return 0;
+    if (now_ms >= g->timed_end_ms) return 0;
+    uint64_t rem = g->timed_end_ms - now_ms;
+    if (rem > 0xFFFFFFFFULL) rem = 0xFFFFFFFFULL;
+    return (uint32_t)rem;
 }
 
-static char body_char(int idx) {
-    if (idx >= 0 && idx < 26) return (char)('a' + idx);
-    idx -= 26;
-    if (idx >= 0 && idx < 10) return (char)('0' + idx);
-    return 'o';
+
+static uint32_t player_status_bits(const game_player_t *pl) {
+    uint32_t flags = (pl->is_active ? STATE_PLAYER_USED : 0) |
+                     (pl->has_joined ? STATE_PLAYER_JOINED : 0) |
+                     (pl->is_alive ? STATE_PLAYER_ALIVE : 0) |
+                     (pl->is_paused ? STATE_PLAYER_PAUSED : 0);
+    return (flags << 16) | pl->score;
 }
 
-void game_build_ascii_map(const game_state_t *g, uint8_t *out_cells, size_t out_cells_len) {
-    if (!g || !out_cells) return;
+static void fill_player_status(const game_player_t *pl, state_player_status_t *out) {
+    uint32_t bits = player_status_bits(pl);
+    out->player_id_net = htonl(pl->player_id);
+    out->flags = (uint8_t)(bits >> 16);
+    out->reserved0 = 0;
+    out->score_net = htons((uint16_t)bits);
+}
 
-    for (size_t i = 0; i < out_cells_len; i++) out_cells[i] = (uint8_t)' ';
+void game_publish_status(game_state_t *g) {
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        game_player_t *pl = game_player_at(g, i);
+        uint32_t bits = player_status_bits(pl);
+        if (bits == pl->published_status) continue;
+        pl->published_status = bits;
+        pl->status_serial = ++g->status_serial;
+    }
+}
 
-    uint8_t width = g->map_width;
-    uint8_t height = g->map_height;
-    size_t world_cells = (size_t)width * (size_t)height;
-    if (world_cells > out_cells_len) world_cells = out_cells_len;
+size_t game_roster_size(const game_state_t *g) {
+    return sizeof(roster_message_t) + (size_t)g->player_count * sizeof(roster_entry_t);
+}
 
-    if (g->world_type == WORLD_FILE) {
-        for (uint8_t y = 0; y < height; y++) {
-            for (uint8_t x = 0; x < width; x++) {
-                size_t idx = (size_t)y * width + x;
-                if (idx >= world_cells) continue;
-                if (cell_is_obstacle(g, x, y)) out_cells[idx] = (uint8_t)'#';
-            }
-        }
+void game_build_roster(const game_state_t *g, roster_message_t *out_msg) {
+    out_msg->player_count_net = htons((uint16_t)g->player_count);
+    out_msg->reserved0 = 0;
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+        roster_entry_t *e = &out_msg->players[i];
+        fill_player_status(pl, &e->status);
+        memset(e->name, 0, sizeof(e->name));
+        memcpy(e->name, pl->player_name, strnlen(pl->player_name, STATE_NAME_MAX - 1));
     }
+}
 
-    for (uint8_t i = 0; i < g->food_count; i++) {
-        game_pos_t f = g->food_positions[i];
-        size_t idx = (size_t)f.y * width + f.x;
-        if (idx < world_cells) out_cells[idx] = (uint8_t)'*';
+static uint16_t count_status_changes(const game_state_t *g, uint32_t since_serial) {
+    if (since_serial >= g->status_serial) return 0;
+    uint16_t count = 0;
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        if (game_player_at(g, i)->status_serial > since_serial) count++;
     }
+    return count;
+}
 
-    for (int s = 0; s < GAME_MAX_PLAYERS; s++) {
-        const game_player_t *pl = &g->players[s];
-        if (!pl->has_joined) continue;
+size_t game_state_status_size(const game_state_t *g, uint32_t since_serial) {
+    return state_message_cells_offset(count_status_changes(g, since_serial));
+}
 
-        if (!pl->is_alive && pl->snake_len > 0) {
-            for (uint16_t i = 0; i < pl->snake_len; i++) {
-                game_pos_t p = pl->snake_body[i];
-                size_t idx = (size_t)p.y * width + p.x;
-                if (idx < world_cells) out_cells[idx] = (uint8_t)'x';
-            }
-            continue;
-        }
+void game_build_state_header(const game_state_t *g, uint64_t now_ms, uint32_t since_serial, state_message_t *out_msg) {
+    if (!g || !out_msg) return;
+    memset(out_msg, 0, sizeof(*out_msg));
+
+    out_msg->tick_counter_net = htonl(g->tick_counter);
+    out_msg->width_net = htons(g->map_width);
+    out_msg->height_net = htons(g->map_height);
+    out_msg->game_mode = (uint8_t)g->game_mode;
+    out_msg->world_type = (uint8_t)g->world_type;
+    out_msg->elapsed_ms_net = htonl(game_get_elapsed_ms(g, now_ms));
+    out_msg->remaining_ms_net = htonl(game_get_remaining_ms(g, now_ms));
+
+    int global_frozen = g->global_freeze_until_ms != 0 && now_ms < g->global_freeze_until_ms;
+    if (g->global_pause_active || global_frozen) out_msg->flags |= STATE_FLAG_WORLD_PAUSED;
+
+    uint16_t count = count_status_changes(g, since_serial);
+    out_msg->status_count_net = htons(count);
+    state_player_status_t *statuses = state_message_statuses(out_msg);
+    for (uint32_t i = 0, n = 0; i < g->player_count && n < count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+        if (pl->status_serial > since_serial) fill_player_status(pl, &statuses[n++]);
+    }
+}
 
-        if (pl->snake_len > 0) {
-            game_pos_t h = pl->snake_body[0];
-            size_t idx = (size_t)h.y * width + h.x;
-            if (idx < world_cells) out_cells[idx] = (uint8_t)head_char(s);
+int game_apply_event(game_state_t *g, const game_event_t *ev) {
+    if (!g || !ev) return -1;
+
+    game_player_id_t slot = ev->player_id;
+    int rc = 0;
+
+    switch (ev->type) {
+        case GAME_EVENT_ACTIVATE:
+            rc = game_mark_client_active(g, slot);
+            break;
+        case GAME_EVENT_DEACTIVATE:
+            game_mark_client_inactive_keep_or_clear(g, slot, 0);
+            break;
+        case GAME_EVENT_JOIN:
+            rc = game_join_new_player(g, slot, ev->player_name, ev->time_ms);
+            break;
+        case GAME_EVENT_RESUME:
+            if (!game_player_lookup(g, slot)) return -1;
+            game_mark_client_active(g, slot);
+            rc = game_resume_player(g, slot, ev->time_ms);
+            break;
+        case GAME_EVENT_INPUT:
+            game_handle_input(g, slot, (direction_t)ev->direction);
+            break;
+        case GAME_EVENT_PAUSE:
+            game_handle_pause(g, slot);
+            game_mark_client_inactive_keep_or_clear(g, slot, 1);
+            break;
+        case GAME_EVENT_LEAVE:
+            game_handle_leave(g, slot, ev->time_ms);
+            break;
+        case GAME_EVENT_RESPAWN:
+            rc = game_respawn_player(g, slot, ev->time_ms);
+            break;
+        case GAME_EVENT_RESPAWN_QUIET:
+            rc = game_respawn_player_without_freeze(g, slot, ev->time_ms);
+            break;
+        default:
+            return -1;
+    }
+
+    if (g->event_sink) g->event_sink(g->event_sink_ctx, ev);
+    return rc;
+}
+
+int game_emit_event(game_state_t *g, uint8_t type, game_player_id_t player_id, uint8_t direction, const char *player_name, uint64_t now_ms) {
+    if (player_id == GAME_PLAYER_NONE) return -1;
+
+    game_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.player_id = player_id;
+    ev.direction = direction;
+    ev.time_ms = now_ms;
+    if (player_name) {
+        strncpy(ev.player_name, player_name, GAME_MAX_NAME_LEN - 1);
+        ev.player_name[GAME_MAX_NAME_LEN - 1] = '\0';
+    }
+    return game_apply_event(g, &ev);
+}
+
+size_t game_event_encode(const game_event_t *ev, uint64_t base_ms, uint8_t *buf, size_t cap) {
+    size_t name_len = 0;
+    if (ev->type == GAME_EVENT_JOIN) name_len = strnlen(ev->player_name, GAME_MAX_NAME_LEN - 1);
+
+    size_t needed = 10 + (ev->type == GAME_EVENT_JOIN ? 1 + name_len : 0);
+    if (needed > cap) return 0;
+
+    uint32_t offset_ms = (uint32_t)(ev->time_ms - base_ms);
+    buf[0] = ev->type;
+    buf[1] = ev->direction;
+    buf[2] = (uint8_t)(ev->player_id >> 24);
+    buf[3] = (uint8_t)(ev->player_id >> 16);
+    buf[4] = (uint8_t)(ev->player_id >> 8);
+    buf[5] = (uint8_t)ev->player_id;
+    buf[6] = (uint8_t)(offset_ms >> 24);
+    buf[7] = (uint8_t)(offset_ms >> 16);
+    buf[8] = (uint8_t)(offset_ms >> 8);
+    buf[9] = (uint8_t)offset_ms;
+
+    if (ev->type == GAME_EVENT_JOIN) {
+        buf[10] = (uint8_t)name_len;
+        memcpy(buf + 11, ev->player_name, name_len);
+    }
+    return needed;
+}
+
+size_t game_event_decode(game_event_t *ev, uint64_t base_ms, const uint8_t *buf, size_t len) {
+    if (len < 10) return 0;
+    memset(ev, 0, sizeof(*ev));
+
+    ev->type = buf[0];
+    ev->direction = buf[1];
+    ev->player_id = ((uint32_t)buf[2] << 24) | ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 8) | (uint32_t)buf[5];
+    uint32_t offset_ms = ((uint32_t)buf[6] << 24) | ((uint32_t)buf[7] << 16) | ((uint32_t)buf[8] << 8) | (uint32_t)buf[9];
+    ev->time_ms = base_ms + offset_ms;
+
+    if (ev->type != GAME_EVENT_JOIN) return 10;
+
+    if (len < 11) return 0;
+    size_t name_len = buf[10];
+    if (name_len >= GAME_MAX_NAME_LEN || len < 11 + name_len) return 0;
+    memcpy(ev->player_name, buf + 11, name_len);
+    ev->player_name[name_len] = '\0';
+    return 11 + name_len;
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    int hash_only;
+    uint32_t hash;
+    int overflow;
+} snapshot_writer_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    int error;
+} snapshot_reader_t;
+
+static void sw_bytes(snapshot_writer_t *w, const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t*)data;
+    if (w->hash_only) {
+        for (size_t i = 0; i < n; i++) {
+            w->hash ^= p[i];
+            w->hash *= 16777619u;
         }
-        for (uint16_t i = 1; i < pl->snake_len; i++) {
-            game_pos_t p = pl->snake_body[i];
-            size_t idx = (size_t)p.y * width + p.x;
-            if (idx < world_cells) out_cells[idx] = (uint8_t)body_char(s);
+        w->len += n;
+        return;
+    }
+    if (!w->buf) {
+        w->len += n;
+        return;
+    }
+    if (w->len + n > w->cap) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static void sw_u8(snapshot_writer_t *w, uint8_t v) {
+    sw_bytes(w, &v, 1);
+}
+
+static void sw_u16(snapshot_writer_t *w, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    sw_bytes(w, b, sizeof(b));
+}
+
+static void sw_u32(snapshot_writer_t *w, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    sw_bytes(w, b, sizeof(b));
+}
+
+static void sw_u64(snapshot_writer_t *w, uint64_t v) {
+    sw_u32(w, (uint32_t)(v >> 32));
+    sw_u32(w, (uint32_t)v);
+}
+
+static void sw_time(snapshot_writer_t *w, uint64_t t, uint64_t now_ms) {
+    if (t == 0) {
+        sw_u8(w, 0);
+        return;
+    }
+    sw_u8(w, 1);
+    sw_u64(w, t - now_ms);
+}
+
+static void sr_bytes(snapshot_reader_t *r, void *out, size_t n) {
+    if (r->error || r->pos + n > r->len) {
+        r->error = 1;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, r->buf + r->pos, n);
+    r->pos += n;
+}
+
+static uint8_t sr_u8(snapshot_reader_t *r) {
+    uint8_t v;
+    sr_bytes(r, &v, 1);
+    return v;
+}
+
+static uint16_t sr_u16(snapshot_reader_t *r) {
+    uint8_t b[2];
+    sr_bytes(r, b, sizeof(b));
+    return (uint16_t)(((uint16_t)b[0] << 8) | b[1]);
+}
+
+static uint32_t sr_u32(snapshot_reader_t *r) {
+    uint8_t b[4];
+    sr_bytes(r, b, sizeof(b));
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+static uint64_t sr_u64(snapshot_reader_t *r) {
+    uint64_t hi = sr_u32(r);
+    uint64_t lo = sr_u32(r);
+    return (hi << 32) | lo;
+}
+
+static uint64_t sr_time(snapshot_reader_t *r, uint64_t now_ms) {
+    if (sr_u8(r) == 0) return 0;
+    return now_ms + sr_u64(r);
+}
+
+static void snapshot_write(snapshot_writer_t *w, const game_state_t *g, uint64_t now_ms) {
+    sw_u8(w, GAME_SNAPSHOT_VERSION);
+    sw_u32(w, g->tick_counter);
+    sw_u32(w, g->rng_state);
+
+    sw_u16(w, g->map_width);
+    sw_u16(w, g->map_height);
+    sw_u8(w, (uint8_t)g->world_type);
+    sw_u8(w, (uint8_t)g->game_mode);
+    sw_u16(w, g->max_snake_len);
+
+    sw_time(w, g->start_time_ms, now_ms);
+    sw_time(w, g->timed_end_ms, now_ms);
+    sw_time(w, g->last_no_snakes_ms, now_ms);
+    sw_time(w, g->global_freeze_until_ms, now_ms);
+
+    sw_u8(w, g->should_terminate ? 1 : 0);
+    sw_u8(w, g->global_pause_active ? 1 : 0);
+    sw_bytes(w, g->global_pause_owner_name, GAME_MAX_NAME_LEN);
+
+    size_t cells = (size_t)g->map_width * (size_t)g->map_height;
+    size_t i = 0;
+    uint8_t value = 0;
+    while (i < cells) {
+        size_t run = 0;
+        while (i + run < cells && ((g->cell_flags[i + run] & GAME_CELL_OBSTACLE) ? 1 : 0) == value && run < 0xFFFF) run++;
+        sw_u16(w, (uint16_t)run);
+        i += run;
+        value ^= 1;
+    }
+
+    sw_u16(w, g->food_count);
+    for (uint16_t f = 0; f < g->food_count; f++) {
+        sw_u16(w, g->food_positions[f].x);
+        sw_u16(w, g->food_positions[f].y);
+    }
+
+    sw_u16(w, (uint16_t)g->player_count);
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
+
+        uint8_t flags = (uint8_t)((pl->is_active ? 1 : 0) |
+                                  (pl->has_joined ? 2 : 0) |
+                                  (pl->is_alive ? 4 : 0) |
+                                  (pl->is_paused ? 8 : 0));
+        sw_u32(w, pl->player_id);
+        sw_u8(w, flags);
+        sw_bytes(w, pl->player_name, GAME_MAX_NAME_LEN);
+        sw_u16(w, pl->score);
+        sw_u8(w, (uint8_t)pl->current_direction);
+        sw_u8(w, (uint8_t)pl->requested_direction);
+
+        game_snake_iter_t it;
+        game_pos_t p;
+        sw_u16(w, pl->snake_len);
+        game_snake_iter_begin(g, pl, &it);
+        while (game_snake_iter_next(g, &it, &p)) {
+            sw_u16(w, p.x);
+            sw_u16(w, p.y);
         }
+
+        sw_time(w, pl->freeze_until_ms, now_ms);
+        sw_time(w, pl->snake_alive_start_ms, now_ms);
+        sw_u64(w, pl->snake_time_ms);
     }
 }
 
-uint32_t game_get_elapsed_ms(const game_state_t *g, uint64_t now_ms) {
+int game_snapshot_encode(const game_state_t *g, uint64_t now_ms, uint8_t *buf, size_t cap, size_t *out_len) {
+    if (!g || !buf) return -1;
+
+    snapshot_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.cap = cap;
+
+    snapshot_write(&w, g, now_ms);
+    if (w.overflow) return -1;
+    if (out_len) *out_len = w.len;
+    return 0;
+}
+
+size_t game_snapshot_size(const game_state_t *g, uint64_t now_ms) {
     if (!g) return 0;
-    if (g->start_time_ms == 0) return 0;
-    uint64_t diff = now_ms - g->start_time_ms;
-    if (diff > 0xFFFFFFFFULL) diff = 0xFFFFFFFFULL;
-    return (uint32_t)diff;
+
+    snapshot_writer_t w;
+    memset(&w, 0, sizeof(w));
+
+    snapshot_write(&w, g, now_ms);
+    return w.len;
 }
 
-uint32_t game_get_remaining_ms(const game_state_t *g, uint64_t now_ms) {
+uint32_t game_state_hash(const game_state_t *g, uint64_t now_ms) {
     if (!g) return 0;
-    if (g->game_mode != GAME_MODE_TIMED) return 0;
-    if (g->timed_end_ms == 0) return 0;
-    if (now_ms >= g->timed_end_ms) return 0;
-    uint64_t rem = g->timed_end_ms - now_ms;
-    if (rem > 0xFFFFFFFFULL) rem = 0xFFFFFFFFULL;
-    return (uint32_t)rem;
+
+    snapshot_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.hash_only = 1;
+    w.hash = 2166136261u;
+
+    snapshot_write(&w, g, now_ms);
+    return w.hash;
 }
 
+int game_snapshot_decode(game_state_t *g, uint64_t now_ms, const uint8_t *buf, size_t len) {
+    if (!g || !buf) return -1;
+
+    snapshot_reader_t r;
+    memset(&r, 0, sizeof(r));
+    r.buf = buf;
+    r.len = len;
+
+    if (sr_u8(&r) != GAME_SNAPSHOT_VERSION) return -1;
+
+    game_event_sink_t sink = g->event_sink;
+    void *sink_ctx = g->event_sink_ctx;
+    game_free(g);
+    memset(g, 0, sizeof(*g));
+    g->event_sink = sink;
+    g->event_sink_ctx = sink_ctx;
+
+    g->tick_counter = sr_u32(&r);
+    g->rng_state = sr_u32(&r);
+
+    g->map_width = sr_u16(&r);
+    g->map_height = sr_u16(&r);
+    g->world_type = (world_type_t)sr_u8(&r);
+    g->game_mode = (game_mode_t)sr_u8(&r);
+    g->max_snake_len = sr_u16(&r);
+    if (g->max_snake_len < 3) return -1;
+    if (g->map_width < 5 || g->map_height < 5) return -1;
+    if (g->map_width > GAME_MAX_WIDTH || g->map_height > GAME_MAX_HEIGHT) return -1;
+
+    g->cell_flags = (uint8_t*)calloc((size_t)g->map_width * g->map_height, 1);
+    if (!g->cell_flags) return -1;
+    mark_all_changed(g);
+
+    g->start_time_ms = sr_time(&r, now_ms);
+    g->timed_end_ms = sr_time(&r, now_ms);
+    g->last_no_snakes_ms = sr_time(&r, now_ms);
+    g->global_freeze_until_ms = sr_time(&r, now_ms);
+
+    g->should_terminate = sr_u8(&r);
+    g->global_pause_active = sr_u8(&r);
+    sr_bytes(&r, g->global_pause_owner_name, GAME_MAX_NAME_LEN);
+    g->global_pause_owner_name[GAME_MAX_NAME_LEN - 1] = '\0';
+
+    size_t cells = (size_t)g->map_width * (size_t)g->map_height;
+    size_t i = 0;
+    uint8_t value = 0;
+    while (i < cells && !r.error) {
+        size_t run = sr_u16(&r);
+        if (i + run > cells) return -1;
+        if (value) memset(g->cell_flags + i, GAME_CELL_OBSTACLE, run);
+        i += run;
+        value ^= 1;
+    }
+
+    g->food_count = sr_u16(&r);
+    if (g->food_count > GAME_MAX_PLAYERS) return -1;
+    for (uint16_t f = 0; f < g->food_count; f++) {
+        game_pos_t p;
+        p.x = sr_u16(&r);
+        p.y = sr_u16(&r);
+        if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return -1;
+        g->food_positions[f] = p;
+        g->cell_flags[cell_index(g, p)] |= GAME_CELL_FOOD;
+    }
+
+    uint16_t player_count = sr_u16(&r);
+    for (uint16_t n = 0; n < player_count && !r.error; n++) {
+        game_player_t *pl = claim_player(g, sr_u32(&r));
+        if (!pl) return -1;
+
+        uint8_t flags = sr_u8(&r);
+        pl->is_active = (flags & 1) ? 1 : 0;
+        pl->has_joined = (flags & 2) ? 1 : 0;
+        pl->is_alive = (flags & 4) ? 1 : 0;
+        pl->is_paused = (flags & 8) ? 1 : 0;
+
+        sr_bytes(&r, pl->player_name, GAME_MAX_NAME_LEN);
+        pl->player_name[GAME_MAX_NAME_LEN - 1] = '\0';
+        pl->score = sr_u16(&r);
+        pl->current_direction = (direction_t)(sr_u8(&r) & 3);
+        pl->requested_direction = (direction_t)(sr_u8(&r) & 3);
+
+        uint16_t snake_len = sr_u16(&r);
+        if (snake_len > g->max_snake_len) return -1;
+        for (uint16_t k = 0; k < snake_len && !r.error; k++) {
+            game_pos_t p;
+            p.x = sr_u16(&r);
+            p.y = sr_u16(&r);
+            if (!is_inside_bounds(g, (int)p.x, (int)p.y)) return -1;
+            if (snake_push_back(g, pl, p) != 0) return -1;
+        }
+        if (pl->has_joined && pl->is_alive) occupy_snake(g, pl);
+
+        pl->freeze_until_ms = sr_time(&r, now_ms);
+        pl->snake_alive_start_ms = sr_time(&r, now_ms);
+        pl->snake_time_ms = sr_u64(&r);
+    }
+
+    return r.error ? -1 : 0;
+}
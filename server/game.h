@@ -4,9 +4,24 @@
 #include <stdint.h>
 #include "../common/protocol.h"
 
-#define GAME_MAX_PLAYERS   64
+#define GAME_MAX_PLAYERS   4096
 #define GAME_MAX_NAME_LEN  32
-#define GAME_MAX_SNAKE_LEN 64
+#define GAME_DEFAULT_SNAKE_LEN 64
+#define GAME_MAX_SNAKE_LEN     UINT16_MAX
+
+#define GAME_SEGMENT_CHUNK_LEN 16
+#define GAME_SEGMENT_NONE      UINT32_MAX
+
+#define GAME_MAX_WIDTH     STATE_MAX_WIDTH
+#define GAME_MAX_HEIGHT    STATE_MAX_HEIGHT
+
+#define GAME_REGION_SHIFT  5
+#define GAME_REGION_SIZE   (1 << GAME_REGION_SHIFT)
+#define GAME_MAX_REGIONS   ((GAME_MAX_WIDTH >> GAME_REGION_SHIFT) * (GAME_MAX_HEIGHT >> GAME_REGION_SHIFT))
+
+#define GAME_CELL_OBSTACLE  0x80
+#define GAME_CELL_FOOD      0x40
+#define GAME_CELL_BODY_MASK 0x3F
 
 typedef enum {
     WORLD_EMPTY = 0,
@@ -14,11 +29,41 @@ typedef enum {
 } world_type_t;
 
 typedef struct {
-    uint8_t x;
-    uint8_t y;
+    uint16_t x;
+    uint16_t y;
 } game_pos_t;
 
 typedef struct {
+    game_pos_t cells[GAME_SEGMENT_CHUNK_LEN];
+    uint32_t prev;
+    uint32_t next;
+} game_segment_chunk_t;
+
+typedef struct {
+    game_segment_chunk_t *chunks;
+    uint32_t capacity;
+    uint32_t free_head;
+    uint32_t used;
+} game_segment_pool_t;
+
+typedef struct {
+    uint32_t chunk;
+    uint16_t offset;
+    uint16_t remaining;
+} game_snake_iter_t;
+
+typedef uint32_t game_player_id_t;
+
+#define GAME_PLAYER_NONE              0u
+#define GAME_PLAYER_INDEX(id)         ((uint16_t)((id) & 0xFFFFu))
+#define GAME_PLAYER_GENERATION(id)    ((uint16_t)((id) >> 16))
+#define GAME_PLAYER_MAKE_ID(gen, idx) (((game_player_id_t)(gen) << 16) | (game_player_id_t)(idx))
+
+typedef struct {
+    game_player_id_t player_id;
+    uint16_t generation;
+    uint32_t list_index;
+
     int is_active;
     int has_joined;
     int is_alive;
@@ -32,26 +77,60 @@ typedef struct {
     direction_t requested_direction;
 
     uint16_t snake_len;
-    game_pos_t snake_body[GAME_MAX_SNAKE_LEN];
+    uint32_t snake_head_chunk;
+    uint32_t snake_tail_chunk;
+    uint16_t snake_head_offset;
+    uint16_t snake_tail_offset;
 
     uint64_t freeze_until_ms;
     uint64_t snake_alive_start_ms;
     uint64_t snake_time_ms;
+
+    uint32_t published_status;
+    uint32_t status_serial;
 } game_player_t;
 
+typedef enum {
+    GAME_EVENT_ACTIVATE      = 1,
+    GAME_EVENT_DEACTIVATE    = 2,
+    GAME_EVENT_JOIN          = 3,
+    GAME_EVENT_RESUME        = 4,
+    GAME_EVENT_INPUT         = 5,
+    GAME_EVENT_PAUSE         = 6,
+    GAME_EVENT_LEAVE         = 7,
+    GAME_EVENT_RESPAWN       = 8,
+    GAME_EVENT_RESPAWN_QUIET = 9
+} game_event_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t direction;
+    game_player_id_t player_id;
+    uint64_t time_ms;
+    char player_name[GAME_MAX_NAME_LEN];
+} game_event_t;
+
+typedef void (*game_event_sink_t)(void *sink_ctx, const game_event_t *event);
+
 typedef struct {
     uint32_t tick_counter;
+    uint32_t rng_state;
 
-    uint8_t map_width;
-    uint8_t map_height;
+    uint16_t map_width;
+    uint16_t map_height;
 
     world_type_t world_type;
-    uint8_t obstacle_map[STATE_MAX_CELLS];
+    uint8_t *cell_flags;
 
-    uint8_t food_count;
+    uint32_t change_serial;
+    uint32_t region_serial[GAME_MAX_REGIONS];
+
+    uint16_t food_count;
     game_pos_t food_positions[GAME_MAX_PLAYERS];
 
     game_mode_t game_mode;
+    uint16_t max_snake_len;
+    game_segment_pool_t segments;
 
     uint64_t start_time_ms;
     uint64_t timed_end_ms;
@@ -63,35 +142,86 @@ typedef struct {
     int global_pause_active;
     char global_pause_owner_name[GAME_MAX_NAME_LEN];
 
-    game_player_t players[GAME_MAX_PLAYERS];
-} game_state_t;
+    game_player_t *players;
+    uint32_t player_capacity;
+    uint16_t *free_players;
+    uint32_t free_player_count;
+    uint16_t *player_list;
+    uint32_t player_count;
 
-int game_load_map_from_file(game_state_t *game_state, const char *path);
+    uint32_t roster_serial;
+    uint32_t status_serial;
+
+    game_event_sink_t event_sink;
+    void *event_sink_ctx;
+} game_state_t;
 
-void game_init(game_state_t *game_state,
-               uint8_t map_width,
-               uint8_t map_height,
+typedef struct {
+    uint16_t map_width;
+    uint16_t map_height;
+    uint8_t *cell_flags;
+} game_map_t;
+
+int  game_map_load(game_map_t *map, const char *path);
+void game_map_free(game_map_t *map);
+void game_apply_map(game_state_t *game_state, game_map_t *map, uint64_t now_ms);
+
+int  game_init(game_state_t *game_state,
+               uint16_t map_width,
+               uint16_t map_height,
                game_mode_t mode,
                uint32_t timed_duration_ms,
                world_type_t world_type);
+void game_free(game_state_t *game_state);
+
+game_player_t   *game_player_lookup(const game_state_t *game_state, game_player_id_t player_id);
+game_player_t   *game_player_at(const game_state_t *game_state, uint32_t list_position);
+game_player_id_t game_next_player_id(const game_state_t *game_state);
+game_player_id_t game_activate_new_player(game_state_t *game_state, uint64_t now_ms);
+
+int  game_mark_client_active(game_state_t *game_state, game_player_id_t player_id);
+void game_mark_client_inactive_keep_or_clear(game_state_t *game_state, game_player_id_t player_id, int keep_player_state);
+
+game_player_id_t game_find_paused_player_by_name(const game_state_t *game_state, const char *player_name);
+game_player_id_t game_find_player_by_name(const game_state_t *game_state, const char *player_name);
 
-void game_mark_client_active(game_state_t *game_state, int player_slot);
-void game_mark_client_inactive_keep_or_clear(game_state_t *game_state, int player_slot, int keep_player_state);
+int  game_join_new_player(game_state_t *game_state, game_player_id_t player_id, const char *player_name, uint64_t now_ms);
+int  game_resume_player(game_state_t *game_state, game_player_id_t player_id, uint64_t now_ms);
+int  game_respawn_player(game_state_t *game_state, game_player_id_t player_id, uint64_t now_ms);
+int  game_respawn_player_without_freeze(game_state_t *game_state, game_player_id_t player_id, uint64_t now_ms);
 
-int  game_find_paused_player_by_name(const game_state_t *game_state, const char *player_name);
+void game_handle_input(game_state_t *game_state, game_player_id_t player_id, direction_t direction);
 
-int  game_join_new_player(game_state_t *game_state, int player_slot, const char *player_name, uint64_t now_ms);
-int  game_resume_player(game_state_t *game_state, int player_slot, uint64_t now_ms);
-int  game_respawn_player(game_state_t *game_state, int player_slot, uint64_t now_ms);
+game_pos_t game_snake_head(const game_state_t *game_state, const game_player_t *player);
+void       game_snake_iter_begin(const game_state_t *game_state, const game_player_t *player, game_snake_iter_t *it);
+int        game_snake_iter_next(const game_state_t *game_state, game_snake_iter_t *it, game_pos_t *out_pos);
 
-void game_handle_input(game_state_t *game_state, int player_slot, direction_t direction);
+int  game_next_position(const game_state_t *game_state, game_pos_t from, direction_t direction, game_pos_t *out_pos);
+int  game_cell_is_obstacle(const game_state_t *game_state, game_pos_t pos);
 
-void game_handle_pause(game_state_t *game_state, int player_slot);
-void game_handle_leave(game_state_t *game_state, int player_slot, uint64_t now_ms);
+void game_handle_pause(game_state_t *game_state, game_player_id_t player_id);
+void game_handle_leave(game_state_t *game_state, game_player_id_t player_id, uint64_t now_ms);
 
 void game_tick(game_state_t *game_state, uint64_t now_ms);
 
-void game_build_ascii_map(const game_state_t *game_state, uint8_t *out_cells, size_t out_cells_len);
+int  game_region_cols(const game_state_t *game_state);
+int  game_region_rows(const game_state_t *game_state);
+
+void   game_publish_status(game_state_t *game_state);
+size_t game_roster_size(const game_state_t *game_state);
+void   game_build_roster(const game_state_t *game_state, roster_message_t *out_msg);
+size_t game_state_status_size(const game_state_t *game_state, uint32_t since_serial);
+void   game_build_state_header(const game_state_t *game_state, uint64_t now_ms, uint32_t since_serial, state_message_t *out_msg);
+
+int    game_apply_event(game_state_t *game_state, const game_event_t *event);
+int    game_emit_event(game_state_t *game_state, uint8_t type, game_player_id_t player_id, uint8_t direction, const char *player_name, uint64_t now_ms);
+size_t game_event_encode(const game_event_t *event, uint64_t base_ms, uint8_t *buf, size_t cap);
+size_t game_event_decode(game_event_t *out_event, uint64_t base_ms, const uint8_t *buf, size_t len);
+
+int      game_snapshot_encode(const game_state_t *game_state, uint64_t now_ms, uint8_t *buf, size_t cap, size_t *out_len);
+int      game_snapshot_decode(game_state_t *game_state, uint64_t now_ms, const uint8_t *buf, size_t len);
+size_t   game_snapshot_size(const game_state_t *game_state, uint64_t now_ms);
+uint32_t game_state_hash(const game_state_t *game_state, uint64_t now_ms);
 
 uint32_t game_get_elapsed_ms(const game_state_t *game_state, uint64_t now_ms);
 uint32_t game_get_remaining_ms(const game_state_t *game_state, uint64_t now_ms);
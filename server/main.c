@@ -1,42 +1,243 @@
+#define _GNU_SOURCE
 #define D_POSIX_C_SOURCE = 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <pthread.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
 #include "game.h"
+#include "bot.h"
+#include "view.h"
+#include "transport.h"
+#include "checkpoint.h"
+#include "metrics.h"
 #include "../common/protocol.h"
+#include "../common/snapring.h"
+
+#define SERVER_MAX_CONNECTIONS 16384
+#define SERVER_CONNECTIONS_INITIAL 64
+#define MAP_ROTATION_MAX 16
+#define LOCKSTEP_EVENT_BUF_SIZE 32768
+#define LOCKSTEP_DEFAULT_HASH_EVERY 10
+#define LOCKSTEP_MAX_LAG_TICKS 25
+#define CLIENT_RATE_MAX_INTERVAL  16
+#define CLIENT_RATE_IDLE_INTERVAL 4
+#define CLIENT_RATE_MIN_BACKLOG   4096
+#define LISTENER_TAG_TCP   0
+#define LISTENER_TAG_LOCAL 1
+#define SERVER_MAX_REACTORS 64
+#define SERVER_MAX_WORKERS  64
+#define HANDOFF_TAG         UINT32_MAX
+#define WORKER_RESTART_DELAY_MS 1000
+#define WORKER_MIN_UPTIME_MS    2000
+#define LOBBY_REPORT_INTERVAL_MS 1000
+#define ROOM_DEFAULT_CAPACITY    32
+#define MIGRATE_DEADLINE_TICKS   2
+#define SHUTDOWN_DRAIN_MS        1000
+#define TICK_DEFAULT_MS     200
+#define TICK_FLOOR_MS       10
+#define TICK_CEILING_MS     2000
+#define TICK_ADAPT_WINDOW   10
+#define WATCHDOG_SPAWNS_PER_TICK 1
+#define WATCHDOG_THIN_FACTOR     4
+#define FLOOD_INPUT_PER_SEC    40
+#define FLOOD_INPUT_BURST      40
+#define FLOOD_CONTROL_PER_SEC  8
+#define FLOOD_CONTROL_BURST    16
+#define FLOOD_STRIKE_LIMIT     64
+#define FLOOD_STRIKE_WINDOW_MS 5000
+
+// One encoded spectator frame, shared by every spectator socket still sending it.
+typedef struct {
+    uint32_t refcount;
+    uint32_t len;
+    uint8_t data[];
+} shared_frame_t;
 
-#define MAX_CLIENTS GAME_MAX_PLAYERS
+// Tokens are kept in thousandths so a refill of a few milliseconds is not rounded away.
+typedef struct {
+    uint32_t milli_tokens;
+    uint64_t refill_ms;
+} token_bucket_t;
 
 typedef struct {
     int client_socket_fd;
+    int needs_keyframe;
+    game_player_id_t player_id;
+
+    uint16_t view_width;
+    uint16_t view_height;
+    game_player_id_t follow_id;
+    game_pos_t view_center;
+    view_rect_t last_view;
+    uint32_t last_view_serial;
+
+    int needs_roster;
+    uint32_t roster_serial;
+    int respawn_deferred;
+
+    uint32_t input_seq;
+    uint32_t input_sent_us;
+    uint64_t input_recv_us;
+    int input_pending;
+    uint32_t status_serial;
+
+    msg_reader_t reader;
+
+    uint32_t rate_interval;
+    uint32_t rate_ticks_waited;
+    uint32_t rate_queued;
+    uint32_t rate_last_queued;
+    uint32_t rate_last_frame_len;
+    uint32_t rate_drain_per_tick;
+
+    int is_spectator;
+    int is_local;
+    shared_frame_t *pending_frame;
+    size_t pending_offset;
+    int writable_armed;
+    uint32_t lockstep_lag_ticks;
+    size_t active_index;
+
+    // Touched only by the owning reactor, before any lock is taken.
+    token_bucket_t input_bucket;
+    token_bucket_t control_bucket;
+    uint32_t flood_strikes;
+    uint64_t flood_window_ms;
+    uint32_t flood_dropped;
 } client_slot_t;
 
+struct server_context;
+
+// A reactor owns the connections whose slot index maps to it: it reads and dispatches their
+// messages and sends the frames the tick thread queues for them. Reactor 0 is the main thread
+// and also accepts.
 typedef struct {
+    struct server_context *server_ctx;
+    int index;
+    pthread_t thread;
+    transport_t transport;
+} server_reactor_t;
+
+typedef struct server_context {
     int listen_socket_fd;
-    client_slot_t client_slots[MAX_CLIENTS];
+    socket_tuning_t listen_tuning;
+    int local_listen_fd;
+    char local_socket_name[LOCAL_SOCKET_NAME_MAX];
+    client_slot_t *client_slots;
+    size_t client_slot_cap;
+    // Dense list of the slots holding a connection, in the manner of the game's player_list,
+    // so per-tick loops cost what is connected rather than client_slot_cap; the free slots
+    // are a stack with the lowest index on top. Both are guarded by state_mutex.
+    size_t *active_slots;
+    size_t active_count;
+    size_t *free_slots;
+    size_t free_count;
+
+    server_reactor_t reactors[SERVER_MAX_REACTORS];
+    int reactor_count;
+    int pin_reactors;
+
+    uint16_t port;
+    uint16_t room;
+    uint16_t room_count;
+    int handoff_fd;
+
+    char lobby_host[64];
+    uint16_t lobby_port;
+    uint16_t room_capacity;
+    pthread_t lobby_thread;
+    uint64_t tick_cost_us_sum;
+    uint32_t tick_cost_count;
+
+    char checkpoint_path[256];
+    int checkpoint_interval_ms;
+    uint64_t checkpoint_next_ms;
+    checkpoint_image_t checkpoint_captured;
+    int checkpoint_ready;
+    pthread_t checkpoint_thread;
+    pthread_cond_t checkpoint_cond;
+
+    int migrating;                          // match frozen: handed off, or staged here
+    int is_migrated;
+    room_target_message_t redirect;
+    checkpoint_image_t migration_staged;    // image held until its source commits
+    size_t migration_staged_slot;
+    int has_migration_staged;
+    size_t migration_admin_slot;            // who asked for the migration under way, until it hangs up
+    int has_migration_admin;
 
     pthread_mutex_t state_mutex;
     int is_running;
 
     int tick_interval_ms;
+    int tick_min_ms;
+    int tick_max_ms;
+    uint64_t tick_window_cost_us;
+    uint64_t tick_window_late_us;
+    uint32_t tick_window_count;
+    metrics_t metrics;
+    uint32_t respawns_deferred;
+    uint64_t tick_start_us;
+    int adaptive_rate;
     game_mode_t game_mode;
     uint32_t timed_duration_ms;
 
     world_type_t world_type;
     char map_file_path[256];
 
+    char map_rotation[MAP_ROTATION_MAX][256];
+    int map_rotation_count;
+    int map_rotation_index;
+
+    pthread_t map_loader_thread;
+    pthread_cond_t map_loader_cond;
+    int map_load_requested;
+    char map_load_path[256];
+    game_map_t *pending_map;
+
     game_state_t game_state;
+    bot_manager_t bots;
     int game_over_sent;
+
+    view_cache_t view_cache;
+    uint8_t minimap[VIEW_MINIMAP_MAX_WIDTH * VIEW_MINIMAP_MAX_HEIGHT];
+    state_message_t *state_buf;
+    size_t state_buf_cap;
+    roster_message_t *roster_buf;
+    size_t roster_buf_cap;
+
+    int lockstep_enabled;
+    uint32_t lockstep_hash_every;
+    uint8_t lockstep_events[LOCKSTEP_EVENT_BUF_SIZE];
+    size_t lockstep_events_len;
+    uint16_t lockstep_event_count;
+    int lockstep_events_overflow;
+    uint8_t *lockstep_keyframe_buf;
+    size_t lockstep_keyframe_cap;
+
+    snapring_t shm_ring;
+    int shm_ring_overflow_reported;
+
+    int spectator_every;
+    game_pos_t spectator_center;
+    view_rect_t spectator_view;
+    uint32_t spectator_view_serial;
+    uint32_t spectator_status_serial;
+    uint32_t spectator_roster_serial;
+    int spectator_view_valid;
 } server_context_t;
 
 static uint64_t monotonic_ms(void) {
@@ -45,12 +246,25 @@ static uint64_t monotonic_ms(void) {
     return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
 }
 
-static int create_listen_socket(uint16_t port) {
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)(ts.tv_nsec / 1000ULL);
+}
+
+static int create_listen_socket(uint16_t port, const socket_tuning_t *tuning, int reuse_port) {
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd < 0) return -1;
 
     int yes = 1;
     setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        close(listen_fd);
+        return -1;
+    }
+    if (socket_apply_buffers(listen_fd, tuning) < 0) {
+        fprintf(stderr, "server: socket buffer sizing failed: %s\n", strerror(errno));
+    }
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -69,26 +283,33 @@ static int create_listen_socket(uint16_t port) {
     return listen_fd;
 }
 
-static void server_init(server_context_t *server_ctx,
-                        int listen_fd,
-                        uint8_t map_width,
-                        uint8_t map_height,
-                        game_mode_t mode,
-                        uint32_t timed_duration_ms,
-                        world_type_t world_type,
-                        const char *map_file_path) {
+static int server_init(server_context_t *server_ctx,
+                       int listen_fd,
+                       uint16_t map_width,
+                       uint16_t map_height,
+                       game_mode_t mode,
+                       uint32_t timed_duration_ms,
+                       world_type_t world_type,
+                       const char *map_file_path) {
     memset(server_ctx, 0, sizeof(*server_ctx));
 
     server_ctx->listen_socket_fd = listen_fd;
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        server_ctx->client_slots[i].client_socket_fd = -1;
-    }
+    server_ctx->local_listen_fd = -1;
+    server_ctx->handoff_fd = -1;
+    server_ctx->room_count = 1;
+    server_ctx->room_capacity = ROOM_DEFAULT_CAPACITY;
 
     pthread_mutex_init(&server_ctx->state_mutex, NULL);
+    pthread_cond_init(&server_ctx->map_loader_cond, NULL);
+    pthread_cond_init(&server_ctx->checkpoint_cond, NULL);
+    server_ctx->checkpoint_interval_ms = CHECKPOINT_DEFAULT_MS;
     server_ctx->is_running = 1;
 
-    server_ctx->tick_interval_ms = 200;
+    server_ctx->tick_interval_ms = TICK_DEFAULT_MS;
+    server_ctx->tick_min_ms = TICK_DEFAULT_MS;
+    server_ctx->tick_max_ms = TICK_DEFAULT_MS;
+    metrics_init(&server_ctx->metrics);
+    server_ctx->adaptive_rate = 1;
     server_ctx->game_mode = mode;
     server_ctx->timed_duration_ms = timed_duration_ms;
 
@@ -99,92 +320,276 @@ static void server_init(server_context_t *server_ctx,
         server_ctx->map_file_path[sizeof(server_ctx->map_file_path) - 1] = '\0';
     }
 
-    game_init(&server_ctx->game_state, map_width, map_height, mode, timed_duration_ms, world_type);
+    server_ctx->map_rotation_count = 0;
+    server_ctx->map_rotation_index = 0;
+    if (map_file_path && map_file_path[0] != '\0') {
+        const char *cursor = map_file_path;
+        while (*cursor != '\0' && server_ctx->map_rotation_count < MAP_ROTATION_MAX) {
+            const char *sep = strchr(cursor, ',');
+            size_t len = sep ? (size_t)(sep - cursor) : strlen(cursor);
+            if (len > 0 && len < sizeof(server_ctx->map_rotation[0])) {
+                char *dst = server_ctx->map_rotation[server_ctx->map_rotation_count++];
+                memcpy(dst, cursor, len);
+                dst[len] = '\0';
+            }
+            if (!sep) break;
+            cursor = sep + 1;
+        }
+    }
+    if (server_ctx->map_rotation_count > 0) {
+        strncpy(server_ctx->map_file_path, server_ctx->map_rotation[0], sizeof(server_ctx->map_file_path) - 1);
+        server_ctx->map_file_path[sizeof(server_ctx->map_file_path) - 1] = '\0';
+    }
+
+    server_ctx->map_load_requested = 0;
+    server_ctx->map_load_path[0] = '\0';
+    server_ctx->pending_map = NULL;
+    view_cache_init(&server_ctx->view_cache);
+
+    if (game_init(&server_ctx->game_state, map_width, map_height, mode, timed_duration_ms, world_type) != 0) return -1;
 
     uint64_t now = monotonic_ms();
     server_ctx->game_state.start_time_ms = now;
     if (mode == GAME_MODE_TIMED) server_ctx->game_state.timed_end_ms = now + (uint64_t)timed_duration_ms;
 
     server_ctx->game_over_sent = 0;
+    server_ctx->spectator_every = 1;
+    server_ctx->spectator_center.x = UINT16_MAX;
+    server_ctx->spectator_center.y = UINT16_MAX;
+    return 0;
 }
 
-static int server_add_client(server_context_t *server_ctx, int client_fd, int *out_slot_index) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (server_ctx->client_slots[i].client_socket_fd < 0) {
-            server_ctx->client_slots[i].client_socket_fd = client_fd;
-            *out_slot_index = i;
-            return 0;
-        }
+static int grow_client_slots(server_context_t *server_ctx) {
+    size_t old_cap = server_ctx->client_slot_cap;
+    if (old_cap >= SERVER_MAX_CONNECTIONS) return -1;
+
+    size_t cap = old_cap ? old_cap * 2 : SERVER_CONNECTIONS_INITIAL;
+    if (cap > SERVER_MAX_CONNECTIONS) cap = SERVER_MAX_CONNECTIONS;
+
+    size_t *active = (size_t*)realloc(server_ctx->active_slots, cap * sizeof(size_t));
+    if (!active) return -1;
+    server_ctx->active_slots = active;
+    size_t *free_slots = (size_t*)realloc(server_ctx->free_slots, cap * sizeof(size_t));
+    if (!free_slots) return -1;
+    server_ctx->free_slots = free_slots;
+
+    client_slot_t *slots = (client_slot_t*)realloc(server_ctx->client_slots, cap * sizeof(client_slot_t));
+    if (!slots) return -1;
+    for (size_t i = old_cap; i < cap; i++) {
+        memset(&slots[i], 0, sizeof(slots[i]));
+        slots[i].client_socket_fd = -1;
     }
-    return -1;
+    for (size_t i = cap; i > old_cap; i--) free_slots[server_ctx->free_count++] = i - 1;
+
+    server_ctx->client_slots = slots;
+    server_ctx->client_slot_cap = cap;
+    return 0;
 }
 
-static void server_close_slot_fd(server_context_t *server_ctx, int slot_index) {
-    int client_fd = server_ctx->client_slots[slot_index].client_socket_fd;
-    if (client_fd >= 0) {
-        close(client_fd);
-        server_ctx->client_slots[slot_index].client_socket_fd = -1;
-    }
+// Admin requests are taken only from AF_UNIX peers, which are on this host by construction.
+static int socket_is_local(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    return getsockname(fd, (struct sockaddr*)&addr, &addr_len) == 0 && addr.ss_family == AF_UNIX;
+}
+
+static int server_add_client(server_context_t *server_ctx, int client_fd, size_t *out_slot_index) {
+    if (server_ctx->free_count == 0 && grow_client_slots(server_ctx) != 0) return -1;
+    size_t i = server_ctx->free_slots[--server_ctx->free_count];
+
+    client_slot_t *slot = &server_ctx->client_slots[i];
+    memset(slot, 0, sizeof(*slot));
+    msg_reader_init(&slot->reader);
+    slot->client_socket_fd = client_fd;
+    slot->active_index = server_ctx->active_count;
+    server_ctx->active_slots[server_ctx->active_count++] = i;
+    slot->is_local = socket_is_local(client_fd);
+    // Only a migration image from a process on this host may exceed the small inbound cap.
+    slot->reader.max_payload = MSG_INBOUND_PAYLOAD_LEN;
+    if (slot->is_local) slot->reader.bulk_type = MSG_MIGRATE_STATE;
+    slot->needs_keyframe = 1;
+    slot->needs_roster = 1;
+    slot->player_id = GAME_PLAYER_NONE;
+    slot->view_width = VIEW_DEFAULT_WIDTH;
+    slot->view_height = VIEW_DEFAULT_HEIGHT;
+    slot->follow_id = GAME_PLAYER_NONE;
+    slot->view_center.x = UINT16_MAX;
+    slot->view_center.y = UINT16_MAX;
+    slot->rate_interval = 1;
+    uint64_t now = monotonic_ms();
+    slot->input_bucket.milli_tokens = FLOOD_INPUT_BURST * 1000u;
+    slot->input_bucket.refill_ms = now;
+    slot->control_bucket.milli_tokens = FLOOD_CONTROL_BURST * 1000u;
+    slot->control_bucket.refill_ms = now;
+    slot->flood_window_ms = now;
+    *out_slot_index = i;
+    return 0;
+}
+
+static transport_t *slot_transport(server_context_t *server_ctx, size_t slot_index) {
+    return &server_ctx->reactors[slot_index % (size_t)server_ctx->reactor_count].transport;
+}
+
+// Replies queue behind whatever the slot's reactor is still sending on the socket.
+static void server_reply(server_context_t *server_ctx, size_t slot_index, int client_fd, uint16_t message_type, const char *text) {
+    transport_send_message(slot_transport(server_ctx, slot_index), client_fd, message_type, text, (uint32_t)strlen(text));
+}
+
+// For a reply that ends the connection: the socket is shut down once the reply is out.
+static void server_reply_final(server_context_t *server_ctx, size_t slot_index, int client_fd, uint16_t message_type,
+                               const char *text) {
+    transport_send_final(slot_transport(server_ctx, slot_index), client_fd, message_type, text, (uint32_t)strlen(text));
+}
+
+static void server_stop(server_context_t *server_ctx) {
+    server_ctx->is_running = 0;
+    for (int r = 0; r < server_ctx->reactor_count; r++) transport_wake(&server_ctx->reactors[r].transport);
+}
+
+static void shared_frame_release(shared_frame_t *frame) {
+    if (frame && --frame->refcount == 0) free(frame);
 }
 
-static int find_slot_by_fd(server_context_t *server_ctx, int fd) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (server_ctx->client_slots[i].client_socket_fd == fd) return i;
+static void server_close_slot_fd(server_context_t *server_ctx, size_t slot_index) {
+    client_slot_t *slot = &server_ctx->client_slots[slot_index];
+    if (server_ctx->has_migration_staged && server_ctx->migration_staged_slot == slot_index) {
+        // The source went away without committing, so it still runs the match.
+        checkpoint_image_free(&server_ctx->migration_staged);
+        server_ctx->has_migration_staged = 0;
+        server_ctx->migrating = 0;
     }
-    return -1;
+    if (server_ctx->has_migration_admin && server_ctx->migration_admin_slot == slot_index) server_ctx->has_migration_admin = 0;
+    if (slot->client_socket_fd >= 0) {
+        transport_remove(slot_transport(server_ctx, slot_index), slot->client_socket_fd);
+        close(slot->client_socket_fd);
+        slot->client_socket_fd = -1;
+
+        size_t last = server_ctx->active_slots[--server_ctx->active_count];
+        server_ctx->active_slots[slot->active_index] = last;
+        server_ctx->client_slots[last].active_index = slot->active_index;
+        server_ctx->free_slots[server_ctx->free_count++] = slot_index;
+    }
+    if (slot->respawn_deferred) {
+        slot->respawn_deferred = 0;
+        server_ctx->respawns_deferred--;
+    }
+    msg_reader_free(&slot->reader);
+    shared_frame_release(slot->pending_frame);
+    slot->pending_frame = NULL;
+    slot->writable_armed = 0;
+    slot->is_spectator = 0;
+    slot->player_id = GAME_PLAYER_NONE;
 }
 
-static void drain_payload_if_any(int fd, uint16_t payload_len) {
-    char tmp[256];
-    uint16_t rem = payload_len;
-    while (rem > 0) {
-        uint16_t chunk = rem > (uint16_t)sizeof(tmp) ? (uint16_t)sizeof(tmp) : rem;
-        if (recv_all_bytes(fd, tmp, chunk) < 0) return;
-        rem = (uint16_t)(rem - chunk);
+static void server_record_event(void *sink_ctx, const game_event_t *event) {
+    server_context_t *server_ctx = (server_context_t*)sink_ctx;
+    if (server_ctx->lockstep_events_overflow) return;
+
+    size_t room = sizeof(server_ctx->lockstep_events) - server_ctx->lockstep_events_len;
+    size_t written = game_event_encode(event, server_ctx->game_state.start_time_ms,
+                                       server_ctx->lockstep_events + server_ctx->lockstep_events_len, room);
+    if (written == 0 || server_ctx->lockstep_event_count == UINT16_MAX) {
+        server_ctx->lockstep_events_overflow = 1;
+        return;
     }
+    server_ctx->lockstep_events_len += written;
+    server_ctx->lockstep_event_count++;
 }
 
-static void migrate_client_slot(server_context_t *server_ctx, int from_slot, int to_slot) {
-    if (from_slot == to_slot) return;
-    int fd = server_ctx->client_slots[from_slot].client_socket_fd;
-    server_ctx->client_slots[from_slot].client_socket_fd = -1;
-    server_ctx->client_slots[to_slot].client_socket_fd = fd;
+static void server_request_keyframe_for_all(server_context_t *server_ctx) {
+    for (size_t n = 0; n < server_ctx->active_count; n++) server_ctx->client_slots[server_ctx->active_slots[n]].needs_keyframe = 1;
 }
 
-static void fill_state_player_list(const server_context_t *server_ctx, state_player_info_t *out_players) {
+static void broadcast_lockstep_tick(server_context_t *server_ctx, uint64_t now_ms) {
     const game_state_t *g = &server_ctx->game_state;
-    int global_paused = g->global_pause_active ? 1 : 0;
-    int global_frozen = 0;
-    uint64_t now = monotonic_ms();
-    if (g->global_freeze_until_ms != 0 && now < g->global_freeze_until_ms) global_frozen = 1;
-
-    for (int i = 0; i < STATE_MAX_PLAYERS; i++) {
-        state_player_info_t *p = &out_players[i];
-        const game_player_t *gp = &g->players[i];
-
-        memset(p, 0, sizeof(*p));
-        p->is_used = gp->is_active ? 1 : 0;
-        p->has_joined = gp->has_joined ? 1 : 0;
-        p->is_alive = gp->is_alive ? 1 : 0;
-        p->is_paused = (gp->is_paused || global_paused || global_frozen) ? 1 : 0;
-        p->score_net = htons(gp->score);
-
-        if (gp->player_name[0] != '\0') {
-            strncpy((char*)p->name, gp->player_name, STATE_NAME_MAX - 1);
-            p->name[STATE_NAME_MAX - 1] = '\0';
-        } else {
-            p->name[0] = '\0';
+
+    if (server_ctx->lockstep_events_overflow) server_request_keyframe_for_all(server_ctx);
+
+    uint8_t tick_buf[sizeof(lockstep_tick_header_t) + LOCKSTEP_EVENT_BUF_SIZE];
+    lockstep_tick_header_t *tick_header = (lockstep_tick_header_t*)tick_buf;
+    memset(tick_header, 0, sizeof(*tick_header));
+    tick_header->tick_counter_net = htonl(g->tick_counter);
+    tick_header->now_offset_ms_net = htonl((uint32_t)(now_ms - g->start_time_ms));
+    tick_header->event_count_net = htons(server_ctx->lockstep_event_count);
+    if (server_ctx->lockstep_hash_every > 0 && g->tick_counter % server_ctx->lockstep_hash_every == 0) {
+        tick_header->has_state_hash = 1;
+        tick_header->state_hash_net = htonl(game_state_hash(g, now_ms));
+    }
+    memcpy(tick_buf + sizeof(*tick_header), server_ctx->lockstep_events, server_ctx->lockstep_events_len);
+    uint32_t tick_len = (uint32_t)(sizeof(*tick_header) + server_ctx->lockstep_events_len);
+
+    size_t keyframe_len = 0;
+    int keyframe_ready = 0;
+
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        client_slot_t *slot = &server_ctx->client_slots[i];
+        transport_t *t = slot_transport(server_ctx, i);
+
+        // Every tick must reach a lockstep client in order, so one that stays behind cannot skip
+        // ahead like a state client; it is cut off and its reactor drops it.
+        if (transport_backlog_len(t, slot->client_socket_fd) == 0) {
+            slot->lockstep_lag_ticks = 0;
+        } else if (++slot->lockstep_lag_ticks > LOCKSTEP_MAX_LAG_TICKS) {
+            if (slot->lockstep_lag_ticks == LOCKSTEP_MAX_LAG_TICKS + 1) {
+                fprintf(stderr, "server: dropping lockstep client %zu: %d ticks behind\n", i, LOCKSTEP_MAX_LAG_TICKS);
+                shutdown(slot->client_socket_fd, SHUT_RDWR);
+            }
+            continue;
+        }
+
+        if (!slot->needs_keyframe) {
+            if (transport_send_frame(t, slot->client_socket_fd, MSG_LOCKSTEP_TICK, tick_buf, tick_len) != 0) slot->needs_keyframe = 1;
+            continue;
+        }
+
+        if (!keyframe_ready) {
+            size_t needed = sizeof(lockstep_keyframe_header_t) + game_snapshot_size(g, now_ms);
+            if (needed > server_ctx->lockstep_keyframe_cap) {
+                uint8_t *grown = (uint8_t*)realloc(server_ctx->lockstep_keyframe_buf, needed);
+                if (!grown) {
+                    fprintf(stderr, "server: out of memory for keyframe\n");
+                    break;
+                }
+                server_ctx->lockstep_keyframe_buf = grown;
+                server_ctx->lockstep_keyframe_cap = needed;
+            }
+
+            lockstep_keyframe_header_t *kf_header = (lockstep_keyframe_header_t*)server_ctx->lockstep_keyframe_buf;
+            kf_header->now_ms_high_net = htonl((uint32_t)(now_ms >> 32));
+            kf_header->now_ms_low_net = htonl((uint32_t)now_ms);
+            if (game_snapshot_encode(g, now_ms,
+                                     server_ctx->lockstep_keyframe_buf + sizeof(*kf_header),
+                                     server_ctx->lockstep_keyframe_cap - sizeof(*kf_header),
+                                     &keyframe_len) != 0) {
+                fprintf(stderr, "server: keyframe does not fit\n");
+                break;
+            }
+            keyframe_len += sizeof(*kf_header);
+            keyframe_ready = 1;
+        }
+
+        if (transport_send_frame(t, slot->client_socket_fd, MSG_LOCKSTEP_KEYFRAME, server_ctx->lockstep_keyframe_buf,
+                                 (uint32_t)keyframe_len) == 0) {
+            slot->needs_keyframe = 0;
         }
     }
+    for (int r = 0; r < server_ctx->reactor_count; r++) transport_send_commit(&server_ctx->reactors[r].transport);
+
+    server_ctx->lockstep_events_len = 0;
+    server_ctx->lockstep_event_count = 0;
+    server_ctx->lockstep_events_overflow = 0;
 }
 
-static void build_game_over_payload(const game_state_t *g, uint64_t now_ms, game_over_message_t *out_msg) {
-    memset(out_msg, 0, sizeof(*out_msg));
+static game_over_message_t *build_game_over_payload(const game_state_t *g, uint64_t now_ms, uint32_t *out_len) {
+    size_t len = sizeof(game_over_message_t) + (size_t)g->player_count * sizeof(game_over_player_entry_t);
+    game_over_message_t *out_msg = (game_over_message_t*)calloc(1, len);
+    if (!out_msg) return NULL;
     out_msg->elapsed_ms_net = htonl(game_get_elapsed_ms(g, now_ms));
 
-    uint8_t count = 0;
-    for (int i = 0; i < GAME_MAX_PLAYERS; i++) {
-        const game_player_t *pl = &g->players[i];
+    uint16_t count = 0;
+    for (uint32_t i = 0; i < g->player_count; i++) {
+        const game_player_t *pl = game_player_at(g, i);
         if (!pl->has_joined) continue;
 
         game_over_player_entry_t *e = &out_msg->players[count];
@@ -199,424 +604,2118 @@ static void build_game_over_payload(const game_state_t *g, uint64_t now_ms, game
         if (snake_time_ms > 0xFFFFFFFFULL) snake_time_ms = 0xFFFFFFFFULL;
         e->snake_time_ms_net = htonl((uint32_t)snake_time_ms);
 
-        strncpy((char*)e->name, pl->player_name, STATE_NAME_MAX - 1);
-        e->name[STATE_NAME_MAX - 1] = '\0';
+        memcpy(e->name, pl->player_name, strnlen(pl->player_name, STATE_NAME_MAX - 1));
 
         count++;
-        if (count >= STATE_MAX_PLAYERS) break;
     }
 
-    out_msg->player_count = count;
+    out_msg->player_count_net = htons(count);
+    *out_len = (uint32_t)(sizeof(game_over_message_t) + (size_t)count * sizeof(game_over_player_entry_t));
+    return out_msg;
 }
 
 static void send_game_over_to_all(server_context_t *server_ctx) {
     if (server_ctx->game_over_sent) return;
 
     uint64_t now = monotonic_ms();
-    game_over_message_t msg;
+    uint32_t msg_len = 0;
 
     pthread_mutex_lock(&server_ctx->state_mutex);
-    build_game_over_payload(&server_ctx->game_state, now, &msg);
+    game_over_message_t *msg = build_game_over_payload(&server_ctx->game_state, now, &msg_len);
+    if (!msg) {
+        fprintf(stderr, "server: out of memory for game over\n");
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
         int fd = server_ctx->client_slots[i].client_socket_fd;
-        if (fd >= 0) send_message(fd, MSG_GAME_OVER, &msg, (uint16_t)sizeof(msg));
+        if (!server_ctx->client_slots[i].pending_frame) {
+            transport_send_message(slot_transport(server_ctx, i), fd, MSG_GAME_OVER, msg, msg_len);
+        }
     }
+    free(msg);
 
     server_ctx->game_over_sent = 1;
     pthread_mutex_unlock(&server_ctx->state_mutex);
 }
 
-static int validate_player_name_len(uint16_t payload_len) {
+// After a migration the clients rejoin the match where it now runs instead of seeing it end.
+static void send_redirect_to_all(server_context_t *server_ctx) {
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        int fd = server_ctx->client_slots[i].client_socket_fd;
+        if (!server_ctx->client_slots[i].pending_frame) {
+            transport_send_message(slot_transport(server_ctx, i), fd, MSG_REDIRECT, &server_ctx->redirect,
+                                   (uint32_t)sizeof(server_ctx->redirect));
+        }
+    }
+    server_ctx->game_over_sent = 1;
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+}
+
+static int validate_player_name_len(uint32_t payload_len) {
     if (payload_len == 0) return -1;
     if (payload_len >= GAME_MAX_NAME_LEN) return -1;
     return 0;
 }
 
-static void handle_client_message(server_context_t *server_ctx, int client_fd) {
-    message_header_t header_net;
-    if (recv_message_header(client_fd, &header_net) < 0) {
-        shutdown(client_fd, SHUT_RDWR);
-        return;
-    }
-
-    uint16_t message_type = ntohs(header_net.message_type_net);
-    uint16_t payload_len  = ntohs(header_net.payload_len_net);
-
-    int slot_index = find_slot_by_fd(server_ctx, client_fd);
-    if (slot_index < 0) {
-        drain_payload_if_any(client_fd, payload_len);
-        shutdown(client_fd, SHUT_RDWR);
-        return;
+static int server_request_map_load(server_context_t *server_ctx, const char *map_path) {
+    if (map_path && map_path[0] != '\0') {
+        strncpy(server_ctx->map_load_path, map_path, sizeof(server_ctx->map_load_path) - 1);
+        server_ctx->map_load_path[sizeof(server_ctx->map_load_path) - 1] = '\0';
+    } else if (server_ctx->map_rotation_count > 0) {
+        server_ctx->map_rotation_index = (server_ctx->map_rotation_index + 1) % server_ctx->map_rotation_count;
+        strncpy(server_ctx->map_load_path, server_ctx->map_rotation[server_ctx->map_rotation_index], sizeof(server_ctx->map_load_path) - 1);
+        server_ctx->map_load_path[sizeof(server_ctx->map_load_path) - 1] = '\0';
+    } else {
+        return -1;
     }
 
-    if (message_type == MSG_SHUTDOWN) {
-        drain_payload_if_any(client_fd, payload_len);
-        server_ctx->is_running = 0;
-        return;
-    }
+    server_ctx->map_load_requested = 1;
+    pthread_cond_signal(&server_ctx->map_loader_cond);
+    return 0;
+}
 
-    if (message_type == MSG_PAUSE) {
-        drain_payload_if_any(client_fd, payload_len);
+static void server_free_map(game_map_t *map) {
+    if (!map) return;
+    game_map_free(map);
+    free(map);
+}
 
-        pthread_mutex_lock(&server_ctx->state_mutex);
+static void *server_map_loader_thread(void *arg) {
+    server_context_t *server_ctx = (server_context_t*)arg;
 
-        game_handle_pause(&server_ctx->game_state, slot_index);
-        server_close_slot_fd(server_ctx, slot_index);
-        server_ctx->game_state.players[slot_index].is_active = 0;
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    while (server_ctx->is_running) {
+        if (!server_ctx->map_load_requested) {
+            pthread_cond_wait(&server_ctx->map_loader_cond, &server_ctx->state_mutex);
+            continue;
+        }
 
+        char map_path[256];
+        memcpy(map_path, server_ctx->map_load_path, sizeof(map_path));
+        server_ctx->map_load_requested = 0;
         pthread_mutex_unlock(&server_ctx->state_mutex);
-        return;
-    }
 
-    if (message_type == MSG_LEAVE) {
-        drain_payload_if_any(client_fd, payload_len);
-        uint64_t now = monotonic_ms();
+        game_map_t *map = (game_map_t*)malloc(sizeof(*map));
+        int load_rc = map ? game_map_load(map, map_path) : -1;
+        if (load_rc != 0) {
+            fprintf(stderr, "server: failed to load map: %s\n", map_path);
+            free(map);
+            map = NULL;
+        }
 
         pthread_mutex_lock(&server_ctx->state_mutex);
-        server_close_slot_fd(server_ctx, slot_index);
-        game_handle_leave(&server_ctx->game_state, slot_index, now);
-        pthread_mutex_unlock(&server_ctx->state_mutex);
-        return;
+        if (map) {
+            server_free_map(server_ctx->pending_map);
+            server_ctx->pending_map = map;
+            strncpy(server_ctx->map_file_path, map_path, sizeof(server_ctx->map_file_path) - 1);
+            server_ctx->map_file_path[sizeof(server_ctx->map_file_path) - 1] = '\0';
+        }
     }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
 
-    if (message_type == MSG_JOIN) {
-        if (validate_player_name_len(payload_len) != 0) {
-            drain_payload_if_any(client_fd, payload_len);
-            const char *error_text = "bad player name length (max 31)";
-            send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
-            shutdown(client_fd, SHUT_RDWR);
-            return;
-        }
+    return NULL;
+}
 
-        char player_name[GAME_MAX_NAME_LEN];
-        memset(player_name, 0, sizeof(player_name));
+static void server_drop_client(server_context_t *server_ctx, size_t slot_index) {
+    client_slot_t *slot = &server_ctx->client_slots[slot_index];
+    game_player_id_t player_id = slot->player_id;
+    shutdown(slot->client_socket_fd, SHUT_RDWR);
+    server_close_slot_fd(server_ctx, slot_index);
+    game_emit_event(&server_ctx->game_state, GAME_EVENT_DEACTIVATE, player_id, 0, NULL, monotonic_ms());
+}
 
-        if (recv_all_bytes(client_fd, player_name, payload_len) < 0) {
-            shutdown(client_fd, SHUT_RDWR);
-            return;
-        }
-        player_name[payload_len] = '\0';
+// Sends the socket to the worker hosting room, together with the JOIN and anything read after
+// it; that worker replays them as if it had read them itself. Only our copy of the fd is closed.
+static void server_route_join(server_context_t *server_ctx, size_t slot_index, uint16_t room) {
+    client_slot_t *slot = &server_ctx->client_slots[slot_index];
+    int client_fd = slot->client_socket_fd;
+
+    char peer_name[LOCAL_SOCKET_NAME_MAX];
+    handoff_socket_name(peer_name, sizeof(peer_name), server_ctx->port, room);
+    size_t resume_offset = slot->reader.start;
+    msg_reader_rewind(&slot->reader, slot->reader.last_frame_offset);
+    int rc = room < server_ctx->room_count
+                 ? handoff_send(server_ctx->handoff_fd, peer_name, client_fd, slot->reader.buf + slot->reader.start,
+                                slot->reader.len - slot->reader.start)
+                 : -1;
 
-        uint64_t now = monotonic_ms();
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    if (rc != 0) {
+        // Past the JOIN again; the reactor drops the client once the error is out.
+        msg_reader_rewind(&slot->reader, resume_offset);
+        const char *error_text = room < server_ctx->room_count ? "room unavailable" : "no such room";
+        server_reply_final(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+    } else {
+        game_player_id_t player_id = slot->player_id;
+        server_close_slot_fd(server_ctx, slot_index);
+        game_emit_event(&server_ctx->game_state, GAME_EVENT_DEACTIVATE, player_id, 0, NULL, monotonic_ms());
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+}
 
-        pthread_mutex_lock(&server_ctx->state_mutex);
+// Opens a non-blocking stream to the process taking over the match: its local socket, or for
+// one room of a --workers set, a socket pair whose far end is handed to that room's worker.
+static int migrate_connect(uint16_t port, uint16_t room) {
+    if (room == JOIN_ROOM_ANY) {
+        char name[LOCAL_SOCKET_NAME_MAX];
+        local_socket_default_name(name, sizeof(name), port);
+        return local_socket_connect_flags(name, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    }
 
-        int paused_slot = game_find_paused_player_by_name(&server_ctx->game_state, player_name);
-        if (paused_slot >= 0) {
-            if (paused_slot != slot_index) {
-                migrate_client_slot(server_ctx, slot_index, paused_slot);
-                game_mark_client_inactive_keep_or_clear(&server_ctx->game_state, slot_index, 0);
-                slot_index = paused_slot;
-            }
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) return -1;
+    // Only our end: the target's reactor expects the blocking socket an accept would give it.
+    int fl = fcntl(pair[0], F_GETFL, 0);
+    if (fl < 0 || fcntl(pair[0], F_SETFL, fl | O_NONBLOCK) != 0) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    char peer_name[LOCAL_SOCKET_NAME_MAX];
+    handoff_socket_name(peer_name, sizeof(peer_name), port, room);
+
+    int sender_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int rc = sender_fd >= 0 ? handoff_send(sender_fd, peer_name, pair[1], NULL, 0) : -1;
+    int saved = errno;
+    if (sender_fd >= 0) close(sender_fd);
+    close(pair[1]);
+    if (rc != 0) {
+        close(pair[0]);
+        errno = saved;
+        return -1;
+    }
+    return pair[0];
+}
 
-            game_mark_client_active(&server_ctx->game_state, slot_index);
-            (void)game_resume_player(&server_ctx->game_state, slot_index, now);
+// Waits for fd to become ready for events; 0 once it is, -1 at the deadline or on error.
+static int migrate_poll(int fd, short events, uint64_t deadline) {
+    for (;;) {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) return -1;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, (int)(deadline - now));
+        if (n > 0) return 0;
+        if (n < 0 && errno != EINTR) return -1;
+    }
+}
 
-            if (server_ctx->game_state.global_pause_active &&
-                strncmp(server_ctx->game_state.global_pause_owner_name, player_name, GAME_MAX_NAME_LEN) == 0) {
-                server_ctx->game_state.global_pause_active = 0;
-                server_ctx->game_state.global_pause_owner_name[0] = '\0';
-                server_ctx->game_state.global_freeze_until_ms = now + 3000ULL;
-            } else {
-                server_ctx->game_state.global_freeze_until_ms = now + 3000ULL;
-            }
+static int migrate_send(int fd, const void *data, size_t len, uint64_t deadline) {
+    size_t offset = 0;
+    for (;;) {
+        int rc = send_pending_bytes(fd, (const uint8_t*)data, len, &offset);
+        if (rc != 0) return rc > 0 ? 0 : -1;
+        if (migrate_poll(fd, POLLOUT, deadline) != 0) return -1;
+    }
+}
 
-            pthread_mutex_unlock(&server_ctx->state_mutex);
+// Returns 0 once the target confirms with MSG_TEXT; its MSG_ERROR text lands in reply.
+static int migrate_await_reply(int fd, char *reply, size_t reply_cap, uint64_t deadline) {
+    msg_reader_t reader;
+    msg_reader_init(&reader);
+    int rc = -1;
 
-            const char *welcome_text = "RESUMED | WASD move | p pause | q leave | r respawn";
-            send_message(client_fd, MSG_WELCOME, welcome_text, (uint16_t)strlen(welcome_text));
-            return;
+    for (;;) {
+        if (migrate_poll(fd, POLLIN, deadline) != 0) {
+            snprintf(reply, reply_cap, "target did not answer in time");
+            break;
         }
+        if (msg_reader_fill(&reader, fd) < 0) break;
+
+        uint16_t msg_type = 0;
+        const uint8_t *payload = NULL;
+        uint32_t payload_len = 0;
+        if (msg_reader_next(&reader, &msg_type, &payload, &payload_len) > 0) {
+            size_t n = payload_len < reply_cap - 1 ? payload_len : reply_cap - 1;
+            memcpy(reply, payload, n);
+            reply[n] = '\0';
+            rc = msg_type == MSG_TEXT ? 0 : -1;
+            break;
+        }
+        if (reader.eof) break;
+    }
+    msg_reader_free(&reader);
+    return rc;
+}
 
-        int join_rc = game_join_new_player(&server_ctx->game_state, slot_index, player_name, now);
+typedef struct {
+    server_context_t *server_ctx;
+    room_target_message_t target;
+    checkpoint_image_t image;
+    uint64_t frozen_us;
+    uint64_t window_ms;
+    uint64_t deadline_ms;
+} migrate_job_t;
+
+// Called with the state lock held; an admin that hung up meanwhile gets nothing.
+static void migrate_reply(server_context_t *server_ctx, uint16_t message_type, const char *text) {
+    if (!server_ctx->has_migration_admin) return;
+    size_t slot_index = server_ctx->migration_admin_slot;
+    server_ctx->has_migration_admin = 0;
+    server_reply(server_ctx, slot_index, server_ctx->client_slots[slot_index].client_socket_fd, message_type, text);
+}
 
-        pthread_mutex_unlock(&server_ctx->state_mutex);
+// Runs the transfer off the reactors in two phases. Until the target confirms it has staged the
+// image, one deadline a couple of ticks out bounds everything, and missing it abandons the
+// transfer and resumes ticking; the target never starts a match it was not told to commit.
+// Once MSG_MIGRATE_COMMIT is on its way this server never resumes, whatever happens next.
+static void *server_migrate_thread(void *arg) {
+    migrate_job_t *job = (migrate_job_t*)arg;
+    server_context_t *server_ctx = job->server_ctx;
+    uint16_t port = ntohs(job->target.port_net);
+    uint16_t room = ntohs(job->target.room_net);
 
-        if (join_rc < 0) {
-            const char *error_text = "JOIN failed";
-            send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
-            shutdown(client_fd, SHUT_RDWR);
-            return;
+    message_header_t header_net;
+    header_net.message_type_net = htons(MSG_MIGRATE_STATE);
+    header_net.payload_len_net = htonl((uint32_t)job->image.len);
+
+    char reply[128];
+    snprintf(reply, sizeof(reply), "target unreachable");
+    int target_fd = migrate_connect(port, room);
+    int rc = -1;
+    if (target_fd >= 0) {
+        if (migrate_send(target_fd, &header_net, sizeof(header_net), job->deadline_ms) != 0 ||
+            migrate_send(target_fd, job->image.buf, job->image.len, job->deadline_ms) != 0) {
+            snprintf(reply, sizeof(reply), "state not sent in time");
+        } else {
+            rc = migrate_await_reply(target_fd, reply, sizeof(reply), job->deadline_ms);
+            if (rc == 0 && strcmp(reply, "match staged") != 0) rc = -1;
         }
-
-        const char *welcome_text = "WELCOME | WASD move | p pause | q leave | r respawn";
-        send_message(client_fd, MSG_WELCOME, welcome_text, (uint16_t)strlen(welcome_text));
-        return;
     }
 
-    if (message_type == MSG_INPUT) {
-        if (payload_len != sizeof(input_message_t)) {
-            const char *error_text = "bad INPUT length";
-            send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
-            shutdown(client_fd, SHUT_RDWR);
-            return;
+    if (rc == 0) {
+        // The point of no return: the target waits on this and the reply only gets logged.
+        uint64_t commit_deadline = monotonic_ms() + job->window_ms;
+        header_net.message_type_net = htons(MSG_MIGRATE_COMMIT);
+        header_net.payload_len_net = 0;
+        if (migrate_send(target_fd, &header_net, sizeof(header_net), commit_deadline) != 0 ||
+            migrate_await_reply(target_fd, reply, sizeof(reply), commit_deadline) != 0) {
+            fprintf(stderr, "server: port %u did not confirm the commit: %s\n", (unsigned)port, reply);
         }
+    }
+    if (target_fd >= 0) close(target_fd);
+    uint32_t tick = job->image.tick;
+    unsigned long long frozen = (unsigned long long)(monotonic_us() - job->frozen_us);
 
-        input_message_t input_message;
-        if (recv_all_bytes(client_fd, &input_message, sizeof(input_message)) < 0) {
-            shutdown(client_fd, SHUT_RDWR);
-            return;
-        }
+    if (rc != 0) {
+        fprintf(stderr, "server: migration to port %u failed after %llu us: %s\n", (unsigned)port, frozen, reply);
+        char error_text[160];
+        snprintf(error_text, sizeof(error_text), "migration failed: %s", reply);
 
-        direction_t direction = (direction_t)input_message.direction;
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        server_ctx->migrating = 0;
+        migrate_reply(server_ctx, MSG_ERROR, error_text);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+    } else {
+        fprintf(stderr, "server: match migrated to port %u at tick %u, frozen for %llu us\n", (unsigned)port, tick, frozen);
 
         pthread_mutex_lock(&server_ctx->state_mutex);
-        game_handle_input(&server_ctx->game_state, slot_index, direction);
+        // Queued before the stop, so the shutdown drain delivers it.
+        migrate_reply(server_ctx, MSG_TEXT, "match migrated");
+        server_ctx->migrating = 0;
+        server_ctx->is_migrated = 1;
+        server_ctx->redirect = job->target;
+        server_stop(server_ctx);
         pthread_mutex_unlock(&server_ctx->state_mutex);
+    }
+
+    checkpoint_image_free(&job->image);
+    free(job);
+    return NULL;
+}
+
+// The tick thread holds the match still from the capture until the target has it or the
+// deadline passes, and the reactors turn away requests that would change it, so nothing
+// happens that the target will not see; on success this process redirects everyone and exits.
+static void server_migrate(server_context_t *server_ctx, size_t slot_index, int client_fd, const uint8_t *payload, uint32_t payload_len) {
+    room_target_message_t target;
+    if (payload_len != sizeof(target)) {
+        const char *error_text = "bad migrate request";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        return;
+    }
+    memcpy(&target, payload, sizeof(target));
+    uint16_t port = ntohs(target.port_net);
+    uint16_t room = ntohs(target.room_net);
+    if (port == server_ctx->port && (room == JOIN_ROOM_ANY || room == server_ctx->room)) {
+        const char *error_text = "cannot migrate onto itself";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
         return;
     }
 
-    if (message_type == MSG_RESPAWN) {
-        drain_payload_if_any(client_fd, payload_len);
-        uint64_t now = monotonic_ms();
-        pthread_mutex_lock(&server_ctx->state_mutex);
-        (void)game_respawn_player(&server_ctx->game_state, slot_index, now);
+    migrate_job_t *job = (migrate_job_t*)calloc(1, sizeof(*job));
+    if (!job) {
+        const char *error_text = "out of resources";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        return;
+    }
+    job->server_ctx = server_ctx;
+    job->target = target;
+    job->frozen_us = monotonic_us();
+
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    if (server_ctx->migrating || server_ctx->is_migrated) {
         pthread_mutex_unlock(&server_ctx->state_mutex);
+        free(job);
+        const char *error_text = "migration already in progress";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
         return;
     }
+    server_ctx->migrating = 1;
+    job->window_ms = (uint64_t)server_ctx->tick_interval_ms * MIGRATE_DEADLINE_TICKS;
+    job->deadline_ms = monotonic_ms() + job->window_ms;
+    int capture_rc = checkpoint_capture(&job->image, &server_ctx->game_state, &server_ctx->bots, monotonic_ms());
+
+    pthread_t thread;
+    server_ctx->migration_admin_slot = slot_index;
+    server_ctx->has_migration_admin = 1;
+    int started = capture_rc == 0 && pthread_create(&thread, NULL, server_migrate_thread, job) == 0;
+    if (!started) {
+        server_ctx->migrating = 0;
+        server_ctx->has_migration_admin = 0;
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
 
-    drain_payload_if_any(client_fd, payload_len);
-    {
-        const char *error_text = "unknown message type";
-        send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
+    if (!started) {
+        const char *error_text = capture_rc == 0 ? "migration failed: no thread" : "migration failed: capture failed";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        checkpoint_image_free(&job->image);
+        free(job);
+        return;
     }
+    pthread_detach(thread);
 }
 
-static void *server_tick_thread(void *arg) {
-    server_context_t *server_ctx = (server_context_t*)arg;
-
-    while (server_ctx->is_running) {
-        struct timespec sleep_time;
-        sleep_time.tv_sec = server_ctx->tick_interval_ms / 1000;
-        sleep_time.tv_nsec = (long)(server_ctx->tick_interval_ms % 1000) * 1000L * 1000L;
-        nanosleep(&sleep_time, NULL);
-
-        uint64_t now = monotonic_ms();
-
-        state_message_t state_message;
-        memset(&state_message, 0, sizeof(state_message));
+// Caller holds state_mutex. Bots are replaced along with the match; people are not.
+static int server_hosts_players(server_context_t *server_ctx, size_t except_slot) {
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        if (i != except_slot && server_ctx->client_slots[i].player_id != GAME_PLAYER_NONE) return 1;
+    }
+    const game_state_t *g = &server_ctx->game_state;
+    for (uint32_t n = 0; n < g->player_count; n++) {
+        const game_player_t *pl = game_player_at(g, n);
+        if (pl->has_joined && !bot_is_bot(&server_ctx->bots, pl->player_id)) return 1;
+    }
+    return 0;
+}
 
-        pthread_mutex_lock(&server_ctx->state_mutex);
+static void server_accept_migration(server_context_t *server_ctx, size_t slot_index, int client_fd,
+                                    const uint8_t *payload, uint32_t payload_len) {
+    const char *error_text = NULL;
+    if (!server_ctx->client_slots[slot_index].is_local) error_text = "migration only over a local socket";
 
-        state_message.width = server_ctx->game_state.map_width;
-        state_message.height = server_ctx->game_state.map_height;
-        state_message.game_mode = (uint8_t)server_ctx->game_mode;
-        state_message.world_type = (uint8_t)server_ctx->world_type;
+    checkpoint_image_t image;
+    memset(&image, 0, sizeof(image));
+    image.buf = (uint8_t*)payload;
+    image.len = payload_len;
+    if (!error_text && checkpoint_verify(&image) != 0) error_text = "bad match image";
 
-        game_tick(&server_ctx->game_state, now);
+    uint8_t *copy = error_text ? NULL : (uint8_t*)malloc(payload_len);
+    if (!error_text && !copy) error_text = "out of memory";
 
-        if (server_ctx->game_state.should_terminate) {
-            pthread_mutex_unlock(&server_ctx->state_mutex);
-            send_game_over_to_all(server_ctx);
-            pthread_mutex_lock(&server_ctx->state_mutex);
-            server_ctx->is_running = 0;
-        }
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    if (!error_text && (server_ctx->migrating || server_ctx->is_migrated || server_hosts_players(server_ctx, slot_index))) {
+        error_text = "room busy";
+    }
+    if (!error_text) {
+        // Held still and closed to joins until the source commits or goes away.
+        memcpy(copy, payload, payload_len);
+        server_ctx->migration_staged = image;
+        server_ctx->migration_staged.buf = copy;
+        server_ctx->migration_staged.cap = payload_len;
+        server_ctx->migration_staged_slot = slot_index;
+        server_ctx->has_migration_staged = 1;
+        server_ctx->migrating = 1;
+        copy = NULL;
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+    free(copy);
 
-        state_message.tick_counter_net = htonl(server_ctx->game_state.tick_counter);
-        state_message.elapsed_ms_net = htonl(game_get_elapsed_ms(&server_ctx->game_state, now));
-        state_message.remaining_ms_net = htonl(game_get_remaining_ms(&server_ctx->game_state, now));
+    if (error_text) {
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        return;
+    }
+    const char *ok_text = "match staged";
+    server_reply(server_ctx, slot_index, client_fd, MSG_TEXT, ok_text);
+}
 
-        fill_state_player_list(server_ctx, state_message.players);
-        game_build_ascii_map(&server_ctx->game_state, state_message.cells, sizeof(state_message.cells));
+static void server_commit_migration(server_context_t *server_ctx, size_t slot_index, int client_fd) {
+    const char *error_text = NULL;
+    uint32_t tick = 0;
 
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int fd = server_ctx->client_slots[i].client_socket_fd;
-            if (fd >= 0) send_message(fd, MSG_STATE, &state_message, (uint16_t)sizeof(state_message));
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    if (!server_ctx->has_migration_staged || server_ctx->migration_staged_slot != slot_index) {
+        error_text = "nothing staged";
+    } else {
+        tick = server_ctx->migration_staged.tick;
+        if (checkpoint_restore(&server_ctx->migration_staged, &server_ctx->game_state, &server_ctx->bots, monotonic_ms()) != 0) {
+            error_text = "bad match image";
+        } else {
+            server_ctx->game_mode = server_ctx->game_state.game_mode;
+            server_ctx->world_type = server_ctx->game_state.world_type;
+            server_ctx->spectator_view_valid = 0;
+            server_ctx->checkpoint_next_ms = 0;
+            server_request_keyframe_for_all(server_ctx);
+            for (size_t n = 0; n < server_ctx->active_count; n++) server_ctx->client_slots[server_ctx->active_slots[n]].needs_roster = 1;
         }
+        checkpoint_image_free(&server_ctx->migration_staged);
+        server_ctx->has_migration_staged = 0;
+        server_ctx->migrating = 0;
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
 
-        pthread_mutex_unlock(&server_ctx->state_mutex);
+    if (error_text) {
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        return;
     }
+    fprintf(stderr, "server: took over a migrated match at tick %u\n", tick);
+    const char *ok_text = "match taken over";
+    server_reply(server_ctx, slot_index, client_fd, MSG_TEXT, ok_text);
+}
 
-    return NULL;
+// Takes the state lock unless the match is frozen for a migration; a request that would change
+// it then is refused, since the image already on its way would not carry the change.
+static int server_lock_unfrozen(server_context_t *server_ctx) {
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    if (!server_ctx->migrating && !server_ctx->is_migrated) return 0;
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+    return -1;
 }
 
-static int load_map_and_set_size(game_state_t *game_state, const char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
+static void handle_client_message(server_context_t *server_ctx, size_t slot_index,
+                                  uint16_t message_type, const uint8_t *payload, uint32_t payload_len) {
+    int client_fd = server_ctx->client_slots[slot_index].client_socket_fd;
 
-    char line[1024];
-    int width = -1;
-    int height = 0;
+    if (message_type == MSG_SHUTDOWN) {
+        server_stop(server_ctx);
+        return;
+    }
 
-    while (fgets(line, sizeof(line), f)) {
-        size_t len = strlen(line);
-        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-            line[len - 1] = '\0';
-            len--;
-        }
-        if (len == 0) continue;
+    if (message_type == MSG_METRICS) {
+        char report[2048];
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        int len = snprintf(report, sizeof(report), "room %u: ", (unsigned)server_ctx->room);
+        metrics_format(&server_ctx->metrics, server_ctx->tick_interval_ms, monotonic_ms(),
+                       report + len, sizeof(report) - (size_t)len);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        server_reply(server_ctx, slot_index, client_fd, MSG_TEXT, report);
+        return;
+    }
 
-        if (width < 0) width = (int)len;
-        if ((int)len != width) {
-            fclose(f);
-            return -1;
+    if (message_type == MSG_MIGRATE) {
+        // A migration stops this server and moves every player, so only a local admin may ask.
+        if (!server_ctx->client_slots[slot_index].is_local) {
+            const char *error_text = "migrate only over the local socket";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
         }
-        height++;
+        server_migrate(server_ctx, slot_index, client_fd, payload, payload_len);
+        return;
     }
 
-    fclose(f);
-
-    if (width < 5 || height < 5) return -1;
-    if (width > STATE_MAX_WIDTH || height > STATE_MAX_HEIGHT) return -1;
+    if (message_type == MSG_MIGRATE_STATE) {
+        server_accept_migration(server_ctx, slot_index, client_fd, payload, payload_len);
+        return;
+    }
 
-    game_state->map_width = (uint8_t)width;
-    game_state->map_height = (uint8_t)height;
+    if (message_type == MSG_MIGRATE_COMMIT) {
+        server_commit_migration(server_ctx, slot_index, client_fd);
+        return;
+    }
 
-    memset(game_state->obstacle_map, 0, sizeof(game_state->obstacle_map));
+    if (message_type == MSG_PING) {
+        if (payload_len != sizeof(ping_message_t) || server_ctx->client_slots[slot_index].is_spectator) return;
+        ping_message_t pong;
+        memcpy(&pong, payload, sizeof(pong));
+        pong.server_us_net = htonl((uint32_t)monotonic_us());
+        transport_send_message(slot_transport(server_ctx, slot_index), client_fd, MSG_PONG, &pong, (uint32_t)sizeof(pong));
+        return;
+    }
 
-    return game_load_map_from_file(game_state, path);
-}
+    // Spectators are read-only and may be mid-way through a shared frame, so nothing is replied to them.
+    if (server_ctx->client_slots[slot_index].is_spectator &&
+        message_type != MSG_KEYFRAME_REQUEST && message_type != MSG_LEAVE) {
+        return;
+    }
 
-int main(int argc, char **argv) {
-    signal(SIGPIPE, SIG_IGN);
+    if (message_type == MSG_SPECTATE) {
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        client_slot_t *slot = &server_ctx->client_slots[slot_index];
+        if (slot->player_id != GAME_PLAYER_NONE) {
+            pthread_mutex_unlock(&server_ctx->state_mutex);
+            const char *error_text = "already playing";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        const char *welcome_text = "SPECTATING | following the leader | q leave";
+        server_reply(server_ctx, slot_index, client_fd, MSG_WELCOME, welcome_text);
+        slot->is_spectator = 1;
+        slot->needs_keyframe = 1;
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_MAP_RELOAD) {
+        // The server opens whatever path it is given, so only a local admin may ask.
+        if (!server_ctx->client_slots[slot_index].is_local) {
+            const char *error_text = "map reload only over the local socket";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        char map_path[256];
+        if (payload_len >= sizeof(map_path)) {
+            const char *error_text = "bad map path length";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+        memcpy(map_path, payload, payload_len);
+        map_path[payload_len] = '\0';
+
+        if (server_lock_unfrozen(server_ctx) != 0) {
+            const char *error_text = "match is migrating";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+        int request_rc = server_request_map_load(server_ctx, map_path);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+
+        if (request_rc < 0) {
+            const char *error_text = "no map to load";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+        } else {
+            const char *ok_text = "map load scheduled";
+            server_reply(server_ctx, slot_index, client_fd, MSG_TEXT, ok_text);
+        }
+        return;
+    }
+
+    if (message_type == MSG_VIEWPORT) {
+        viewport_message_t viewport;
+        if (payload_len != sizeof(viewport)) return;
+        memcpy(&viewport, payload, sizeof(viewport));
+
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        server_ctx->client_slots[slot_index].view_width = ntohs(viewport.width_net);
+        server_ctx->client_slots[slot_index].view_height = ntohs(viewport.height_net);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_KEYFRAME_REQUEST) {
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        server_ctx->client_slots[slot_index].needs_keyframe = 1;
+        server_ctx->client_slots[slot_index].needs_roster = 1;
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_PAUSE) {
+        if (server_lock_unfrozen(server_ctx) != 0) {
+            const char *error_text = "match is migrating";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        game_emit_event(&server_ctx->game_state, GAME_EVENT_PAUSE, server_ctx->client_slots[slot_index].player_id, 0, NULL, monotonic_ms());
+        server_close_slot_fd(server_ctx, slot_index);
+
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_LEAVE) {
+        uint64_t now = monotonic_ms();
+
+        if (server_lock_unfrozen(server_ctx) != 0) {
+            const char *error_text = "match is migrating";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+        game_player_id_t player_id = server_ctx->client_slots[slot_index].player_id;
+        server_close_slot_fd(server_ctx, slot_index);
+        game_emit_event(&server_ctx->game_state, GAME_EVENT_LEAVE, player_id, 0, NULL, now);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_JOIN) {
+        uint32_t name_len = 0;
+        uint16_t room = JOIN_ROOM_ANY;
+        if (join_payload_parse(payload, payload_len, &name_len, &room) != 0 || validate_player_name_len(name_len) != 0) {
+            const char *error_text = "bad player name length (max 31)";
+            server_reply_final(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+        if (room != JOIN_ROOM_ANY && server_ctx->room_count > 1 && room != server_ctx->room) {
+            server_route_join(server_ctx, slot_index, room);
+            return;
+        }
+
+        char player_name[GAME_MAX_NAME_LEN];
+        memset(player_name, 0, sizeof(player_name));
+        memcpy(player_name, payload, name_len);
+        player_name[name_len] = '\0';
+
+        uint64_t now = monotonic_ms();
+
+        if (server_lock_unfrozen(server_ctx) != 0) {
+            const char *error_text = "match is migrating";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        client_slot_t *slot = &server_ctx->client_slots[slot_index];
+        if (bot_is_bot(&server_ctx->bots, game_find_player_by_name(&server_ctx->game_state, player_name))) {
+            pthread_mutex_unlock(&server_ctx->state_mutex);
+            const char *error_text = "name taken by a bot";
+            server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        game_player_id_t paused_id = game_find_paused_player_by_name(&server_ctx->game_state, player_name);
+        if (paused_id != GAME_PLAYER_NONE) {
+            if (paused_id != slot->player_id) {
+                game_emit_event(&server_ctx->game_state, GAME_EVENT_DEACTIVATE, slot->player_id, 0, NULL, now);
+                slot->player_id = paused_id;
+            }
+
+            (void)game_emit_event(&server_ctx->game_state, GAME_EVENT_RESUME, slot->player_id, 0, NULL, now);
+
+            pthread_mutex_unlock(&server_ctx->state_mutex);
+
+            const char *welcome_text = "RESUMED | WASD move | p pause | q leave | r respawn";
+            server_reply(server_ctx, slot_index, client_fd, MSG_WELCOME, welcome_text);
+            return;
+        }
+
+        if (!game_player_lookup(&server_ctx->game_state, slot->player_id)) {
+            slot->player_id = game_activate_new_player(&server_ctx->game_state, now);
+        }
+
+        int join_rc = -1;
+        if (slot->player_id != GAME_PLAYER_NONE) {
+            join_rc = game_emit_event(&server_ctx->game_state, GAME_EVENT_JOIN, slot->player_id, 0, player_name, now);
+            if (join_rc < 0) {
+                game_emit_event(&server_ctx->game_state, GAME_EVENT_DEACTIVATE, slot->player_id, 0, NULL, now);
+                slot->player_id = GAME_PLAYER_NONE;
+            }
+        }
+
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+
+        if (join_rc < 0) {
+            const char *error_text = "JOIN failed";
+            server_reply_final(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        const char *welcome_text = "WELCOME | WASD move | p pause | q leave | r respawn";
+        server_reply(server_ctx, slot_index, client_fd, MSG_WELCOME, welcome_text);
+        return;
+    }
+
+    if (message_type == MSG_INPUT) {
+        if (payload_len != sizeof(input_message_t) && payload_len != INPUT_LEGACY_LEN) {
+            const char *error_text = "bad INPUT length";
+            server_reply_final(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+            return;
+        }
+
+        input_message_t input_message;
+        memset(&input_message, 0, sizeof(input_message));
+        memcpy(&input_message, payload, payload_len);
+        if (input_message.direction > DIR_LEFT) return;
+
+        // A steering input lost to a migration freeze is repeated by the next key press.
+        if (server_lock_unfrozen(server_ctx) != 0) return;
+        client_slot_t *slot = &server_ctx->client_slots[slot_index];
+        game_emit_event(&server_ctx->game_state, GAME_EVENT_INPUT, slot->player_id, input_message.direction, NULL, monotonic_ms());
+        if (payload_len == sizeof(input_message_t)) {
+            // The next frame acknowledges every input since the last one, timed from the oldest.
+            if (!slot->input_pending) {
+                slot->input_sent_us = ntohl(input_message.sent_us_net);
+                slot->input_recv_us = monotonic_us();
+                slot->input_pending = 1;
+            }
+            slot->input_seq = ntohl(input_message.seq_net);
+        }
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    if (message_type == MSG_RESPAWN) {
+        uint64_t now = monotonic_ms();
+        if (server_lock_unfrozen(server_ctx) != 0) return;
+        client_slot_t *slot = &server_ctx->client_slots[slot_index];
+        if (server_ctx->metrics.level >= DEGRADE_DEFER_SPAWNS) {
+            // The spawn search is the costliest thing a message can trigger; the tick paces them.
+            if (!slot->respawn_deferred) server_ctx->respawns_deferred++;
+            slot->respawn_deferred = 1;
+        } else {
+            (void)game_emit_event(&server_ctx->game_state, GAME_EVENT_RESPAWN, slot->player_id, 0, NULL, now);
+        }
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+        return;
+    }
+
+    {
+        const char *error_text = "unknown message type";
+        server_reply(server_ctx, slot_index, client_fd, MSG_ERROR, error_text);
+    }
+}
+
+// data is what the transport already received for the slot; NULL means read the socket here.
+static int token_bucket_take(token_bucket_t *bucket, uint32_t per_sec, uint32_t burst, uint64_t now_ms) {
+    if (now_ms > bucket->refill_ms) {
+        uint64_t refill = (now_ms - bucket->refill_ms) * per_sec;
+        uint64_t cap = (uint64_t)burst * 1000u;
+        bucket->milli_tokens = (uint32_t)((uint64_t)bucket->milli_tokens + refill < cap ? bucket->milli_tokens + refill : cap);
+        bucket->refill_ms = now_ms;
+    }
+    if (bucket->milli_tokens < 1000u) return 0;
+    bucket->milli_tokens -= 1000u;
+    return 1;
+}
+
+// Decides before any locking whether a message is dispatched. Steering and view updates draw
+// on a generous bucket, everything else on a tight one; unknown types always cost a strike.
+// Returns 1 to dispatch, 0 to drop, -1 once the strikes in the window mark a flood.
+static int flood_admit(client_slot_t *slot, uint16_t message_type, uint64_t now_ms) {
+    int known = 1;
+    int admitted;
+    switch (message_type) {
+        case MSG_INPUT:
+        case MSG_VIEWPORT:
+        case MSG_KEYFRAME_REQUEST:
+        case MSG_PING:
+            admitted = token_bucket_take(&slot->input_bucket, FLOOD_INPUT_PER_SEC, FLOOD_INPUT_BURST, now_ms);
+            break;
+        case MSG_JOIN: case MSG_SHUTDOWN: case MSG_PAUSE: case MSG_LEAVE: case MSG_RESPAWN:
+        case MSG_MAP_RELOAD: case MSG_SPECTATE: case MSG_MIGRATE: case MSG_MIGRATE_STATE: case MSG_METRICS:
+        case MSG_MIGRATE_COMMIT:
+            admitted = token_bucket_take(&slot->control_bucket, FLOOD_CONTROL_PER_SEC, FLOOD_CONTROL_BURST, now_ms);
+            break;
+        default:
+            known = 0;
+            admitted = token_bucket_take(&slot->control_bucket, FLOOD_CONTROL_PER_SEC, FLOOD_CONTROL_BURST, now_ms);
+            break;
+    }
+    if (admitted && known) return 1;
+
+    if (now_ms - slot->flood_window_ms >= FLOOD_STRIKE_WINDOW_MS) {
+        slot->flood_window_ms = now_ms;
+        slot->flood_strikes = 0;
+    }
+    if (!admitted) slot->flood_dropped++;
+    if (++slot->flood_strikes >= FLOOD_STRIKE_LIMIT) return -1;
+    return admitted;
+}
+
+static void handle_client_input(server_context_t *server_ctx, size_t slot_index, const uint8_t *data, size_t len) {
+    client_slot_t *slot = &server_ctx->client_slots[slot_index];
+    int fd = slot->client_socket_fd;
+
+    int fill_rc = data ? msg_reader_push(&slot->reader, data, len) : msg_reader_fill(&slot->reader, fd);
+
+    uint16_t message_type = 0;
+    const uint8_t *payload = NULL;
+    uint32_t payload_len = 0;
+    int next_rc = 0;
+    int flooded = 0;
+    uint64_t now_ms = monotonic_ms();
+    while (server_ctx->client_slots[slot_index].client_socket_fd == fd &&
+           (next_rc = msg_reader_next(&server_ctx->client_slots[slot_index].reader, &message_type, &payload, &payload_len)) > 0) {
+        int admit = flood_admit(&server_ctx->client_slots[slot_index], message_type, now_ms);
+        if (admit < 0) {
+            flooded = 1;
+            break;
+        }
+        if (admit > 0) handle_client_message(server_ctx, slot_index, message_type, payload, payload_len);
+    }
+
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    slot = &server_ctx->client_slots[slot_index];
+    if (slot->client_socket_fd == fd) {
+        server_ctx->metrics.flood_dropped += slot->flood_dropped;
+        slot->flood_dropped = 0;
+        if (flooded) {
+            server_ctx->metrics.flood_disconnects++;
+            fprintf(stderr, "server: disconnecting client %zu: %u messages over its rate in %d ms\n",
+                    slot_index, slot->flood_strikes, FLOOD_STRIKE_WINDOW_MS);
+        }
+        if (flooded || fill_rc < 0 || next_rc < 0 || slot->reader.eof) server_drop_client(server_ctx, slot_index);
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+}
+
+static int ensure_state_buf(server_context_t *server_ctx, size_t needed) {
+    if (needed <= server_ctx->state_buf_cap) return 0;
+    state_message_t *grown = (state_message_t*)realloc(server_ctx->state_buf, needed);
+    if (!grown) return -1;
+    server_ctx->state_buf = grown;
+    server_ctx->state_buf_cap = needed;
+    return 0;
+}
+
+static size_t build_roster(server_context_t *server_ctx) {
+    const game_state_t *g = &server_ctx->game_state;
+    size_t needed = game_roster_size(g);
+    if (needed > server_ctx->roster_buf_cap) {
+        roster_message_t *grown = (roster_message_t*)realloc(server_ctx->roster_buf, needed);
+        if (!grown) return 0;
+        server_ctx->roster_buf = grown;
+        server_ctx->roster_buf_cap = needed;
+    }
+    game_build_roster(g, server_ctx->roster_buf);
+    return needed;
+}
+
+// AIMD over the socket send queue: a backlog that outlives a frame means the client is not
+// draining at the current rate, so the frame interval doubles (or stretches to the measured
+// drain time); each clean opportunity shortens it by one tick. Dead, not-yet-joined and
+// world-paused clients are held at an idle floor. Frames skipped here are not lost: the next
+// one carries every change since the last frame the client actually got.
+static int client_rate_should_send(server_context_t *server_ctx, client_slot_t *slot) {
+    const game_state_t *g = &server_ctx->game_state;
+    if (!server_ctx->adaptive_rate || slot->needs_roster) {
+        slot->rate_queued = 0;
+        return 1;
+    }
+
+    const game_player_t *pl = game_player_lookup(g, slot->player_id);
+    int idle = !pl || !pl->has_joined || !pl->is_alive || g->global_pause_active;
+    uint32_t interval = slot->rate_interval;
+    uint32_t idle_floor = CLIENT_RATE_IDLE_INTERVAL;
+    if (server_ctx->metrics.level >= DEGRADE_THIN_FRAMES) idle_floor *= WATCHDOG_THIN_FACTOR;
+    if (idle && interval < idle_floor) interval = idle_floor;
+
+    slot->rate_ticks_waited++;
+    if (slot->rate_ticks_waited < interval) return 0;
+
+    int queued = 0;
+    if (ioctl(slot->client_socket_fd, SIOCOUTQ, &queued) < 0 || queued < 0) queued = 0;
+    uint32_t elapsed = slot->rate_ticks_waited;
+    slot->rate_ticks_waited = 0;
+    slot->rate_queued = (uint32_t)queued;
+
+    if (queued > 0 && slot->rate_last_queued > (uint32_t)queued) {
+        uint32_t sample = (slot->rate_last_queued - (uint32_t)queued) / elapsed;
+        slot->rate_drain_per_tick = slot->rate_drain_per_tick ? (3 * slot->rate_drain_per_tick + sample) / 4 : sample;
+    }
+
+    uint32_t backlog_limit = slot->rate_last_frame_len > CLIENT_RATE_MIN_BACKLOG ? slot->rate_last_frame_len : CLIENT_RATE_MIN_BACKLOG;
+    if ((uint32_t)queued >= backlog_limit) {
+        uint32_t next = slot->rate_interval * 2;
+        if (slot->rate_drain_per_tick > 0 && (uint32_t)queued / slot->rate_drain_per_tick > next) {
+            next = (uint32_t)queued / slot->rate_drain_per_tick;
+        }
+        slot->rate_interval = next < CLIENT_RATE_MAX_INTERVAL ? next : CLIENT_RATE_MAX_INTERVAL;
+        slot->rate_last_queued = (uint32_t)queued;
+        return 0;
+    }
+
+    if (slot->rate_interval > 1) slot->rate_interval--;
+    return 1;
+}
+
+static void broadcast_state(server_context_t *server_ctx, uint64_t now_ms) {
+    game_state_t *g = &server_ctx->game_state;
+    if (view_cache_update(&server_ctx->view_cache, g) != 0) {
+        fprintf(stderr, "server: out of memory for view cache\n");
+        return;
+    }
+    game_publish_status(g);
+    size_t roster_len = 0;
+
+    uint8_t minimap_width, minimap_height;
+    view_minimap_size(g, &minimap_width, &minimap_height);
+    view_build_minimap(&server_ctx->view_cache, g, server_ctx->minimap, minimap_width, minimap_height);
+
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        client_slot_t *slot = &server_ctx->client_slots[i];
+        if (slot->is_spectator) continue;
+        if (!client_rate_should_send(server_ctx, slot)) continue;
+
+        uint32_t frame_len = 0;
+
+        int roster_stale = slot->roster_serial != g->roster_serial && server_ctx->metrics.level < DEGRADE_SKIP_ROSTER;
+        if (slot->needs_roster || roster_stale) {
+            if (roster_len == 0) roster_len = build_roster(server_ctx);
+            if (roster_len == 0) {
+                fprintf(stderr, "server: out of memory for roster\n");
+                break;
+            }
+            if (transport_send_frame(slot_transport(server_ctx, i), slot->client_socket_fd, MSG_ROSTER,
+                                     server_ctx->roster_buf, (uint32_t)roster_len) != 0) break;
+            frame_len += (uint32_t)(sizeof(message_header_t) + roster_len);
+            slot->needs_roster = 0;
+            slot->roster_serial = g->roster_serial;
+            slot->status_serial = g->status_serial;
+        }
+
+        game_player_id_t follow_id = slot->follow_id != GAME_PLAYER_NONE ? slot->follow_id : slot->player_id;
+        view_rect_t rect = view_rect_follow(g, follow_id, slot->view_width, slot->view_height, &slot->view_center);
+
+        int include_cells = !view_rect_equal(&rect, &slot->last_view) ||
+                            view_rect_changed_since(g, &rect, slot->last_view_serial);
+        int covers_world = rect.width == g->map_width && rect.height == g->map_height;
+        uint8_t mm_width = covers_world ? 0 : minimap_width;
+        uint8_t mm_height = covers_world ? 0 : minimap_height;
+
+        if (ensure_state_buf(server_ctx, view_state_size(g, &rect, slot->status_serial, include_cells, mm_width, mm_height)) != 0) {
+            fprintf(stderr, "server: out of memory for state\n");
+            break;
+        }
+
+        size_t len = view_build_state(&server_ctx->view_cache, g, now_ms, &rect, slot->status_serial, include_cells,
+                                      server_ctx->minimap, mm_width, mm_height,
+                                      server_ctx->state_buf, server_ctx->state_buf_cap);
+        if (len == 0) continue;
+        uint64_t frame_us = monotonic_us();
+        server_ctx->state_buf->input_seq_net = htonl(slot->input_seq);
+        server_ctx->state_buf->input_sent_us_net = htonl(slot->input_sent_us);
+        server_ctx->state_buf->tick_us_net = htonl((uint32_t)server_ctx->tick_start_us);
+        server_ctx->state_buf->frame_us_net = htonl((uint32_t)frame_us);
+        if (slot->input_pending) {
+            uint64_t waited_us = frame_us - slot->input_recv_us;
+            latency_hist_add(&server_ctx->metrics.input_latency, waited_us < UINT32_MAX ? (uint32_t)waited_us : UINT32_MAX);
+            slot->input_pending = 0;
+        }
+        if (transport_send_frame(slot_transport(server_ctx, i), slot->client_socket_fd, MSG_STATE,
+                                 server_ctx->state_buf, (uint32_t)len) != 0) break;
+
+        frame_len += (uint32_t)(sizeof(message_header_t) + len);
+        slot->rate_last_frame_len = frame_len;
+        slot->rate_last_queued = slot->rate_queued + frame_len;
+
+        slot->last_view = rect;
+        slot->last_view_serial = g->change_serial;
+        slot->status_serial = g->status_serial;
+    }
+
+    // Each reactor sends its shard's frames for this tick in one submission.
+    for (int r = 0; r < server_ctx->reactor_count; r++) transport_send_commit(&server_ctx->reactors[r].transport);
+}
+
+static game_player_id_t spectator_leader(const game_state_t *g) {
+    const game_player_t *best = NULL;
+    for (uint32_t n = 0; n < g->player_count; n++) {
+        const game_player_t *pl = game_player_at(g, n);
+        if (!pl->has_joined || !pl->is_alive) continue;
+        if (!best || pl->score > best->score) best = pl;
+    }
+    return best ? best->player_id : GAME_PLAYER_NONE;
+}
+
+static uint8_t *shared_frame_reserve(shared_frame_t *frame, uint16_t message_type, uint32_t payload_len) {
+    message_header_t header_net;
+    header_net.message_type_net = htons(message_type);
+    header_net.payload_len_net = htonl(payload_len);
+
+    uint8_t *out = frame->data + frame->len;
+    memcpy(out, &header_net, sizeof(header_net));
+    frame->len += (uint32_t)(sizeof(header_net) + payload_len);
+    return out + sizeof(header_net);
+}
+
+static shared_frame_t *build_spectator_frame(server_context_t *server_ctx, uint64_t now_ms, const view_rect_t *rect,
+                                             int with_roster, int include_cells, uint8_t mm_width, uint8_t mm_height) {
+    const game_state_t *g = &server_ctx->game_state;
+    uint32_t status_since = with_roster ? g->status_serial : server_ctx->spectator_status_serial;
+    size_t roster_len = with_roster ? game_roster_size(g) : 0;
+    size_t state_len = view_state_size(g, rect, status_since, include_cells, mm_width, mm_height);
+    size_t total = (with_roster ? sizeof(message_header_t) + roster_len : 0) + sizeof(message_header_t) + state_len;
+    if (total > UINT32_MAX) return NULL;
+
+    shared_frame_t *frame = (shared_frame_t*)malloc(sizeof(*frame) + total);
+    if (!frame) return NULL;
+    frame->refcount = 1;
+    frame->len = 0;
+
+    if (with_roster) game_build_roster(g, (roster_message_t*)shared_frame_reserve(frame, MSG_ROSTER, (uint32_t)roster_len));
+    state_message_t *state = (state_message_t*)shared_frame_reserve(frame, MSG_STATE, (uint32_t)state_len);
+    if (view_build_state(&server_ctx->view_cache, g, now_ms, rect, status_since, include_cells,
+                         server_ctx->minimap, mm_width, mm_height, state, state_len) == 0) {
+        free(frame);
+        return NULL;
+    }
+    state->tick_us_net = htonl((uint32_t)server_ctx->tick_start_us);
+    state->frame_us_net = htonl((uint32_t)monotonic_us());
+    return frame;
+}
+
+static int spectator_flush(server_context_t *server_ctx, client_slot_t *slot) {
+    int rc = send_pending_bytes(slot->client_socket_fd, slot->pending_frame->data, slot->pending_frame->len, &slot->pending_offset);
+    if (rc == 0) {
+        transport_t *t = slot_transport(server_ctx, (size_t)(slot - server_ctx->client_slots));
+        if (!slot->writable_armed && transport_want_writable(t, slot->client_socket_fd) == 0) {
+            slot->writable_armed = 1;
+        }
+        return 0;
+    }
+
+    shared_frame_release(slot->pending_frame);
+    slot->pending_frame = NULL;
+    slot->pending_offset = 0;
+    if (rc < 0) shutdown(slot->client_socket_fd, SHUT_RDWR);
+    return rc;
+}
+
+// Spectators share the leader-following view, so each tick encodes at most a delta frame and a
+// keyframe (roster + full cells) no matter how many are watching. A spectator that is still
+// sending an older frame skips this one and resynchronises from the next keyframe.
+static void broadcast_spectators(server_context_t *server_ctx, uint64_t now_ms) {
+    game_state_t *g = &server_ctx->game_state;
+    uint32_t every = (uint32_t)server_ctx->spectator_every;
+    if (server_ctx->metrics.level >= DEGRADE_THIN_FRAMES) every *= WATCHDOG_THIN_FACTOR;
+    if (every > 1 && g->tick_counter % every != 0) return;
+
+    size_t spectator_count = 0;
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        client_slot_t *slot = &server_ctx->client_slots[i];
+        if (!slot->is_spectator) continue;
+        if (slot->pending_frame && spectator_flush(server_ctx, slot) == 0) slot->needs_keyframe = 1;
+        spectator_count++;
+    }
+    if (spectator_count == 0) return;
+
+    view_rect_t rect = view_rect_follow(g, spectator_leader(g), VIEW_DEFAULT_WIDTH, VIEW_DEFAULT_HEIGHT,
+                                        &server_ctx->spectator_center);
+    int include_cells = !server_ctx->spectator_view_valid ||
+                        !view_rect_equal(&rect, &server_ctx->spectator_view) ||
+                        view_rect_changed_since(g, &rect, server_ctx->spectator_view_serial);
+    int roster_changed = !server_ctx->spectator_view_valid || server_ctx->spectator_roster_serial != g->roster_serial;
+    int delta_is_key = include_cells && roster_changed;
+
+    uint8_t mm_width, mm_height;
+    view_minimap_size(g, &mm_width, &mm_height);
+    if (rect.width == g->map_width && rect.height == g->map_height) mm_width = mm_height = 0;
+
+    shared_frame_t *delta = NULL;
+    shared_frame_t *key = NULL;
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        size_t i = server_ctx->active_slots[n];
+        client_slot_t *slot = &server_ctx->client_slots[i];
+        if (!slot->is_spectator || slot->pending_frame) continue;
+
+        int wants_key = slot->needs_keyframe && !delta_is_key;
+        shared_frame_t **frame = wants_key ? &key : &delta;
+        if (!*frame) {
+            *frame = wants_key ? build_spectator_frame(server_ctx, now_ms, &rect, 1, 1, mm_width, mm_height)
+                               : build_spectator_frame(server_ctx, now_ms, &rect, roster_changed, include_cells, mm_width, mm_height);
+            if (!*frame) {
+                fprintf(stderr, "server: out of memory for spectator frame\n");
+                break;
+            }
+        }
+
+        (*frame)->refcount++;
+        slot->pending_frame = *frame;
+        slot->pending_offset = 0;
+        slot->needs_keyframe = 0;
+        (void)spectator_flush(server_ctx, slot);
+    }
+    shared_frame_release(delta);
+    shared_frame_release(key);
+
+    server_ctx->spectator_view = rect;
+    server_ctx->spectator_view_serial = g->change_serial;
+    server_ctx->spectator_status_serial = g->status_serial;
+    server_ctx->spectator_roster_serial = g->roster_serial;
+    server_ctx->spectator_view_valid = 1;
+}
+
+// Encodes straight into the next ring slot, so the cost is one snapshot per tick however many observers follow it.
+static void publish_shm_snapshot(server_context_t *server_ctx, uint64_t now_ms) {
+    size_t cap = 0;
+    size_t len = 0;
+    uint8_t *slot = snapring_begin(&server_ctx->shm_ring, &cap);
+    if (game_snapshot_encode(&server_ctx->game_state, now_ms, slot, cap, &len) != 0) {
+        snapring_abandon(&server_ctx->shm_ring);
+        if (!server_ctx->shm_ring_overflow_reported) {
+            fprintf(stderr, "server: snapshot does not fit a %zu byte ring slot, dropping\n", cap);
+            server_ctx->shm_ring_overflow_reported = 1;
+        }
+        return;
+    }
+    snapring_commit(&server_ctx->shm_ring, server_ctx->game_state.tick_counter, now_ms, len);
+}
+
+static void server_close_local_endpoints(server_context_t *server_ctx) {
+    if (server_ctx->local_listen_fd >= 0) {
+        close(server_ctx->local_listen_fd);
+        if (server_ctx->local_socket_name[0] != '@') unlink(server_ctx->local_socket_name);
+        server_ctx->local_listen_fd = -1;
+    }
+    if (server_ctx->handoff_fd >= 0) {
+        close(server_ctx->handoff_fd);
+        server_ctx->handoff_fd = -1;
+    }
+    snapring_close(&server_ctx->shm_ring);
+}
+
+// Bytes a handed-off connection already delivered are replayed before its owner reactor can
+// see the socket, so nothing else touches the slot's reader meanwhile.
+static void server_adopt_client(server_context_t *server_ctx, int client_fd, const uint8_t *data, size_t len) {
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    size_t slot_index = 0;
+    int add_rc = server_add_client(server_ctx, client_fd, &slot_index);
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+
+    if (add_rc != 0) {
+        // Never added to a reactor, so nothing else writes to it.
+        const char *error_text = "server full";
+        send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
+        close(client_fd);
+        return;
+    }
+
+    if (len > 0) {
+        handle_client_input(server_ctx, slot_index, data, len);
+        if (server_ctx->client_slots[slot_index].client_socket_fd != client_fd) return;
+    }
+
+    if (transport_add_client(slot_transport(server_ctx, slot_index), client_fd, (uint32_t)slot_index) != 0) {
+        fprintf(stderr, "server: transport rejected client: %s\n", strerror(errno));
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        server_drop_client(server_ctx, slot_index);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+    }
+}
+
+static void server_accept_client(server_context_t *server_ctx, int client_fd, int is_tcp) {
+    int tuning_rc = is_tcp ? socket_apply_tuning(client_fd, &server_ctx->listen_tuning)
+                           : socket_apply_buffers(client_fd, &server_ctx->listen_tuning);
+    if (tuning_rc < 0) fprintf(stderr, "server: socket tuning failed: %s\n", strerror(errno));
+    server_adopt_client(server_ctx, client_fd, NULL, 0);
+}
+
+static void server_receive_handoffs(server_context_t *server_ctx) {
+    static uint8_t handoff_buf[HANDOFF_MAX_BYTES];
+    for (;;) {
+        int client_fd = -1;
+        size_t len = 0;
+        int rc = handoff_recv(server_ctx->handoff_fd, &client_fd, handoff_buf, sizeof(handoff_buf), &len);
+        if (rc == 0) break;
+        if (rc < 0) {
+            fprintf(stderr, "server: bad connection handoff: %s\n", strerror(errno));
+            if (errno == EPROTO) continue;
+            break;
+        }
+        server_adopt_client(server_ctx, client_fd, handoff_buf, len);
+    }
+}
+
+// Caller holds state_mutex. The image is only serialized here; the writer thread does the I/O,
+// and a capture is skipped while the previous one is still being written.
+static void capture_checkpoint(server_context_t *server_ctx, uint64_t now_ms) {
+    if (now_ms < server_ctx->checkpoint_next_ms || server_ctx->checkpoint_ready) return;
+    server_ctx->checkpoint_next_ms = now_ms + (uint64_t)server_ctx->checkpoint_interval_ms;
+
+    if (checkpoint_capture(&server_ctx->checkpoint_captured, &server_ctx->game_state, &server_ctx->bots, now_ms) != 0) {
+        fprintf(stderr, "server: checkpoint capture failed\n");
+        return;
+    }
+    server_ctx->checkpoint_ready = 1;
+    pthread_cond_signal(&server_ctx->checkpoint_cond);
+}
+
+static void *server_checkpoint_thread(void *arg) {
+    server_context_t *server_ctx = (server_context_t*)arg;
+    checkpoint_image_t writing;
+    memset(&writing, 0, sizeof(writing));
+
+    pthread_mutex_lock(&server_ctx->state_mutex);
+    while (1) {
+        while (server_ctx->is_running && !server_ctx->checkpoint_ready) {
+            pthread_cond_wait(&server_ctx->checkpoint_cond, &server_ctx->state_mutex);
+        }
+        if (!server_ctx->checkpoint_ready) break;
+
+        checkpoint_image_t captured = server_ctx->checkpoint_captured;
+        server_ctx->checkpoint_captured = writing;
+        writing = captured;
+        server_ctx->checkpoint_ready = 0;
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+
+        if (checkpoint_save(&writing, server_ctx->checkpoint_path) != 0) {
+            fprintf(stderr, "server: checkpoint %s not written: %s\n", server_ctx->checkpoint_path, strerror(errno));
+        }
+
+        pthread_mutex_lock(&server_ctx->state_mutex);
+    }
+    pthread_mutex_unlock(&server_ctx->state_mutex);
+
+    checkpoint_image_free(&writing);
+    return NULL;
+}
+
+// Counts the connections whose socket is backed up far enough that the sender is skipping
+// frames for them; called under the state lock.
+static uint32_t tick_backlogged_clients(const server_context_t *server_ctx, uint32_t *connected) {
+    uint32_t backlogged = 0;
+    *connected = (uint32_t)server_ctx->active_count;
+    for (size_t n = 0; n < server_ctx->active_count; n++) {
+        const client_slot_t *slot = &server_ctx->client_slots[server_ctx->active_slots[n]];
+        if (slot->rate_interval > 1 || slot->pending_frame) backlogged++;
+    }
+    return backlogged;
+}
+
+// Widens the tick when the work, the wake-up lateness or the clients' send backlog eat into
+// the interval, and narrows it again once a whole window runs comfortably inside it. Timers
+// stay in wall milliseconds, so only the step rate moves.
+static void tick_adapt(server_context_t *server_ctx, uint64_t cost_us, uint64_t late_us) {
+    if (server_ctx->tick_min_ms >= server_ctx->tick_max_ms) return;
+    server_ctx->tick_window_cost_us += cost_us;
+    server_ctx->tick_window_late_us += late_us;
+    if (++server_ctx->tick_window_count < TICK_ADAPT_WINDOW) return;
+
+    uint64_t budget_us = (uint64_t)server_ctx->tick_interval_ms * 1000u * server_ctx->tick_window_count;
+    uint64_t window_cost_us = server_ctx->tick_window_cost_us;
+    uint64_t window_late_us = server_ctx->tick_window_late_us;
+    server_ctx->tick_window_cost_us = 0;
+    server_ctx->tick_window_late_us = 0;
+    server_ctx->tick_window_count = 0;
+
+    uint32_t connected = 0;
+    uint32_t backlogged = tick_backlogged_clients(server_ctx, &connected);
+
+    int interval = server_ctx->tick_interval_ms;
+    int next = interval;
+    if (window_cost_us * 2 > budget_us || window_late_us * 4 > budget_us || (backlogged > 0 && backlogged * 4 >= connected)) {
+        next = interval + interval / 4 + 1;
+    } else if (window_cost_us * 5 < budget_us && window_late_us * 10 < budget_us && backlogged == 0) {
+        next = interval - (interval / 10 > 1 ? interval / 10 : 1);
+    }
+    if (next < server_ctx->tick_min_ms) next = server_ctx->tick_min_ms;
+    if (next > server_ctx->tick_max_ms) next = server_ctx->tick_max_ms;
+    server_ctx->tick_interval_ms = next;
+}
+
+// Runs the respawns that arrived while spawns were being deferred, a few per tick.
+static void apply_deferred_respawns(server_context_t *server_ctx, uint64_t now_ms) {
+    // Closing a slot withdraws its request, so the count only covers connected slots.
+    uint32_t budget = server_ctx->metrics.level >= DEGRADE_DEFER_SPAWNS ? WATCHDOG_SPAWNS_PER_TICK : UINT32_MAX;
+    for (size_t n = 0; n < server_ctx->active_count && server_ctx->respawns_deferred > 0 && budget > 0; n++) {
+        client_slot_t *slot = &server_ctx->client_slots[server_ctx->active_slots[n]];
+        if (!slot->respawn_deferred) continue;
+        slot->respawn_deferred = 0;
+        server_ctx->respawns_deferred--;
+        (void)game_emit_event(&server_ctx->game_state, GAME_EVENT_RESPAWN, slot->player_id, 0, NULL, now_ms);
+        budget--;
+    }
+}
+
+static void tick_watchdog(server_context_t *server_ctx, uint64_t now_ms) {
+    metrics_t *metrics = &server_ctx->metrics;
+    uint32_t events_before = metrics->event_count;
+    int level = metrics_tick_end(metrics, server_ctx->tick_interval_ms, server_ctx->game_state.tick_counter, now_ms);
+    server_ctx->bots.spawn_limit = level >= DEGRADE_DEFER_SPAWNS ? WATCHDOG_SPAWNS_PER_TICK : 0;
+    if (metrics->event_count == events_before) return;
+
+    const watchdog_event_t *ev = &metrics->events[(metrics->event_count - 1) % METRICS_EVENT_MAX];
+    if (ev->phase < TICK_PHASE_COUNT) {
+        fprintf(stderr, "server: room %u degraded to %s: %s took %u us of a %u us budget\n", (unsigned)server_ctx->room,
+                degrade_level_name(ev->to_level), tick_phase_name(ev->phase), ev->cost_us, ev->budget_us);
+    } else {
+        fprintf(stderr, "server: room %u recovered to %s\n", (unsigned)server_ctx->room, degrade_level_name(ev->to_level));
+    }
+}
+
+static void *server_tick_thread(void *arg) {
+    server_context_t *server_ctx = (server_context_t*)arg;
+    uint64_t deadline_us = monotonic_us();
+
+    while (server_ctx->is_running) {
+        // Sleeping to an absolute deadline keeps the rate independent of the tick's own cost.
+        deadline_us += (uint64_t)server_ctx->tick_interval_ms * 1000u;
+        struct timespec wake;
+        wake.tv_sec = (time_t)(deadline_us / 1000000u);
+        wake.tv_nsec = (long)(deadline_us % 1000000u) * 1000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {}
+
+        uint64_t now = monotonic_ms();
+        uint64_t tick_start_us = monotonic_us();
+        uint64_t late_us = tick_start_us > deadline_us ? tick_start_us - deadline_us : 0;
+        // A tick that overran a whole interval is not made up with a burst.
+        if (late_us > (uint64_t)server_ctx->tick_interval_ms * 1000u) deadline_us = tick_start_us;
+
+        metrics_t *metrics = &server_ctx->metrics;
+        metrics_tick_begin(metrics, tick_start_us);
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        metrics_phase_end(metrics, TICK_PHASE_LOCK, monotonic_us());
+        server_ctx->tick_start_us = tick_start_us;
+
+        if (server_ctx->migrating || server_ctx->is_migrated) {
+            pthread_mutex_unlock(&server_ctx->state_mutex);
+            continue;
+        }
+
+        if (server_ctx->pending_map) {
+            game_apply_map(&server_ctx->game_state, server_ctx->pending_map, now);
+            server_ctx->world_type = WORLD_FILE;
+            server_free_map(server_ctx->pending_map);
+            server_ctx->pending_map = NULL;
+            server_request_keyframe_for_all(server_ctx);
+        }
+
+        if (server_ctx->respawns_deferred > 0) apply_deferred_respawns(server_ctx, now);
+        bot_update(&server_ctx->bots, &server_ctx->game_state, now);
+        metrics_phase_end(metrics, TICK_PHASE_BOTS, monotonic_us());
+        game_tick(&server_ctx->game_state, now);
+        metrics_phase_end(metrics, TICK_PHASE_SIMULATE, monotonic_us());
+
+        if (server_ctx->game_state.should_terminate) {
+            pthread_mutex_unlock(&server_ctx->state_mutex);
+            send_game_over_to_all(server_ctx);
+            pthread_mutex_lock(&server_ctx->state_mutex);
+            server_stop(server_ctx);
+        }
+
+        if (server_ctx->lockstep_enabled) {
+            broadcast_lockstep_tick(server_ctx, now);
+        } else {
+            broadcast_state(server_ctx, now);
+            broadcast_spectators(server_ctx, now);
+        }
+        metrics_phase_end(metrics, TICK_PHASE_BROADCAST, monotonic_us());
+
+        if (server_ctx->shm_ring.header) publish_shm_snapshot(server_ctx, now);
+        if (server_ctx->checkpoint_path[0] != '\0') capture_checkpoint(server_ctx, now);
+
+        uint64_t tick_end_us = monotonic_us();
+        metrics_phase_end(metrics, TICK_PHASE_PUBLISH, tick_end_us);
+        uint64_t cost_us = tick_end_us - tick_start_us;
+        server_ctx->tick_cost_us_sum += cost_us;
+        server_ctx->tick_cost_count++;
+        tick_watchdog(server_ctx, now);
+        tick_adapt(server_ctx, cost_us, late_us);
+
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+    }
+
+    return NULL;
+}
+
+static int lobby_connect(const char *host, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Caller holds state_mutex; the tick cost counters restart with every report.
+static void server_build_room_report(server_context_t *server_ctx, room_report_message_t *report) {
+    const game_state_t *g = &server_ctx->game_state;
+    uint32_t joined = 0;
+    for (uint32_t n = 0; n < g->player_count; n++) {
+        if (game_player_at(g, n)->has_joined) joined++;
+    }
+
+    uint64_t tick_cost_us = server_ctx->tick_cost_count > 0 ? server_ctx->tick_cost_us_sum / server_ctx->tick_cost_count : 0;
+    server_ctx->tick_cost_us_sum = 0;
+    server_ctx->tick_cost_count = 0;
+
+    memset(report, 0, sizeof(*report));
+    report->port_net = htons(server_ctx->port);
+    report->room_net = htons(server_ctx->room);
+    report->game_mode = (uint8_t)server_ctx->game_mode;
+    report->world_type = (uint8_t)server_ctx->world_type;
+    report->width_net = htons(g->map_width);
+    report->height_net = htons(g->map_height);
+    report->player_count_net = htons((uint16_t)(joined < UINT16_MAX ? joined : UINT16_MAX));
+    report->player_capacity_net = htons(server_ctx->room_capacity);
+    report->tick_cost_us_net = htonl((uint32_t)(tick_cost_us < UINT32_MAX ? tick_cost_us : UINT32_MAX));
+    report->tick_budget_us_net = htonl((uint32_t)server_ctx->tick_interval_ms * 1000u);
+
+    const char *world_name = "empty";
+    if (server_ctx->world_type == WORLD_FILE) {
+        const char *slash = strrchr(server_ctx->map_file_path, '/');
+        world_name = slash ? slash + 1 : server_ctx->map_file_path;
+    }
+    size_t name_len = strlen(world_name);
+    if (name_len >= sizeof(report->world_name)) name_len = sizeof(report->world_name) - 1;
+    memcpy(report->world_name, world_name, name_len);
+}
+
+// Reports this room to the lobby once a second, reconnecting whenever the lobby goes away.
+static void *server_lobby_thread(void *arg) {
+    server_context_t *server_ctx = (server_context_t*)arg;
+    int lobby_fd = -1;
+    uint64_t next_report_ms = 0;
+
+    while (server_ctx->is_running) {
+        struct timespec sleep_time = {0, 100L * 1000L * 1000L};
+        nanosleep(&sleep_time, NULL);
+
+        uint64_t now = monotonic_ms();
+        if (now < next_report_ms) continue;
+        next_report_ms = now + LOBBY_REPORT_INTERVAL_MS;
+
+        room_report_message_t report;
+        pthread_mutex_lock(&server_ctx->state_mutex);
+        server_build_room_report(server_ctx, &report);
+        pthread_mutex_unlock(&server_ctx->state_mutex);
+
+        if (lobby_fd < 0) lobby_fd = lobby_connect(server_ctx->lobby_host, server_ctx->lobby_port);
+        if (lobby_fd < 0) continue;
+        if (send_message(lobby_fd, MSG_ROOM_REPORT, &report, (uint32_t)sizeof(report)) < 0) {
+            close(lobby_fd);
+            lobby_fd = -1;
+        }
+    }
+
+    if (lobby_fd >= 0) close(lobby_fd);
+    return NULL;
+}
+
+static void reactor_run(server_reactor_t *reactor) {
+    server_context_t *server_ctx = reactor->server_ctx;
+    transport_t *t = &reactor->transport;
+    transport_event_t events[TRANSPORT_MAX_EVENTS];
+
+    while (server_ctx->is_running) {
+        int event_count = transport_wait(t, events, TRANSPORT_MAX_EVENTS, -1);
+        if (event_count < 0) {
+            fprintf(stderr, "server: reactor %d %s wait failed: %s\n", reactor->index, transport_name(t), strerror(errno));
+            server_stop(server_ctx);
+            break;
+        }
+
+        for (int e = 0; e < event_count; e++) {
+            const transport_event_t *ev = &events[e];
+            if (ev->type == TRANSPORT_EV_ACCEPT) {
+                server_accept_client(server_ctx, ev->fd, ev->tag == LISTENER_TAG_TCP);
+                continue;
+            }
+            if (!transport_event_is_current(t, ev)) continue;
+            if (ev->tag == HANDOFF_TAG) {
+                server_receive_handoffs(server_ctx);
+                continue;
+            }
+
+            size_t slot_index = ev->tag;
+            if (slot_index >= server_ctx->client_slot_cap || server_ctx->client_slots[slot_index].client_socket_fd != ev->fd) continue;
+
+            if (ev->type == TRANSPORT_EV_WRITABLE) {
+                pthread_mutex_lock(&server_ctx->state_mutex);
+                client_slot_t *slot = &server_ctx->client_slots[slot_index];
+                slot->writable_armed = 0;
+                if (slot->client_socket_fd == ev->fd && slot->pending_frame) (void)spectator_flush(server_ctx, slot);
+                pthread_mutex_unlock(&server_ctx->state_mutex);
+            } else if (ev->type == TRANSPORT_EV_CLOSED) {
+                pthread_mutex_lock(&server_ctx->state_mutex);
+                if (server_ctx->client_slots[slot_index].client_socket_fd == ev->fd) server_drop_client(server_ctx, slot_index);
+                pthread_mutex_unlock(&server_ctx->state_mutex);
+            } else {
+                handle_client_input(server_ctx, slot_index, ev->data, ev->len);
+            }
+        }
+
+        if (transport_send_flush(t) < 0) {
+            fprintf(stderr, "server: reactor %d send failed: %s\n", reactor->index, strerror(errno));
+        }
+    }
+}
+
+static void reactor_pin(server_reactor_t *reactor, pthread_t thread) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count < 1) return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((int)(reactor->index % cpu_count), &cpus);
+    int rc = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (rc != 0) fprintf(stderr, "server: cannot pin reactor %d: %s\n", reactor->index, strerror(rc));
+}
+
+static void *reactor_thread(void *arg) {
+    reactor_run((server_reactor_t*)arg);
+    return NULL;
+}
+
+// Reactor 0 also owns the listeners. With more than one reactor the slot array is allocated
+// at full size up front, since reactors index it without the state lock while reactor 0 accepts.
+static int server_open_reactors(server_context_t *server_ctx, int reactor_count, transport_kind_t kind) {
+    if (reactor_count > 1) {
+        while (server_ctx->client_slot_cap < SERVER_MAX_CONNECTIONS) {
+            if (grow_client_slots(server_ctx) != 0) return -1;
+        }
+    }
+
+    for (int r = 0; r < reactor_count; r++) {
+        server_reactor_t *reactor = &server_ctx->reactors[r];
+        reactor->server_ctx = server_ctx;
+        reactor->index = r;
+        if (transport_open(&reactor->transport, kind) != 0) return -1;
+        server_ctx->reactor_count = r + 1;
+    }
+
+    transport_t *t = &server_ctx->reactors[0].transport;
+    if (transport_add_listener(t, server_ctx->listen_socket_fd, LISTENER_TAG_TCP) != 0 ||
+        transport_add_listener(t, server_ctx->local_listen_fd, LISTENER_TAG_LOCAL) != 0) {
+        return -1;
+    }
+    if (server_ctx->handoff_fd >= 0 && transport_add_client(t, server_ctx->handoff_fd, HANDOFF_TAG) != 0) return -1;
+    return 0;
+}
+
+static int server_start_reactors(server_context_t *server_ctx, int *out_started) {
+    *out_started = 1;
+    if (server_ctx->pin_reactors) reactor_pin(&server_ctx->reactors[0], pthread_self());
+    for (int r = 1; r < server_ctx->reactor_count; r++) {
+        server_reactor_t *reactor = &server_ctx->reactors[r];
+        if (pthread_create(&reactor->thread, NULL, reactor_thread, reactor) != 0) return -1;
+        *out_started = r + 1;
+        if (server_ctx->pin_reactors) reactor_pin(reactor, reactor->thread);
+    }
+    return 0;
+}
+
+static void server_join_reactors(server_context_t *server_ctx, int started) {
+    server_stop(server_ctx);
+    for (int r = 1; r < started; r++) pthread_join(server_ctx->reactors[r].thread, NULL);
+}
+
+static void server_close_reactors(server_context_t *server_ctx) {
+    for (int r = 0; r < server_ctx->reactor_count; r++) transport_close(&server_ctx->reactors[r].transport);
+    server_ctx->reactor_count = 0;
+}
+
+static volatile sig_atomic_t supervisor_signal = 0;
+
+static void supervisor_on_signal(int sig) {
+    supervisor_signal = sig;
+}
+
+static pid_t supervisor_spawn(int room, uint64_t *out_started_ms) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+    } else if (pid < 0) {
+        fprintf(stderr, "server: fork for room %d failed: %s\n", room, strerror(errno));
+    }
+    *out_started_ms = monotonic_ms();
+    return pid;
+}
+
+// Runs one worker process per room, all listening on the same port through SO_REUSEPORT.
+// A worker that crashes is restarted on its own; the others keep their games. Returns 1 in
+// a worker, with its room set, and 0 in the supervisor once every worker has finished.
+// out_restarted tells a worker it replaces one that died, so it may resume from a checkpoint.
+static int server_supervise(int worker_count, int *out_room, int *out_restarted) {
+    pid_t pids[SERVER_MAX_WORKERS];
+    uint64_t started_ms[SERVER_MAX_WORKERS];
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = supervisor_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int running = 0;
+    for (int room = 0; room < worker_count; room++) {
+        pids[room] = supervisor_spawn(room, &started_ms[room]);
+        if (pids[room] == 0) {
+            *out_room = room;
+            return 1;
+        }
+        if (pids[room] > 0) running++;
+    }
+    fprintf(stderr, "server: supervising %d workers\n", running);
+
+    int forwarded = 0;
+    while (running > 0) {
+        if (supervisor_signal && !forwarded) {
+            for (int room = 0; room < worker_count; room++) {
+                if (pids[room] > 0) kill(pids[room], SIGTERM);
+            }
+            forwarded = 1;
+        }
+
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        int room = 0;
+        while (room < worker_count && pids[room] != pid) room++;
+        if (room == worker_count) continue;
+        pids[room] = -1;
+        running--;
+
+        int crashed = WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+        if (!crashed || supervisor_signal) continue;
+
+        if (WIFEXITED(status) && monotonic_ms() - started_ms[room] < WORKER_MIN_UPTIME_MS) {
+            fprintf(stderr, "server: worker for room %d failed at startup, not restarting\n", room);
+            continue;
+        }
+        fprintf(stderr, "server: worker for room %d died (%s %d), restarting\n", room,
+                WIFSIGNALED(status) ? "signal" : "exit", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+
+        struct timespec delay;
+        delay.tv_sec = WORKER_RESTART_DELAY_MS / 1000;
+        delay.tv_nsec = (long)(WORKER_RESTART_DELAY_MS % 1000) * 1000L * 1000L;
+        nanosleep(&delay, NULL);
+        if (supervisor_signal) continue;
+
+        pids[room] = supervisor_spawn(room, &started_ms[room]);
+        if (pids[room] == 0) {
+            *out_room = room;
+            *out_restarted = 1;
+            return 1;
+        }
+        if (pids[room] > 0) running++;
+    }
+    return 0;
+}
+
+static const char *long_option_value(const char *arg, const char *name) {
+    size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0) return NULL;
+    if (arg[name_len] != '=') return NULL;
+    return arg + name_len + 1;
+}
+
+static int server_add_bots(server_context_t *server_ctx, int bot_count) {
+    uint64_t now = monotonic_ms();
+    int added = 0;
+
+    while (added < bot_count) {
+        if (bot_add(&server_ctx->bots, &server_ctx->game_state, now) != 0) break;
+        added++;
+    }
+    return added;
+}
+
+// --tick-ms takes one interval or a comma list with an entry per room (the last one repeats);
+// the bounds default to that interval, which keeps the rate fixed.
+static void server_apply_tick_rate(server_context_t *server_ctx, const char *tick_ms_list, int min_ms, int max_ms) {
+    int tick_ms = TICK_DEFAULT_MS;
+    const char *entry = tick_ms_list;
+    for (uint16_t r = 0; entry && *entry != '\0'; r++) {
+        tick_ms = atoi(entry);
+        if (r == server_ctx->room) break;
+        entry = strchr(entry, ',');
+        if (entry) entry++;
+    }
+    if (tick_ms < TICK_FLOOR_MS) tick_ms = TICK_FLOOR_MS;
+    if (tick_ms > TICK_CEILING_MS) tick_ms = TICK_CEILING_MS;
+    if (min_ms <= 0 || min_ms > tick_ms) min_ms = tick_ms;
+    if (max_ms <= 0 || max_ms < tick_ms) max_ms = tick_ms;
+    if (min_ms < TICK_FLOOR_MS) min_ms = TICK_FLOOR_MS;
+    if (max_ms > TICK_CEILING_MS) max_ms = TICK_CEILING_MS;
+
+    server_ctx->tick_interval_ms = tick_ms;
+    server_ctx->tick_min_ms = min_ms;
+    server_ctx->tick_max_ms = max_ms;
+}
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
 
     uint16_t port = 23456;
     game_mode_t mode = GAME_MODE_STANDARD;
     uint32_t timed_seconds = 60;
     world_type_t world_type = WORLD_EMPTY;
 
-    uint8_t map_width = 40;
-    uint8_t map_height = 20;
+    int map_width = 40;
+    int map_height = 20;
     const char *map_file_path = NULL;
 
-    if (argc >= 2) port = (uint16_t)atoi(argv[1]);
-    if (argc >= 3) mode = (game_mode_t)atoi(argv[2]);
-    if (argc >= 4) timed_seconds = (uint32_t)atoi(argv[3]);
-    if (argc >= 5) world_type = (world_type_t)atoi(argv[4]);
+    int bot_count = 0;
+    uint32_t bot_cell_budget = BOT_DEFAULT_CELL_BUDGET;
+    int lockstep_enabled = 0;
+    int lockstep_hash_every = LOCKSTEP_DEFAULT_HASH_EVERY;
+    socket_tuning_t listen_tuning;
+    socket_tuning_defaults(&listen_tuning);
+    const char *local_socket_name = NULL;
+    const char *shm_ring_name = NULL;
+    int spectator_every = 1;
+    int adaptive_rate = 1;
+    int shm_ring_slots = SNAPRING_DEFAULT_SLOTS;
+    long shm_ring_slot_kb = SNAPRING_DEFAULT_SLOT_BYTES / 1024;
+    long max_snake_len = GAME_DEFAULT_SNAKE_LEN;
+    transport_kind_t transport_kind = TRANSPORT_AUTO;
+    int reactor_count = 1;
+    int pin_reactors = 0;
+    int worker_count = 1;
+    const char *lobby_address = NULL;
+    int room_capacity = ROOM_DEFAULT_CAPACITY;
+    const char *checkpoint_path = NULL;
+    int checkpoint_ms = CHECKPOINT_DEFAULT_MS;
+    int restore = 0;
+    const char *tick_ms_list = NULL;
+    int tick_min_ms = 0;
+    int tick_max_ms = 0;
+
+    char *args[16];
+    int arg_count = 1;
+    args[0] = argv[0];
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = NULL;
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (arg_count < (int)(sizeof(args) / sizeof(args[0]))) args[arg_count++] = argv[i];
+        } else if ((value = long_option_value(argv[i], "--bots")) != NULL) {
+            bot_count = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--bot-budget")) != NULL) {
+            bot_cell_budget = (uint32_t)atoi(value);
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep_enabled = 1;
+        } else if ((value = long_option_value(argv[i], "--lockstep-hash-every")) != NULL) {
+            lockstep_hash_every = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--tcp-nodelay")) != NULL) {
+            listen_tuning.no_delay = atoi(value) != 0;
+        } else if ((value = long_option_value(argv[i], "--sndbuf")) != NULL) {
+            listen_tuning.send_buffer_bytes = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--rcvbuf")) != NULL) {
+            listen_tuning.recv_buffer_bytes = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--user-timeout-ms")) != NULL) {
+            listen_tuning.user_timeout_ms = (unsigned)strtoul(value, NULL, 10);
+        } else if ((value = long_option_value(argv[i], "--local-socket")) != NULL) {
+            local_socket_name = value;
+        } else if ((value = long_option_value(argv[i], "--adaptive-rate")) != NULL) {
+            adaptive_rate = atoi(value) != 0;
+        } else if ((value = long_option_value(argv[i], "--spectator-every")) != NULL) {
+            spectator_every = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--shm-ring")) != NULL) {
+            shm_ring_name = value;
+        } else if ((value = long_option_value(argv[i], "--shm-ring-slots")) != NULL) {
+            shm_ring_slots = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--shm-ring-slot-kb")) != NULL) {
+            shm_ring_slot_kb = atol(value);
+        } else if ((value = long_option_value(argv[i], "--max-snake-len")) != NULL) {
+            max_snake_len = atol(value);
+        } else if ((value = long_option_value(argv[i], "--transport")) != NULL) {
+            if (transport_parse_kind(value, &transport_kind) != 0) {
+                fprintf(stderr, "server: unknown transport: %s (auto, epoll, io_uring)\n", value);
+                return 1;
+            }
+        } else if ((value = long_option_value(argv[i], "--reactors")) != NULL) {
+            reactor_count = atoi(value);
+        } else if (strcmp(argv[i], "--pin-reactors") == 0) {
+            pin_reactors = 1;
+        } else if ((value = long_option_value(argv[i], "--workers")) != NULL) {
+            worker_count = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--lobby")) != NULL) {
+            lobby_address = value;
+        } else if ((value = long_option_value(argv[i], "--room-capacity")) != NULL) {
+            room_capacity = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--checkpoint")) != NULL) {
+            checkpoint_path = value;
+        } else if ((value = long_option_value(argv[i], "--checkpoint-ms")) != NULL) {
+            checkpoint_ms = atoi(value);
+        } else if (strcmp(argv[i], "--restore") == 0) {
+            restore = 1;
+        } else if ((value = long_option_value(argv[i], "--tick-ms")) != NULL) {
+            tick_ms_list = value;
+        } else if ((value = long_option_value(argv[i], "--tick-min-ms")) != NULL) {
+            tick_min_ms = atoi(value);
+        } else if ((value = long_option_value(argv[i], "--tick-max-ms")) != NULL) {
+            tick_max_ms = atoi(value);
+        } else {
+            fprintf(stderr, "server: unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (arg_count >= 2) port = (uint16_t)atoi(args[1]);
+    if (arg_count >= 3) mode = (game_mode_t)atoi(args[2]);
+    if (arg_count >= 4) timed_seconds = (uint32_t)atoi(args[3]);
+    if (arg_count >= 5) world_type = (world_type_t)atoi(args[4]);
 
     if (world_type == WORLD_FILE) {
-        if (argc >= 6) map_file_path = argv[5];
+        if (arg_count >= 6) map_file_path = args[5];
     } else {
-        if (argc >= 6) map_width = (uint8_t)atoi(argv[5]);
-        if (argc >= 7) map_height = (uint8_t)atoi(argv[6]);
-        if (argc >= 8) map_file_path = argv[7];
+        if (arg_count >= 6) map_width = atoi(args[5]);
+        if (arg_count >= 7) map_height = atoi(args[6]);
+        if (arg_count >= 8) map_file_path = args[7];
     }
 
+    if (max_snake_len < 3) max_snake_len = 3;
+    if (max_snake_len > GAME_MAX_SNAKE_LEN) max_snake_len = GAME_MAX_SNAKE_LEN;
+
+    if (shm_ring_slots < 2) shm_ring_slots = 2;
+    if (shm_ring_slots > SNAPRING_MAX_SLOTS) shm_ring_slots = SNAPRING_MAX_SLOTS;
+    if (shm_ring_slot_kb < 4) shm_ring_slot_kb = 4;
+    if (shm_ring_slot_kb > (long)(SNAPRING_MAX_SLOT_BYTES / 1024)) shm_ring_slot_kb = SNAPRING_MAX_SLOT_BYTES / 1024;
+
+    if (reactor_count < 1) reactor_count = 1;
+    if (reactor_count > SERVER_MAX_REACTORS) reactor_count = SERVER_MAX_REACTORS;
+
+    if (bot_count < 0) bot_count = 0;
+    if (bot_count > BOT_MAX_COUNT) bot_count = BOT_MAX_COUNT;
+
     if (map_width < 5) map_width = 5;
     if (map_height < 5) map_height = 5;
-    if (map_width > STATE_MAX_WIDTH) map_width = STATE_MAX_WIDTH;
-    if (map_height > STATE_MAX_HEIGHT) map_height = STATE_MAX_HEIGHT;
+    if (map_width > GAME_MAX_WIDTH) map_width = GAME_MAX_WIDTH;
+    if (map_height > GAME_MAX_HEIGHT) map_height = GAME_MAX_HEIGHT;
 
     uint32_t timed_ms = timed_seconds * 1000U;
 
-    int listen_fd = create_listen_socket(port);
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > SERVER_MAX_WORKERS) worker_count = SERVER_MAX_WORKERS;
+
+    // Workers are forked before any thread or socket exists; each one then starts up as usual.
+    if (restore && !checkpoint_path) {
+        fprintf(stderr, "server: --restore requires --checkpoint=PATH\n");
+        return 1;
+    }
+    if (checkpoint_ms < 50) checkpoint_ms = 50;
+
+    int room = 0;
+    int restarted = 0;
+    if (worker_count > 1 && !server_supervise(worker_count, &room, &restarted)) return 0;
+    if (restarted && checkpoint_path) restore = 1;
+
+    int listen_fd = create_listen_socket(port, &listen_tuning, worker_count > 1);
     if (listen_fd < 0) {
         fprintf(stderr, "server: listen failed: %s\n", strerror(errno));
         return 1;
     }
 
     server_context_t server_ctx;
-    server_init(&server_ctx, listen_fd, map_width, map_height, mode, timed_ms, world_type, map_file_path);
+    if (server_init(&server_ctx, listen_fd, (uint16_t)map_width, (uint16_t)map_height, mode, timed_ms, world_type, map_file_path) != 0) {
+        fprintf(stderr, "server: out of memory\n");
+        close(listen_fd);
+        return 1;
+    }
+    server_ctx.game_state.max_snake_len = (uint16_t)max_snake_len;
+    server_ctx.listen_tuning = listen_tuning;
+    server_ctx.spectator_every = spectator_every > 0 ? spectator_every : 1;
+    server_ctx.adaptive_rate = adaptive_rate;
+    server_ctx.port = port;
+    server_ctx.room = (uint16_t)room;
+    server_ctx.room_count = (uint16_t)worker_count;
+    if (room_capacity < 1) room_capacity = 1;
+    if (room_capacity > UINT16_MAX) room_capacity = UINT16_MAX;
+    server_ctx.room_capacity = (uint16_t)room_capacity;
+    server_apply_tick_rate(&server_ctx, tick_ms_list, tick_min_ms, tick_max_ms);
+
+    if (lobby_address) {
+        const char *colon = strrchr(lobby_address, ':');
+        if (colon) {
+            size_t host_len = (size_t)(colon - lobby_address);
+            if (host_len >= sizeof(server_ctx.lobby_host)) host_len = sizeof(server_ctx.lobby_host) - 1;
+            memcpy(server_ctx.lobby_host, lobby_address, host_len);
+            server_ctx.lobby_port = (uint16_t)atoi(colon + 1);
+        } else {
+            snprintf(server_ctx.lobby_host, sizeof(server_ctx.lobby_host), "127.0.0.1");
+            server_ctx.lobby_port = (uint16_t)atoi(lobby_address);
+        }
+    }
+
+    if (worker_count > 1) {
+        char handoff_name[LOCAL_SOCKET_NAME_MAX];
+        handoff_socket_name(handoff_name, sizeof(handoff_name), port, (uint16_t)room);
+        server_ctx.handoff_fd = handoff_socket_bind(handoff_name);
+        if (server_ctx.handoff_fd < 0) {
+            fprintf(stderr, "server: handoff socket %s unavailable: %s\n", handoff_name, strerror(errno));
+        }
+        fprintf(stderr, "server: worker %d hosting room %d\n", (int)getpid(), room);
+    }
+
+    if (local_socket_name) {
+        strncpy(server_ctx.local_socket_name, local_socket_name, sizeof(server_ctx.local_socket_name) - 1);
+    } else {
+        local_socket_default_name(server_ctx.local_socket_name, sizeof(server_ctx.local_socket_name), port);
+    }
+    // A Unix listener cannot be shared, so room 0 takes local clients and routes them on.
+    if (server_ctx.local_socket_name[0] != '\0' && room == 0) {
+        server_ctx.local_listen_fd = local_socket_listen(server_ctx.local_socket_name);
+        if (server_ctx.local_listen_fd < 0) {
+            fprintf(stderr, "server: local socket %s unavailable: %s\n", server_ctx.local_socket_name, strerror(errno));
+        } else if (socket_apply_buffers(server_ctx.local_listen_fd, &listen_tuning) < 0) {
+            fprintf(stderr, "server: socket buffer sizing failed: %s\n", strerror(errno));
+        }
+    }
 
     if (world_type == WORLD_FILE) {
         if (!map_file_path || map_file_path[0] == '\0') {
             fprintf(stderr, "server: WORLD_FILE requires map path\n");
             close(server_ctx.listen_socket_fd);
+            server_close_local_endpoints(&server_ctx);
             return 1;
         }
-        if (load_map_and_set_size(&server_ctx.game_state, map_file_path) != 0) {
-            fprintf(stderr, "server: failed to load map: %s\n", map_file_path);
+        game_map_t *initial_map = (game_map_t*)malloc(sizeof(*initial_map));
+        if (!initial_map || game_map_load(initial_map, server_ctx.map_file_path) != 0) {
+            fprintf(stderr, "server: failed to load map: %s\n", server_ctx.map_file_path);
+            free(initial_map);
             close(server_ctx.listen_socket_fd);
+            server_close_local_endpoints(&server_ctx);
             return 1;
         }
+        game_apply_map(&server_ctx.game_state, initial_map, monotonic_ms());
+        server_free_map(initial_map);
         server_ctx.world_type = WORLD_FILE;
-        server_ctx.game_state.world_type = WORLD_FILE;
+    }
+
+    if (lockstep_enabled) {
+        server_ctx.lockstep_enabled = 1;
+        server_ctx.lockstep_hash_every = lockstep_hash_every > 0 ? (uint32_t)lockstep_hash_every : 0;
+        server_ctx.game_state.event_sink = server_record_event;
+        server_ctx.game_state.event_sink_ctx = &server_ctx;
+    }
+
+    if (shm_ring_name && shm_ring_name[0] != '\0') {
+        char ring_name[SNAPRING_NAME_MAX];
+        if (worker_count > 1) snprintf(ring_name, sizeof(ring_name), "%s-%d", shm_ring_name, room);
+        else snprintf(ring_name, sizeof(ring_name), "%s", shm_ring_name);
+        if (snapring_create(&server_ctx.shm_ring, ring_name, (uint32_t)shm_ring_slots, (uint32_t)shm_ring_slot_kb * 1024u) != 0) {
+            fprintf(stderr, "server: shm ring %s unavailable: %s\n", ring_name, strerror(errno));
+        }
+    }
+
+    bot_manager_init(&server_ctx.bots, bot_cell_budget);
+
+    if (checkpoint_path && checkpoint_path[0] != '\0') {
+        if (worker_count > 1) snprintf(server_ctx.checkpoint_path, sizeof(server_ctx.checkpoint_path), "%s-%d", checkpoint_path, room);
+        else snprintf(server_ctx.checkpoint_path, sizeof(server_ctx.checkpoint_path), "%s", checkpoint_path);
+        server_ctx.checkpoint_interval_ms = checkpoint_ms;
+    }
+    if (restore && server_ctx.checkpoint_path[0] != '\0') {
+        checkpoint_image_t image;
+        memset(&image, 0, sizeof(image));
+        if (checkpoint_load(&image, server_ctx.checkpoint_path) != 0) {
+            fprintf(stderr, "server: no checkpoint restored from %s: %s\n", server_ctx.checkpoint_path, strerror(errno));
+        } else if (checkpoint_restore(&image, &server_ctx.game_state, &server_ctx.bots, monotonic_ms()) != 0) {
+            fprintf(stderr, "server: checkpoint %s is damaged, starting a new match\n", server_ctx.checkpoint_path);
+        } else {
+            server_ctx.game_mode = server_ctx.game_state.game_mode;
+            server_ctx.world_type = server_ctx.game_state.world_type;
+            fprintf(stderr, "server: resumed match at tick %u from %s\n", image.tick, server_ctx.checkpoint_path);
+        }
+        checkpoint_image_free(&image);
+    }
+
+    if (server_add_bots(&server_ctx, bot_count - server_ctx.bots.bot_count) < bot_count - server_ctx.bots.bot_count) {
+        fprintf(stderr, "server: could not place all %d bots\n", bot_count);
+    }
+
+    server_ctx.pin_reactors = pin_reactors;
+    if (server_open_reactors(&server_ctx, reactor_count, transport_kind) != 0) {
+        fprintf(stderr, "server: transport setup failed: %s\n", strerror(errno));
+        server_close_reactors(&server_ctx);
+        close(server_ctx.listen_socket_fd);
+        server_close_local_endpoints(&server_ctx);
+        return 1;
+    }
+    fprintf(stderr, "server: using %s transport, %d reactor%s\n", transport_name(&server_ctx.reactors[0].transport),
+            reactor_count, reactor_count == 1 ? "" : "s");
+
+    int checkpoint_started = server_ctx.checkpoint_path[0] != '\0' &&
+                             pthread_create(&server_ctx.checkpoint_thread, NULL, server_checkpoint_thread, &server_ctx) == 0;
+    if (server_ctx.checkpoint_path[0] != '\0' && !checkpoint_started) {
+        fprintf(stderr, "server: checkpoint writer not started\n");
+        server_ctx.checkpoint_path[0] = '\0';
     }
 
     pthread_t tick_thread;
     if (pthread_create(&tick_thread, NULL, server_tick_thread, &server_ctx) != 0) {
         fprintf(stderr, "server: pthread_create failed\n");
+        server_close_reactors(&server_ctx);
         close(server_ctx.listen_socket_fd);
+        server_close_local_endpoints(&server_ctx);
         return 1;
     }
 
-    while (server_ctx.is_running) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-
-        FD_SET(server_ctx.listen_socket_fd, &read_fds);
-        int max_fd = server_ctx.listen_socket_fd;
-
-        int client_fds_snapshot[MAX_CLIENTS];
-        for (int i = 0; i < MAX_CLIENTS; i++) client_fds_snapshot[i] = -1;
-
-        pthread_mutex_lock(&server_ctx.state_mutex);
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            client_fds_snapshot[i] = server_ctx.client_slots[i].client_socket_fd;
-        }
-        pthread_mutex_unlock(&server_ctx.state_mutex);
-
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int fd = client_fds_snapshot[i];
-            if (fd >= 0) {
-                FD_SET(fd, &read_fds);
-                if (fd > max_fd) max_fd = fd;
-            }
-        }
+    if (pthread_create(&server_ctx.map_loader_thread, NULL, server_map_loader_thread, &server_ctx) != 0) {
+        fprintf(stderr, "server: pthread_create failed\n");
+        server_ctx.is_running = 0;
+        pthread_join(tick_thread, NULL);
+        server_close_reactors(&server_ctx);
+        close(server_ctx.listen_socket_fd);
+        server_close_local_endpoints(&server_ctx);
+        return 1;
+    }
 
-        int select_rc = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
-        if (select_rc < 0) {
-            if (errno == EINTR) continue;
-            fprintf(stderr, "server: select failed: %s\n", strerror(errno));
-            break;
-        }
+    int lobby_started = server_ctx.lobby_port != 0 &&
+                        pthread_create(&server_ctx.lobby_thread, NULL, server_lobby_thread, &server_ctx) == 0;
+    if (server_ctx.lobby_port != 0 && !lobby_started) fprintf(stderr, "server: lobby reporter not started\n");
 
-        if (FD_ISSET(server_ctx.listen_socket_fd, &read_fds)) {
-            struct sockaddr_in client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
+    int reactors_started = 0;
+    if (server_start_reactors(&server_ctx, &reactors_started) != 0) {
+        fprintf(stderr, "server: pthread_create failed\n");
+    } else {
+        reactor_run(&server_ctx.reactors[0]);
+    }
+    server_join_reactors(&server_ctx, reactors_started);
 
-            int client_fd = accept(server_ctx.listen_socket_fd, (struct sockaddr*)&client_addr, &client_addr_len);
-            if (client_fd >= 0) {
-                pthread_mutex_lock(&server_ctx.state_mutex);
+    pthread_join(tick_thread, NULL);
+    if (lobby_started) pthread_join(server_ctx.lobby_thread, NULL);
 
-                int slot_index = -1;
-                int add_rc = server_add_client(&server_ctx, client_fd, &slot_index);
-                if (add_rc == 0) {
-                    game_mark_client_active(&server_ctx.game_state, slot_index);
-                } else {
-                    const char *error_text = "server full";
-                    send_message(client_fd, MSG_ERROR, error_text, (uint16_t)strlen(error_text));
-                    close(client_fd);
-                }
+    // Last on the wire: the tick thread is gone and queues nothing after these.
+    if (server_ctx.is_migrated) send_redirect_to_all(&server_ctx);
+    else send_game_over_to_all(&server_ctx);
 
-                pthread_mutex_unlock(&server_ctx.state_mutex);
-            }
-        }
+    // The reactors are gone too, so the last frames would otherwise die in their queues.
+    uint64_t drain_deadline = monotonic_ms() + SHUTDOWN_DRAIN_MS;
+    for (int r = 0; r < server_ctx.reactor_count; r++) {
+        uint64_t now = monotonic_ms();
+        transport_send_drain(&server_ctx.reactors[r].transport, now < drain_deadline ? (int)(drain_deadline - now) : 0);
+    }
 
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int fd = client_fds_snapshot[i];
-            if (fd >= 0 && FD_ISSET(fd, &read_fds)) handle_client_message(&server_ctx, fd);
-        }
+    pthread_mutex_lock(&server_ctx.state_mutex);
+    pthread_cond_signal(&server_ctx.map_loader_cond);
+    pthread_mutex_unlock(&server_ctx.state_mutex);
+    pthread_join(server_ctx.map_loader_thread, NULL);
+    server_free_map(server_ctx.pending_map);
 
+    if (checkpoint_started) {
         pthread_mutex_lock(&server_ctx.state_mutex);
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            int fd = server_ctx.client_slots[i].client_socket_fd;
-            if (fd < 0) continue;
-
-            char ping;
-            ssize_t rc = recv(fd, &ping, 1, MSG_PEEK | MSG_DONTWAIT);
-            if (rc == 0) {
-                shutdown(fd, SHUT_RDWR);
-                server_close_slot_fd(&server_ctx, i);
-                game_mark_client_inactive_keep_or_clear(&server_ctx.game_state, i, 0);
-            }
-        }
+        pthread_cond_signal(&server_ctx.checkpoint_cond);
         pthread_mutex_unlock(&server_ctx.state_mutex);
+        pthread_join(server_ctx.checkpoint_thread, NULL);
+        // A finished or migrated match has nothing to resume here.
+        if (server_ctx.game_state.should_terminate || server_ctx.is_migrated) unlink(server_ctx.checkpoint_path);
     }
-
-    send_game_over_to_all(&server_ctx);
-
-    pthread_join(tick_thread, NULL);
+    checkpoint_image_free(&server_ctx.checkpoint_captured);
+    checkpoint_image_free(&server_ctx.migration_staged);
 
     pthread_mutex_lock(&server_ctx.state_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        server_close_slot_fd(&server_ctx, i);
-        game_mark_client_inactive_keep_or_clear(&server_ctx.game_state, i, 0);
-    }
+    while (server_ctx.active_count > 0) server_close_slot_fd(&server_ctx, server_ctx.active_slots[server_ctx.active_count - 1]);
     pthread_mutex_unlock(&server_ctx.state_mutex);
 
+    free(server_ctx.client_slots);
+    free(server_ctx.active_slots);
+    free(server_ctx.free_slots);
+    server_close_reactors(&server_ctx);
+
+    free(server_ctx.lockstep_keyframe_buf);
+    free(server_ctx.state_buf);
+    free(server_ctx.roster_buf);
+    view_cache_free(&server_ctx.view_cache);
+    bot_manager_free(&server_ctx.bots);
+    game_free(&server_ctx.game_state);
     close(server_ctx.listen_socket_fd);
+    server_close_local_endpoints(&server_ctx);
     return 0;
 }
 
@@ -0,0 +1,145 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Share of the tick interval each phase may use, in percent; together they leave headroom
+// for the reactors and the sleep slack.
+static const uint32_t phase_budget_pct[TICK_PHASE_COUNT] = { 10, 20, 20, 30, 10 };
+
+static const char *const phase_names[TICK_PHASE_COUNT] = { "lock", "bots", "simulate", "broadcast", "publish" };
+static const char *const level_names[DEGRADE_LEVEL_COUNT] = { "normal", "defer-spawns", "thin-frames", "skip-roster" };
+
+const char *tick_phase_name(int phase) {
+    return phase >= 0 && phase < TICK_PHASE_COUNT ? phase_names[phase] : "none";
+}
+
+const char *degrade_level_name(int level) {
+    return level >= 0 && level < DEGRADE_LEVEL_COUNT ? level_names[level] : "unknown";
+}
+
+void metrics_init(metrics_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->worst_phase = -1;
+}
+
+void metrics_tick_begin(metrics_t *m, uint64_t now_us) {
+    m->phase_start_us = now_us;
+    memset(m->phase_us, 0, sizeof(m->phase_us));
+}
+
+void metrics_phase_end(metrics_t *m, tick_phase_t phase, uint64_t now_us) {
+    uint64_t spent = now_us > m->phase_start_us ? now_us - m->phase_start_us : 0;
+    if (spent > UINT32_MAX) spent = UINT32_MAX;
+    m->phase_us[phase] += (uint32_t)spent;
+    m->phase_start_us = now_us;
+}
+
+static void record_event(metrics_t *m, int to_level, uint32_t tick, uint64_t now_ms) {
+    watchdog_event_t *ev = &m->events[m->event_count % METRICS_EVENT_MAX];
+    ev->at_ms = now_ms;
+    ev->tick = tick;
+    ev->from_level = (uint8_t)m->level;
+    ev->to_level = (uint8_t)to_level;
+    ev->phase = (uint8_t)(m->worst_phase >= 0 ? m->worst_phase : TICK_PHASE_COUNT);
+    ev->cost_us = m->worst_cost_us;
+    ev->budget_us = m->worst_budget_us;
+    m->event_count++;
+    m->level = to_level;
+}
+
+int metrics_tick_end(metrics_t *m, int interval_ms, uint32_t tick, uint64_t now_ms) {
+    uint64_t interval_us = (uint64_t)(interval_ms > 0 ? interval_ms : 1) * 1000u;
+    int overrun = 0;
+    for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+        uint32_t spent = m->phase_us[p];
+        m->phase_sum_us[p] += spent;
+        if (spent > m->phase_max_us[p]) m->phase_max_us[p] = spent;
+
+        uint32_t budget = (uint32_t)(interval_us * phase_budget_pct[p] / 100u);
+        if (spent <= budget) continue;
+        overrun = 1;
+        // Ranked by how far over budget, so a slow broadcast is not hidden by a cheap phase.
+        if (m->worst_phase < 0 || (uint64_t)spent * m->worst_budget_us > (uint64_t)m->worst_cost_us * budget) {
+            m->worst_phase = p;
+            m->worst_cost_us = spent;
+            m->worst_budget_us = budget;
+        }
+    }
+    m->tick_count++;
+    if (overrun) {
+        m->overrun_total++;
+        m->window_overruns++;
+    }
+
+    if (++m->window_ticks < WATCHDOG_WINDOW_TICKS) return m->level;
+
+    if (m->window_overruns >= WATCHDOG_ESCALATE_TICKS) {
+        m->clean_windows = 0;
+        if (m->level + 1 < DEGRADE_LEVEL_COUNT) record_event(m, m->level + 1, tick, now_ms);
+    } else if (m->window_overruns == 0) {
+        if (++m->clean_windows >= WATCHDOG_RECOVER_WINDOWS && m->level > DEGRADE_NONE) {
+            m->worst_phase = -1;
+            m->worst_cost_us = 0;
+            m->worst_budget_us = 0;
+            record_event(m, m->level - 1, tick, now_ms);
+            m->clean_windows = 0;
+        }
+    } else {
+        m->clean_windows = 0;
+    }
+
+    m->window_ticks = 0;
+    m->window_overruns = 0;
+    m->worst_phase = -1;
+    m->worst_cost_us = 0;
+    m->worst_budget_us = 0;
+    return m->level;
+}
+
+size_t metrics_format(metrics_t *m, int interval_ms, uint64_t now_ms, char *out, size_t cap) {
+    size_t len = 0;
+#define METRICS_APPEND(...) do { \
+        if (len < cap) { \
+            int n = snprintf(out + len, cap - len, __VA_ARGS__); \
+            if (n > 0) len += (size_t)n < cap - len ? (size_t)n : cap - len - 1; \
+        } \
+    } while (0)
+
+    if (cap == 0) return 0;
+    out[0] = '\0';
+    METRICS_APPEND("tick %d ms, level %s, %u ticks, %u over budget\n",
+                   interval_ms, degrade_level_name(m->level), m->tick_count, m->overrun_total);
+    for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+        unsigned long long avg = m->tick_count ? (unsigned long long)(m->phase_sum_us[p] / m->tick_count) : 0;
+        METRICS_APPEND("  %-9s avg %llu us, max %u us, budget %u us\n", phase_names[p], avg, m->phase_max_us[p],
+                       (unsigned)((uint64_t)interval_ms * 1000u * phase_budget_pct[p] / 100u));
+    }
+
+    METRICS_APPEND("  flood: %llu messages dropped, %u clients disconnected\n",
+                   (unsigned long long)m->flood_dropped, m->flood_disconnects);
+
+    METRICS_APPEND("  input to frame: p50 %u us, p90 %u us, p99 %u us, max %u us over %u inputs\n",
+                   latency_hist_percentile(&m->input_latency, 500), latency_hist_percentile(&m->input_latency, 900),
+                   latency_hist_percentile(&m->input_latency, 990), m->input_latency.max_us, m->input_latency.total);
+
+    uint32_t shown = m->event_count < METRICS_EVENT_MAX ? m->event_count : METRICS_EVENT_MAX;
+    for (uint32_t i = m->event_count - shown; i < m->event_count; i++) {
+        const watchdog_event_t *ev = &m->events[i % METRICS_EVENT_MAX];
+        METRICS_APPEND("  %llu s ago, tick %u: %s -> %s", (unsigned long long)((now_ms - ev->at_ms) / 1000u), ev->tick,
+                       degrade_level_name(ev->from_level), degrade_level_name(ev->to_level));
+        if (ev->phase < TICK_PHASE_COUNT) {
+            METRICS_APPEND(" (%s %u us of %u us)\n", phase_names[ev->phase], ev->cost_us, ev->budget_us);
+        } else {
+            METRICS_APPEND(" (recovered)\n");
+        }
+    }
+#undef METRICS_APPEND
+
+    memset(m->phase_sum_us, 0, sizeof(m->phase_sum_us));
+    memset(m->phase_max_us, 0, sizeof(m->phase_max_us));
+    m->tick_count = 0;
+    m->overrun_total = 0;
+    latency_hist_reset(&m->input_latency);
+    return len;
+}
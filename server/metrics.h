@@ -0,0 +1,84 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../common/latency.h"
+
+#define METRICS_EVENT_MAX        16
+#define WATCHDOG_WINDOW_TICKS    10
+#define WATCHDOG_ESCALATE_TICKS  5
+#define WATCHDOG_RECOVER_WINDOWS 5
+
+typedef enum {
+    TICK_PHASE_LOCK = 0,
+    TICK_PHASE_BOTS,
+    TICK_PHASE_SIMULATE,
+    TICK_PHASE_BROADCAST,
+    TICK_PHASE_PUBLISH,
+    TICK_PHASE_COUNT
+} tick_phase_t;
+
+// Each level keeps the ones below it.
+typedef enum {
+    DEGRADE_NONE = 0,
+    DEGRADE_DEFER_SPAWNS,
+    DEGRADE_THIN_FRAMES,
+    DEGRADE_SKIP_ROSTER,
+    DEGRADE_LEVEL_COUNT
+} degrade_level_t;
+
+typedef struct {
+    uint64_t at_ms;
+    uint32_t tick;
+    uint8_t from_level;
+    uint8_t to_level;
+    uint8_t phase;
+    uint32_t cost_us;
+    uint32_t budget_us;
+} watchdog_event_t;
+
+// Owned by the tick thread and read under the state lock.
+typedef struct {
+    uint64_t phase_start_us;
+    uint32_t phase_us[TICK_PHASE_COUNT];
+    uint64_t phase_sum_us[TICK_PHASE_COUNT];
+    uint32_t phase_max_us[TICK_PHASE_COUNT];
+    uint32_t tick_count;
+    uint32_t overrun_total;
+
+    int level;
+    uint32_t window_ticks;
+    uint32_t window_overruns;
+    uint32_t clean_windows;
+    int worst_phase;
+    uint32_t worst_cost_us;
+    uint32_t worst_budget_us;
+
+    watchdog_event_t events[METRICS_EVENT_MAX];
+    uint32_t event_count;
+
+    uint64_t flood_dropped;
+    uint32_t flood_disconnects;
+
+    latency_hist_t input_latency;   // input received to the first frame acknowledging it
+} metrics_t;
+
+void metrics_init(metrics_t *metrics);
+
+// A tick is bracketed by begin and end; each phase_end closes the phase that ran since the last mark.
+void metrics_tick_begin(metrics_t *metrics, uint64_t now_us);
+void metrics_phase_end(metrics_t *metrics, tick_phase_t phase, uint64_t now_us);
+
+// Checks the tick's phases against their share of the interval and moves the degradation
+// level one step when a window overruns or several windows run clean. Returns the level.
+int  metrics_tick_end(metrics_t *metrics, int interval_ms, uint32_t tick, uint64_t now_ms);
+
+const char *tick_phase_name(int phase);
+const char *degrade_level_name(int level);
+
+// Renders the counters since the previous report and the recent watchdog events, then
+// restarts the phase averages and the latency histogram.
+size_t metrics_format(metrics_t *metrics, int interval_ms, uint64_t now_ms, char *out, size_t cap);
+
+#endif
@@ -0,0 +1,1003 @@
+#define _GNU_SOURCE
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <linux/io_uring.h>
+
+#include "../common/protocol.h"
+
+enum {
+    URING_OP_ACCEPT   = 1,
+    URING_OP_RECV     = 2,
+    URING_OP_POLL_IN  = 3,
+    URING_OP_POLL_OUT = 4,
+    URING_OP_CANCEL   = 5,
+    URING_OP_SEND     = 6,
+    URING_OP_WAKE     = 7
+};
+
+#define EPOLL_WAKE_DATA UINT64_MAX
+
+#define URING_USER_DATA(op, gen, fd) (((uint64_t)(op) << 56) | ((uint64_t)((gen) & 0xFFFFFFu) << 32) | (uint32_t)(fd))
+#define URING_DATA_OP(ud)  ((int)((ud) >> 56))
+#define URING_DATA_GEN(ud) ((uint32_t)(((ud) >> 32) & 0xFFFFFFu))
+#define URING_DATA_FD(ud)  ((int)(uint32_t)(ud))
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static int fd_table_reserve(transport_t *t, int fd) {
+    if (fd < 0) return -1;
+    if ((size_t)fd < t->fd_cap) return 0;
+
+    size_t cap = t->fd_cap ? t->fd_cap : 256;
+    while (cap <= (size_t)fd) cap *= 2;
+    transport_fd_t *grown = (transport_fd_t*)realloc(t->fds, cap * sizeof(*grown));
+    if (!grown) return -1;
+    memset(grown + t->fd_cap, 0, (cap - t->fd_cap) * sizeof(*grown));
+    t->fds = grown;
+    t->fd_cap = cap;
+    return 0;
+}
+
+static transport_fd_t *fd_entry_open(transport_t *t, int fd, uint32_t tag, int is_listener) {
+    if (fd_table_reserve(t, fd) != 0) return NULL;
+
+    transport_fd_t *entry = &t->fds[fd];
+    entry->fd = fd;
+    entry->tag = tag;
+    entry->generation = (entry->generation + 1) & 0xFFFFFFu;
+    entry->is_listener = (uint8_t)is_listener;
+    entry->is_open = 1;
+    entry->shut_after_send = 0;
+
+    int socket_type = SOCK_STREAM;
+    socklen_t type_len = sizeof(socket_type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &socket_type, &type_len) < 0) socket_type = SOCK_STREAM;
+    entry->is_packet = socket_type != SOCK_STREAM;
+    return entry;
+}
+
+static transport_fd_t *fd_entry_current(transport_t *t, int fd, uint32_t generation) {
+    if (fd < 0 || (size_t)fd >= t->fd_cap) return NULL;
+    transport_fd_t *entry = &t->fds[fd];
+    return entry->is_open && entry->generation == generation ? entry : NULL;
+}
+
+static void backlog_free(transport_fd_t *entry) {
+    free(entry->backlog);
+    entry->backlog = NULL;
+    entry->backlog_len = 0;
+    entry->backlog_sent = 0;
+}
+
+// A client this far behind will not catch up; shutting it down lets its reactor drop it.
+static void backlog_cut(transport_fd_t *entry) {
+    fprintf(stderr, "server: dropping fd %d: %zu bytes it has not read\n", entry->fd, entry->backlog_len - entry->backlog_sent);
+    backlog_free(entry);
+    shutdown(entry->fd, SHUT_RDWR);
+}
+
+static int backlog_append(transport_fd_t *entry, const uint8_t *data, size_t len) {
+    size_t unsent = entry->backlog_len - entry->backlog_sent;
+    if (unsent + len > TRANSPORT_BACKLOG_MAX) return -1;
+    if (entry->backlog_sent > 0) {
+        memmove(entry->backlog, entry->backlog + entry->backlog_sent, unsent);
+        entry->backlog_len = unsent;
+        entry->backlog_sent = 0;
+    }
+    uint8_t *grown = (uint8_t*)realloc(entry->backlog, unsent + len);
+    if (!grown) return -1;
+    memcpy(grown + unsent, data, len);
+    entry->backlog = grown;
+    entry->backlog_len = unsent + len;
+    return 0;
+}
+
+// Returns 1 once the backlog is gone, 0 while the socket is still full, -1 after cutting fd off.
+static int backlog_send(transport_fd_t *entry) {
+    int rc = send_pending_bytes(entry->fd, entry->backlog, entry->backlog_len, &entry->backlog_sent);
+    if (rc > 0) backlog_free(entry);
+    else if (rc < 0) backlog_cut(entry);
+    if (rc > 0 && entry->shut_after_send) shutdown(entry->fd, SHUT_RDWR);
+    return rc;
+}
+
+// ---- io_uring rings ----
+
+static void ring_unmap(transport_ring_t *r) {
+    if (r->sqe_map) munmap(r->sqe_map, r->sqe_map_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->ring_fd >= 0) close(r->ring_fd);
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+}
+
+static int ring_setup(transport_ring_t *r, unsigned entries, unsigned cq_entries) {
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (cq_entries) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+    }
+
+    int ring_fd = sys_io_uring_setup(entries, &params);
+    if (ring_fd < 0) return -1;
+    r->ring_fd = ring_fd;
+
+    r->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    r->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        ring_unmap(r);
+        return -1;
+    }
+    if (single_mmap) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            ring_unmap(r);
+            return -1;
+        }
+    }
+    r->sqe_map_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqe_map = mmap(NULL, r->sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_SQES);
+    if (r->sqe_map == MAP_FAILED) {
+        r->sqe_map = NULL;
+        ring_unmap(r);
+        return -1;
+    }
+
+    uint8_t *sq = (uint8_t*)r->sq_map;
+    uint8_t *cq = (uint8_t*)r->cq_map;
+    r->sq_head = (uint32_t*)(sq + params.sq_off.head);
+    r->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    r->sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    r->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    r->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    r->cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    r->cqes = cq + params.cq_off.cqes;
+    r->sqes = r->sqe_map;
+    return 0;
+}
+
+static int ring_enter_submit(transport_ring_t *r, unsigned to_submit, unsigned wait_nr, int timeout_ms) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *arg_ptr = NULL;
+    size_t arg_size = 0;
+    if (wait_nr > 0 && timeout_ms >= 0) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        arg_ptr = &arg;
+        arg_size = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    for (;;) {
+        int rc = sys_io_uring_enter(r->ring_fd, to_submit, wait_nr, flags, arg_ptr, arg_size);
+        if (rc >= 0) {
+            r->sq_pending -= (uint32_t)rc < r->sq_pending ? (uint32_t)rc : r->sq_pending;
+            return rc;
+        }
+        if (errno == EINTR) continue;
+        if (errno == ETIME) return 0;
+        return -1;
+    }
+}
+
+static int ring_enter(transport_ring_t *r, unsigned wait_nr, int timeout_ms) {
+    return ring_enter_submit(r, r->sq_pending, wait_nr, timeout_ms);
+}
+
+static struct io_uring_sqe *ring_get_sqe(transport_ring_t *r) {
+    uint32_t tail = *r->sq_tail;
+    uint32_t head = atomic_load_explicit((_Atomic uint32_t*)r->sq_head, memory_order_acquire);
+    if (tail - head > r->sq_mask) {
+        if (ring_enter(r, 0, -1) < 0) return NULL;
+        head = atomic_load_explicit((_Atomic uint32_t*)r->sq_head, memory_order_acquire);
+        if (tail - head > r->sq_mask) return NULL;
+    }
+
+    uint32_t index = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe*)r->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    return sqe;
+}
+
+static void ring_push_sqe(transport_ring_t *r) {
+    atomic_store_explicit((_Atomic uint32_t*)r->sq_tail, *r->sq_tail + 1, memory_order_release);
+    r->sq_pending++;
+}
+
+static const struct io_uring_cqe *ring_peek_cqe(transport_ring_t *r) {
+    uint32_t head = *r->cq_head;
+    uint32_t tail = atomic_load_explicit((_Atomic uint32_t*)r->cq_tail, memory_order_acquire);
+    if (head == tail) return NULL;
+    return &((const struct io_uring_cqe*)r->cqes)[head & r->cq_mask];
+}
+
+static void ring_advance_cq(transport_ring_t *r) {
+    atomic_store_explicit((_Atomic uint32_t*)r->cq_head, *r->cq_head + 1, memory_order_release);
+}
+
+static void buf_ring_publish(transport_t *t, uint16_t bid) {
+    struct io_uring_buf *bufs = (struct io_uring_buf*)t->buf_ring;
+    uint16_t tail = *(volatile uint16_t*)&bufs[0].resv;
+    struct io_uring_buf *slot = &bufs[(uint16_t)(tail + t->buf_pending) & (TRANSPORT_URING_BUFS - 1)];
+    slot->addr = (uint64_t)(uintptr_t)(t->buf_pool + (size_t)bid * TRANSPORT_URING_BUF_SIZE);
+    slot->len = TRANSPORT_URING_BUF_SIZE;
+    slot->bid = bid;
+    t->buf_pending++;
+}
+
+static void buf_ring_commit(transport_t *t) {
+    if (t->buf_pending == 0) return;
+    struct io_uring_buf *bufs = (struct io_uring_buf*)t->buf_ring;
+    uint16_t tail = *(volatile uint16_t*)&bufs[0].resv;
+    atomic_store_explicit((_Atomic uint16_t*)&bufs[0].resv, (uint16_t)(tail + t->buf_pending), memory_order_release);
+    t->buf_pending = 0;
+}
+
+static int uring_arm(transport_t *t, const transport_fd_t *entry, int op) {
+    struct io_uring_sqe *sqe = ring_get_sqe(&t->events);
+    if (!sqe) return -1;
+
+    sqe->fd = entry->fd;
+    sqe->user_data = URING_USER_DATA(op, entry->generation, entry->fd);
+    if (op == URING_OP_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    } else if (op == URING_OP_RECV) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    } else if (op == URING_OP_POLL_IN) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+    }
+    ring_push_sqe(&t->events);
+    return 0;
+}
+
+static int uring_arm_input(transport_t *t, const transport_fd_t *entry) {
+    if (entry->is_listener) return uring_arm(t, entry, URING_OP_ACCEPT);
+    return uring_arm(t, entry, entry->is_packet ? URING_OP_POLL_IN : URING_OP_RECV);
+}
+
+// Multishot receive landed in 6.0; buffer rings alone (5.19) are not enough, so try it once.
+static int uring_probe_multishot_recv(transport_t *t) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) return -1;
+
+    transport_fd_t probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.fd = pair[0];
+    int ok = uring_arm(t, &probe, URING_OP_RECV) == 0 && send(pair[1], "x", 1, MSG_NOSIGNAL) == 1 &&
+             ring_enter(&t->events, 1, 1000) >= 0;
+
+    const struct io_uring_cqe *cqe = ok ? ring_peek_cqe(&t->events) : NULL;
+    ok = cqe && cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER);
+    int more = 0;
+    if (cqe) {
+        if (cqe->flags & IORING_CQE_F_BUFFER) buf_ring_publish(t, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        ring_advance_cq(&t->events);
+    }
+
+    // Closing the peer ends the multishot request; reap its final completion here.
+    close(pair[1]);
+    while (more) {
+        cqe = ring_peek_cqe(&t->events);
+        if (!cqe) {
+            if (ring_enter(&t->events, 1, 1000) < 0 || !ring_peek_cqe(&t->events)) break;
+            continue;
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER) buf_ring_publish(t, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        ring_advance_cq(&t->events);
+    }
+    close(pair[0]);
+    buf_ring_commit(t);
+    return ok && !more ? 0 : -1;
+}
+
+static void uring_close(transport_t *t) {
+    ring_unmap(&t->events);
+    ring_unmap(&t->sends);
+    if (t->buf_ring) munmap(t->buf_ring, t->buf_ring_len);
+    free(t->buf_pool);
+    t->buf_ring = NULL;
+    t->buf_pool = NULL;
+}
+
+static int uring_open(transport_t *t) {
+    if (ring_setup(&t->events, TRANSPORT_URING_ENTRIES, TRANSPORT_URING_CQ) != 0) return -1;
+    if (ring_setup(&t->sends, TRANSPORT_URING_ENTRIES, 0) != 0) {
+        uring_close(t);
+        return -1;
+    }
+
+    t->buf_ring_len = TRANSPORT_URING_BUFS * sizeof(struct io_uring_buf);
+    t->buf_ring = mmap(NULL, t->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    t->buf_pool = (uint8_t*)malloc((size_t)TRANSPORT_URING_BUFS * TRANSPORT_URING_BUF_SIZE);
+    if (t->buf_ring == MAP_FAILED || !t->buf_pool) {
+        if (t->buf_ring == MAP_FAILED) t->buf_ring = NULL;
+        uring_close(t);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)t->buf_ring;
+    reg.ring_entries = TRANSPORT_URING_BUFS;
+    reg.bgid = 0;
+    if (sys_io_uring_register(t->events.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        uring_close(t);
+        return -1;
+    }
+    for (uint16_t bid = 0; bid < TRANSPORT_URING_BUFS; bid++) buf_ring_publish(t, bid);
+    buf_ring_commit(t);
+
+    if (uring_probe_multishot_recv(t) != 0) {
+        uring_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+static int uring_wait(transport_t *t, transport_event_t *events, int max_events, int timeout_ms) {
+    for (int i = 0; i < t->recycle_count; i++) buf_ring_publish(t, t->recycle[i]);
+    buf_ring_commit(t);
+    t->recycle_count = 0;
+
+    pthread_mutex_lock(&t->lock);
+    for (int i = 0; i < t->rearm_count; i++) {
+        int fd = (int)(uint32_t)t->rearm[i];
+        uint32_t gen = (uint32_t)(t->rearm[i] >> 32);
+        if ((size_t)fd < t->fd_cap && t->fds[fd].is_open && t->fds[fd].generation == gen) (void)uring_arm_input(t, &t->fds[fd]);
+    }
+    t->rearm_count = 0;
+    if (!t->wake_armed) {
+        struct io_uring_sqe *sqe = ring_get_sqe(&t->events);
+        if (sqe) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = t->wake_fd;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = URING_USER_DATA(URING_OP_WAKE, 0, 0);
+            ring_push_sqe(&t->events);
+            t->wake_armed = 1;
+        }
+    }
+    int rc = t->events.sq_pending > 0 ? ring_enter(&t->events, 0, -1) : 0;
+    pthread_mutex_unlock(&t->lock);
+    if (rc < 0) return -1;
+
+    // Other threads submit under the lock, so the blocking wait submits nothing.
+    if (!ring_peek_cqe(&t->events) && ring_enter_submit(&t->events, 0, 1, timeout_ms) < 0) return -1;
+
+    // The fd table may be grown by a thread adding a client to this transport.
+    pthread_mutex_lock(&t->lock);
+    int count = 0;
+    const struct io_uring_cqe *cqe;
+    while (count < max_events && t->rearm_count < TRANSPORT_MAX_EVENTS && (cqe = ring_peek_cqe(&t->events)) != NULL) {
+        uint64_t user_data = cqe->user_data;
+        int32_t res = cqe->res;
+        uint32_t flags = cqe->flags;
+        ring_advance_cq(&t->events);
+
+        int op = URING_DATA_OP(user_data);
+        int fd = URING_DATA_FD(user_data);
+        uint32_t gen = URING_DATA_GEN(user_data);
+        int more = (flags & IORING_CQE_F_MORE) != 0;
+        int has_buf = (flags & IORING_CQE_F_BUFFER) != 0;
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if (op == URING_OP_WAKE) {
+            uint64_t wakeups;
+            if (read(t->wake_fd, &wakeups, sizeof(wakeups)) < 0) wakeups = 0;
+            if (!more) t->wake_armed = 0;
+            continue;
+        }
+
+        transport_fd_t *entry = (fd >= 0 && (size_t)fd < t->fd_cap) ? &t->fds[fd] : NULL;
+        int current = entry && entry->is_open && entry->generation == gen;
+        if (!current || op == URING_OP_CANCEL) {
+            if (has_buf) buf_ring_publish(t, bid);
+            continue;
+        }
+
+        transport_event_t *ev = &events[count];
+        memset(ev, 0, sizeof(*ev));
+        ev->fd = fd;
+        ev->tag = entry->tag;
+        ev->generation = gen;
+
+        if (op == URING_OP_ACCEPT) {
+            if (!more) t->rearm[t->rearm_count++] = ((uint64_t)gen << 32) | (uint32_t)fd;
+            if (res < 0) continue;
+            ev->type = TRANSPORT_EV_ACCEPT;
+            ev->fd = res;
+            count++;
+        } else if (op == URING_OP_RECV) {
+            if (res > 0 && has_buf) {
+                ev->type = TRANSPORT_EV_DATA;
+                ev->data = t->buf_pool + (size_t)bid * TRANSPORT_URING_BUF_SIZE;
+                ev->len = (size_t)res;
+                t->recycle[t->recycle_count++] = bid;
+                if (!more) t->rearm[t->rearm_count++] = ((uint64_t)gen << 32) | (uint32_t)fd;
+                count++;
+            } else if (res == -ENOBUFS) {
+                t->rearm[t->rearm_count++] = ((uint64_t)gen << 32) | (uint32_t)fd;
+            } else {
+                if (has_buf) buf_ring_publish(t, bid);
+                ev->type = TRANSPORT_EV_CLOSED;
+                count++;
+            }
+        } else if (op == URING_OP_POLL_IN) {
+            // One-shot and re-armed after the caller has read, so a partly drained socket fires again.
+            if (res >= 0) t->rearm[t->rearm_count++] = ((uint64_t)gen << 32) | (uint32_t)fd;
+            ev->type = res < 0 ? TRANSPORT_EV_CLOSED : TRANSPORT_EV_READABLE;
+            count++;
+        } else if (op == URING_OP_POLL_OUT) {
+            if (res < 0) continue;
+            if (entry->backlog && backlog_send(entry) == 0) (void)uring_arm(t, entry, URING_OP_POLL_OUT);
+            ev->type = TRANSPORT_EV_WRITABLE;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    buf_ring_commit(t);
+    return count;
+}
+
+static int fd_arm_writable(transport_t *t, const transport_fd_t *entry) {
+    if (t->kind == TRANSPORT_IO_URING) {
+        if (uring_arm(t, entry, URING_OP_POLL_OUT) != 0) return -1;
+        return ring_enter(&t->events, 0, -1) < 0 ? -1 : 0;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = ((uint64_t)entry->generation << 32) | (uint32_t)entry->fd;
+    return epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, entry->fd, &ev);
+}
+
+// Returns 1 when the frames were queued behind the fd's backlog, or the fd is gone, and so
+// must not be sent now.
+static int send_entry_deferred(transport_t *t, const transport_send_t *send_entry, const uint8_t *data) {
+    pthread_mutex_lock(&t->lock);
+    transport_fd_t *entry = fd_entry_current(t, send_entry->fd, send_entry->generation);
+    int deferred = 1;
+    if (entry && entry->backlog) {
+        if (backlog_append(entry, data, send_entry->len) != 0) backlog_cut(entry);
+    } else if (entry) {
+        deferred = 0;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return deferred;
+}
+
+// Sends what the socket takes now from sent on; the rest becomes the fd's backlog.
+static void send_entry_rest(transport_t *t, const transport_send_t *send_entry, const uint8_t *data, size_t sent) {
+    int rc = send_pending_bytes(send_entry->fd, data, send_entry->len, &sent);
+    if (rc > 0) return;
+
+    pthread_mutex_lock(&t->lock);
+    transport_fd_t *entry = fd_entry_current(t, send_entry->fd, send_entry->generation);
+    if (entry && rc < 0) {
+        shutdown(entry->fd, SHUT_RDWR);
+    } else if (entry && (backlog_append(entry, data + sent, send_entry->len - sent) != 0 || fd_arm_writable(t, entry) != 0)) {
+        backlog_cut(entry);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static int uring_send_flush(transport_t *t, const transport_send_queue_t *q) {
+    size_t done = 0;
+    while (done < q->count) {
+        size_t batch = q->count - done;
+        if (batch > TRANSPORT_URING_ENTRIES) batch = TRANSPORT_URING_ENTRIES;
+
+        size_t queued = 0;
+        for (size_t i = 0; i < batch; i++) {
+            const transport_send_t *send_entry = &q->entries[done + i];
+            if (send_entry->fd < 0 || send_entry_deferred(t, send_entry, q->arena + send_entry->offset)) continue;
+            struct io_uring_sqe *sqe = ring_get_sqe(&t->sends);
+            if (!sqe) return -1;
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = send_entry->fd;
+            sqe->addr = (uint64_t)(uintptr_t)(q->arena + send_entry->offset);
+            sqe->len = (uint32_t)send_entry->len;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+            sqe->user_data = URING_USER_DATA(URING_OP_SEND, 0, done + i);
+            ring_push_sqe(&t->sends);
+            queued++;
+        }
+        if (queued > 0 && ring_enter(&t->sends, (unsigned)queued, -1) < 0) return -1;
+
+        size_t reaped = 0;
+        while (reaped < queued) {
+            const struct io_uring_cqe *cqe = ring_peek_cqe(&t->sends);
+            if (!cqe) {
+                if (ring_enter(&t->sends, 1, -1) < 0) return -1;
+                continue;
+            }
+            size_t index = (size_t)(uint32_t)cqe->user_data;
+            int32_t res = cqe->res;
+            ring_advance_cq(&t->sends);
+            reaped++;
+
+            const transport_send_t *send_entry = &q->entries[index];
+            if (res >= 0 && (size_t)res == send_entry->len) continue;
+
+            // A full socket leaves the rest to the backlog; oversize packet records go out in chunks.
+            if (res >= 0 || res == -EAGAIN || res == -EMSGSIZE) {
+                send_entry_rest(t, send_entry, q->arena + send_entry->offset, res > 0 ? (size_t)res : 0);
+                continue;
+            }
+            shutdown(send_entry->fd, SHUT_RDWR);
+        }
+        done += batch;
+    }
+    return 0;
+}
+
+// ---- epoll ----
+
+static int epoll_wait_events(transport_t *t, transport_event_t *events, int max_events, int timeout_ms) {
+    struct epoll_event ready[TRANSPORT_MAX_EVENTS];
+    int ready_max = max_events < TRANSPORT_MAX_EVENTS ? max_events : TRANSPORT_MAX_EVENTS;
+
+    int n = epoll_wait(t->epoll_fd, ready, ready_max, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    pthread_mutex_lock(&t->lock);
+    int count = 0;
+    for (int i = 0; i < n && count < max_events; i++) {
+        if (ready[i].data.u64 == EPOLL_WAKE_DATA) {
+            uint64_t wakeups;
+            if (read(t->wake_fd, &wakeups, sizeof(wakeups)) < 0) wakeups = 0;
+            continue;
+        }
+        int fd = (int)(uint32_t)ready[i].data.u64;
+        uint32_t gen = (uint32_t)(ready[i].data.u64 >> 32);
+        if ((size_t)fd >= t->fd_cap || !t->fds[fd].is_open || t->fds[fd].generation != gen) continue;
+        const transport_fd_t *entry = &t->fds[fd];
+
+        if (entry->is_listener) {
+            while (count < max_events) {
+                int client_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+                if (client_fd < 0) break;
+                transport_event_t *ev = &events[count++];
+                memset(ev, 0, sizeof(*ev));
+                ev->type = TRANSPORT_EV_ACCEPT;
+                ev->fd = client_fd;
+                ev->tag = entry->tag;
+                ev->generation = gen;
+            }
+            continue;
+        }
+
+        if (ready[i].events & EPOLLOUT) {
+            struct epoll_event change;
+            memset(&change, 0, sizeof(change));
+            change.events = EPOLLIN;
+            if (t->fds[fd].backlog && backlog_send(&t->fds[fd]) == 0) change.events |= EPOLLOUT;
+            change.data.u64 = ready[i].data.u64;
+            (void)epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, fd, &change);
+
+            transport_event_t *ev = &events[count++];
+            memset(ev, 0, sizeof(*ev));
+            ev->type = TRANSPORT_EV_WRITABLE;
+            ev->fd = fd;
+            ev->tag = entry->tag;
+            ev->generation = gen;
+        }
+        if ((ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && count < max_events) {
+            transport_event_t *ev = &events[count++];
+            memset(ev, 0, sizeof(*ev));
+            ev->type = TRANSPORT_EV_READABLE;
+            ev->fd = fd;
+            ev->tag = entry->tag;
+            ev->generation = gen;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return count;
+}
+
+static int epoll_register(transport_t *t, const transport_fd_t *entry, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)entry->generation << 32) | (uint32_t)entry->fd;
+    return epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, entry->fd, &ev);
+}
+
+// ---- public ----
+
+int transport_parse_kind(const char *text, transport_kind_t *out_kind) {
+    if (strcmp(text, "auto") == 0) *out_kind = TRANSPORT_AUTO;
+    else if (strcmp(text, "epoll") == 0) *out_kind = TRANSPORT_EPOLL;
+    else if (strcmp(text, "io_uring") == 0 || strcmp(text, "uring") == 0) *out_kind = TRANSPORT_IO_URING;
+    else return -1;
+    return 0;
+}
+
+const char *transport_name(const transport_t *t) {
+    return t->kind == TRANSPORT_IO_URING ? "io_uring" : "epoll";
+}
+
+int transport_open(transport_t *t, transport_kind_t kind) {
+    memset(t, 0, sizeof(*t));
+    t->epoll_fd = -1;
+    t->events.ring_fd = -1;
+    t->sends.ring_fd = -1;
+    t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (t->wake_fd < 0) return -1;
+    pthread_mutex_init(&t->lock, NULL);
+
+    if (kind != TRANSPORT_EPOLL) {
+        if (uring_open(t) == 0) {
+            t->kind = TRANSPORT_IO_URING;
+            return 0;
+        }
+        if (kind == TRANSPORT_IO_URING) {
+            fprintf(stderr, "server: io_uring unavailable (%s), falling back to epoll\n", strerror(errno));
+        }
+    }
+
+    struct epoll_event wake;
+    memset(&wake, 0, sizeof(wake));
+    wake.events = EPOLLIN;
+    wake.data.u64 = EPOLL_WAKE_DATA;
+    t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (t->epoll_fd < 0 || epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->wake_fd, &wake) != 0) {
+        if (t->epoll_fd >= 0) close(t->epoll_fd);
+        close(t->wake_fd);
+        pthread_mutex_destroy(&t->lock);
+        return -1;
+    }
+    t->kind = TRANSPORT_EPOLL;
+    return 0;
+}
+
+static void send_queue_free(transport_send_queue_t *q) {
+    free(q->arena);
+    free(q->entries);
+    memset(q, 0, sizeof(*q));
+}
+
+void transport_close(transport_t *t) {
+    if (t->kind == TRANSPORT_IO_URING) uring_close(t);
+    if (t->epoll_fd >= 0) close(t->epoll_fd);
+    if (t->wake_fd >= 0) close(t->wake_fd);
+    for (size_t i = 0; i < t->fd_cap; i++) backlog_free(&t->fds[i]);
+    free(t->fds);
+    send_queue_free(&t->queued);
+    send_queue_free(&t->flushing);
+    pthread_mutex_destroy(&t->lock);
+    memset(t, 0, sizeof(*t));
+    t->epoll_fd = -1;
+    t->wake_fd = -1;
+}
+
+int transport_add_listener(transport_t *t, int listen_fd, uint32_t tag) {
+    if (listen_fd < 0) return 0;
+
+    pthread_mutex_lock(&t->lock);
+    transport_fd_t *entry = fd_entry_open(t, listen_fd, tag, 1);
+    int rc = -1;
+    if (entry && t->kind == TRANSPORT_IO_URING) {
+        rc = uring_arm(t, entry, URING_OP_ACCEPT);
+    } else if (entry) {
+        int fl = fcntl(listen_fd, F_GETFL, 0);
+        rc = (fl >= 0 && fcntl(listen_fd, F_SETFL, fl | O_NONBLOCK) == 0) ? epoll_register(t, entry, EPOLLIN) : -1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return rc;
+}
+
+// May be called from a thread other than the one waiting on t, so io_uring arms are submitted here.
+int transport_add_client(transport_t *t, int fd, uint32_t tag) {
+    pthread_mutex_lock(&t->lock);
+    transport_fd_t *entry = fd_entry_open(t, fd, tag, 0);
+    int rc = -1;
+    if (entry && t->kind == TRANSPORT_IO_URING) {
+        rc = uring_arm_input(t, entry);
+        if (rc == 0) rc = ring_enter(&t->events, 0, -1) < 0 ? -1 : 0;
+    } else if (entry) {
+        rc = epoll_register(t, entry, EPOLLIN);
+    }
+    if (rc != 0 && entry) entry->is_open = 0;
+    pthread_mutex_unlock(&t->lock);
+    return rc;
+}
+
+// Call before close(): io_uring requests pin the socket until they are cancelled, and frames
+// still queued for fd must not reach whichever connection reuses the number.
+void transport_remove(transport_t *t, int fd) {
+    pthread_mutex_lock(&t->lock);
+    if (fd >= 0 && (size_t)fd < t->fd_cap && t->fds[fd].is_open) {
+        transport_fd_t *entry = &t->fds[fd];
+        if (t->kind == TRANSPORT_IO_URING) {
+            struct io_uring_sqe *sqe = ring_get_sqe(&t->events);
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = fd;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                sqe->user_data = URING_USER_DATA(URING_OP_CANCEL, 0, fd);
+                ring_push_sqe(&t->events);
+                (void)ring_enter(&t->events, 0, -1);
+            }
+        } else {
+            (void)epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        }
+        backlog_free(entry);
+        entry->is_open = 0;
+        entry->generation = (entry->generation + 1) & 0xFFFFFFu;
+    }
+    for (size_t i = 0; i < t->queued.count; i++) {
+        if (t->queued.entries[i].fd == fd) t->queued.entries[i].fd = -1;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+int transport_want_writable(transport_t *t, int fd) {
+    pthread_mutex_lock(&t->lock);
+    int rc = -1;
+    if (fd >= 0 && (size_t)fd < t->fd_cap && t->fds[fd].is_open) rc = fd_arm_writable(t, &t->fds[fd]);
+    pthread_mutex_unlock(&t->lock);
+    return rc;
+}
+
+// Bytes a full socket left waiting for fd; 0 once it has caught up.
+size_t transport_backlog_len(transport_t *t, int fd) {
+    pthread_mutex_lock(&t->lock);
+    size_t len = 0;
+    if (fd >= 0 && (size_t)fd < t->fd_cap && t->fds[fd].is_open) len = t->fds[fd].backlog_len - t->fds[fd].backlog_sent;
+    pthread_mutex_unlock(&t->lock);
+    return len;
+}
+
+// Interrupts transport_wait on the owner thread; it then returns, possibly with no events.
+void transport_wake(transport_t *t) {
+    uint64_t one = 1;
+    if (write(t->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "server: transport wake failed: %s\n", strerror(errno));
+    }
+}
+
+int transport_wait(transport_t *t, transport_event_t *events, int max_events, int timeout_ms) {
+    if (max_events > TRANSPORT_MAX_EVENTS) max_events = TRANSPORT_MAX_EVENTS;
+    if (t->kind == TRANSPORT_IO_URING) return uring_wait(t, events, max_events, timeout_ms);
+    return epoll_wait_events(t, events, max_events, timeout_ms);
+}
+
+int transport_event_is_current(transport_t *t, const transport_event_t *event) {
+    if (event->type == TRANSPORT_EV_ACCEPT) return 1;
+
+    pthread_mutex_lock(&t->lock);
+    int current = 0;
+    if (event->fd >= 0 && (size_t)event->fd < t->fd_cap) {
+        const transport_fd_t *entry = &t->fds[event->fd];
+        current = entry->is_open && entry->generation == event->generation;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return current;
+}
+
+static int send_queue_append(transport_send_queue_t *q, int fd, uint32_t generation, uint16_t message_type,
+                             const void *payload, uint32_t payload_len) {
+    size_t frame_len = sizeof(message_header_t) + payload_len;
+    if (q->arena_len + frame_len > q->arena_cap) {
+        size_t cap = q->arena_cap ? q->arena_cap : 65536;
+        while (cap < q->arena_len + frame_len) cap *= 2;
+        uint8_t *grown = (uint8_t*)realloc(q->arena, cap);
+        if (!grown) return -1;
+        q->arena = grown;
+        q->arena_cap = cap;
+    }
+
+    transport_send_t *last = q->count > 0 ? &q->entries[q->count - 1] : NULL;
+    if (!last || last->fd != fd) {
+        if (q->count == q->cap) {
+            size_t cap = q->cap ? q->cap * 2 : 64;
+            transport_send_t *grown = (transport_send_t*)realloc(q->entries, cap * sizeof(*grown));
+            if (!grown) return -1;
+            q->entries = grown;
+            q->cap = cap;
+        }
+        last = &q->entries[q->count++];
+        last->fd = fd;
+        last->generation = generation;
+        last->offset = q->arena_len;
+        last->len = 0;
+    }
+
+    message_header_t header_net;
+    header_net.message_type_net = htons(message_type);
+    header_net.payload_len_net = htonl(payload_len);
+    memcpy(q->arena + q->arena_len, &header_net, sizeof(header_net));
+    if (payload_len > 0) memcpy(q->arena + q->arena_len + sizeof(header_net), payload, payload_len);
+    q->arena_len += frame_len;
+    last->len += frame_len;
+    return 0;
+}
+
+// Frames for one fd queued back to back become a single send at flush time.
+int transport_send_frame(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len) {
+    pthread_mutex_lock(&t->lock);
+    int rc = -1;
+    if (fd >= 0 && (size_t)fd < t->fd_cap && t->fds[fd].is_open) {
+        rc = send_queue_append(&t->queued, fd, t->fds[fd].generation, message_type, payload, payload_len);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return rc;
+}
+
+void transport_send_commit(transport_t *t) {
+    pthread_mutex_lock(&t->lock);
+    int has_frames = t->queued.count > 0;
+    pthread_mutex_unlock(&t->lock);
+    if (has_frames) transport_wake(t);
+}
+
+int transport_send_flush(transport_t *t) {
+    pthread_mutex_lock(&t->lock);
+    transport_send_queue_t swap = t->flushing;
+    t->flushing = t->queued;
+    t->queued = swap;
+    pthread_mutex_unlock(&t->lock);
+
+    transport_send_queue_t *q = &t->flushing;
+    int rc = 0;
+    if (t->kind == TRANSPORT_IO_URING) {
+        rc = uring_send_flush(t, q);
+    } else {
+        for (size_t i = 0; i < q->count; i++) {
+            const uint8_t *data = q->arena + q->entries[i].offset;
+            if (q->entries[i].fd < 0 || send_entry_deferred(t, &q->entries[i], data)) continue;
+            send_entry_rest(t, &q->entries[i], data, 0);
+        }
+    }
+
+    // A final message still in a backlog leaves the shutdown to backlog_send.
+    pthread_mutex_lock(&t->lock);
+    for (size_t i = 0; i < q->count; i++) {
+        transport_fd_t *entry = fd_entry_current(t, q->entries[i].fd, q->entries[i].generation);
+        if (entry && entry->shut_after_send && !entry->backlog) shutdown(entry->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&t->lock);
+    q->arena_len = 0;
+    q->count = 0;
+    return rc;
+}
+
+// Queued like any frame so that only the owner thread ever writes to fd: a direct send from
+// another thread could interleave with the owner's partial sends. A socket not added yet has
+// no owner, so the message goes straight out.
+static int send_message_queued(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len,
+                               int is_final) {
+    pthread_mutex_lock(&t->lock);
+    int queued = fd >= 0 && (size_t)fd < t->fd_cap && t->fds[fd].is_open;
+    int rc = 0;
+    if (queued) {
+        rc = send_queue_append(&t->queued, fd, t->fds[fd].generation, message_type, payload, payload_len);
+        if (is_final) t->fds[fd].shut_after_send = 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    if (queued) {
+        if (rc == 0) transport_wake(t);
+        else if (is_final) shutdown(fd, SHUT_RDWR);
+        return rc;
+    }
+    rc = send_message(fd, message_type, payload, payload_len);
+    if (is_final) shutdown(fd, SHUT_RDWR);
+    return rc;
+}
+
+int transport_send_message(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len) {
+    return send_message_queued(t, fd, message_type, payload, payload_len, 0);
+}
+
+int transport_send_final(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len) {
+    return send_message_queued(t, fd, message_type, payload, payload_len, 1);
+}
+
+static int64_t drain_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void transport_send_drain(transport_t *t, int timeout_ms) {
+    (void)transport_send_flush(t);
+
+    struct pollfd *polls = NULL;
+    size_t poll_cap = 0;
+    int64_t deadline = drain_clock_ms() + timeout_ms;
+    for (;;) {
+        pthread_mutex_lock(&t->lock);
+        size_t count = 0;
+        for (size_t i = 0; i < t->fd_cap; i++) {
+            if (!t->fds[i].is_open || !t->fds[i].backlog) continue;
+            if (count == poll_cap) {
+                size_t cap = poll_cap ? poll_cap * 2 : 64;
+                struct pollfd *grown = (struct pollfd*)realloc(polls, cap * sizeof(*grown));
+                if (!grown) break;
+                polls = grown;
+                poll_cap = cap;
+            }
+            polls[count].fd = (int)i;
+            polls[count].events = POLLOUT;
+            polls[count].revents = 0;
+            count++;
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        int64_t left = deadline - drain_clock_ms();
+        if (count == 0 || left <= 0) break;
+        int ready = poll(polls, (nfds_t)count, (int)left);
+        if (ready < 0 && errno != EINTR) break;
+
+        pthread_mutex_lock(&t->lock);
+        for (size_t i = 0; ready > 0 && i < count; i++) {
+            transport_fd_t *entry = &t->fds[polls[i].fd];
+            if (!polls[i].revents || !entry->backlog) continue;
+            if (polls[i].revents & (POLLERR | POLLHUP | POLLNVAL)) backlog_free(entry);
+            else (void)backlog_send(entry);
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    free(polls);
+}
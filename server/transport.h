@@ -0,0 +1,153 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define TRANSPORT_MAX_EVENTS     256
+#define TRANSPORT_URING_ENTRIES  256
+#define TRANSPORT_URING_CQ       4096
+#define TRANSPORT_URING_BUFS     1024
+#define TRANSPORT_URING_BUF_SIZE 2048
+#define TRANSPORT_BACKLOG_MAX    (2 * 1024 * 1024)
+
+typedef enum {
+    TRANSPORT_AUTO     = 0,
+    TRANSPORT_EPOLL    = 1,
+    TRANSPORT_IO_URING = 2
+} transport_kind_t;
+
+typedef enum {
+    TRANSPORT_EV_ACCEPT   = 1,   // fd is a freshly accepted socket, tag is the listener's tag
+    TRANSPORT_EV_READABLE = 2,   // fd has bytes waiting; the caller reads them
+    TRANSPORT_EV_DATA     = 3,   // bytes were already received for fd into data/len
+    TRANSPORT_EV_CLOSED   = 4,   // peer closed the stream or the receive failed
+    TRANSPORT_EV_WRITABLE = 5    // fd asked for one writable notification and got it
+} transport_event_type_t;
+
+typedef struct {
+    uint8_t type;
+    int fd;
+    uint32_t tag;
+    uint32_t generation;
+    const uint8_t *data;
+    size_t len;
+} transport_event_t;
+
+typedef struct {
+    int fd;
+    uint32_t generation;
+    size_t offset;
+    size_t len;
+} transport_send_t;
+
+// Frames queued for one owner thread; consecutive frames for the same fd share an entry.
+typedef struct {
+    uint8_t *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    transport_send_t *entries;
+    size_t count;
+    size_t cap;
+} transport_send_queue_t;
+
+typedef struct {
+    int fd;
+    uint32_t tag;
+    uint32_t generation;
+    uint8_t is_listener;
+    uint8_t is_packet;
+    uint8_t is_open;
+    uint8_t shut_after_send;   // shut down once everything queued for it has gone out
+
+    // Bytes a non-blocking send left behind; they go out on writable before any newer frame.
+    uint8_t *backlog;
+    size_t backlog_len;
+    size_t backlog_sent;
+} transport_fd_t;
+
+typedef struct {
+    int ring_fd;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    void *sqe_map;
+    size_t sqe_map_len;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    uint32_t sq_pending;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    void *cqes;
+
+    void *sqes;
+} transport_ring_t;
+
+typedef struct {
+    transport_kind_t kind;
+    pthread_mutex_t lock;
+
+    int epoll_fd;
+    int wake_fd;
+    int wake_armed;
+
+    transport_ring_t events;
+    transport_ring_t sends;
+    void *buf_ring;
+    size_t buf_ring_len;
+    uint8_t *buf_pool;
+    uint16_t buf_pending;
+    uint16_t recycle[TRANSPORT_MAX_EVENTS];
+    int recycle_count;
+    uint64_t rearm[TRANSPORT_MAX_EVENTS];   // generation << 32 | fd
+    int rearm_count;
+
+    transport_fd_t *fds;
+    size_t fd_cap;
+
+    transport_send_queue_t queued;     // filled by producers under lock
+    transport_send_queue_t flushing;   // swapped out and sent by the owner
+} transport_t;
+
+int  transport_open(transport_t *t, transport_kind_t kind);
+void transport_close(transport_t *t);
+const char *transport_name(const transport_t *t);
+int  transport_parse_kind(const char *text, transport_kind_t *out_kind);
+
+int  transport_add_listener(transport_t *t, int listen_fd, uint32_t tag);
+int  transport_add_client(transport_t *t, int fd, uint32_t tag);
+void transport_remove(transport_t *t, int fd);
+int  transport_want_writable(transport_t *t, int fd);
+size_t transport_backlog_len(transport_t *t, int fd);
+void transport_wake(transport_t *t);
+
+int  transport_wait(transport_t *t, transport_event_t *events, int max_events, int timeout_ms);
+int  transport_event_is_current(transport_t *t, const transport_event_t *event);
+
+// Any thread may queue frames and commit them; the thread that waits on t sends them in
+// transport_send_flush, so a commit wakes it when there is something to send.
+int  transport_send_frame(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len);
+void transport_send_commit(transport_t *t);
+int  transport_send_flush(transport_t *t);
+
+// Queues one message and wakes the owner thread, which sends it after anything already queued
+// or backlogged for fd; callable from any thread, including the owner. Before fd is added it
+// has no owner, and the message is sent right away.
+int  transport_send_message(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len);
+
+// The same, for a last message: once it is out the socket is shut down, and the owner drops
+// the connection when it sees the close.
+int  transport_send_final(transport_t *t, int fd, uint16_t message_type, const void *payload, uint32_t payload_len);
+
+// For shutdown, once no thread waits on t any more: sends what is queued, then gives sockets
+// that are still behind up to timeout_ms to take the rest.
+void transport_send_drain(transport_t *t, int timeout_ms);
+
+#endif
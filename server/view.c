@@ -0,0 +1,277 @@
+#include "view.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+void view_cache_init(view_cache_t *c) {
+    memset(c, 0, sizeof(*c));
+}
+
+void view_cache_free(view_cache_t *c) {
+    free(c->cells);
+    free(c->region_summary);
+    free(c->region_refresh);
+    memset(c, 0, sizeof(*c));
+}
+
+static int cache_resize(view_cache_t *c, const game_state_t *g) {
+    size_t cells = (size_t)g->map_width * (size_t)g->map_height;
+    size_t regions = (size_t)game_region_cols(g) * (size_t)game_region_rows(g);
+
+    uint16_t *grid = (uint16_t*)realloc(c->cells, cells * sizeof(uint16_t));
+    if (!grid) return -1;
+    c->cells = grid;
+
+    uint8_t *summary = (uint8_t*)realloc(c->region_summary, regions);
+    if (!summary) return -1;
+    c->region_summary = summary;
+
+    uint8_t *refresh = (uint8_t*)realloc(c->region_refresh, regions);
+    if (!refresh) return -1;
+    c->region_refresh = refresh;
+
+    c->width = g->map_width;
+    c->height = g->map_height;
+    c->is_valid = 0;
+    return 0;
+}
+
+static size_t region_of(const game_state_t *g, game_pos_t p) {
+    return (size_t)(p.y >> GAME_REGION_SHIFT) * (size_t)game_region_cols(g) + (p.x >> GAME_REGION_SHIFT);
+}
+
+static void render_region_base(view_cache_t *c, const game_state_t *g, int rx, int ry) {
+    int x0 = rx << GAME_REGION_SHIFT;
+    int y0 = ry << GAME_REGION_SHIFT;
+    int x1 = x0 + GAME_REGION_SIZE < g->map_width ? x0 + GAME_REGION_SIZE : g->map_width;
+    int y1 = y0 + GAME_REGION_SIZE < g->map_height ? y0 + GAME_REGION_SIZE : g->map_height;
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *flags = g->cell_flags + (size_t)y * g->map_width;
+        uint16_t *out = c->cells + (size_t)y * g->map_width;
+        for (int x = x0; x < x1; x++) {
+            if (flags[x] & GAME_CELL_OBSTACLE) out[x] = STATE_CELL_OBSTACLE;
+            else if (flags[x] & GAME_CELL_FOOD) out[x] = STATE_CELL_FOOD;
+            else out[x] = STATE_CELL_EMPTY;
+        }
+    }
+}
+
+static void overlay_snakes(view_cache_t *c, const game_state_t *g) {
+    for (uint32_t n = 0; n < g->player_count; n++) {
+        const game_player_t *pl = game_player_at(g, n);
+        if (!pl->has_joined || pl->snake_len == 0) continue;
+
+        uint16_t owner = (uint16_t)(GAME_PLAYER_INDEX(pl->player_id) & STATE_CELL_OWNER_MASK);
+        game_snake_iter_t it;
+        game_pos_t p;
+        int is_head = 1;
+        game_snake_iter_begin(g, pl, &it);
+        while (game_snake_iter_next(g, &it, &p)) {
+            uint16_t cell;
+            if (!pl->is_alive) cell = STATE_CELL_DEAD;
+            else cell = (uint16_t)((is_head ? STATE_CELL_HEAD : STATE_CELL_BODY) | owner);
+            is_head = 0;
+
+            if (p.x >= g->map_width || p.y >= g->map_height) continue;
+            if (!c->region_refresh[region_of(g, p)]) continue;
+            c->cells[(size_t)p.y * g->map_width + p.x] = cell;
+        }
+    }
+}
+
+static uint8_t summarize_region(const view_cache_t *c, const game_state_t *g, int rx, int ry) {
+    int x0 = rx << GAME_REGION_SHIFT;
+    int y0 = ry << GAME_REGION_SHIFT;
+    int x1 = x0 + GAME_REGION_SIZE < g->map_width ? x0 + GAME_REGION_SIZE : g->map_width;
+    int y1 = y0 + GAME_REGION_SIZE < g->map_height ? y0 + GAME_REGION_SIZE : g->map_height;
+
+    int has_food = 0;
+    int obstacles = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint16_t *row = c->cells + (size_t)y * g->map_width;
+        for (int x = x0; x < x1; x++) {
+            uint16_t cell = row[x];
+            if (cell == STATE_CELL_EMPTY || cell == STATE_CELL_DEAD) continue;
+            if (cell == STATE_CELL_OBSTACLE) obstacles++;
+            else if (cell == STATE_CELL_FOOD) has_food = 1;
+            else return (uint8_t)'o';
+        }
+    }
+
+    if (has_food) return (uint8_t)'*';
+    if (obstacles * 2 >= (x1 - x0) * (y1 - y0)) return (uint8_t)'#';
+    return (uint8_t)'.';
+}
+
+int view_cache_update(view_cache_t *c, const game_state_t *g) {
+    if (!c->cells || c->width != g->map_width || c->height != g->map_height) {
+        if (cache_resize(c, g) != 0) return -1;
+    }
+
+    int full = !c->is_valid || g->change_serial < c->rendered_serial;
+    if (!full && g->change_serial == c->rendered_serial) return 0;
+
+    int region_cols = game_region_cols(g);
+    int region_rows = game_region_rows(g);
+    size_t regions = (size_t)region_cols * (size_t)region_rows;
+
+    size_t refreshed = 0;
+    for (size_t r = 0; r < regions; r++) {
+        c->region_refresh[r] = (full || g->region_serial[r] > c->rendered_serial) ? 1 : 0;
+        refreshed += c->region_refresh[r];
+    }
+
+    if (refreshed > 0) {
+        for (int ry = 0; ry < region_rows; ry++) {
+            for (int rx = 0; rx < region_cols; rx++) {
+                if (c->region_refresh[(size_t)ry * region_cols + rx]) render_region_base(c, g, rx, ry);
+            }
+        }
+
+        overlay_snakes(c, g);
+
+        for (int ry = 0; ry < region_rows; ry++) {
+            for (int rx = 0; rx < region_cols; rx++) {
+                size_t r = (size_t)ry * region_cols + rx;
+                if (c->region_refresh[r]) c->region_summary[r] = summarize_region(c, g, rx, ry);
+            }
+        }
+    }
+
+    c->rendered_serial = g->change_serial;
+    c->is_valid = 1;
+    return 0;
+}
+
+static uint16_t clamp_view_size(uint16_t want, uint16_t max_view, uint16_t world) {
+    if (want < VIEW_MIN_SIZE) want = VIEW_MIN_SIZE;
+    if (want > max_view) want = max_view;
+    if (want > world) want = world;
+    return want;
+}
+
+static int clamp_origin(int center, int size, int world) {
+    int origin = center - size / 2;
+    if (origin > world - size) origin = world - size;
+    if (origin < 0) origin = 0;
+    return origin;
+}
+
+view_rect_t view_rect_follow(const game_state_t *g, game_player_id_t follow_id,
+                             uint16_t want_width, uint16_t want_height, game_pos_t *io_center) {
+    view_rect_t rect;
+    rect.width = clamp_view_size(want_width, VIEW_MAX_WIDTH, g->map_width);
+    rect.height = clamp_view_size(want_height, VIEW_MAX_HEIGHT, g->map_height);
+
+    const game_player_t *pl = game_player_lookup(g, follow_id);
+    if (pl && pl->has_joined && pl->is_alive && pl->snake_len > 0) *io_center = game_snake_head(g, pl);
+    if (io_center->x >= g->map_width || io_center->y >= g->map_height) {
+        io_center->x = (uint16_t)(g->map_width / 2);
+        io_center->y = (uint16_t)(g->map_height / 2);
+    }
+
+    rect.x = (uint16_t)clamp_origin(io_center->x, rect.width, g->map_width);
+    rect.y = (uint16_t)clamp_origin(io_center->y, rect.height, g->map_height);
+    return rect;
+}
+
+int view_rect_equal(const view_rect_t *a, const view_rect_t *b) {
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+int view_rect_changed_since(const game_state_t *g, const view_rect_t *rect, uint32_t serial) {
+    if (g->change_serial < serial) return 1;
+
+    int region_cols = game_region_cols(g);
+    int rx0 = rect->x >> GAME_REGION_SHIFT;
+    int ry0 = rect->y >> GAME_REGION_SHIFT;
+    int rx1 = (rect->x + rect->width - 1) >> GAME_REGION_SHIFT;
+    int ry1 = (rect->y + rect->height - 1) >> GAME_REGION_SHIFT;
+
+    for (int ry = ry0; ry <= ry1; ry++) {
+        for (int rx = rx0; rx <= rx1; rx++) {
+            if (g->region_serial[(size_t)ry * region_cols + rx] > serial) return 1;
+        }
+    }
+    return 0;
+}
+
+void view_minimap_size(const game_state_t *g, uint8_t *out_width, uint8_t *out_height) {
+    int region_cols = game_region_cols(g);
+    int region_rows = game_region_rows(g);
+    *out_width = (uint8_t)(region_cols < VIEW_MINIMAP_MAX_WIDTH ? region_cols : VIEW_MINIMAP_MAX_WIDTH);
+    *out_height = (uint8_t)(region_rows < VIEW_MINIMAP_MAX_HEIGHT ? region_rows : VIEW_MINIMAP_MAX_HEIGHT);
+}
+
+static int summary_rank(uint8_t ch) {
+    switch (ch) {
+        case 'o': return 3;
+        case '*': return 2;
+        case '#': return 1;
+        default:  return 0;
+    }
+}
+
+void view_build_minimap(const view_cache_t *c, const game_state_t *g, uint8_t *out, uint8_t width, uint8_t height) {
+    int region_cols = game_region_cols(g);
+    int region_rows = game_region_rows(g);
+
+    for (int my = 0; my < height; my++) {
+        int ry0 = my * region_rows / height;
+        int ry1 = (my + 1) * region_rows / height;
+        for (int mx = 0; mx < width; mx++) {
+            int rx0 = mx * region_cols / width;
+            int rx1 = (mx + 1) * region_cols / width;
+
+            uint8_t best = (uint8_t)'.';
+            for (int ry = ry0; ry < ry1; ry++) {
+                for (int rx = rx0; rx < rx1; rx++) {
+                    uint8_t ch = c->region_summary[(size_t)ry * region_cols + rx];
+                    if (summary_rank(ch) > summary_rank(best)) best = ch;
+                }
+            }
+            out[(size_t)my * width + mx] = best;
+        }
+    }
+}
+
+size_t view_state_size(const game_state_t *g, const view_rect_t *rect, uint32_t status_since, int include_cells,
+                       uint8_t minimap_width, uint8_t minimap_height) {
+    size_t size = sizeof(state_message_t) + game_state_status_size(g, status_since) + (size_t)minimap_width * minimap_height;
+    if (include_cells) size += (size_t)rect->width * rect->height * sizeof(uint16_t);
+    return size;
+}
+
+size_t view_build_state(const view_cache_t *c, const game_state_t *g, uint64_t now_ms,
+                        const view_rect_t *rect, uint32_t status_since, int include_cells,
+                        const uint8_t *minimap, uint8_t minimap_width, uint8_t minimap_height,
+                        state_message_t *out_msg, size_t out_cap) {
+    size_t size = view_state_size(g, rect, status_since, include_cells, minimap_width, minimap_height);
+    if (size > out_cap || !c->is_valid) return 0;
+
+    game_build_state_header(g, now_ms, status_since, out_msg);
+    out_msg->view_x_net = htons(rect->x);
+    out_msg->view_y_net = htons(rect->y);
+    out_msg->view_width_net = htons(rect->width);
+    out_msg->view_height_net = htons(rect->height);
+    out_msg->minimap_width = minimap_width;
+    out_msg->minimap_height = minimap_height;
+    if (!include_cells) out_msg->flags |= STATE_FLAG_CELLS_UNCHANGED;
+
+    uint8_t *cursor = out_msg->data + state_message_cells_offset(ntohs(out_msg->status_count_net));
+    if (include_cells) {
+        for (uint16_t y = 0; y < rect->height; y++) {
+            const uint16_t *row = c->cells + (size_t)(rect->y + y) * c->width + rect->x;
+            for (uint16_t x = 0; x < rect->width; x++) {
+                uint16_t cell_net = htons(row[x]);
+                memcpy(cursor, &cell_net, sizeof(cell_net));
+                cursor += sizeof(cell_net);
+            }
+        }
+    }
+    if (minimap_width > 0 && minimap_height > 0) memcpy(cursor, minimap, (size_t)minimap_width * minimap_height);
+
+    return size;
+}
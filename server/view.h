@@ -0,0 +1,52 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "game.h"
+
+#define VIEW_DEFAULT_WIDTH      80
+#define VIEW_DEFAULT_HEIGHT     40
+#define VIEW_MIN_SIZE           5
+#define VIEW_MAX_WIDTH          512
+#define VIEW_MAX_HEIGHT         256
+#define VIEW_MINIMAP_MAX_WIDTH  24
+#define VIEW_MINIMAP_MAX_HEIGHT 12
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+} view_rect_t;
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint16_t *cells;
+    uint8_t *region_summary;
+    uint8_t *region_refresh;
+    uint32_t rendered_serial;
+    int is_valid;
+} view_cache_t;
+
+void view_cache_init(view_cache_t *cache);
+void view_cache_free(view_cache_t *cache);
+int  view_cache_update(view_cache_t *cache, const game_state_t *game_state);
+
+view_rect_t view_rect_follow(const game_state_t *game_state, game_player_id_t follow_id,
+                             uint16_t want_width, uint16_t want_height, game_pos_t *io_center);
+int  view_rect_equal(const view_rect_t *a, const view_rect_t *b);
+int  view_rect_changed_since(const game_state_t *game_state, const view_rect_t *rect, uint32_t serial);
+
+void view_minimap_size(const game_state_t *game_state, uint8_t *out_width, uint8_t *out_height);
+void view_build_minimap(const view_cache_t *cache, const game_state_t *game_state, uint8_t *out, uint8_t width, uint8_t height);
+
+size_t view_state_size(const game_state_t *game_state, const view_rect_t *rect, uint32_t status_since, int include_cells,
+                       uint8_t minimap_width, uint8_t minimap_height);
+size_t view_build_state(const view_cache_t *cache, const game_state_t *game_state, uint64_t now_ms,
+                        const view_rect_t *rect, uint32_t status_since, int include_cells,
+                        const uint8_t *minimap, uint8_t minimap_width, uint8_t minimap_height,
+                        state_message_t *out_msg, size_t out_cap);
+
+#endif